@@ -0,0 +1,215 @@
+#ifndef AUDIO_OUT_H_INCLUDED
+#define AUDIO_OUT_H_INCLUDED
+
+/*
+ * audio_out.h
+ * ===========
+ * 
+ * Unified header for real-time audio output backends.
+ * 
+ * Each audio output backend has a different C source file
+ * implementation of this header.
+ * 
+ * Output is driven by a callback.  The backend repeatedly asks the
+ * callback to fill one period of signed 16-bit mono samples, and then
+ * queues that period on the audio device.  The backend blocks while
+ * the device buffer is full, so the callback is paced by the device
+ * clock.  Small periods give low latency, but they make underruns more
+ * likely if the callback can not keep up.
+ * 
+ * Separate outputs may be used from separate threads, but a single
+ * output must only be used from one thread at a time.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Error codes.
+ * 
+ * Use audio_errstr() to get an error message for a code.
+ */
+#define AUDIO_ERR_NONE    (0)   /* No error */
+#define AUDIO_ERR_OPEN    (1)   /* Failed to open audio device */
+#define AUDIO_ERR_FORMAT  (2)   /* Sample format not supported */
+#define AUDIO_ERR_RATE    (3)   /* Sample rate not supported */
+#define AUDIO_ERR_PERIOD  (4)   /* Period size not supported */
+#define AUDIO_ERR_MEM     (5)   /* Memory allocation failed */
+#define AUDIO_ERR_IO      (6)   /* I/O error writing to audio device */
+#define AUDIO_ERR_BACKEND (7)   /* No audio output on this system */
+
+/*
+ * The range of supported period sizes in sample frames.  The period
+ * size must also be a power of two.
+ */
+#define AUDIO_PERIOD_MIN (16)
+#define AUDIO_PERIOD_MAX (4096)
+
+/*
+ * Structure prototype for an audio output.
+ * 
+ * The actual structure is defined by the backend implementation.
+ */
+struct AUDIO_OUT_TAG;
+typedef struct AUDIO_OUT_TAG AUDIO_OUT;
+
+/*
+ * Callback function that fills one period of samples.
+ * 
+ * The callback must fill the whole buffer.  If there are not enough
+ * samples left, it should pad the buffer with silence and return zero
+ * to indicate that this is the last period.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the custom parameter passed to audio_run()
+ * 
+ *   pbuf - the buffer to fill
+ * 
+ *   frames - the number of samples to write into the buffer
+ * 
+ * Return:
+ * 
+ *   non-zero if more periods follow, zero if this is the last period
+ */
+typedef int (*AUDIO_FUNC)(void *pArg, int16_t *pbuf, int32_t frames);
+
+/*
+ * Statistics about an audio output.
+ */
+typedef struct {
+  
+  /*
+   * The period size in sample frames that the device actually uses,
+   * which is the number of frames passed to each callback.
+   */
+  int32_t period;
+  
+  /*
+   * The total size of the device buffer in sample frames.
+   */
+  int32_t buffer;
+  
+  /*
+   * The greatest number of sample frames that were queued on the
+   * device right after a period was written.  This plus the period
+   * size is the end-to-end latency from the callback to the speaker.
+   */
+  int32_t max_delay;
+  
+  /*
+   * The number of times the device ran out of samples after playback
+   * had started.
+   */
+  int32_t underruns;
+  
+  /*
+   * The number of periods that have been played.
+   */
+  int32_t periods;
+  
+} AUDIO_STATS;
+
+/*
+ * Open an audio output device.
+ * 
+ * pDevice is the path to the audio device, or NULL to use the default
+ * device of the backend.
+ * 
+ * The period must be a power of two in range [AUDIO_PERIOD_MIN,
+ * AUDIO_PERIOD_MAX].  The device may choose a different period size,
+ * which is reported by audio_stats().  The device buffer holds the
+ * given number of periods, which must be at least two.
+ * 
+ * If the device can not be opened and configured, NULL is returned and
+ * an error code is written to *perr.
+ * 
+ * Parameters:
+ * 
+ *   pDevice - path to the audio device, or NULL for the default
+ * 
+ *   sample_rate - the sample rate in Hz
+ * 
+ *   period - the requested period size in sample frames
+ * 
+ *   periods - the requested number of periods in the device buffer
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   the new audio output, or NULL if there was an error
+ */
+AUDIO_OUT *audio_open(
+    const char    * pDevice,
+          int32_t   sample_rate,
+          int32_t   period,
+          int32_t   periods,
+          int     * perr);
+
+/*
+ * Close an audio output.
+ * 
+ * Any samples still queued on the device are dropped.  If NULL is
+ * passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pa - the audio output to close, or NULL
+ */
+void audio_close(AUDIO_OUT *pa);
+
+/*
+ * Play audio from a callback until the callback indicates that it has
+ * filled the last period.
+ * 
+ * This function does not return until all the queued samples have
+ * been played by the device.
+ * 
+ * If there is an error, zero is returned and an error code is written
+ * to *perr.
+ * 
+ * Parameters:
+ * 
+ *   pa - the audio output
+ * 
+ *   fn - the callback that fills each period
+ * 
+ *   pArg - custom parameter passed through to the callback
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int audio_run(AUDIO_OUT *pa, AUDIO_FUNC fn, void *pArg, int *perr);
+
+/*
+ * Get statistics about an audio output.
+ * 
+ * Parameters:
+ * 
+ *   pa - the audio output
+ * 
+ *   ps - the structure to receive the statistics
+ */
+void audio_stats(const AUDIO_OUT *pa, AUDIO_STATS *ps);
+
+/*
+ * Get an error message for an error code.
+ * 
+ * The message does not have any punctuation at the end.  An unknown
+ * error code returns a generic message.
+ * 
+ * Parameters:
+ * 
+ *   code - the error code
+ * 
+ * Return:
+ * 
+ *   the error message
+ */
+const char *audio_errstr(int code);
+
+#endif
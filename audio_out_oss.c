@@ -0,0 +1,463 @@
+/*
+ * audio_out_oss.c
+ * ===============
+ * 
+ * Implementation of audio_out.h using the Open Sound System (OSS) API.
+ * 
+ * This works with native OSS and with the OSS emulation of ALSA on
+ * Linux, and it does not need any libraries.  The default device is
+ * /dev/dsp.
+ * 
+ * Underruns are detected by checking whether the device has run out of
+ * queued samples before each period is written.
+ * 
+ * OSS is only available on Linux and the BSDs.  On other systems, such
+ * as macOS, this file compiles to a backend without any devices, which
+ * fails to open with AUDIO_ERR_BACKEND, so that programs still build
+ * and everything but real-time playback works.
+ */
+
+#include "audio_out.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__FreeBSD__) || \
+    defined(__DragonFly__) || defined(__NetBSD__)
+#define AUDIO_OSS
+#endif
+
+#ifdef AUDIO_OSS
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/soundcard.h>
+#include <unistd.h>
+#endif
+
+#ifdef AUDIO_OSS
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The default audio device.
+ */
+#define DEFAULT_DEVICE "/dev/dsp"
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * AUDIO_OUT structure.
+ * 
+ * Prototype given in header.
+ */
+struct AUDIO_OUT_TAG {
+  
+  /*
+   * The file descriptor of the audio device.
+   */
+  int fd;
+  
+  /*
+   * The statistics of the output.
+   */
+  AUDIO_STATS st;
+  
+  /*
+   * The period buffer, which holds st.period samples.
+   */
+  int16_t *pBuf;
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int writeAll(int fd, const int16_t *pbuf, int32_t frames);
+
+/*
+ * Write a whole buffer of samples to the audio device.
+ * 
+ * Parameters:
+ * 
+ *   fd - the audio device
+ * 
+ *   pbuf - the samples to write
+ * 
+ *   frames - the number of samples to write
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an I/O error or the
+ *   device stopped accepting samples
+ */
+static int writeAll(int fd, const int16_t *pbuf, int32_t frames) {
+  
+  const uint8_t *pd = NULL;
+  size_t len = 0;
+  ssize_t rc = 0;
+  
+  pd = (const uint8_t *) pbuf;
+  len = ((size_t) frames) * 2;
+  
+  while (len > 0) {
+    rc = write(fd, pd, len);
+    if ((rc < 0) && (errno == EINTR)) {
+      continue;
+    }
+    
+    /* A device that accepts nothing would never let the loop end */
+    if (rc < 1) {
+      return 0;
+    }
+    pd += rc;
+    len -= (size_t) rc;
+  }
+  
+  return 1;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * audio_open function.
+ */
+AUDIO_OUT *audio_open(
+    const char    * pDevice,
+          int32_t   sample_rate,
+          int32_t   period,
+          int32_t   periods,
+          int     * perr) {
+  
+  AUDIO_OUT *pa = NULL;
+  int err = AUDIO_ERR_NONE;
+  int fd = -1;
+  int arg = 0;
+  int shift = 0;
+  audio_buf_info bi;
+  
+  /* Check parameters */
+  if ((sample_rate < 1) || (periods < 2) || (periods > 0x7fff) ||
+      (perr == NULL)) {
+    abort();
+  }
+  
+  /* Period must be a power of two within range */
+  if ((period < AUDIO_PERIOD_MIN) || (period > AUDIO_PERIOD_MAX) ||
+      ((period & (period - 1)) != 0)) {
+    err = AUDIO_ERR_PERIOD;
+  }
+  
+  /* Use default device if none given */
+  if (pDevice == NULL) {
+    pDevice = DEFAULT_DEVICE;
+  }
+  
+  /* Open the device */
+  if (!err) {
+    fd = open(pDevice, O_WRONLY);
+    if (fd < 0) {
+      err = AUDIO_ERR_OPEN;
+    }
+  }
+  
+  /* Request the fragment layout, which must be done before setting the
+   * format; the low bits are the base-2 logarithm of the fragment size
+   * in bytes, and the high bits are the fragment count */
+  if (!err) {
+    for(shift = 0; (1 << shift) < period * 2; shift++);
+    arg = (((int) periods) << 16) | shift;
+    if (ioctl(fd, SNDCTL_DSP_SETFRAGMENT, &arg) < 0) {
+      err = AUDIO_ERR_PERIOD;
+    }
+  }
+  
+  /* Set signed 16-bit samples in native byte order */
+  if (!err) {
+    arg = AFMT_S16_NE;
+    if (ioctl(fd, SNDCTL_DSP_SETFMT, &arg) < 0) {
+      err = AUDIO_ERR_FORMAT;
+    } else if (arg != AFMT_S16_NE) {
+      err = AUDIO_ERR_FORMAT;
+    }
+  }
+  
+  /* Set one channel */
+  if (!err) {
+    arg = 1;
+    if (ioctl(fd, SNDCTL_DSP_CHANNELS, &arg) < 0) {
+      err = AUDIO_ERR_FORMAT;
+    } else if (arg != 1) {
+      err = AUDIO_ERR_FORMAT;
+    }
+  }
+  
+  /* Set the sample rate, which must be exact because the emulator
+   * generates samples at exactly that rate */
+  if (!err) {
+    arg = (int) sample_rate;
+    if (ioctl(fd, SNDCTL_DSP_SPEED, &arg) < 0) {
+      err = AUDIO_ERR_RATE;
+    } else if (arg != (int) sample_rate) {
+      err = AUDIO_ERR_RATE;
+    }
+  }
+  
+  /* Find out the fragment layout the device actually chose */
+  if (!err) {
+    if (ioctl(fd, SNDCTL_DSP_GETOSPACE, &bi) < 0) {
+      err = AUDIO_ERR_PERIOD;
+    } else if ((bi.fragsize < 2) || (bi.fragstotal < 1) ||
+                (bi.fragsize / 2 > AUDIO_PERIOD_MAX)) {
+      err = AUDIO_ERR_PERIOD;
+    }
+  }
+  
+  /* Allocate the output and its period buffer */
+  if (!err) {
+    pa = (AUDIO_OUT *) calloc(1, sizeof(AUDIO_OUT));
+    if (pa == NULL) {
+      err = AUDIO_ERR_MEM;
+    }
+  }
+  if (!err) {
+    pa->fd = fd;
+    fd = -1;
+    
+    pa->st.period = (int32_t) (bi.fragsize / 2);
+    pa->st.buffer = pa->st.period * ((int32_t) bi.fragstotal);
+    
+    pa->pBuf = (int16_t *) calloc(
+                  (size_t) pa->st.period, sizeof(int16_t));
+    if (pa->pBuf == NULL) {
+      err = AUDIO_ERR_MEM;
+    }
+  }
+  
+  /* Close device if it was not taken over by the output */
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  
+  /* Free output if error */
+  if (err) {
+    audio_close(pa);
+    pa = NULL;
+    *perr = err;
+  }
+  
+  /* Return the output or NULL */
+  return pa;
+}
+
+/*
+ * audio_close function.
+ */
+void audio_close(AUDIO_OUT *pa) {
+  if (pa != NULL) {
+    if (pa->fd >= 0) {
+      ioctl(pa->fd, SNDCTL_DSP_RESET, NULL);
+      close(pa->fd);
+      pa->fd = -1;
+    }
+    if (pa->pBuf != NULL) {
+      free(pa->pBuf);
+      pa->pBuf = NULL;
+    }
+    free(pa);
+  }
+}
+
+/*
+ * audio_run function.
+ */
+int audio_run(AUDIO_OUT *pa, AUDIO_FUNC fn, void *pArg, int *perr) {
+  
+  int more = 1;
+  int delay = 0;
+  int32_t queued = 0;
+  
+  /* Check parameters */
+  if ((pa == NULL) || (fn == NULL) || (perr == NULL)) {
+    abort();
+  }
+  
+  /* Keep playing periods until the callback is done */
+  while (more) {
+    
+    /* Fill the next period */
+    more = fn(pArg, pa->pBuf, pa->st.period);
+    
+    /* Once the device buffer has been filled for the first time, the
+     * device running dry means that there was an underrun */
+    if (queued >= pa->st.buffer) {
+      if (ioctl(pa->fd, SNDCTL_DSP_GETODELAY, &delay) == 0) {
+        if (delay <= 0) {
+          (pa->st.underruns)++;
+        }
+      }
+    } else {
+      queued += pa->st.period;
+    }
+    
+    /* Queue the period, which blocks while the device buffer is
+     * full */
+    if (!writeAll(pa->fd, pa->pBuf, pa->st.period)) {
+      *perr = AUDIO_ERR_IO;
+      return 0;
+    }
+    (pa->st.periods)++;
+    
+    /* Track the greatest queue delay */
+    if (ioctl(pa->fd, SNDCTL_DSP_GETODELAY, &delay) == 0) {
+      if (delay / 2 > pa->st.max_delay) {
+        pa->st.max_delay = (int32_t) (delay / 2);
+      }
+    }
+  }
+  
+  /* Wait for the device to play everything */
+  if (ioctl(pa->fd, SNDCTL_DSP_SYNC, NULL) < 0) {
+    *perr = AUDIO_ERR_IO;
+    return 0;
+  }
+  
+  return 1;
+}
+
+/*
+ * audio_stats function.
+ */
+void audio_stats(const AUDIO_OUT *pa, AUDIO_STATS *ps) {
+  /* Check parameters */
+  if ((pa == NULL) || (ps == NULL)) {
+    abort();
+  }
+  
+  /* Copy statistics */
+  memcpy(ps, &(pa->st), sizeof(AUDIO_STATS));
+}
+
+#else
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.  Without OSS there are no devices, so
+ * outputs can never be opened.
+ */
+
+/*
+ * audio_open function.
+ */
+AUDIO_OUT *audio_open(
+    const char    * pDevice,
+          int32_t   sample_rate,
+          int32_t   period,
+          int32_t   periods,
+          int     * perr) {
+  
+  /* Check parameters */
+  (void) pDevice;
+  (void) period;
+  if ((sample_rate < 1) || (periods < 2) || (periods > 0x7fff) ||
+      (perr == NULL)) {
+    abort();
+  }
+  
+  *perr = AUDIO_ERR_BACKEND;
+  return NULL;
+}
+
+/*
+ * audio_close function.
+ */
+void audio_close(AUDIO_OUT *pa) {
+  if (pa != NULL) {
+    abort();
+  }
+}
+
+/*
+ * audio_run function.
+ */
+int audio_run(AUDIO_OUT *pa, AUDIO_FUNC fn, void *pArg, int *perr) {
+  (void) pa;
+  (void) fn;
+  (void) pArg;
+  (void) perr;
+  abort();
+  return 0;
+}
+
+/*
+ * audio_stats function.
+ */
+void audio_stats(const AUDIO_OUT *pa, AUDIO_STATS *ps) {
+  (void) pa;
+  (void) ps;
+  abort();
+}
+
+#endif
+
+/*
+ * audio_errstr function.
+ */
+const char *audio_errstr(int code) {
+  const char *pResult = NULL;
+  
+  switch (code) {
+    case AUDIO_ERR_NONE:
+      pResult = "No error";
+      break;
+    
+    case AUDIO_ERR_OPEN:
+      pResult = "Failed to open audio device";
+      break;
+    
+    case AUDIO_ERR_FORMAT:
+      pResult = "Sample format not supported by audio device";
+      break;
+    
+    case AUDIO_ERR_RATE:
+      pResult = "Sample rate not supported by audio device";
+      break;
+    
+    case AUDIO_ERR_PERIOD:
+      pResult = "Period size not supported by audio device";
+      break;
+    
+    case AUDIO_ERR_MEM:
+      pResult = "Memory allocation failed";
+      break;
+    
+    case AUDIO_ERR_IO:
+      pResult = "I/O error writing to audio device";
+      break;
+    
+    case AUDIO_ERR_BACKEND:
+      pResult = "No audio output available on this system";
+      break;
+    
+    default:
+      pResult = "Unknown error";
+  }
+  
+  return pResult;
+}
@@ -0,0 +1,54 @@
+#ifndef OPL_BIN_H_INCLUDED
+#define OPL_BIN_H_INCLUDED
+
+/*
+ * opl_bin.h
+ * =========
+ * 
+ * Constants of the compiled binary event stream format, shared by every
+ * program and module that reads or writes binary event streams, so that
+ * the format can only change in one place.  See the README for the
+ * description of the format.
+ * 
+ * A stream starts with the signature and a header of little-endian
+ * 32-bit fields: the format version and the control rate, followed in
+ * version 2 headers by the number of chips.  Version 2 is only used for
+ * streams with more than one chip.  The events follow until the end of
+ * the stream, each starting with its event code.
+ * 
+ * Wait counts are stored in groups of seven bits, with the least
+ * significant group first and the high bit set on every group except
+ * the last.  The last of the at most BIN_WAIT_GROUPS groups may only
+ * use the four bits that still fit into 32 bits.
+ */
+
+/*
+ * The signature at the start of every binary event stream, and its
+ * length in bytes.
+ */
+#define BIN_SIGNATURE "OPLB"
+#define BIN_SIGNATURE_SIZE (4)
+
+/*
+ * The size in bytes of the version 1 header and its version, and the
+ * size in bytes of the version 2 header with the chip count and its
+ * version.
+ */
+#define BIN_HEADER_SIZE (12)
+#define BIN_VERSION (1)
+#define BIN_HEADER_CHIPS (16)
+#define BIN_VERSION_CHIPS (2)
+
+/*
+ * The event codes.
+ */
+#define BIN_EVENT_WRITE (0x01)   /* Register byte and value byte */
+#define BIN_EVENT_WAIT  (0x02)   /* Base-128 count of control cycles */
+#define BIN_EVENT_CHIP  (0x03)   /* Chip number byte */
+
+/*
+ * The maximum number of seven-bit groups in a wait count.
+ */
+#define BIN_WAIT_GROUPS (5)
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * opl_coalesce.c
+ * ==============
+ * 
+ * Implementation of opl_coalesce.h
+ * 
+ * See the header for further information.
+ * 
+ * Pending writes are kept in order in a fixed-size list.  Each time an
+ * order-sensitive write is added, a new segment of the list begins.
+ * Every ordinary register remembers where its pending write is in the
+ * list, and a later write to the same register within the same segment
+ * just replaces the value there.  Flushing walks the list in order and
+ * compares each write against the value the chip holds at that point,
+ * so that writes which change nothing are left out.
+ */
+
+#include "opl_coalesce.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of OPL2 register indices.
+ */
+#define REG_COUNT (256)
+
+/*
+ * The maximum number of pending writes.
+ */
+#define MAX_PENDING (1024)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * OPL_COALESCE structure.
+ * 
+ * Prototype given in header.
+ */
+struct OPL_COALESCE_TAG {
+  
+  /*
+   * The callback that receives the coalesced writes and its custom
+   * parameter.
+   */
+  OPL_COALESCE_FUNC fn;
+  void *pArg;
+  
+  /*
+   * The number of pending writes, and the index in the pending list
+   * where the current segment begins.
+   */
+  int32_t count;
+  int32_t seg;
+  
+  /*
+   * The pending writes, in the order they were added.
+   */
+  uint8_t p_reg[MAX_PENDING];
+  uint8_t p_val[MAX_PENDING];
+  
+  /*
+   * For each register, the index of its pending write in the pending
+   * list.  This is only valid if it is within the current segment.
+   */
+  int32_t slot[REG_COUNT];
+  
+  /*
+   * For each register, a flag set if the value the chip holds is
+   * known, and that value.
+   */
+  uint8_t known[REG_COUNT];
+  uint8_t val[REG_COUNT];
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Check whether a register has effects that depend on the order of
+ * writes.
+ * 
+ * Parameters:
+ * 
+ *   reg - the OPL hardware register index
+ * 
+ * Return:
+ * 
+ *   non-zero if the register is order-sensitive, zero otherwise
+ */
+static int isOrdered(int32_t reg) {
+  if ((reg == 0x01) || (reg == 0x04) || (reg == 0x08) ||
+      (reg == 0xbd) || ((reg >= 0xb0) && (reg <= 0xb8))) {
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Forget the positions of all pending writes, so that no later write
+ * is merged into them.
+ * 
+ * Parameters:
+ * 
+ *   pcs - the coalescer
+ */
+static void clearSlots(OPL_COALESCE *pcs) {
+  int32_t i = 0;
+  for(i = 0; i < REG_COUNT; i++) {
+    pcs->slot[i] = -1;
+  }
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * opl_coalesce_new function.
+ */
+OPL_COALESCE *opl_coalesce_new(OPL_COALESCE_FUNC fn, void *pArg) {
+  OPL_COALESCE *pcs = NULL;
+  
+  /* Check parameters */
+  if (fn == NULL) {
+    abort();
+  }
+  
+  /* Allocate the structure */
+  pcs = (OPL_COALESCE *) malloc(sizeof(OPL_COALESCE));
+  if (pcs == NULL) {
+    return NULL;
+  }
+  
+  /* Initialize */
+  pcs->fn = fn;
+  pcs->pArg = pArg;
+  opl_coalesce_reset(pcs);
+  
+  /* Return the new coalescer */
+  return pcs;
+}
+
+/*
+ * opl_coalesce_free function.
+ */
+void opl_coalesce_free(OPL_COALESCE *pcs) {
+  if (pcs != NULL) {
+    free(pcs);
+  }
+}
+
+/*
+ * opl_coalesce_reset function.
+ */
+void opl_coalesce_reset(OPL_COALESCE *pcs) {
+  /* Check parameter */
+  if (pcs == NULL) {
+    abort();
+  }
+  
+  /* Discard pending writes and forget all register values */
+  pcs->count = 0;
+  pcs->seg = 0;
+  clearSlots(pcs);
+  memset(pcs->known, 0, sizeof(pcs->known));
+  memset(pcs->val, 0, sizeof(pcs->val));
+}
+
+/*
+ * opl_coalesce_write function.
+ */
+void opl_coalesce_write(OPL_COALESCE *pcs, int32_t reg, int32_t val) {
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pcs == NULL) || (reg < 0) || (reg >= REG_COUNT) ||
+      (val < 0) || (val > 255)) {
+    abort();
+  }
+  
+  /* Ordinary writes replace the pending write of the same register in
+   * the current segment, if there is one */
+  if (!isOrdered(reg)) {
+    i = pcs->slot[reg];
+    if (i >= pcs->seg) {
+      pcs->p_val[i] = (uint8_t) val;
+      return;
+    }
+  }
+  
+  /* Make room in the pending list if necessary */
+  if (pcs->count >= MAX_PENDING) {
+    opl_coalesce_flush(pcs);
+  }
+  
+  /* Add the write to the end of the pending list */
+  i = pcs->count;
+  pcs->p_reg[i] = (uint8_t) reg;
+  pcs->p_val[i] = (uint8_t) val;
+  (pcs->count)++;
+  
+  /* Order-sensitive writes begin a new segment, while ordinary writes
+   * remember their position */
+  if (isOrdered(reg)) {
+    pcs->seg = pcs->count;
+  } else {
+    pcs->slot[reg] = i;
+  }
+}
+
+/*
+ * opl_coalesce_flush function.
+ */
+int32_t opl_coalesce_flush(OPL_COALESCE *pcs) {
+  int32_t i = 0;
+  int32_t reg = 0;
+  int32_t sent = 0;
+  
+  /* Check parameter */
+  if (pcs == NULL) {
+    abort();
+  }
+  
+  /* Send each pending write that changes the register, along with all
+   * timer control writes */
+  for(i = 0; i < pcs->count; i++) {
+    reg = (int32_t) pcs->p_reg[i];
+    if ((reg != 0x04) && pcs->known[reg] &&
+        (pcs->val[reg] == pcs->p_val[i])) {
+      continue;
+    }
+    pcs->known[reg] = 1;
+    pcs->val[reg] = pcs->p_val[i];
+    pcs->fn(pcs->pArg, reg, (int32_t) pcs->p_val[i]);
+    sent++;
+  }
+  
+  /* Empty the pending list */
+  if (pcs->count > 0) {
+    pcs->count = 0;
+    pcs->seg = 0;
+    clearSlots(pcs);
+  }
+  
+  /* Return the number of writes sent */
+  return sent;
+}
@@ -0,0 +1,142 @@
+#ifndef OPL_COALESCE_H_INCLUDED
+#define OPL_COALESCE_H_INCLUDED
+
+/*
+ * opl_coalesce.h
+ * ==============
+ * 
+ * Coalescing of OPL2 register writes that happen at the same time.
+ * 
+ * Register writes logged from trackers often write the same register
+ * several times in a row without any samples in between, or write a
+ * register with the value it already has.  Only the final state of the
+ * chip at the next sample matters, so such writes can be merged or left
+ * out without changing the output.
+ * 
+ * A coalescer tracks the writes for a single chip.  Writes go into the
+ * coalescer while time stands still, and flushing the coalescer sends
+ * the remaining writes on to a callback, which happens right before
+ * time moves forward again.
+ * 
+ * Within the writes between two flushes, the following is done:
+ * 
+ *   (1) Repeated writes to the same ordinary register are merged into
+ *   a single write with the last value, which keeps the position of
+ *   the first write.
+ * 
+ *   (2) Writes that would store the value the chip already holds in a
+ *   register are left out.
+ * 
+ * Some registers have effects that depend on the order of writes, such
+ * as the key-on bits in registers B0-B8 and BD, the waveform select
+ * enable in register 01, the timer control in register 04, and the
+ * mode bits in register 08.  These order-sensitive registers are never
+ * merged, and ordinary writes are never merged across them, so every
+ * write to an order-sensitive register sees the same register state as
+ * it would have without coalescing.  A repeated write to register 04
+ * is never left out either, since it resets the timer flags each time.
+ * 
+ * Register values are only known to the coalescer once they have been
+ * written through it.  After a reset, all registers are unknown again.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Callback function that receives the register writes that remain
+ * after coalescing, in the order they should be applied.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the custom parameter passed to opl_coalesce_new()
+ * 
+ *   reg - the OPL hardware register index
+ * 
+ *   val - the unsigned byte value to write (0-255)
+ */
+typedef void (*OPL_COALESCE_FUNC)(void *pArg, int32_t reg, int32_t val);
+
+/*
+ * Structure prototype for a register write coalescer.
+ * 
+ * The actual structure is defined in the implementation.
+ */
+struct OPL_COALESCE_TAG;
+typedef struct OPL_COALESCE_TAG OPL_COALESCE;
+
+/*
+ * Create a new register write coalescer.
+ * 
+ * All registers start out unknown, and no writes are pending.
+ * 
+ * Parameters:
+ * 
+ *   fn - the callback that receives the coalesced writes
+ * 
+ *   pArg - custom parameter passed through to the callback
+ * 
+ * Return:
+ * 
+ *   the new coalescer, or NULL if memory allocation failed
+ */
+OPL_COALESCE *opl_coalesce_new(OPL_COALESCE_FUNC fn, void *pArg);
+
+/*
+ * Free a register write coalescer.
+ * 
+ * Pending writes are discarded without being flushed.  If NULL is
+ * passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pcs - the coalescer to free, or NULL
+ */
+void opl_coalesce_free(OPL_COALESCE *pcs);
+
+/*
+ * Reset a coalescer for a chip that has just been reset.
+ * 
+ * Pending writes are discarded without being flushed, and all
+ * registers become unknown.
+ * 
+ * Parameters:
+ * 
+ *   pcs - the coalescer
+ */
+void opl_coalesce_reset(OPL_COALESCE *pcs);
+
+/*
+ * Add a register write to the coalescer.
+ * 
+ * The write stays pending until the next flush.  If too many writes
+ * are pending, the coalescer may flush by itself, which is harmless
+ * because the writes are still delivered in the right order.
+ * 
+ * Parameters:
+ * 
+ *   pcs - the coalescer
+ * 
+ *   reg - the OPL hardware register index (0-255)
+ * 
+ *   val - the unsigned byte value to write (0-255)
+ */
+void opl_coalesce_write(OPL_COALESCE *pcs, int32_t reg, int32_t val);
+
+/*
+ * Send all pending writes that are still needed to the callback.
+ * 
+ * This must be called before any samples are generated after the
+ * pending writes.
+ * 
+ * Parameters:
+ * 
+ *   pcs - the coalescer
+ * 
+ * Return:
+ * 
+ *   the number of writes sent to the callback
+ */
+int32_t opl_coalesce_flush(OPL_COALESCE *pcs);
+
+#endif
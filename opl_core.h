@@ -0,0 +1,99 @@
+#ifndef OPL_CORE_H_INCLUDED
+#define OPL_CORE_H_INCLUDED
+
+/*
+ * opl_core.h
+ * ==========
+ * 
+ * Interface between the OPL emulator core backends and the core
+ * registry.
+ * 
+ * Clients never use this header.  They use opl_driver.h, which is
+ * implemented by the registry in opl_registry.c.  The registry keeps a
+ * table of all the emulator cores compiled into the program, and each
+ * OPL_CONTEXT it hands out wraps a context of the core that was
+ * selected when the context was created.
+ * 
+ * Each emulator core has a different C source file that defines a
+ * constant OPL_CORE structure with its properties and functions.  The
+ * functions have the same meaning and the same parameter checks as the
+ * corresponding opl_ctx functions in opl_driver.h, except that the
+ * contexts are the core's own context pointers.
+ * 
+ * To add a core, define its OPL_CORE structure in a new source file,
+ * declare it at the end of this header, and add it to the table in
+ * opl_registry.c.
+ */
+
+#include "opl_driver.h"
+
+/*
+ * The properties and functions of an emulator core.
+ */
+typedef struct {
+  
+  /*
+   * The short name used to select the core, such as "dosbox".
+   */
+  const char *pKey;
+  
+  /*
+   * The name with revision returned by opl_ctx_name().
+   */
+  const char *pName;
+  
+  /*
+   * The maximum number of contexts that can exist at the same time.
+   */
+  int32_t limit;
+  
+  /*
+   * The size in bytes of a state snapshot, and flag set if snapshots
+   * are exact.
+   */
+  int32_t state_size;
+  int state_exact;
+  
+  /*
+   * The context functions.
+   */
+  int32_t (*rate)(int32_t sample_rate);
+  void *(*ctx_new)(int32_t sample_rate);
+  void (*ctx_free)(void *pCtx);
+  void (*reset)(void *pCtx, int32_t sample_rate);
+  void (*write)(void *pCtx, int32_t reg, int32_t val);
+  void (*write_bulk)(void *pCtx, const uint8_t *pPairs, int32_t count);
+  void (*generate)(void *pCtx, int16_t *pbuf, int32_t count);
+  void (*generate_stride)(
+      void *pCtx, int16_t *pbuf, int32_t count, int32_t stride);
+  void (*generate_events)(
+      void *pCtx, int16_t *pbuf, int32_t count, int32_t stride,
+      const OPL_EVENT *pEv, int32_t ev_count);
+  void (*set_skip)(void *pCtx, int enable);
+  int (*idle)(const void *pCtx);
+  void (*save)(const void *pCtx, uint8_t *pState);
+  int (*restore)(void *pCtx, const uint8_t *pState);
+
+} OPL_CORE;
+
+/*
+ * The DOSBox OPL emulator, defined in opl_driver_dosbox.c.
+ */
+extern const OPL_CORE opl_core_dosbox;
+
+/*
+ * A core that generates silence, defined in opl_core_null.c.
+ */
+extern const OPL_CORE opl_core_null;
+
+/*
+ * The native OPL2 emulator with SIMD kernels chosen at runtime, its
+ * variant that always uses the scalar kernel, and its cheaper preview
+ * variant that evaluates the operators at half the chip rate, all
+ * defined in opl_core_native.c.
+ */
+extern const OPL_CORE opl_core_native;
+extern const OPL_CORE opl_core_native_scalar;
+extern const OPL_CORE opl_core_native_preview;
+
+#endif
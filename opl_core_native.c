@@ -0,0 +1,2091 @@
+/*
+ * opl_core_native.c
+ * =================
+ * 
+ * Emulator core backend for opl_core.h with a native OPL2 emulator.
+ * 
+ * The native core emulates the OPL2 at its own sample rate of one
+ * sample every 72 cycles of the 3.579545 MHz chip clock, which is
+ * about 49716 Hz, and interpolates the output to the sample rate of
+ * the context.  It models the phase generators with vibrato, the
+ * envelope generators with key scaling and tremolo, the four OPL2
+ * waveforms through the logarithmic sine and exponential tables,
+ * feedback and both connection types, and the rhythm instruments.  The
+ * timers are not emulated, since they do not affect the output.
+ * 
+ * The operator state is kept in structure-of-arrays layout.  The nine
+ * modulators form one group and the nine carriers another, with one
+ * lane per channel.  All the operators of a group are independent
+ * within a sample, so each group is evaluated by a single kernel that
+ * computes the phases, waveform lookups, and output levels of all its
+ * lanes at once.  The carriers are evaluated after the modulators,
+ * whose outputs they take as modulation.
+ * 
+ * There is a scalar kernel, and on suitable machines kernels that use
+ * SSE2 or AVX2 on x86 and NEON on ARM.  The best kernel the processor
+ * supports is chosen at runtime, once, when the first context is
+ * created, and every later context uses the same choice.  All the
+ * kernels only use integer arithmetic on the same tables, so they
+ * generate exactly the same samples.  The "native-scalar" core is the
+ * same emulator always running the scalar kernel, which allows the
+ * kernels to be compared against each other.
+ * 
+ * The "native-preview" core is a cheaper variant for previews.  It
+ * only evaluates the operators on every other sample of the chip, at
+ * about 24858 Hz, while the envelope generators, the low-frequency
+ * oscillators, the noise generator, and the phases still advance on
+ * every sample, so notes keep their pitch and timing.  This halves the
+ * operator work, at the cost of more aliasing and slightly different
+ * feedback, so it does not generate the same samples as the other
+ * variants.
+ * 
+ * Each context has its own state and there is no global state besides
+ * the tables, which are constant data, and the kernel choice, which is
+ * made under a pthread_once() guard, so any number of contexts can be
+ * created and used from separate threads without any setup.  State
+ * snapshots hold the complete emulator state, so they are exact.
+ * Snapshots are checked before they are restored, since they may come
+ * from damaged index files.
+ * 
+ * The native core chooses the same emulation rates as the DOSBox core.
+ */
+
+#include "opl_core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define NATIVE_X86
+#elif defined(__GNUC__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NATIVE_NEON
+#endif
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The names of this core and of its scalar and preview variants,
+ * returned by opl_ctx_name().
+ * 
+ * Increase the revisions each time a change here may change the
+ * generated samples.  The core and its scalar variant always generate
+ * the same samples, so they share the revision.
+ */
+#define CORE_NAME "native-1"
+#define SCALAR_NAME "native-scalar-1"
+#define PREVIEW_NAME "native-preview-1"
+
+/*
+ * The maximum number of contexts.  There is no real limit, but the
+ * clients size their worker pools by it, so it should stay reasonable.
+ */
+#define CTX_LIMIT (1024)
+
+/*
+ * The number of OPL2 register indices.
+ */
+#define REG_COUNT (256)
+
+/*
+ * The number of channels, and the number of lanes in an operator
+ * group.  Lanes beyond the channels are padding so that the groups
+ * divide evenly into vectors, and they always stay silent.
+ */
+#define CHANNELS (9)
+#define LANES (16)
+
+/*
+ * The chip clock in Hz, and the number of clock cycles per emulated
+ * sample.
+ */
+#define CHIP_CLOCK (3579545)
+#define CHIP_DIV (72)
+
+/*
+ * The number of clock cycles per emulated sample in the preview
+ * variant, which evaluates the operators on every other chip sample.
+ */
+#define PREVIEW_DIV (CHIP_DIV * 2)
+
+/*
+ * The largest envelope attenuation, in steps of 0.1875 dB.
+ */
+#define ENV_MAX (511)
+
+/*
+ * The largest total attenuation in the logarithmic domain, in steps of
+ * 1/256 of an octave.  Anything beyond it is too quiet to produce any
+ * output.
+ */
+#define LEVEL_MAX (0xfff)
+
+/*
+ * The envelope stages.
+ */
+#define ENV_ATTACK  (0)
+#define ENV_DECAY   (1)
+#define ENV_SUSTAIN (2)
+#define ENV_RELEASE (3)
+
+/*
+ * The key-on sources of an operator, which are the channel key-on bit
+ * and the rhythm instrument bits.
+ */
+#define KEY_CHANNEL (1)
+#define KEY_RHYTHM  (2)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * A group of operators in structure-of-arrays layout, with one lane per
+ * channel.
+ * 
+ * The kernels read the phase accumulators and increments, the
+ * modulation inputs and masks, the total attenuations, and the
+ * waveform masks, and they write the outputs and advance the phase
+ * accumulators.
+ */
+typedef struct {
+  
+  /*
+   * The phase accumulators, where bits 9 to 18 are the phase of the
+   * waveform, and the phase increments per sample.
+   */
+  uint32_t phase[LANES];
+  uint32_t inc[LANES];
+  
+  /*
+   * The modulation added to the phase, and a mask that is either all
+   * ones or zero to leave the modulation out.
+   */
+  int32_t mod[LANES];
+  int32_t mmask[LANES];
+  
+  /*
+   * The total attenuation in range [0, ENV_MAX].
+   */
+  int32_t eg[LANES];
+  
+  /*
+   * The phase bits that silence the waveform, and the phase bits that
+   * negate it.
+   */
+  int32_t sil[LANES];
+  int32_t neg[LANES];
+  
+  /*
+   * The outputs of the last sample.
+   */
+  int32_t out[LANES];
+
+} OP_GROUP;
+
+/*
+ * The complete state of an emulated chip.
+ * 
+ * This holds no pointers, so that it can be copied as a snapshot.
+ */
+typedef struct {
+  
+  /*
+   * The operator groups, with the modulators first and the carriers
+   * second.
+   */
+  OP_GROUP grp[2];
+  
+  /*
+   * The envelope state of each operator: the attenuation, the stage,
+   * and the key-on sources that are on.
+   */
+  int32_t env[2][LANES];
+  uint8_t stage[2][LANES];
+  uint8_t key[2][LANES];
+  
+  /*
+   * The effective envelope rate of each operator for each stage, in
+   * range [0, 63], where zero means the envelope does not move.
+   */
+  uint8_t rate[2][LANES][4];
+  
+  /*
+   * The sustain level of each operator, the attenuation from the total
+   * level and key scaling, and flag set if tremolo is on.
+   */
+  int32_t sl_level[2][LANES];
+  int32_t eg_base[2][LANES];
+  uint8_t am[2][LANES];
+  
+  /*
+   * The previous modulator output of each channel for feedback, and the
+   * feedback shift, or zero if feedback is off.
+   */
+  int32_t prev[LANES];
+  int32_t fb_shift[LANES];
+  
+  /*
+   * The value last written to each register.
+   */
+  uint8_t regs[REG_COUNT];
+  
+  /*
+   * Flag set if anything is keyed on or CSM mode is on.
+   */
+  int keyed;
+  
+  /*
+   * The number of emulated samples so far, which also drives the
+   * envelope generators and the low-frequency oscillators.
+   */
+  uint32_t timer;
+  
+  /*
+   * The tremolo position in range [0, 209] and the current tremolo
+   * attenuation, and the vibrato position in range [0, 7].
+   */
+  int32_t am_pos;
+  int32_t trem;
+  int32_t vib_pos;
+  
+  /*
+   * The noise generator used by the rhythm instruments.
+   */
+  uint32_t noise;
+  
+  /*
+   * The sample rate of the context, and the interpolation state: the
+   * last two emulated samples, and the position between them in units
+   * of one (div * sample_rate)th of a chip clock cycle, where div is
+   * the number of clock cycles per emulated sample of the context.
+   */
+  int32_t sample_rate;
+  int32_t s0;
+  int32_t s1;
+  uint32_t acc;
+  uint32_t den;
+
+} NATIVE_STATE;
+
+/*
+ * A kernel that evaluates all the lanes of an operator group.
+ */
+typedef void (*KERNEL_FUNC)(OP_GROUP *pg);
+
+/*
+ * The state of an emulator context.
+ */
+typedef struct {
+  
+  /*
+   * The emulator state.
+   */
+  NATIVE_STATE st;
+  
+  /*
+   * The kernel chosen for this context.
+   */
+  KERNEL_FUNC kern;
+  
+  /*
+   * The number of chip clock cycles per emulated sample, which is
+   * CHIP_DIV, or PREVIEW_DIV for the preview variant.
+   */
+  int32_t div;
+  
+  /*
+   * Flag set if silence skipping is enabled, and flag set while the
+   * chip is idle so that synthesis is skipped.
+   */
+  int skip;
+  int idle;
+
+} NATIVE_CTX;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The phase multipliers, in units of one half.
+ */
+static const uint8_t mult_tab[16] = {
+  1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30
+};
+
+/*
+ * The key scale level attenuation for the top four bits of the
+ * frequency number at the highest block.
+ */
+static const uint8_t ksl_tab[16] = {
+  0, 32, 40, 45, 48, 51, 53, 55, 56, 58, 59, 60, 61, 62, 63, 64
+};
+
+/*
+ * The shift applied to the key scale level attenuation for each value
+ * of the key scale level register bits, which give 0, 3, 1.5, and
+ * 6 dB per octave.
+ */
+static const uint8_t ksl_shift[4] = {
+  0, 1, 2, 0
+};
+
+/*
+ * The envelope increments of the slow rates, which step on one sample
+ * out of every 2^(12 - rate / 4), and of the fast rates, which step on
+ * every sample, for each of the four rates within an octave of rates.
+ */
+static const uint8_t env_slow[4][8] = {
+  {0, 1, 0, 1, 0, 1, 0, 1},
+  {0, 1, 0, 1, 1, 1, 0, 1},
+  {0, 1, 1, 1, 0, 1, 1, 1},
+  {0, 1, 1, 1, 1, 1, 1, 1}
+};
+static const uint8_t env_fast[4][8] = {
+  {1, 1, 1, 1, 1, 1, 1, 1},
+  {1, 1, 1, 2, 1, 1, 1, 2},
+  {1, 2, 1, 2, 1, 2, 1, 2},
+  {1, 2, 2, 2, 1, 2, 2, 2}
+};
+
+/*
+ * The register offset of the modulator of each channel.  The carrier
+ * is three registers further.
+ */
+static const uint8_t op_base[CHANNELS] = {
+  0x00, 0x01, 0x02, 0x08, 0x09, 0x0a, 0x10, 0x11, 0x12
+};
+
+/*
+ * The attenuation of a quarter sine wave in the logarithmic domain, in
+ * steps of 1/256 octave, which is -log2(sin((i + 0.5) * pi / 512))
+ * scaled by 256 and rounded.
+ */
+static const int32_t logsin_tab[256] = {
+  2137, 1731, 1543, 1419, 1326, 1252, 1190, 1137, 1091, 1050,
+  1013, 979, 949, 920, 894, 869, 846, 825, 804, 785,
+  767, 749, 732, 717, 701, 687, 672, 659, 646, 633,
+  621, 609, 598, 587, 576, 566, 556, 546, 536, 527,
+  518, 509, 501, 492, 484, 476, 468, 461, 453, 446,
+  439, 432, 425, 418, 411, 405, 399, 392, 386, 380,
+  375, 369, 363, 358, 352, 347, 341, 336, 331, 326,
+  321, 316, 311, 307, 302, 297, 293, 289, 284, 280,
+  276, 271, 267, 263, 259, 255, 251, 248, 244, 240,
+  236, 233, 229, 226, 222, 219, 215, 212, 209, 205,
+  202, 199, 196, 193, 190, 187, 184, 181, 178, 175,
+  172, 169, 167, 164, 161, 159, 156, 153, 151, 148,
+  146, 143, 141, 138, 136, 134, 131, 129, 127, 125,
+  122, 120, 118, 116, 114, 112, 110, 108, 106, 104,
+  102, 100, 98, 96, 94, 92, 91, 89, 87, 85,
+  83, 82, 80, 78, 77, 75, 74, 72, 70, 69,
+  67, 66, 64, 63, 62, 60, 59, 57, 56, 55,
+  53, 52, 51, 49, 48, 47, 46, 45, 43, 42,
+  41, 40, 39, 38, 37, 36, 35, 34, 33, 32,
+  31, 30, 29, 28, 27, 26, 25, 24, 23, 23,
+  22, 21, 20, 20, 19, 18, 17, 17, 16, 15,
+  15, 14, 13, 13, 12, 12, 11, 10, 10, 9,
+  9, 8, 8, 7, 7, 7, 6, 6, 5, 5,
+  5, 4, 4, 4, 3, 3, 3, 2, 2, 2,
+  2, 1, 1, 1, 1, 1, 1, 1, 0, 0,
+  0, 0, 0, 0, 0, 0
+};
+
+/*
+ * The linear output for every total attenuation in the logarithmic
+ * domain.  The low eight bits of the attenuation select the fraction
+ * of an octave, 2^((255 - i) / 256) scaled by 1024, rounded, and
+ * doubled, and each whole octave shifts it down by one more bit.
+ * EXP_OCTAVE gives the 256 entries of the octave with shift s.
+ */
+#define EXP_OCTAVE(s) \
+  4084 >> (s), 4074 >> (s), 4062 >> (s), 4052 >> (s), 4040 >> (s), \
+  4030 >> (s), 4020 >> (s), 4008 >> (s), 3998 >> (s), 3986 >> (s), \
+  3976 >> (s), 3966 >> (s), 3954 >> (s), 3944 >> (s), 3932 >> (s), \
+  3922 >> (s), 3912 >> (s), 3902 >> (s), 3890 >> (s), 3880 >> (s), \
+  3870 >> (s), 3860 >> (s), 3848 >> (s), 3838 >> (s), 3828 >> (s), \
+  3818 >> (s), 3808 >> (s), 3796 >> (s), 3786 >> (s), 3776 >> (s), \
+  3766 >> (s), 3756 >> (s), 3746 >> (s), 3736 >> (s), 3726 >> (s), \
+  3716 >> (s), 3706 >> (s), 3696 >> (s), 3686 >> (s), 3676 >> (s), \
+  3666 >> (s), 3656 >> (s), 3646 >> (s), 3636 >> (s), 3626 >> (s), \
+  3616 >> (s), 3606 >> (s), 3596 >> (s), 3588 >> (s), 3578 >> (s), \
+  3568 >> (s), 3558 >> (s), 3548 >> (s), 3538 >> (s), 3530 >> (s), \
+  3520 >> (s), 3510 >> (s), 3500 >> (s), 3492 >> (s), 3482 >> (s), \
+  3472 >> (s), 3464 >> (s), 3454 >> (s), 3444 >> (s), 3434 >> (s), \
+  3426 >> (s), 3416 >> (s), 3408 >> (s), 3398 >> (s), 3388 >> (s), \
+  3380 >> (s), 3370 >> (s), 3362 >> (s), 3352 >> (s), 3344 >> (s), \
+  3334 >> (s), 3326 >> (s), 3316 >> (s), 3308 >> (s), 3298 >> (s), \
+  3290 >> (s), 3280 >> (s), 3272 >> (s), 3262 >> (s), 3254 >> (s), \
+  3246 >> (s), 3236 >> (s), 3228 >> (s), 3218 >> (s), 3210 >> (s), \
+  3202 >> (s), 3192 >> (s), 3184 >> (s), 3176 >> (s), 3168 >> (s), \
+  3158 >> (s), 3150 >> (s), 3142 >> (s), 3132 >> (s), 3124 >> (s), \
+  3116 >> (s), 3108 >> (s), 3100 >> (s), 3090 >> (s), 3082 >> (s), \
+  3074 >> (s), 3066 >> (s), 3058 >> (s), 3050 >> (s), 3040 >> (s), \
+  3032 >> (s), 3024 >> (s), 3016 >> (s), 3008 >> (s), 3000 >> (s), \
+  2992 >> (s), 2984 >> (s), 2976 >> (s), 2968 >> (s), 2960 >> (s), \
+  2952 >> (s), 2944 >> (s), 2936 >> (s), 2928 >> (s), 2920 >> (s), \
+  2912 >> (s), 2904 >> (s), 2896 >> (s), 2888 >> (s), 2880 >> (s), \
+  2872 >> (s), 2866 >> (s), 2858 >> (s), 2850 >> (s), 2842 >> (s), \
+  2834 >> (s), 2826 >> (s), 2818 >> (s), 2812 >> (s), 2804 >> (s), \
+  2796 >> (s), 2788 >> (s), 2782 >> (s), 2774 >> (s), 2766 >> (s), \
+  2758 >> (s), 2752 >> (s), 2744 >> (s), 2736 >> (s), 2728 >> (s), \
+  2722 >> (s), 2714 >> (s), 2706 >> (s), 2700 >> (s), 2692 >> (s), \
+  2684 >> (s), 2678 >> (s), 2670 >> (s), 2664 >> (s), 2656 >> (s), \
+  2648 >> (s), 2642 >> (s), 2634 >> (s), 2628 >> (s), 2620 >> (s), \
+  2614 >> (s), 2606 >> (s), 2600 >> (s), 2592 >> (s), 2584 >> (s), \
+  2578 >> (s), 2572 >> (s), 2564 >> (s), 2558 >> (s), 2550 >> (s), \
+  2544 >> (s), 2536 >> (s), 2530 >> (s), 2522 >> (s), 2516 >> (s), \
+  2510 >> (s), 2502 >> (s), 2496 >> (s), 2488 >> (s), 2482 >> (s), \
+  2476 >> (s), 2468 >> (s), 2462 >> (s), 2456 >> (s), 2448 >> (s), \
+  2442 >> (s), 2436 >> (s), 2428 >> (s), 2422 >> (s), 2416 >> (s), \
+  2410 >> (s), 2402 >> (s), 2396 >> (s), 2390 >> (s), 2384 >> (s), \
+  2376 >> (s), 2370 >> (s), 2364 >> (s), 2358 >> (s), 2352 >> (s), \
+  2344 >> (s), 2338 >> (s), 2332 >> (s), 2326 >> (s), 2320 >> (s), \
+  2314 >> (s), 2308 >> (s), 2300 >> (s), 2294 >> (s), 2288 >> (s), \
+  2282 >> (s), 2276 >> (s), 2270 >> (s), 2264 >> (s), 2258 >> (s), \
+  2252 >> (s), 2246 >> (s), 2240 >> (s), 2234 >> (s), 2228 >> (s), \
+  2222 >> (s), 2216 >> (s), 2210 >> (s), 2204 >> (s), 2198 >> (s), \
+  2192 >> (s), 2186 >> (s), 2180 >> (s), 2174 >> (s), 2168 >> (s), \
+  2162 >> (s), 2156 >> (s), 2150 >> (s), 2144 >> (s), 2138 >> (s), \
+  2132 >> (s), 2128 >> (s), 2122 >> (s), 2116 >> (s), 2110 >> (s), \
+  2104 >> (s), 2098 >> (s), 2092 >> (s), 2088 >> (s), 2082 >> (s), \
+  2076 >> (s), 2070 >> (s), 2064 >> (s), 2060 >> (s), 2054 >> (s), \
+  2048 >> (s)
+
+static const int32_t exp_tab[LEVEL_MAX + 1] = {
+  EXP_OCTAVE(0), EXP_OCTAVE(1),
+  EXP_OCTAVE(2), EXP_OCTAVE(3),
+  EXP_OCTAVE(4), EXP_OCTAVE(5),
+  EXP_OCTAVE(6), EXP_OCTAVE(7),
+  EXP_OCTAVE(8), EXP_OCTAVE(9),
+  EXP_OCTAVE(10), EXP_OCTAVE(11),
+  EXP_OCTAVE(12), EXP_OCTAVE(13),
+  EXP_OCTAVE(14), EXP_OCTAVE(15)
+};
+
+/*
+ * The kernel chosen for the native core, and the guard that makes sure
+ * it is chosen only once.  Set by chooseKernel().
+ */
+static pthread_once_t kern_once = PTHREAD_ONCE_INIT;
+static KERNEL_FUNC kern_best = NULL;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Compute the output of an operator.
+ * 
+ * This is the same computation that the kernels perform on each lane.
+ * 
+ * Parameters:
+ * 
+ *   ph - the phase of the waveform in range [0, 1023]
+ * 
+ *   eg - the total attenuation in range [0, ENV_MAX]
+ * 
+ *   sil - the phase bits that silence the waveform
+ * 
+ *   neg - the phase bits that negate the waveform
+ * 
+ * Return:
+ * 
+ *   the output of the operator
+ */
+static int32_t evalOp(
+    uint32_t ph,
+    int32_t  eg,
+    int32_t  sil,
+    int32_t  neg) {
+  
+  uint32_t idx = 0;
+  int32_t lv = 0;
+  int32_t out = 0;
+  
+  /* The second quarter of each half mirrors the first */
+  idx = (ph & 0xff) ^ ((ph & 0x100) ? 0xff : 0);
+  lv = logsin_tab[idx] + (eg << 3);
+  if (ph & ((uint32_t) sil)) {
+    lv = LEVEL_MAX;
+  }
+  if (lv > LEVEL_MAX) {
+    lv = LEVEL_MAX;
+  }
+  
+  /* The negative half is the ones' complement */
+  out = exp_tab[lv];
+  if (ph & ((uint32_t) neg)) {
+    out = ~out;
+  }
+  return out;
+}
+
+/*
+ * The scalar kernel.
+ * 
+ * Parameters:
+ * 
+ *   pg - the operator group to evaluate
+ */
+static void kernScalar(OP_GROUP *pg) {
+  uint32_t ph = 0;
+  int32_t i = 0;
+  
+  for(i = 0; i < LANES; i++) {
+    ph = ((pg->phase[i] >> 9) +
+          ((uint32_t) (pg->mod[i] & pg->mmask[i]))) & 0x3ff;
+    pg->phase[i] += pg->inc[i];
+    pg->out[i] = evalOp(ph, pg->eg[i], pg->sil[i], pg->neg[i]);
+  }
+}
+
+#ifdef NATIVE_X86
+
+/*
+ * The SSE2 kernel, which has no gather instructions, so the table
+ * lookups are done lane by lane.
+ * 
+ * Parameters:
+ * 
+ *   pg - the operator group to evaluate
+ */
+__attribute__((target("sse2")))
+static void kernSSE2(OP_GROUP *pg) {
+  
+  int32_t tmp[4];
+  __m128i k3ff = _mm_set1_epi32(0x3ff);
+  __m128i kff = _mm_set1_epi32(0xff);
+  __m128i k100 = _mm_set1_epi32(0x100);
+  __m128i kmax = _mm_set1_epi32(LEVEL_MAX);
+  __m128i zero = _mm_setzero_si128();
+  __m128i ones = _mm_set1_epi32(-1);
+  __m128i ph;
+  __m128i v;
+  __m128i m;
+  int32_t i = 0;
+  int32_t k = 0;
+  
+  for(i = 0; i < LANES; i += 4) {
+    /* Get the phases and advance the accumulators */
+    ph = _mm_loadu_si128((const __m128i *) (pg->phase + i));
+    _mm_storeu_si128((__m128i *) (pg->phase + i),
+      _mm_add_epi32(ph,
+        _mm_loadu_si128((const __m128i *) (pg->inc + i))));
+    ph = _mm_srli_epi32(ph, 9);
+    ph = _mm_add_epi32(ph, _mm_and_si128(
+          _mm_loadu_si128((const __m128i *) (pg->mod + i)),
+          _mm_loadu_si128((const __m128i *) (pg->mmask + i))));
+    ph = _mm_and_si128(ph, k3ff);
+    
+    /* Look up the quarter sine */
+    m = _mm_cmpeq_epi32(_mm_and_si128(ph, k100), k100);
+    v = _mm_xor_si128(_mm_and_si128(ph, kff), _mm_and_si128(m, kff));
+    _mm_storeu_si128((__m128i *) tmp, v);
+    for(k = 0; k < 4; k++) {
+      tmp[k] = logsin_tab[tmp[k]];
+    }
+    
+    /* Add the attenuation, silence, and clamp */
+    v = _mm_add_epi32(_mm_loadu_si128((const __m128i *) tmp),
+          _mm_slli_epi32(
+            _mm_loadu_si128((const __m128i *) (pg->eg + i)), 3));
+    m = _mm_cmpeq_epi32(_mm_and_si128(ph,
+          _mm_loadu_si128((const __m128i *) (pg->sil + i))), zero);
+    v = _mm_or_si128(_mm_and_si128(m, v), _mm_andnot_si128(m, kmax));
+    m = _mm_cmpgt_epi32(v, kmax);
+    v = _mm_or_si128(_mm_andnot_si128(m, v), _mm_and_si128(m, kmax));
+    
+    /* Look up the linear output */
+    _mm_storeu_si128((__m128i *) tmp, v);
+    for(k = 0; k < 4; k++) {
+      tmp[k] = exp_tab[tmp[k]];
+    }
+    
+    /* Negate */
+    m = _mm_cmpeq_epi32(_mm_and_si128(ph,
+          _mm_loadu_si128((const __m128i *) (pg->neg + i))), zero);
+    v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) tmp),
+          _mm_andnot_si128(m, ones));
+    _mm_storeu_si128((__m128i *) (pg->out + i), v);
+  }
+}
+
+/*
+ * The AVX2 kernel, which does the table lookups with gathers.
+ * 
+ * Parameters:
+ * 
+ *   pg - the operator group to evaluate
+ */
+__attribute__((target("avx2")))
+static void kernAVX2(OP_GROUP *pg) {
+  
+  __m256i k3ff = _mm256_set1_epi32(0x3ff);
+  __m256i kff = _mm256_set1_epi32(0xff);
+  __m256i k100 = _mm256_set1_epi32(0x100);
+  __m256i kmax = _mm256_set1_epi32(LEVEL_MAX);
+  __m256i zero = _mm256_setzero_si256();
+  __m256i ones = _mm256_set1_epi32(-1);
+  __m256i ph;
+  __m256i v;
+  __m256i m;
+  int32_t i = 0;
+  
+  for(i = 0; i < LANES; i += 8) {
+    /* Get the phases and advance the accumulators */
+    ph = _mm256_loadu_si256((const __m256i *) (pg->phase + i));
+    _mm256_storeu_si256((__m256i *) (pg->phase + i),
+      _mm256_add_epi32(ph,
+        _mm256_loadu_si256((const __m256i *) (pg->inc + i))));
+    ph = _mm256_srli_epi32(ph, 9);
+    ph = _mm256_add_epi32(ph, _mm256_and_si256(
+          _mm256_loadu_si256((const __m256i *) (pg->mod + i)),
+          _mm256_loadu_si256((const __m256i *) (pg->mmask + i))));
+    ph = _mm256_and_si256(ph, k3ff);
+    
+    /* Look up the quarter sine */
+    m = _mm256_cmpeq_epi32(_mm256_and_si256(ph, k100), k100);
+    v = _mm256_xor_si256(_mm256_and_si256(ph, kff),
+          _mm256_and_si256(m, kff));
+    v = _mm256_i32gather_epi32((const int *) logsin_tab, v, 4);
+    
+    /* Add the attenuation, silence, and clamp */
+    v = _mm256_add_epi32(v, _mm256_slli_epi32(
+          _mm256_loadu_si256((const __m256i *) (pg->eg + i)), 3));
+    m = _mm256_cmpeq_epi32(_mm256_and_si256(ph,
+          _mm256_loadu_si256((const __m256i *) (pg->sil + i))), zero);
+    v = _mm256_blendv_epi8(kmax, v, m);
+    v = _mm256_min_epi32(v, kmax);
+    
+    /* Look up the linear output and negate */
+    v = _mm256_i32gather_epi32((const int *) exp_tab, v, 4);
+    m = _mm256_cmpeq_epi32(_mm256_and_si256(ph,
+          _mm256_loadu_si256((const __m256i *) (pg->neg + i))), zero);
+    v = _mm256_xor_si256(v, _mm256_andnot_si256(m, ones));
+    _mm256_storeu_si256((__m256i *) (pg->out + i), v);
+  }
+}
+
+#endif
+
+#ifdef NATIVE_NEON
+
+/*
+ * The NEON kernel, which has no gather instructions, so the table
+ * lookups are done lane by lane.
+ * 
+ * Parameters:
+ * 
+ *   pg - the operator group to evaluate
+ */
+static void kernNEON(OP_GROUP *pg) {
+  
+  int32_t tmp[4];
+  uint32x4_t k3ff = vdupq_n_u32(0x3ff);
+  uint32x4_t kff = vdupq_n_u32(0xff);
+  uint32x4_t k100 = vdupq_n_u32(0x100);
+  int32x4_t kmax = vdupq_n_s32(LEVEL_MAX);
+  uint32x4_t ph;
+  uint32x4_t m;
+  int32x4_t v;
+  int32_t i = 0;
+  int32_t k = 0;
+  
+  for(i = 0; i < LANES; i += 4) {
+    /* Get the phases and advance the accumulators */
+    ph = vld1q_u32(pg->phase + i);
+    vst1q_u32(pg->phase + i, vaddq_u32(ph, vld1q_u32(pg->inc + i)));
+    ph = vshrq_n_u32(ph, 9);
+    ph = vaddq_u32(ph, vreinterpretq_u32_s32(
+          vandq_s32(vld1q_s32(pg->mod + i), vld1q_s32(pg->mmask + i))));
+    ph = vandq_u32(ph, k3ff);
+    
+    /* Look up the quarter sine */
+    m = vtstq_u32(ph, k100);
+    vst1q_s32(tmp, vreinterpretq_s32_u32(
+      veorq_u32(vandq_u32(ph, kff), vandq_u32(m, kff))));
+    for(k = 0; k < 4; k++) {
+      tmp[k] = logsin_tab[tmp[k]];
+    }
+    
+    /* Add the attenuation, silence, and clamp */
+    v = vaddq_s32(vld1q_s32(tmp),
+          vshlq_n_s32(vld1q_s32(pg->eg + i), 3));
+    m = vtstq_u32(ph, vreinterpretq_u32_s32(vld1q_s32(pg->sil + i)));
+    v = vbslq_s32(m, kmax, v);
+    v = vminq_s32(v, kmax);
+    
+    /* Look up the linear output and negate */
+    vst1q_s32(tmp, v);
+    for(k = 0; k < 4; k++) {
+      tmp[k] = exp_tab[tmp[k]];
+    }
+    m = vtstq_u32(ph, vreinterpretq_u32_s32(vld1q_s32(pg->neg + i)));
+    vst1q_s32(pg->out + i,
+      veorq_s32(vld1q_s32(tmp), vreinterpretq_s32_u32(m)));
+  }
+}
+
+#endif
+
+/*
+ * Choose the fastest kernel the processor supports and store it in
+ * kern_best.
+ * 
+ * This is only called through pthread_once() from pickKernel().
+ */
+static void chooseKernel(void) {
+#ifdef NATIVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kern_best = &kernAVX2;
+    return;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    kern_best = &kernSSE2;
+    return;
+  }
+#endif
+#ifdef NATIVE_NEON
+  kern_best = &kernNEON;
+#else
+  kern_best = &kernScalar;
+#endif
+}
+
+/*
+ * Get the fastest kernel the processor supports.
+ * 
+ * The processor features are only checked on the first call, and later
+ * calls return the same kernel.  This may be called from any thread.
+ * 
+ * Return:
+ * 
+ *   the kernel
+ */
+static KERNEL_FUNC pickKernel(void) {
+  if (pthread_once(&kern_once, &chooseKernel)) {
+    abort();
+  }
+  return kern_best;
+}
+
+/*
+ * Get the frequency number and block of a channel.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   c - the channel
+ * 
+ *   pBlock - receives the block
+ * 
+ * Return:
+ * 
+ *   the frequency number
+ */
+static int32_t chFnum(
+    const NATIVE_STATE * ps,
+          int32_t        c,
+          int32_t      * pBlock) {
+  
+  *pBlock = (ps->regs[0xb0 + c] >> 2) & 0x07;
+  return ((int32_t) ps->regs[0xa0 + c]) |
+          (((int32_t) (ps->regs[0xb0 + c] & 0x03)) << 8);
+}
+
+/*
+ * Compute the phase increment of an operator.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   g - the operator group
+ * 
+ *   c - the channel
+ */
+static void opUpdateInc(NATIVE_STATE *ps, int32_t g, int32_t c) {
+  int32_t reg = 0;
+  int32_t block = 0;
+  int32_t fnum = 0;
+  int32_t range = 0;
+  
+  reg = ps->regs[0x20 + op_base[c] + (g * 3)];
+  fnum = chFnum(ps, c, &block);
+  
+  /* Vibrato moves the frequency number by a fraction of its top bits,
+   * following a triangle over eight steps */
+  if (reg & 0x40) {
+    range = (fnum >> 7) & 0x07;
+    if (!(ps->vib_pos & 0x03)) {
+      range = 0;
+    } else if (ps->vib_pos & 0x01) {
+      range >>= 1;
+    }
+    if (!(ps->regs[0xbd] & 0x40)) {
+      range >>= 1;
+    }
+    if (ps->vib_pos & 0x04) {
+      range = -range;
+    }
+    fnum += range;
+  }
+  
+  ps->grp[g].inc[c] = (uint32_t)
+    ((((fnum << block) >> 1) * ((int32_t) mult_tab[reg & 0x0f])) >> 1);
+}
+
+/*
+ * Compute the envelope parameters of an operator.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   g - the operator group
+ * 
+ *   c - the channel
+ */
+static void opUpdateEnv(NATIVE_STATE *ps, int32_t g, int32_t c) {
+  int32_t offs = 0;
+  int32_t block = 0;
+  int32_t fnum = 0;
+  int32_t ks = 0;
+  int32_t ksl = 0;
+  int32_t r = 0;
+  int32_t i = 0;
+  int32_t rr[4];
+  
+  offs = op_base[c] + (g * 3);
+  fnum = chFnum(ps, c, &block);
+  
+  /* The key scale value comes from the block and one bit of the
+   * frequency number selected by the note select bit */
+  ks = block << 1;
+  if (ps->regs[0x08] & 0x40) {
+    ks |= (fnum >> 8) & 0x01;
+  } else {
+    ks |= (fnum >> 9) & 0x01;
+  }
+  if (!(ps->regs[0x20 + offs] & 0x10)) {
+    ks >>= 2;
+  }
+  
+  /* Rates for each stage, where sustain holds unless the envelope is
+   * percussive */
+  rr[ENV_ATTACK] = ps->regs[0x60 + offs] >> 4;
+  rr[ENV_DECAY] = ps->regs[0x60 + offs] & 0x0f;
+  rr[ENV_RELEASE] = ps->regs[0x80 + offs] & 0x0f;
+  rr[ENV_SUSTAIN] = rr[ENV_RELEASE];
+  if (ps->regs[0x20 + offs] & 0x20) {
+    rr[ENV_SUSTAIN] = 0;
+  }
+  for(i = 0; i < 4; i++) {
+    r = 0;
+    if (rr[i] > 0) {
+      r = (rr[i] << 2) + ks;
+      if (r > 63) {
+        r = 63;
+      }
+    }
+    ps->rate[g][c][i] = (uint8_t) r;
+  }
+  
+  /* Sustain level in 3 dB steps, with the top step at 93 dB */
+  i = ps->regs[0x80 + offs] >> 4;
+  if (i >= 15) {
+    ps->sl_level[g][c] = 0x1f0;
+  } else {
+    ps->sl_level[g][c] = i << 4;
+  }
+  
+  /* Total level in 0.75 dB steps plus the key scale level */
+  i = ps->regs[0x40 + offs] >> 6;
+  if (i > 0) {
+    ksl = (((int32_t) ksl_tab[fnum >> 6]) << 2) - ((8 - block) << 5);
+    if (ksl < 0) {
+      ksl = 0;
+    }
+    ksl >>= ksl_shift[i];
+  }
+  ps->eg_base[g][c] = ((ps->regs[0x40 + offs] & 0x3f) << 2) + ksl;
+  ps->am[g][c] = (uint8_t) ((ps->regs[0x20 + offs] & 0x80) != 0);
+}
+
+/*
+ * Compute the waveform masks of an operator.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   g - the operator group
+ * 
+ *   c - the channel
+ */
+static void opUpdateWave(NATIVE_STATE *ps, int32_t g, int32_t c) {
+  int32_t wf = 0;
+  
+  /* Without the waveform select enable, every operator is a sine */
+  if (ps->regs[0x01] & 0x20) {
+    wf = ps->regs[0xe0 + op_base[c] + (g * 3)] & 0x03;
+  }
+  
+  /* Sine, half sine, absolute sine, and pulsed sine */
+  ps->grp[g].sil[c] = 0;
+  ps->grp[g].neg[c] = 0;
+  if (wf == 0) {
+    ps->grp[g].neg[c] = 0x200;
+  } else if (wf == 1) {
+    ps->grp[g].sil[c] = 0x200;
+  } else if (wf == 3) {
+    ps->grp[g].sil[c] = 0x100;
+  }
+}
+
+/*
+ * Change the key-on state of an operator from one source.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   g - the operator group
+ * 
+ *   c - the channel
+ * 
+ *   src - the key-on source
+ * 
+ *   on - non-zero to key on, zero to key off
+ */
+static void opKey(
+    NATIVE_STATE * ps,
+    int32_t        g,
+    int32_t        c,
+    int32_t        src,
+    int            on) {
+  
+  uint8_t old = 0;
+  
+  old = ps->key[g][c];
+  if (on) {
+    ps->key[g][c] = (uint8_t) (old | src);
+  } else {
+    ps->key[g][c] = (uint8_t) (old & ~src);
+  }
+  
+  if ((!old) && ps->key[g][c]) {
+    /* Key on restarts the phase and the envelope */
+    ps->stage[g][c] = ENV_ATTACK;
+    ps->grp[g].phase[c] = 0;
+    if (ps->rate[g][c][ENV_ATTACK] >= 60) {
+      ps->env[g][c] = 0;
+    }
+  
+  } else if (old && (!(ps->key[g][c]))) {
+    ps->stage[g][c] = ENV_RELEASE;
+  }
+}
+
+/*
+ * Compute the connection and feedback of a channel.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   c - the channel
+ */
+static void chUpdateConn(NATIVE_STATE *ps, int32_t c) {
+  int32_t fb = 0;
+  
+  fb = (ps->regs[0xc0 + c] >> 1) & 0x07;
+  ps->fb_shift[c] = 0;
+  if (fb > 0) {
+    ps->fb_shift[c] = 9 - fb;
+  }
+  
+  /* The carrier is only modulated in FM connection */
+  ps->grp[1].mmask[c] = (ps->regs[0xc0 + c] & 0x01) ? 0 : -1;
+}
+
+/*
+ * Update the flag that tells whether anything is keyed on.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ */
+static void updateKeyed(NATIVE_STATE *ps) {
+  int32_t c = 0;
+  
+  ps->keyed = 0;
+  for(c = 0; c < CHANNELS; c++) {
+    if (ps->key[0][c] || ps->key[1][c]) {
+      ps->keyed = 1;
+    }
+  }
+  if (ps->regs[0x08] & 0x80) {
+    ps->keyed = 1;
+  }
+}
+
+/*
+ * Check whether every operator has released all the way to silence.
+ * 
+ * An operator at ENV_MAX still outputs -1 on the negative half of its
+ * waveform, so the output of a chip whose notes have died away is not
+ * exactly zero.  Once nothing is keyed on, though, no operator can
+ * leave ENV_MAX until the next key-on, so the chip makes no more sound
+ * of its own.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ * Return:
+ * 
+ *   non-zero if every operator is at ENV_MAX, zero otherwise
+ */
+static int envSilent(const NATIVE_STATE *ps) {
+  int32_t g = 0;
+  int32_t c = 0;
+  
+  for(g = 0; g < 2; g++) {
+    for(c = 0; c < CHANNELS; c++) {
+      if (ps->env[g][c] < ENV_MAX) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/*
+ * Apply the rhythm instrument key-on bits.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ */
+static void rhythmKeys(NATIVE_STATE *ps) {
+  int32_t val = 0;
+  
+  val = ps->regs[0xbd];
+  if (!(val & 0x20)) {
+    val = 0;
+  }
+  
+  /* Bass drum, hi-hat, snare drum, tom-tom, and top cymbal */
+  opKey(ps, 0, 6, KEY_RHYTHM, val & 0x10);
+  opKey(ps, 1, 6, KEY_RHYTHM, val & 0x10);
+  opKey(ps, 0, 7, KEY_RHYTHM, val & 0x01);
+  opKey(ps, 1, 7, KEY_RHYTHM, val & 0x08);
+  opKey(ps, 0, 8, KEY_RHYTHM, val & 0x04);
+  opKey(ps, 1, 8, KEY_RHYTHM, val & 0x02);
+}
+
+/*
+ * Write a register.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   reg - the register index
+ * 
+ *   val - the value
+ */
+static void writeReg(NATIVE_STATE *ps, int32_t reg, int32_t val) {
+  int32_t offs = 0;
+  int32_t g = 0;
+  int32_t c = 0;
+  
+  /* Ignore registers that do not exist */
+  if ((reg < 0) || (reg >= REG_COUNT)) {
+    return;
+  }
+  ps->regs[reg] = (uint8_t) val;
+  
+  /* Operator registers */
+  if (((reg >= 0x20) && (reg <= 0x95)) ||
+      ((reg >= 0xe0) && (reg <= 0xf5))) {
+    offs = reg & 0x1f;
+    if (((offs & 0x07) >= 6) || (offs >= 0x16)) {
+      return;
+    }
+    g = (offs & 0x07) / 3;
+    c = ((offs >> 3) * 3) + ((offs & 0x07) % 3);
+    
+    if (reg >= 0xe0) {
+      opUpdateWave(ps, g, c);
+    } else {
+      if (reg < 0x40) {
+        opUpdateInc(ps, g, c);
+      }
+      opUpdateEnv(ps, g, c);
+    }
+    return;
+  }
+  
+  /* Channel registers */
+  if (((reg >= 0xa0) && (reg <= 0xa8)) ||
+      ((reg >= 0xb0) && (reg <= 0xb8))) {
+    c = reg & 0x0f;
+    for(g = 0; g < 2; g++) {
+      opUpdateInc(ps, g, c);
+      opUpdateEnv(ps, g, c);
+    }
+    if (reg >= 0xb0) {
+      opKey(ps, 0, c, KEY_CHANNEL, val & 0x20);
+      opKey(ps, 1, c, KEY_CHANNEL, val & 0x20);
+      updateKeyed(ps);
+    }
+    return;
+  }
+  if ((reg >= 0xc0) && (reg <= 0xc8)) {
+    chUpdateConn(ps, reg - 0xc0);
+    return;
+  }
+  
+  /* Global registers */
+  if (reg == 0x01) {
+    for(c = 0; c < CHANNELS; c++) {
+      opUpdateWave(ps, 0, c);
+      opUpdateWave(ps, 1, c);
+    }
+  
+  } else if (reg == 0x08) {
+    for(c = 0; c < CHANNELS; c++) {
+      opUpdateEnv(ps, 0, c);
+      opUpdateEnv(ps, 1, c);
+    }
+    updateKeyed(ps);
+  
+  } else if (reg == 0xbd) {
+    for(c = 0; c < CHANNELS; c++) {
+      opUpdateInc(ps, 0, c);
+      opUpdateInc(ps, 1, c);
+    }
+    rhythmKeys(ps);
+    updateKeyed(ps);
+  }
+}
+
+/*
+ * Reset the chip state to that of a chip that has just been powered
+ * on.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   sample_rate - the sample rate of the context
+ * 
+ *   div - the number of chip clock cycles per emulated sample
+ */
+static void resetState(
+    NATIVE_STATE * ps,
+    int32_t        sample_rate,
+    int32_t        div) {
+  
+  int32_t g = 0;
+  int32_t c = 0;
+  
+  memset(ps, 0, sizeof(NATIVE_STATE));
+  
+  /* Every lane starts silent, including the padding lanes */
+  for(g = 0; g < 2; g++) {
+    for(c = 0; c < LANES; c++) {
+      ps->env[g][c] = ENV_MAX;
+      ps->stage[g][c] = ENV_RELEASE;
+      ps->grp[g].eg[c] = ENV_MAX;
+      ps->grp[g].mmask[c] = -1;
+    }
+  }
+  for(c = 0; c < CHANNELS; c++) {
+    for(g = 0; g < 2; g++) {
+      opUpdateInc(ps, g, c);
+      opUpdateEnv(ps, g, c);
+      opUpdateWave(ps, g, c);
+    }
+    chUpdateConn(ps, c);
+  }
+  
+  ps->noise = 1;
+  ps->sample_rate = sample_rate;
+  ps->den = (uint32_t) (div * sample_rate);
+}
+
+/*
+ * Compute the envelope increment of a rate at the current time.
+ * 
+ * Parameters:
+ * 
+ *   r - the effective rate in range [1, 63]
+ * 
+ *   timer - the sample counter
+ * 
+ * Return:
+ * 
+ *   the increment, which may be zero
+ */
+static int32_t envInc(int32_t r, uint32_t timer) {
+  int32_t hi = 0;
+  int32_t shift = 0;
+  
+  hi = r >> 2;
+  if (hi < 12) {
+    shift = 12 - hi;
+    if (timer & ((UINT32_C(1) << shift) - 1)) {
+      return 0;
+    }
+    return env_slow[r & 0x03][(timer >> shift) & 0x07];
+  
+  } else if (hi < 15) {
+    return ((int32_t) env_fast[r & 0x03][timer & 0x07]) << (hi - 12);
+  }
+  return 8;
+}
+
+/*
+ * Advance the envelope generators and compute the total attenuations.
+ * 
+ * The envelopes normally advance by one sample.  The preview variant
+ * advances them by two samples at once, the one before the sample
+ * counter and the one at it, and only moves them to the next stage
+ * once, which is cheaper than two separate steps.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   ticks - the number of samples to advance, either 1 or 2
+ */
+static void stepEnv(NATIVE_STATE *ps, int32_t ticks) {
+  int32_t g = 0;
+  int32_t c = 0;
+  int32_t t = 0;
+  int32_t env = 0;
+  int32_t r = 0;
+  int32_t inc = 0;
+  
+  for(g = 0; g < 2; g++) {
+    for(c = 0; c < CHANNELS; c++) {
+      env = ps->env[g][c];
+      
+      /* Released envelopes stay silent */
+      if ((env >= ENV_MAX) && (ps->stage[g][c] == ENV_RELEASE)) {
+        ps->grp[g].eg[c] = ENV_MAX;
+        continue;
+      }
+      
+      /* Move to the next stage when the current one is done */
+      if ((ps->stage[g][c] == ENV_ATTACK) && (env <= 0)) {
+        ps->stage[g][c] = ENV_DECAY;
+      }
+      if ((ps->stage[g][c] == ENV_DECAY) &&
+          (env >= ps->sl_level[g][c])) {
+        ps->stage[g][c] = ENV_SUSTAIN;
+      }
+      
+      /* Step the envelope, with the attack approaching zero
+       * exponentially */
+      r = ps->rate[g][c][ps->stage[g][c]];
+      for(t = ticks - 1; (r > 0) && (t >= 0); t--) {
+        inc = envInc(r, ps->timer - ((uint32_t) t));
+        if (inc > 0) {
+          if (ps->stage[g][c] == ENV_ATTACK) {
+            env -= (((env + 1) * inc) + 7) >> 3;
+            if (env < 0) {
+              env = 0;
+            }
+          } else {
+            env += inc;
+            if (env > ENV_MAX) {
+              env = ENV_MAX;
+            }
+          }
+          ps->env[g][c] = env;
+        }
+      }
+      
+      /* Add the total level, key scaling, and tremolo */
+      env += ps->eg_base[g][c];
+      if (ps->am[g][c]) {
+        env += ps->trem;
+      }
+      if (env > ENV_MAX) {
+        env = ENV_MAX;
+      }
+      ps->grp[g].eg[c] = env;
+    }
+  }
+}
+
+/*
+ * Advance the low-frequency oscillators by one sample.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ */
+static void stepLfo(NATIVE_STATE *ps) {
+  int32_t tri = 0;
+  int32_t c = 0;
+  
+  /* Tremolo is a triangle with 210 steps, at 4.8 dB or 1 dB depth */
+  if ((ps->timer & 0x3f) == 0) {
+    ps->am_pos = (ps->am_pos + 1) % 210;
+  }
+  tri = ps->am_pos;
+  if (tri >= 105) {
+    tri = 210 - tri;
+  }
+  ps->trem = tri >> 2;
+  if (!(ps->regs[0xbd] & 0x80)) {
+    ps->trem >>= 2;
+  }
+  
+  /* Vibrato steps every 1024 samples */
+  if ((ps->timer & 0x3ff) == 0) {
+    ps->vib_pos = (ps->vib_pos + 1) & 0x07;
+    for(c = 0; c < CHANNELS; c++) {
+      if (ps->regs[0x20 + op_base[c]] & 0x40) {
+        opUpdateInc(ps, 0, c);
+      }
+      if (ps->regs[0x23 + op_base[c]] & 0x40) {
+        opUpdateInc(ps, 1, c);
+      }
+    }
+  }
+}
+
+/*
+ * Compute the rhythm instruments that replace the operators of
+ * channels 7 and 8 in rhythm mode.
+ * 
+ * The hi-hat, snare drum, and top cymbal get their phases from a mix of
+ * bits of the hi-hat and top cymbal phase generators and the noise
+ * generator.  The tom-tom is an unmodulated operator.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ * 
+ *   p_hh - the phase of the hi-hat phase generator for this sample
+ * 
+ *   p_tom - the phase of the tom-tom phase generator for this sample
+ * 
+ *   p_tc - the phase of the top cymbal phase generator for this sample
+ */
+static void stepRhythm(
+    NATIVE_STATE * ps,
+    uint32_t       p_hh,
+    uint32_t       p_tom,
+    uint32_t       p_tc) {
+  
+  uint32_t x = 0;
+  uint32_t nb = 0;
+  uint32_t b8 = 0;
+  uint32_t ph = 0;
+  OP_GROUP *pm = NULL;
+  OP_GROUP *pc = NULL;
+  
+  pm = &(ps->grp[0]);
+  pc = &(ps->grp[1]);
+  
+  x = (((p_hh >> 2) ^ (p_hh >> 7)) | ((p_hh >> 3) ^ (p_tc >> 5)) |
+        ((p_tc >> 3) ^ (p_tc >> 5))) & 0x01;
+  nb = ps->noise & 0x01;
+  b8 = (p_hh >> 8) & 0x01;
+  
+  /* Hi-hat */
+  ph = (x << 9) | ((x ^ nb) ? 0xd0 : 0x34);
+  pm->out[7] = evalOp(ph, pm->eg[7], pm->sil[7], pm->neg[7]);
+  
+  /* Snare drum */
+  ph = (b8 << 9) | ((b8 ^ nb) << 8);
+  pc->out[7] = evalOp(ph, pc->eg[7], pc->sil[7], pc->neg[7]);
+  
+  /* Tom-tom */
+  pm->out[8] = evalOp(p_tom, pm->eg[8], pm->sil[8], pm->neg[8]);
+  
+  /* Top cymbal */
+  ph = (x << 9) | 0x80;
+  pc->out[8] = evalOp(ph, pc->eg[8], pc->sil[8], pc->neg[8]);
+}
+
+/*
+ * Advance the noise generator and the sample counter by one sample.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ */
+static void stepTimer(NATIVE_STATE *ps) {
+  if (((ps->noise >> 14) ^ ps->noise) & 0x01) {
+    ps->noise = (ps->noise >> 1) | (UINT32_C(1) << 22);
+  } else {
+    ps->noise >>= 1;
+  }
+  (ps->timer)++;
+}
+
+/*
+ * Advance the chip by one sample without evaluating the operators or
+ * stepping the envelopes.
+ * 
+ * The preview variant calls this before every emulated sample, which
+ * then steps the envelopes over both samples, so that everything
+ * besides the operators keeps the timing of the full chip rate.
+ * 
+ * Parameters:
+ * 
+ *   ps - the chip state
+ */
+static void skipStep(NATIVE_STATE *ps) {
+  int32_t g = 0;
+  int32_t c = 0;
+  
+  stepLfo(ps);
+  for(g = 0; g < 2; g++) {
+    for(c = 0; c < CHANNELS; c++) {
+      ps->grp[g].phase[c] += ps->grp[g].inc[c];
+    }
+  }
+  stepTimer(ps);
+}
+
+/*
+ * Emulate one sample of the chip, or two samples in the preview
+ * variant, of which only the second has its operators evaluated.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context
+ * 
+ * Return:
+ * 
+ *   the output sample
+ */
+static int32_t chipStep(NATIVE_CTX *pc) {
+  
+  NATIVE_STATE *ps = NULL;
+  OP_GROUP *pm = NULL;
+  OP_GROUP *pk = NULL;
+  uint32_t p_hh = 0;
+  uint32_t p_tom = 0;
+  uint32_t p_tc = 0;
+  int rhythm = 0;
+  int32_t sum = 0;
+  int32_t c = 0;
+  
+  ps = &(pc->st);
+  pm = &(ps->grp[0]);
+  pk = &(ps->grp[1]);
+  rhythm = ((ps->regs[0xbd] & 0x20) != 0);
+  
+  if (pc->div != CHIP_DIV) {
+    skipStep(ps);
+    stepLfo(ps);
+    stepEnv(ps, 2);
+  } else {
+    stepLfo(ps);
+    stepEnv(ps, 1);
+  }
+  
+  /* Feedback modulates each modulator with its last two outputs */
+  for(c = 0; c < CHANNELS; c++) {
+    pm->mod[c] = 0;
+    if (ps->fb_shift[c] > 0) {
+      pm->mod[c] = (ps->prev[c] + pm->out[c]) >> ps->fb_shift[c];
+    }
+    ps->prev[c] = pm->out[c];
+  }
+  
+  /* The rhythm instruments need their phases before the kernels move
+   * them on */
+  if (rhythm) {
+    p_hh = (pm->phase[7] >> 9) & 0x3ff;
+    p_tom = (pm->phase[8] >> 9) & 0x3ff;
+    p_tc = (pk->phase[8] >> 9) & 0x3ff;
+  }
+  
+  /* Evaluate the modulators, and then the carriers with the modulator
+   * outputs */
+  pc->kern(pm);
+  for(c = 0; c < CHANNELS; c++) {
+    pk->mod[c] = pm->out[c];
+  }
+  pc->kern(pk);
+  
+  /* Mix the channels, with the rhythm instruments at double level */
+  if (rhythm) {
+    stepRhythm(ps, p_hh, p_tom, p_tc);
+    for(c = 0; c < 6; c++) {
+      sum += pk->out[c];
+      if (!(pk->mmask[c])) {
+        sum += pm->out[c];
+      }
+    }
+    sum += pk->out[6] * 2;
+    sum += (pm->out[7] + pk->out[7]) * 2;
+    sum += (pm->out[8] + pk->out[8]) * 2;
+  
+  } else {
+    for(c = 0; c < CHANNELS; c++) {
+      sum += pk->out[c];
+      if (!(pk->mmask[c])) {
+        sum += pm->out[c];
+      }
+    }
+  }
+  
+  stepTimer(ps);
+  
+  if (sum > 32767) {
+    sum = 32767;
+  } else if (sum < -32768) {
+    sum = -32768;
+  }
+  return sum;
+}
+
+/*
+ * Generate output samples.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context
+ * 
+ *   pbuf - the first sample to write
+ * 
+ *   count - the number of samples
+ * 
+ *   stride - the distance between consecutive samples
+ */
+static void genRun(
+    NATIVE_CTX * pc,
+    int16_t    * pbuf,
+    int32_t      count,
+    int32_t      stride) {
+  
+  NATIVE_STATE *ps = NULL;
+  int32_t v = 0;
+  int32_t i = 0;
+  
+  ps = &(pc->st);
+  for(i = 0; i < count; i++) {
+    /* Skip synthesis while idle */
+    if (pc->idle) {
+      pbuf[i * stride] = 0;
+      continue;
+    }
+    
+    /* Emulate up to the time of the output sample and interpolate */
+    ps->acc += CHIP_CLOCK;
+    while (ps->acc >= ps->den) {
+      ps->acc -= ps->den;
+      ps->s0 = ps->s1;
+      ps->s1 = chipStep(pc);
+    }
+    v = ps->s0 + (int32_t) ((((int64_t) (ps->s1 - ps->s0)) *
+                              ((int64_t) ps->acc)) /
+                              ((int64_t) ps->den));
+    pbuf[i * stride] = (int16_t) v;
+    
+    /* Watch for the chip becoming idle */
+    if (pc->skip && (!(ps->keyed)) && envSilent(ps)) {
+      pc->idle = 1;
+    }
+  }
+}
+
+/*
+ * Write a register in a context and resume synthesis if the write keys
+ * anything on.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context
+ * 
+ *   reg - the register index
+ * 
+ *   val - the value
+ */
+static void ctxPoke(NATIVE_CTX *pc, int32_t reg, int32_t val) {
+  writeReg(&(pc->st), reg, val);
+  if (pc->st.keyed) {
+    pc->idle = 0;
+  }
+}
+
+/*
+ * Check that a snapshot holds a state the emulator can be in.
+ * 
+ * Every field that is used as a table index, a shift, or a divisor
+ * must be in its range, and the outputs must be in the range of the
+ * samples, so that a damaged snapshot can not make the emulator read
+ * outside its tables or overflow.  The other fields may hold any
+ * value.
+ * 
+ * Parameters:
+ * 
+ *   ps - the snapshot
+ * 
+ *   sample_rate - the sample rate of the context that restores it
+ * 
+ *   div - the number of chip clock cycles per emulated sample of the
+ *   context that restores it
+ * 
+ * Return:
+ * 
+ *   non-zero if the snapshot is valid, zero if not
+ */
+static int checkState(
+    const NATIVE_STATE * ps,
+          int32_t        sample_rate,
+          int32_t        div) {
+  
+  int32_t g = 0;
+  int32_t c = 0;
+  int32_t i = 0;
+  
+  /* Timing and interpolation */
+  if ((ps->sample_rate != sample_rate) ||
+      (ps->den != (uint32_t) (div * sample_rate)) ||
+      (ps->acc >= ps->den) ||
+      (ps->s0 < -32768) || (ps->s0 > 32767) ||
+      (ps->s1 < -32768) || (ps->s1 > 32767)) {
+    return 0;
+  }
+  
+  /* Low-frequency oscillators */
+  if ((ps->am_pos < 0) || (ps->am_pos >= 210) ||
+      (ps->trem < 0) || (ps->trem > 26) ||
+      (ps->vib_pos < 0) || (ps->vib_pos > 7)) {
+    return 0;
+  }
+  
+  /* Operators, including the padding lanes, which the kernels also
+   * evaluate */
+  for(g = 0; g < 2; g++) {
+    for(c = 0; c < LANES; c++) {
+      if ((ps->stage[g][c] > ENV_RELEASE) ||
+          (ps->env[g][c] < 0) || (ps->env[g][c] > ENV_MAX) ||
+          (ps->grp[g].eg[c] < 0) || (ps->grp[g].eg[c] > ENV_MAX) ||
+          (ps->sl_level[g][c] < 0) || (ps->sl_level[g][c] > ENV_MAX) ||
+          (ps->eg_base[g][c] < 0) || (ps->eg_base[g][c] > ENV_MAX) ||
+          (ps->grp[g].out[c] < -32768) || (ps->grp[g].out[c] > 32767)) {
+        return 0;
+      }
+      for(i = 0; i < 4; i++) {
+        if (ps->rate[g][c][i] > 63) {
+          return 0;
+        }
+      }
+    }
+  }
+  
+  /* Feedback of each channel */
+  for(c = 0; c < LANES; c++) {
+    if ((ps->prev[c] < -32768) || (ps->prev[c] > 32767)) {
+      return 0;
+    }
+    if ((ps->fb_shift[c] != 0) &&
+        ((ps->fb_shift[c] < 2) || (ps->fb_shift[c] > 8))) {
+      return 0;
+    }
+  }
+  
+  return 1;
+}
+
+/*
+ * Create a context with a given kernel.
+ * 
+ * Parameters:
+ * 
+ *   sample_rate - the sample rate, either 44100 or 48000
+ * 
+ *   kern - the kernel
+ * 
+ *   div - the number of chip clock cycles per emulated sample, either
+ *   CHIP_DIV or PREVIEW_DIV
+ * 
+ * Return:
+ * 
+ *   the new context, or NULL if memory allocation failed
+ */
+static void *newContext(
+    int32_t     sample_rate,
+    KERNEL_FUNC kern,
+    int32_t     div) {
+  
+  NATIVE_CTX *pc = NULL;
+  
+  /* Check parameter */
+  if ((sample_rate != 44100) && (sample_rate != 48000)) {
+    abort();
+  }
+  
+  pc = (NATIVE_CTX *) malloc(sizeof(NATIVE_CTX));
+  if (pc == NULL) {
+    return NULL;
+  }
+  
+  resetState(&(pc->st), sample_rate, div);
+  pc->kern = kern;
+  pc->div = div;
+  pc->skip = 0;
+  pc->idle = 0;
+  
+  return pc;
+}
+
+/*
+ * Core functions
+ * ==============
+ * 
+ * See the opl_ctx functions in opl_driver.h for specifications.
+ */
+
+/*
+ * ctxRate function.
+ */
+static int32_t ctxRate(int32_t sample_rate) {
+  /* Check parameter */
+  if (sample_rate < 1) {
+    abort();
+  }
+  
+  if ((sample_rate % 11025) == 0) {
+    return 44100;
+  }
+  return 48000;
+}
+
+/*
+ * ctxNew function.
+ */
+static void *ctxNew(int32_t sample_rate) {
+  return newContext(sample_rate, pickKernel(), CHIP_DIV);
+}
+
+/*
+ * ctxNewScalar function, which creates a context of the scalar
+ * variant.
+ */
+static void *ctxNewScalar(int32_t sample_rate) {
+  return newContext(sample_rate, &kernScalar, CHIP_DIV);
+}
+
+/*
+ * ctxNewPreview function, which creates a context of the preview
+ * variant.
+ */
+static void *ctxNewPreview(int32_t sample_rate) {
+  return newContext(sample_rate, pickKernel(), PREVIEW_DIV);
+}
+
+/*
+ * ctxFree function.
+ */
+static void ctxFree(void *pCtx) {
+  if (pCtx != NULL) {
+    free(pCtx);
+  }
+}
+
+/*
+ * ctxReset function.
+ */
+static void ctxReset(void *pCtx, int32_t sample_rate) {
+  NATIVE_CTX *pc = (NATIVE_CTX *) pCtx;
+  
+  /* Check parameters */
+  if ((pc == NULL) ||
+      ((sample_rate != 44100) && (sample_rate != 48000))) {
+    abort();
+  }
+  
+  resetState(&(pc->st), sample_rate, pc->div);
+  pc->idle = 0;
+}
+
+/*
+ * ctxWrite function.
+ */
+static void ctxWrite(void *pCtx, int32_t reg, int32_t val) {
+  NATIVE_CTX *pc = (NATIVE_CTX *) pCtx;
+  
+  /* Check parameter */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  ctxPoke(pc, reg, val);
+}
+
+/*
+ * ctxWriteBulk function.
+ */
+static void ctxWriteBulk(
+          void        * pCtx,
+    const uint8_t     * pPairs,
+          int32_t       count) {
+  
+  NATIVE_CTX *pc = (NATIVE_CTX *) pCtx;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (count < 0) ||
+      ((pPairs == NULL) && (count > 0))) {
+    abort();
+  }
+  
+  for(i = 0; i < count; i++) {
+    ctxPoke(pc, (int32_t) pPairs[0], (int32_t) pPairs[1]);
+    pPairs += 2;
+  }
+}
+
+/*
+ * ctxGenerate function.
+ */
+static void ctxGenerate(void *pCtx, int16_t *pbuf, int32_t count) {
+  /* Check parameters */
+  if ((pCtx == NULL) || (pbuf == NULL) || (count < 1)) {
+    abort();
+  }
+  
+  genRun((NATIVE_CTX *) pCtx, pbuf, count, 1);
+}
+
+/*
+ * ctxGenerateStride function.
+ */
+static void ctxGenerateStride(
+    void        * pCtx,
+    int16_t     * pbuf,
+    int32_t       count,
+    int32_t       stride) {
+  
+  /* Check parameters */
+  if ((pCtx == NULL) || (pbuf == NULL) || (count < 1) || (stride < 1)) {
+    abort();
+  }
+  
+  genRun((NATIVE_CTX *) pCtx, pbuf, count, stride);
+}
+
+/*
+ * ctxGenerateEvents function.
+ */
+static void ctxGenerateEvents(
+          void        * pCtx,
+          int16_t     * pbuf,
+          int32_t       count,
+          int32_t       stride,
+    const OPL_EVENT   * pEv,
+          int32_t       ev_count) {
+  
+  NATIVE_CTX *pc = (NATIVE_CTX *) pCtx;
+  int32_t pos = 0;
+  int32_t next = 0;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pbuf == NULL) || (count < 1) || (stride < 1) ||
+      (ev_count < 0) || ((pEv == NULL) && (ev_count > 0))) {
+    abort();
+  }
+  for(i = 0; i < ev_count; i++) {
+    if ((pEv[i].offs < 0) || (pEv[i].offs >= count)) {
+      abort();
+    }
+    if (i > 0) {
+      if (pEv[i].offs < pEv[i - 1].offs) {
+        abort();
+      }
+    }
+  }
+  
+  /* Apply the writes at each offset and then generate the samples up
+   * to the next offset that has writes */
+  i = 0;
+  for(pos = 0; pos < count; pos = next) {
+    for( ; i < ev_count; i++) {
+      if (pEv[i].offs > pos) {
+        break;
+      }
+      ctxPoke(pc, (int32_t) pEv[i].reg, (int32_t) pEv[i].val);
+    }
+    
+    next = count;
+    if (i < ev_count) {
+      next = pEv[i].offs;
+    }
+    
+    genRun(pc, pbuf + (((size_t) pos) * stride), next - pos, stride);
+  }
+}
+
+/*
+ * ctxSetSkip function.
+ */
+static void ctxSetSkip(void *pCtx, int enable) {
+  NATIVE_CTX *pc = (NATIVE_CTX *) pCtx;
+  
+  /* Check parameter */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  pc->skip = (enable != 0);
+  if (!(pc->skip)) {
+    pc->idle = 0;
+  }
+}
+
+/*
+ * ctxIdle function.
+ */
+static int ctxIdle(const void *pCtx) {
+  const NATIVE_CTX *pc = (const NATIVE_CTX *) pCtx;
+  
+  /* Check parameter */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  return pc->idle;
+}
+
+/*
+ * ctxSave function.
+ */
+static void ctxSave(const void *pCtx, uint8_t *pState) {
+  const NATIVE_CTX *pc = (const NATIVE_CTX *) pCtx;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pState == NULL)) {
+    abort();
+  }
+  
+  memcpy(pState, &(pc->st), sizeof(NATIVE_STATE));
+}
+
+/*
+ * ctxRestore function.
+ */
+static int ctxRestore(void *pCtx, const uint8_t *pState) {
+  NATIVE_CTX *pc = (NATIVE_CTX *) pCtx;
+  NATIVE_STATE st;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pState == NULL)) {
+    abort();
+  }
+  
+  /* Copy the snapshot out of the possibly unaligned buffer and check it
+   * before it replaces the state */
+  memcpy(&st, pState, sizeof(NATIVE_STATE));
+  if (!checkState(&st, pc->st.sample_rate, pc->div)) {
+    return 0;
+  }
+  
+  pc->st = st;
+  pc->idle = 0;
+  return 1;
+}
+
+/*
+ * Core definitions
+ * ================
+ */
+
+/*
+ * The native core, declared in opl_core.h.
+ */
+const OPL_CORE opl_core_native = {
+  "native",
+  CORE_NAME,
+  CTX_LIMIT,
+  (int32_t) sizeof(NATIVE_STATE),
+  1,
+  &ctxRate,
+  &ctxNew,
+  &ctxFree,
+  &ctxReset,
+  &ctxWrite,
+  &ctxWriteBulk,
+  &ctxGenerate,
+  &ctxGenerateStride,
+  &ctxGenerateEvents,
+  &ctxSetSkip,
+  &ctxIdle,
+  &ctxSave,
+  &ctxRestore
+};
+
+/*
+ * The scalar variant of the native core, declared in opl_core.h.
+ */
+const OPL_CORE opl_core_native_scalar = {
+  "native-scalar",
+  SCALAR_NAME,
+  CTX_LIMIT,
+  (int32_t) sizeof(NATIVE_STATE),
+  1,
+  &ctxRate,
+  &ctxNewScalar,
+  &ctxFree,
+  &ctxReset,
+  &ctxWrite,
+  &ctxWriteBulk,
+  &ctxGenerate,
+  &ctxGenerateStride,
+  &ctxGenerateEvents,
+  &ctxSetSkip,
+  &ctxIdle,
+  &ctxSave,
+  &ctxRestore
+};
+
+/*
+ * The preview variant of the native core, declared in opl_core.h.
+ */
+const OPL_CORE opl_core_native_preview = {
+  "native-preview",
+  PREVIEW_NAME,
+  CTX_LIMIT,
+  (int32_t) sizeof(NATIVE_STATE),
+  1,
+  &ctxRate,
+  &ctxNewPreview,
+  &ctxFree,
+  &ctxReset,
+  &ctxWrite,
+  &ctxWriteBulk,
+  &ctxGenerate,
+  &ctxGenerateStride,
+  &ctxGenerateEvents,
+  &ctxSetSkip,
+  &ctxIdle,
+  &ctxSave,
+  &ctxRestore
+};
@@ -0,0 +1,367 @@
+/*
+ * opl_core_null.c
+ * ===============
+ * 
+ * Emulator core backend for opl_core.h that generates silence.
+ * 
+ * The null core keeps track of the register values, but it never runs
+ * any synthesis, so every sample it generates is zero.  This is useful
+ * for benchmarking, since comparing a render with the null core to the
+ * same render with a real core shows how much of the time is spent in
+ * the emulator and how much in the rest of the pipeline.
+ * 
+ * The null core has no global state, so any number of contexts can be
+ * used from separate threads.  State snapshots hold the register
+ * values, which is the complete state of the core, so snapshots are
+ * exact.
+ * 
+ * The null core chooses the same emulation rates as the DOSBox core,
+ * so that the resampling work is the same with both cores.
+ */
+
+#include "opl_core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The name of this core, returned by opl_ctx_name().
+ * 
+ * Increase the revision each time a change here may change the
+ * generated samples.
+ */
+#define CORE_NAME "null-1"
+
+/*
+ * The maximum number of contexts.  There is no real limit, but the
+ * clients size their worker pools by it, so it should stay reasonable.
+ */
+#define CTX_LIMIT (1024)
+
+/*
+ * The number of OPL2 register indices, which is also the size of a
+ * state snapshot.
+ */
+#define REG_COUNT (256)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * The state of an emulator context.
+ */
+typedef struct {
+  
+  /*
+   * The sample rate the context was initialized with.
+   */
+  int32_t sample_rate;
+  
+  /*
+   * Flag set if silence skipping is enabled.  Since the output is
+   * always silent, the chip is idle whenever skipping is enabled.
+   */
+  int skip;
+  
+  /*
+   * The value last written to each register.
+   */
+  uint8_t regs[REG_COUNT];
+
+} NULL_CTX;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Fill samples in a buffer with silence.
+ * 
+ * Parameters:
+ * 
+ *   pbuf - the first sample to write
+ * 
+ *   count - the number of samples
+ * 
+ *   stride - the distance between consecutive samples
+ */
+static void fillSilence(int16_t *pbuf, int32_t count, int32_t stride) {
+  int32_t i = 0;
+  
+  if (stride == 1) {
+    memset(pbuf, 0, ((size_t) count) * sizeof(int16_t));
+  } else {
+    for(i = 0; i < count; i++) {
+      pbuf[i * stride] = 0;
+    }
+  }
+}
+
+/*
+ * Core functions
+ * ==============
+ * 
+ * See the opl_ctx functions in opl_driver.h for specifications.
+ */
+
+/*
+ * ctxRate function.
+ */
+static int32_t ctxRate(int32_t sample_rate) {
+  /* Check parameter */
+  if (sample_rate < 1) {
+    abort();
+  }
+  
+  if ((sample_rate % 11025) == 0) {
+    return 44100;
+  }
+  return 48000;
+}
+
+/*
+ * ctxNew function.
+ */
+static void *ctxNew(int32_t sample_rate) {
+  NULL_CTX *pc = NULL;
+  
+  /* Check parameter */
+  if ((sample_rate != 44100) && (sample_rate != 48000)) {
+    abort();
+  }
+  
+  /* Allocate a context with all registers cleared */
+  pc = (NULL_CTX *) calloc(1, sizeof(NULL_CTX));
+  if (pc == NULL) {
+    return NULL;
+  }
+  pc->sample_rate = sample_rate;
+  
+  return pc;
+}
+
+/*
+ * ctxFree function.
+ */
+static void ctxFree(void *pCtx) {
+  if (pCtx != NULL) {
+    free(pCtx);
+  }
+}
+
+/*
+ * ctxReset function.
+ */
+static void ctxReset(void *pCtx, int32_t sample_rate) {
+  NULL_CTX *pc = (NULL_CTX *) pCtx;
+  
+  /* Check parameters */
+  if ((pc == NULL) ||
+      ((sample_rate != 44100) && (sample_rate != 48000))) {
+    abort();
+  }
+  
+  pc->sample_rate = sample_rate;
+  memset(pc->regs, 0, REG_COUNT);
+}
+
+/*
+ * ctxWrite function.
+ */
+static void ctxWrite(void *pCtx, int32_t reg, int32_t val) {
+  NULL_CTX *pc = (NULL_CTX *) pCtx;
+  
+  /* Check parameter */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  if ((reg >= 0) && (reg < REG_COUNT)) {
+    pc->regs[reg] = (uint8_t) val;
+  }
+}
+
+/*
+ * ctxWriteBulk function.
+ */
+static void ctxWriteBulk(
+          void        * pCtx,
+    const uint8_t     * pPairs,
+          int32_t       count) {
+  
+  NULL_CTX *pc = (NULL_CTX *) pCtx;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (count < 0) ||
+      ((pPairs == NULL) && (count > 0))) {
+    abort();
+  }
+  
+  for(i = 0; i < count; i++) {
+    pc->regs[pPairs[0]] = pPairs[1];
+    pPairs += 2;
+  }
+}
+
+/*
+ * ctxGenerate function.
+ */
+static void ctxGenerate(void *pCtx, int16_t *pbuf, int32_t count) {
+  /* Check parameters */
+  if ((pCtx == NULL) || (pbuf == NULL) || (count < 1)) {
+    abort();
+  }
+  
+  fillSilence(pbuf, count, 1);
+}
+
+/*
+ * ctxGenerateStride function.
+ */
+static void ctxGenerateStride(
+    void        * pCtx,
+    int16_t     * pbuf,
+    int32_t       count,
+    int32_t       stride) {
+  
+  /* Check parameters */
+  if ((pCtx == NULL) || (pbuf == NULL) || (count < 1) || (stride < 1)) {
+    abort();
+  }
+  
+  fillSilence(pbuf, count, stride);
+}
+
+/*
+ * ctxGenerateEvents function.
+ */
+static void ctxGenerateEvents(
+          void        * pCtx,
+          int16_t     * pbuf,
+          int32_t       count,
+          int32_t       stride,
+    const OPL_EVENT   * pEv,
+          int32_t       ev_count) {
+  
+  NULL_CTX *pc = (NULL_CTX *) pCtx;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pbuf == NULL) || (count < 1) || (stride < 1) ||
+      (ev_count < 0) || ((pEv == NULL) && (ev_count > 0))) {
+    abort();
+  }
+  for(i = 0; i < ev_count; i++) {
+    if ((pEv[i].offs < 0) || (pEv[i].offs >= count)) {
+      abort();
+    }
+    if (i > 0) {
+      if (pEv[i].offs < pEv[i - 1].offs) {
+        abort();
+      }
+    }
+  }
+  
+  /* The writes only change the registers, and the output is silent
+   * regardless */
+  for(i = 0; i < ev_count; i++) {
+    pc->regs[pEv[i].reg] = pEv[i].val;
+  }
+  fillSilence(pbuf, count, stride);
+}
+
+/*
+ * ctxSetSkip function.
+ */
+static void ctxSetSkip(void *pCtx, int enable) {
+  NULL_CTX *pc = (NULL_CTX *) pCtx;
+  
+  /* Check parameter */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  pc->skip = (enable != 0);
+}
+
+/*
+ * ctxIdle function.
+ */
+static int ctxIdle(const void *pCtx) {
+  const NULL_CTX *pc = (const NULL_CTX *) pCtx;
+  
+  /* Check parameter */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  return pc->skip;
+}
+
+/*
+ * ctxSave function.
+ */
+static void ctxSave(const void *pCtx, uint8_t *pState) {
+  const NULL_CTX *pc = (const NULL_CTX *) pCtx;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pState == NULL)) {
+    abort();
+  }
+  
+  memcpy(pState, pc->regs, REG_COUNT);
+}
+
+/*
+ * ctxRestore function.
+ */
+static int ctxRestore(void *pCtx, const uint8_t *pState) {
+  NULL_CTX *pc = (NULL_CTX *) pCtx;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (pState == NULL)) {
+    abort();
+  }
+  
+  /* Any register values are valid */
+  memcpy(pc->regs, pState, REG_COUNT);
+  return 1;
+}
+
+/*
+ * Core definition
+ * ===============
+ */
+
+/*
+ * The null core, declared in opl_core.h.
+ */
+const OPL_CORE opl_core_null = {
+  "null",
+  CORE_NAME,
+  CTX_LIMIT,
+  REG_COUNT,
+  1,
+  &ctxRate,
+  &ctxNew,
+  &ctxFree,
+  &ctxReset,
+  &ctxWrite,
+  &ctxWriteBulk,
+  &ctxGenerate,
+  &ctxGenerateStride,
+  &ctxGenerateEvents,
+  &ctxSetSkip,
+  &ctxIdle,
+  &ctxSave,
+  &ctxRestore
+};
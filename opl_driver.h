@@ -7,18 +7,436 @@
  * 
  * Unified header for all OPL emulation drivers.
  * 
- * Each OPL emulation driver has a different C source file
- * implementation of this header.
+ * This header is implemented by the core registry in opl_registry.c,
+ * which dispatches to one of several emulator core backends that are
+ * all compiled into the program.  The cores are listed with
+ * opl_core_count() and opl_core_key(), and one of them is chosen at
+ * runtime with opl_core_select().  The first core is selected by
+ * default.  The functions that describe the driver, such as
+ * opl_ctx_name() and opl_ctx_limit(), describe the selected core.
+ * 
+ * The main interface is handle-based.  Each OPL_CONTEXT is a separate
+ * emulated OPL chip with its own register and synthesis state.
+ * Separate contexts may be used concurrently from separate threads,
+ * but a single context must only be used from one thread at a time.
+ * Creating and freeing contexts is not thread-safe, so the client must
+ * make sure that opl_ctx_new() and opl_ctx_free() are never called at
+ * the same time from different threads.
+ * 
+ * Some emulator cores keep their state in global variables, and such
+ * drivers can only support a limited number of contexts at the same
+ * time.  Use opl_ctx_limit() to check how many contexts the driver
+ * supports.
+ * 
+ * Contexts can optionally skip synthesis while the emulated chip is
+ * silent, see opl_ctx_set_skip().
+ * 
+ * The state of a context can be saved into a snapshot and restored
+ * later, into the same context or into another one, see opl_ctx_save()
+ * and opl_ctx_restore().
+ * 
+ * Besides single register writes, a whole run of register writes can
+ * be applied with one call to opl_ctx_write_bulk(), and a block of
+ * samples with register writes at sample offsets inside it can be
+ * generated with one call to opl_ctx_generate_events().
+ * 
+ * The older opl_init(), opl_write(), opl_generate() and opl_finish()
+ * functions are still available.  They operate on a default context
+ * that is created by opl_init() and freed by opl_finish().
  */
 
 #include <stddef.h>
 #include <stdint.h>
 
+/*
+ * Structure prototype for an emulator context.
+ * 
+ * The actual structure is defined by the driver implementation.
+ */
+struct OPL_CONTEXT_TAG;
+typedef struct OPL_CONTEXT_TAG OPL_CONTEXT;
+
+/*
+ * A register write at a sample offset within a block of samples, see
+ * opl_ctx_generate_events().
+ */
+typedef struct {
+  
+  /*
+   * The offset of the sample from the start of the block.  The write
+   * takes effect right before this sample is generated.
+   */
+  int32_t offs;
+  
+  /*
+   * The OPL2 register index and the value to write.
+   */
+  uint8_t reg;
+  uint8_t val;
+  
+} OPL_EVENT;
+
+/*
+ * Return the number of emulator cores compiled into the program.
+ * 
+ * Return:
+ * 
+ *   the number of cores, which is always at least one
+ */
+int32_t opl_core_count(void);
+
+/*
+ * Return the short name used to select an emulator core.
+ * 
+ * Parameters:
+ * 
+ *   i - the index of the core, in range [0, opl_core_count() - 1]
+ * 
+ * Return:
+ * 
+ *   the core name, a static string without spaces
+ */
+const char *opl_core_key(int32_t i);
+
+/*
+ * Select the emulator core used by contexts created from now on.
+ * 
+ * This may only be called while no contexts exist, including the
+ * default context created by opl_init().
+ * 
+ * Parameters:
+ * 
+ *   pKey - the short name of the core, as returned by opl_core_key()
+ * 
+ * Return:
+ * 
+ *   non-zero if the core was selected, zero if there is no core with
+ *   that name
+ */
+int opl_core_select(const char *pKey);
+
+/*
+ * Return a short name that identifies the driver.
+ * 
+ * The name includes a revision number that changes whenever a change
+ * to the driver or its emulator core may change the generated samples,
+ * so that clients can tell whether output saved from an earlier run
+ * is still what the driver would generate now.
+ * 
+ * Return:
+ * 
+ *   the driver name, a static string without spaces
+ */
+const char *opl_ctx_name(void);
+
+/*
+ * Return the maximum number of emulator contexts that can exist at the
+ * same time with this driver.
+ * 
+ * The default context used by opl_init() counts towards this limit.
+ * 
+ * Return:
+ * 
+ *   the maximum number of contexts, which is always at least one
+ */
+int32_t opl_ctx_limit(void);
+
+/*
+ * Choose the sample rate to emulate at for a given output sample rate.
+ * 
+ * Drivers only support a few sample rates directly.  If the returned
+ * rate differs from the requested output rate, the client must
+ * resample the generated samples to the output rate.  The returned
+ * rate may always be passed to opl_ctx_new() and opl_ctx_reset().
+ * 
+ * Parameters:
+ * 
+ *   sample_rate - the output sample rate in Hz, greater than zero
+ * 
+ * Return:
+ * 
+ *   the sample rate to emulate at in Hz
+ */
+int32_t opl_ctx_rate(int32_t sample_rate);
+
+/*
+ * Create a new emulator context.
+ * 
+ * The provided sample_rate must either be 44100 or 48000.  The sample
+ * rate is specified in Hz.  The new context starts out in the same
+ * state as OPL hardware that has just been powered on.
+ * 
+ * NULL is returned if the driver has already reached the limit given
+ * by opl_ctx_limit(), or if memory allocation fails.
+ * 
+ * The context must eventually be freed with opl_ctx_free().
+ * 
+ * Parameters:
+ * 
+ *   sample_rate - the sample rate, either 44100 or 48000
+ * 
+ * Return:
+ * 
+ *   the new emulator context, or NULL if no more contexts are available
+ */
+OPL_CONTEXT *opl_ctx_new(int32_t sample_rate);
+
+/*
+ * Free an emulator context.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context to free, or NULL
+ */
+void opl_ctx_free(OPL_CONTEXT *pc);
+
+/*
+ * Reset an emulator context to the state of OPL hardware that has just
+ * been powered on.
+ * 
+ * This allows a context to be reused for another rendering job without
+ * freeing it and creating a new one.  The sample rate may be changed
+ * during the reset.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   sample_rate - the new sample rate, either 44100 or 48000
+ */
+void opl_ctx_reset(OPL_CONTEXT *pc, int32_t sample_rate);
+
+/*
+ * Write a register in an emulated OPL chip.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   reg - the OPL hardware register index
+ * 
+ *   val - the unsigned byte value to write (0-255)
+ */
+void opl_ctx_write(OPL_CONTEXT *pc, int32_t reg, int32_t val);
+
+/*
+ * Write a run of registers in an emulated OPL chip.
+ * 
+ * This is the same as calling opl_ctx_write() for each register write
+ * in order, but with a single call.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   pPairs - the register writes, each a register index byte followed
+ *   by a value byte; may be NULL if count is zero
+ * 
+ *   count - the number of register writes, zero or greater
+ */
+void opl_ctx_write_bulk(
+          OPL_CONTEXT * pc,
+    const uint8_t     * pPairs,
+          int32_t       count);
+
+/*
+ * Generate samples in an emulated OPL chip using the current state of
+ * the emulated hardware registers.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   pbuf - pointer to the sample buffer to fill
+ * 
+ *   count - the number of (one-channel) PCM samples to generate and
+ *   write into the buffer; must be greater than zero
+ */
+void opl_ctx_generate(OPL_CONTEXT *pc, int16_t *pbuf, int32_t count);
+
+/*
+ * Generate samples in an emulated OPL chip into one channel of an
+ * interleaved multi-channel buffer.
+ * 
+ * This is the same as opl_ctx_generate(), except that consecutive
+ * samples are written stride samples apart.  With several chips
+ * rendering into the same buffer at different starting offsets, each
+ * chip fills its own channel of the interleaved frames, so no separate
+ * per-chip buffers need to be mixed afterwards.  A stride of one is
+ * the same as opl_ctx_generate().
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   pbuf - pointer to the first sample to write
+ * 
+ *   count - the number of samples to generate; must be greater than
+ *   zero
+ * 
+ *   stride - the distance between consecutive samples in the buffer;
+ *   must be greater than zero
+ */
+void opl_ctx_generate_stride(
+    OPL_CONTEXT * pc,
+    int16_t     * pbuf,
+    int32_t       count,
+    int32_t       stride);
+
+/*
+ * Generate a block of samples in an emulated OPL chip while applying
+ * register writes at sample offsets inside the block.
+ * 
+ * Each register write is applied right before the sample at its offset
+ * is generated, so the output is the same as applying the writes with
+ * opl_ctx_write() and generating the samples between them with
+ * opl_ctx_generate_stride().  Writes with the same offset are applied
+ * in the order they are given.  Drivers can generate the whole block in
+ * a single pass through the emulator core, so the client does not need
+ * to cut its buffer into small pieces at every change of a register.
+ * 
+ * The samples are written stride samples apart, as with
+ * opl_ctx_generate_stride().
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   pbuf - pointer to the first sample to write
+ * 
+ *   count - the number of samples to generate; must be greater than
+ *   zero
+ * 
+ *   stride - the distance between consecutive samples in the buffer;
+ *   must be greater than zero
+ * 
+ *   pEv - the register writes, sorted by offset, with every offset in
+ *   range [0, count - 1]; may be NULL if ev_count is zero
+ * 
+ *   ev_count - the number of register writes, zero or greater
+ */
+void opl_ctx_generate_events(
+          OPL_CONTEXT * pc,
+          int16_t     * pbuf,
+          int32_t       count,
+          int32_t       stride,
+    const OPL_EVENT   * pEv,
+          int32_t       ev_count);
+
+/*
+ * Enable or disable skipping silence in an emulator context.
+ * 
+ * When skipping is enabled, the context watches for the emulated chip
+ * to become idle.  The chip is idle once no channel or rhythm
+ * instrument is keyed on, the timer-driven CSM mode is off, and every
+ * envelope has released far enough that the chip has produced a long
+ * run of silent samples.  While the chip is idle, the generate
+ * functions just write zero samples instead of running the emulator.
+ * Register writes still go to the emulator while it is idle, and the
+ * first register write that keys on a channel or a rhythm instrument
+ * resumes synthesis.
+ * 
+ * The emulator does not advance its internal oscillators while it is
+ * idle, so the vibrato and tremolo phases after an idle stretch may
+ * differ from a render without skipping.  Skipping is disabled when a
+ * context is created, and resetting a context does not change the
+ * setting.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   enable - non-zero to enable skipping, zero to disable it
+ */
+void opl_ctx_set_skip(OPL_CONTEXT *pc, int enable);
+
+/*
+ * Check whether an emulator context is currently skipping silence.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ * Return:
+ * 
+ *   non-zero if the chip is idle and synthesis is being skipped, zero
+ *   otherwise
+ */
+int opl_ctx_idle(const OPL_CONTEXT *pc);
+
+/*
+ * Return the size in bytes of a state snapshot.
+ * 
+ * Return:
+ * 
+ *   the number of bytes in a snapshot, greater than zero
+ */
+int32_t opl_ctx_state_size(void);
+
+/*
+ * Check whether state snapshots are exact.
+ * 
+ * An exact snapshot holds the complete synthesis state, so restoring it
+ * continues the output exactly where the saved context was.  Drivers
+ * whose emulator core does not expose its internal state only save the
+ * register values.  Restoring such a snapshot resets the chip and then
+ * writes the saved register values back into it, so that envelopes and
+ * oscillators start over from the point of the restore.
+ * 
+ * Return:
+ * 
+ *   non-zero if snapshots are exact, zero if they only hold registers
+ */
+int opl_ctx_state_exact(void);
+
+/*
+ * Save the state of an emulator context into a snapshot.
+ * 
+ * The snapshot buffer must have room for opl_ctx_state_size() bytes.
+ * Snapshots are only meaningful to the driver that saved them.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   pState - the buffer to receive the snapshot
+ */
+void opl_ctx_save(const OPL_CONTEXT *pc, uint8_t *pState);
+
+/*
+ * Restore the state of an emulator context from a snapshot.
+ * 
+ * The snapshot must have been saved with opl_ctx_save() from a context
+ * with the same sample rate, which may be a different context.  The
+ * skip setting of the context is not changed.
+ * 
+ * Snapshots may come from files, so drivers with exact snapshots check
+ * that the snapshot holds a state that their emulator core can be in at
+ * the sample rate of the context.  A snapshot that fails the check is
+ * rejected and the context is left unchanged.  Snapshots that only
+ * hold registers are always accepted.
+ * 
+ * Parameters:
+ * 
+ *   pc - the emulator context
+ * 
+ *   pState - the snapshot to restore
+ * 
+ * Return:
+ * 
+ *   non-zero if the snapshot was restored, zero if it was rejected
+ */
+int opl_ctx_restore(OPL_CONTEXT *pc, const uint8_t *pState);
+
 /*
  * Initialize the driver.
  * 
- * This is called at the start of emulation.  The provided sample_rate
- * must either be 44100 or 48000.  The sample rate is specified in Hz.
+ * This is called at the start of emulation.  It creates the default
+ * context that is used by opl_write() and opl_generate().  The default
+ * context must not already exist.  The provided sample_rate must either
+ * be 44100 or 48000.  The sample rate is specified in Hz.
  * 
  * Parameters:
  * 
@@ -29,13 +447,16 @@ void opl_init(int32_t sample_rate);
 /*
  * Finish the driver.
  * 
- * This is called at the end of emulation.
+ * This is called at the end of emulation.  It frees the default
+ * context.
  */
 void opl_finish(void);
 
 /*
  * Write a register in the emulated OPL hardware.
  * 
+ * This operates on the default context created by opl_init().
+ * 
  * Parameters:
  * 
  *   reg - the OPL hardware register index
@@ -48,6 +469,8 @@ void opl_write(int32_t reg, int32_t val);
  * Generate samples in the emulated OPL hardware using the current state
  * of the emulated hardware registers.
  * 
+ * This operates on the default context created by opl_init().
+ * 
  * Parameters:
  * 
  *   pbuf - pointer to the sample buffer to fill
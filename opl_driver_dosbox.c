@@ -2,53 +2,653 @@
  * opl_driver_dosbox.c
  * ===================
  * 
- * Implementation of opl_driver.h using the DOSBox OPL emulator.
+ * Emulator core backend for opl_core.h using the DOSBox OPL emulator.
  * 
  * You must compile this with the opl.c source file containing the
  * DOSBox OPL emulator, and this implementation file must have the opl.h
  * header from the DOSBox OPL emulator in the include path while
  * compiling.
+ * 
+ * The DOSBox OPL emulator keeps all of its state in global variables,
+ * so this core only supports a single emulator context at a time.
+ * 
+ * The emulator does not expose its internal state either, so state
+ * snapshots only hold a shadow copy of the register values.
+ * 
+ * The DOSBox emulator has no notion of timed register writes, so
+ * opl_ctx_generate_events() applies the writes between runs of samples
+ * inside the core.
+ * 
+ * The emulator builds its waveform and attenuation tables on the first
+ * adlib_init() and keeps them, but every adlib_init() rebuilds the
+ * tables that depend on the sample rate, and it is also the only way
+ * to reset the chip.  The emulator sources are not part of this tree,
+ * so those tables can not be compiled in.  Instead, the driver keeps
+ * track of whether the emulator is still in the state that
+ * adlib_init() left it in, and a context that is created or reset at
+ * the same rate while it is reuses that state instead of initializing
+ * the emulator again.
  */
 
-#include "opl_driver.h"
+#include "opl_core.h"
 #include "opl.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of samples generated at a time when the samples have to
+ * be spread out into an interleaved buffer.
+ */
+#define STRIDE_CHUNK (256)
+
+/*
+ * The number of consecutive silent samples, generated while nothing is
+ * keyed on, after which the chip is considered idle.
+ */
+#define IDLE_RUN (2048)
 
 /*
- * Public function implementations
- * ===============================
+ * The name of this core, returned by opl_ctx_name().
  * 
- * See header for specifications.
+ * Increase the revision each time a change here or in the emulator
+ * core may change the generated samples.
  */
+#define DRIVER_NAME "dosbox-1"
 
 /*
- * opl_init function.
+ * The number of OPL2 register indices, which is also the size of a
+ * state snapshot.
  */
-void opl_init(int32_t sample_rate) {
-  /* Call through */
-  adlib_init((Bit32u) sample_rate);
+#define REG_COUNT (256)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * The state of an emulator context.
+ */
+typedef struct {
+  
+  /*
+   * The sample rate the emulator was initialized with, and flag set
+   * while nothing has been written to or generated from the emulator
+   * since, which survives from one context to the next.
+   */
+  int32_t sample_rate;
+  int fresh;
+  
+  /*
+   * Flag set if silence skipping is enabled, and flag set while the
+   * chip is idle so that synthesis is skipped.
+   */
+  int skip;
+  int idle;
+  
+  /*
+   * Shadow of the key-on state, with one bit for each melodic channel,
+   * the keyed rhythm instruments if rhythm mode is on, and flag set if
+   * CSM mode is on.
+   */
+  uint16_t keys;
+  uint8_t drums;
+  int csm;
+  
+  /*
+   * The number of consecutive silent samples generated at the end of
+   * the output so far.
+   */
+  int32_t zero_run;
+  
+  /*
+   * Shadow copy of the value last written to each register.
+   */
+  uint8_t regs[REG_COUNT];
+  
+} DOSBOX_CTX;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The single context that wraps the global emulator state.
+ */
+static DOSBOX_CTX ctx_global;
+
+/*
+ * Flag indicating whether ctx_global is currently in use.
+ */
+static int ctx_live = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Reset the shadow state of a context to that of a chip that has just
+ * been powered on.
+ * 
+ * The skip setting is not changed.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context
+ */
+static void resetShadow(DOSBOX_CTX *pc) {
+  pc->idle = 0;
+  pc->keys = 0;
+  pc->drums = 0;
+  pc->csm = 0;
+  pc->zero_run = 0;
+  memset(pc->regs, 0, REG_COUNT);
 }
 
 /*
- * opl_finish function.
+ * Initialize the emulator for a sample rate, unless it is still in the
+ * state that initializing it at that rate gives.
+ * 
+ * The shadow state is reset as well, but the skip setting is not
+ * changed.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context
+ * 
+ *   sample_rate - the sample rate, 44100 or 48000
  */
-void opl_finish(void) {
-  /* Nothing required */
+static void initEmu(DOSBOX_CTX *pc, int32_t sample_rate) {
+  if ((!(pc->fresh)) || (pc->sample_rate != sample_rate)) {
+    adlib_init((Bit32u) sample_rate);
+    pc->sample_rate = sample_rate;
+    pc->fresh = 1;
+  }
+  resetShadow(pc);
 }
 
 /*
- * opl_write function.
+ * Update the shadow state for a register write.
+ * 
+ * If the write keys anything on, the chip is no longer idle.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context
+ * 
+ *   reg - the register index
+ * 
+ *   val - the value written
  */
-void opl_write(int32_t reg, int32_t val) {
-  /* Call through */
+static void shadowWrite(DOSBOX_CTX *pc, int32_t reg, int32_t val) {
+  pc->fresh = 0;
+  if ((reg >= 0) && (reg < REG_COUNT)) {
+    pc->regs[reg] = (uint8_t) val;
+  }
+  
+  if ((reg >= 0xb0) && (reg <= 0xb8)) {
+    if (val & 0x20) {
+      pc->keys |= (uint16_t) (1 << (reg - 0xb0));
+    } else {
+      pc->keys &= (uint16_t) ~(1 << (reg - 0xb0));
+    }
+  
+  } else if (reg == 0xbd) {
+    pc->drums = (val & 0x20) ? (uint8_t) (val & 0x1f) : 0;
+  
+  } else if (reg == 0x08) {
+    pc->csm = ((val & 0x80) != 0);
+  }
+  
+  if (pc->keys || pc->drums || pc->csm) {
+    pc->idle = 0;
+    pc->zero_run = 0;
+  }
+}
+
+/*
+ * Check whether a register is written back late when restoring a
+ * snapshot.
+ * 
+ * The key-on registers go last, so that each channel is keyed on with
+ * all of its other settings in place.  The waveform select enable and
+ * the composite sine mode go first, since they change how other writes
+ * are handled.
+ * 
+ * Parameters:
+ * 
+ *   reg - the register index
+ * 
+ * Return:
+ * 
+ *   non-zero if the register is a key-on register
+ */
+static int isKeyReg(int32_t reg) {
+  return (((reg >= 0xb0) && (reg <= 0xb8)) || (reg == 0xbd));
+}
+
+/*
+ * Watch samples that were just generated for the chip becoming idle.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context
+ * 
+ *   pbuf - the samples
+ * 
+ *   count - the number of samples
+ * 
+ *   stride - the distance between consecutive samples
+ */
+static void watchIdle(
+          DOSBOX_CTX  * pc,
+    const int16_t     * pbuf,
+          int32_t       count,
+          int32_t       stride) {
+  
+  int32_t i = 0;
+  
+  /* Only watch while skipping and while nothing is keyed on */
+  if ((!(pc->skip)) || pc->keys || pc->drums || pc->csm) {
+    return;
+  }
+  
+  /* Count the silent samples at the end of the output */
+  for(i = count - 1; i >= 0; i--) {
+    if (pbuf[i * stride] != 0) {
+      break;
+    }
+  }
+  if (i < 0) {
+    pc->zero_run += count;
+  } else {
+    pc->zero_run = count - 1 - i;
+  }
+  
+  if (pc->zero_run >= IDLE_RUN) {
+    pc->idle = 1;
+  }
+}
+
+/*
+ * Core functions
+ * ==============
+ * 
+ * See the opl_ctx functions in opl_driver.h for specifications.
+ */
+
+/*
+ * ctxRate function.
+ */
+static int32_t ctxRate(int32_t sample_rate) {
+  /* Check parameter */
+  if (sample_rate < 1) {
+    abort();
+  }
+  
+  /* Rates related to 44100 resample from it with the simplest ratio,
+   * and everything else resamples from 48000 */
+  if ((sample_rate % 11025) == 0) {
+    return 44100;
+  }
+  return 48000;
+}
+
+/*
+ * ctxNew function.
+ */
+static void *ctxNew(int32_t sample_rate) {
+  /* Check parameter */
+  if ((sample_rate != 44100) && (sample_rate != 48000)) {
+    abort();
+  }
+  
+  /* Only one context is available */
+  if (ctx_live) {
+    return NULL;
+  }
+  
+  /* Initialize the global emulator state and return the context */
+  initEmu(&ctx_global, sample_rate);
+  ctx_global.skip = 0;
+  ctx_live = 1;
+  
+  return &ctx_global;
+}
+
+/*
+ * ctxFree function.
+ */
+static void ctxFree(void *pCtx) {
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  
+  /* Ignore if NULL */
+  if (pc == NULL) {
+    return;
+  }
+  
+  /* Check parameter */
+  if ((pc != &ctx_global) || (!ctx_live)) {
+    abort();
+  }
+  
+  /* Release the global emulator state */
+  ctx_live = 0;
+}
+
+/*
+ * ctxReset function.
+ */
+static void ctxReset(void *pCtx, int32_t sample_rate) {
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  
+  /* Check parameters */
+  if ((pc != &ctx_global) || (!ctx_live) ||
+      ((sample_rate != 44100) && (sample_rate != 48000))) {
+    abort();
+  }
+  
+  /* Reinitializing the global emulator state performs the reset */
+  initEmu(&ctx_global, sample_rate);
+}
+
+/*
+ * ctxWrite function.
+ */
+static void ctxWrite(void *pCtx, int32_t reg, int32_t val) {
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  
+  /* Check parameter */
+  if ((pc != &ctx_global) || (!ctx_live)) {
+    abort();
+  }
+  
+  /* Call through and keep track of the key-on state */
   adlib_write((Bitu) reg, (Bit8u) val);
+  shadowWrite(pc, reg, val);
+}
+
+/*
+ * ctxWriteBulk function.
+ */
+static void ctxWriteBulk(
+          void        * pCtx,
+    const uint8_t     * pPairs,
+          int32_t       count) {
+  
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc != &ctx_global) || (!ctx_live) || (count < 0) ||
+      ((pPairs == NULL) && (count > 0))) {
+    abort();
+  }
+  
+  /* Call through for each write and keep track of the key-on state */
+  for(i = 0; i < count; i++) {
+    adlib_write((Bitu) pPairs[0], (Bit8u) pPairs[1]);
+    shadowWrite(pc, (int32_t) pPairs[0], (int32_t) pPairs[1]);
+    pPairs += 2;
+  }
 }
 
 /*
- * opl_generate function.
+ * ctxGenerate function.
  */
-void opl_generate(int16_t *pbuf, int32_t count) {
+static void ctxGenerate(void *pCtx, int16_t *pbuf, int32_t count) {
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  
+  /* Check parameters */
+  if ((pc != &ctx_global) || (!ctx_live) ||
+      (pbuf == NULL) || (count < 1)) {
+    abort();
+  }
+  
+  /* Skip synthesis while idle */
+  if (pc->idle) {
+    memset(pbuf, 0, ((size_t) count) * sizeof(int16_t));
+    return;
+  }
+  
   /* Call through */
+  pc->fresh = 0;
   adlib_getsample((Bit16s *) pbuf, (Bits) count);
+  watchIdle(pc, pbuf, count, 1);
+}
+
+/*
+ * ctxGenerateStride function.
+ */
+static void ctxGenerateStride(
+    void        * pCtx,
+    int16_t     * pbuf,
+    int32_t       count,
+    int32_t       stride) {
+  
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  Bit16s chunk[STRIDE_CHUNK];
+  int32_t work = 0;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc != &ctx_global) || (!ctx_live) ||
+      (pbuf == NULL) || (count < 1) || (stride < 1)) {
+    abort();
+  }
+  
+  /* Contiguous output can be generated directly */
+  if (stride == 1) {
+    ctxGenerate(pc, pbuf, count);
+    return;
+  }
+  
+  /* Skip synthesis while idle */
+  if (pc->idle) {
+    for(i = 0; i < count; i++) {
+      pbuf[i * stride] = 0;
+    }
+    return;
+  }
+  
+  /* The DOSBox emulator can only write contiguous samples, so generate
+   * small chunks and spread them out */
+  pc->fresh = 0;
+  while (count > 0) {
+    work = count;
+    if (work > STRIDE_CHUNK) {
+      work = STRIDE_CHUNK;
+    }
+    
+    adlib_getsample(chunk, (Bits) work);
+    watchIdle(pc, (const int16_t *) chunk, work, 1);
+    for(i = 0; i < work; i++) {
+      *pbuf = (int16_t) chunk[i];
+      pbuf += stride;
+    }
+    
+    count -= work;
+    
+    /* Once idle, the rest is silence */
+    if (pc->idle) {
+      for(i = 0; i < count; i++) {
+        pbuf[i * stride] = 0;
+      }
+      break;
+    }
+  }
+}
+
+/*
+ * ctxGenerateEvents function.
+ */
+static void ctxGenerateEvents(
+          void        * pCtx,
+          int16_t     * pbuf,
+          int32_t       count,
+          int32_t       stride,
+    const OPL_EVENT   * pEv,
+          int32_t       ev_count) {
+  
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  int32_t pos = 0;
+  int32_t next = 0;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc != &ctx_global) || (!ctx_live) ||
+      (pbuf == NULL) || (count < 1) || (stride < 1) ||
+      (ev_count < 0) || ((pEv == NULL) && (ev_count > 0))) {
+    abort();
+  }
+  for(i = 0; i < ev_count; i++) {
+    if ((pEv[i].offs < 0) || (pEv[i].offs >= count)) {
+      abort();
+    }
+    if (i > 0) {
+      if (pEv[i].offs < pEv[i - 1].offs) {
+        abort();
+      }
+    }
+  }
+  
+  /* Apply the writes at each offset and then generate the samples up
+   * to the next offset that has writes */
+  i = 0;
+  for(pos = 0; pos < count; pos = next) {
+    for( ; i < ev_count; i++) {
+      if (pEv[i].offs > pos) {
+        break;
+      }
+      adlib_write((Bitu) pEv[i].reg, (Bit8u) pEv[i].val);
+      shadowWrite(pc, (int32_t) pEv[i].reg, (int32_t) pEv[i].val);
+    }
+    
+    next = count;
+    if (i < ev_count) {
+      next = pEv[i].offs;
+    }
+    
+    ctxGenerateStride(pc, pbuf + (((size_t) pos) * stride),
+                      next - pos, stride);
+  }
+}
+
+/*
+ * ctxSetSkip function.
+ */
+static void ctxSetSkip(void *pCtx, int enable) {
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  
+  /* Check parameter */
+  if ((pc != &ctx_global) || (!ctx_live)) {
+    abort();
+  }
+  
+  pc->skip = (enable != 0);
+  if (!(pc->skip)) {
+    pc->idle = 0;
+  }
+  pc->zero_run = 0;
 }
+
+/*
+ * ctxIdle function.
+ */
+static int ctxIdle(const void *pCtx) {
+  const DOSBOX_CTX *pc = (const DOSBOX_CTX *) pCtx;
+  
+  /* Check parameter */
+  if ((pc != &ctx_global) || (!ctx_live)) {
+    abort();
+  }
+  
+  return pc->idle;
+}
+
+/*
+ * ctxSave function.
+ */
+static void ctxSave(const void *pCtx, uint8_t *pState) {
+  const DOSBOX_CTX *pc = (const DOSBOX_CTX *) pCtx;
+  
+  /* Check parameters */
+  if ((pc != &ctx_global) || (!ctx_live) || (pState == NULL)) {
+    abort();
+  }
+  
+  memcpy(pState, pc->regs, REG_COUNT);
+}
+
+/*
+ * ctxRestore function.
+ */
+static int ctxRestore(void *pCtx, const uint8_t *pState) {
+  DOSBOX_CTX *pc = (DOSBOX_CTX *) pCtx;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if ((pc != &ctx_global) || (!ctx_live) || (pState == NULL)) {
+    abort();
+  }
+  
+  /* Start from a chip that has just been powered on */
+  ctxReset(pc, pc->sample_rate);
+  
+  /* Write the mode registers first, then everything except the key-on
+   * registers, and then the key-on registers; the timer control
+   * register is left alone, since the timers do not affect the
+   * output */
+  ctxWrite(pc, 0x01, pState[0x01]);
+  ctxWrite(pc, 0x08, pState[0x08]);
+  for(i = 0x02; i < REG_COUNT; i++) {
+    if ((i != 0x04) && (i != 0x08) && (!isKeyReg(i))) {
+      ctxWrite(pc, i, pState[i]);
+    }
+  }
+  for(i = 0xb0; i <= 0xbd; i++) {
+    if (isKeyReg(i)) {
+      ctxWrite(pc, i, pState[i]);
+    }
+  }
+  
+  /* Any register values are valid */
+  return 1;
+}
+
+/*
+ * Core definition
+ * ===============
+ */
+
+/*
+ * The DOSBox core, declared in opl_core.h.
+ */
+const OPL_CORE opl_core_dosbox = {
+  "dosbox",
+  DRIVER_NAME,
+  1,
+  REG_COUNT,
+  0,
+  &ctxRate,
+  &ctxNew,
+  &ctxFree,
+  &ctxReset,
+  &ctxWrite,
+  &ctxWriteBulk,
+  &ctxGenerate,
+  &ctxGenerateStride,
+  &ctxGenerateEvents,
+  &ctxSetSkip,
+  &ctxIdle,
+  &ctxSave,
+  &ctxRestore
+};
@@ -0,0 +1,1689 @@
+/*
+ * opl_input.c
+ * ===========
+ * 
+ * Implementation of opl_input.h
+ * 
+ * See the header for further information.
+ * 
+ * Scripts are read into the block buffer in large blocks, either with
+ * read() from the file or by copying from memory.  Each line is found
+ * with a single search for its line break, checked, and terminated in
+ * place, so the parsing functions work directly on the block buffer.
+ * 
+ * Binary event streams in files are memory-mapped, so that both kinds
+ * of binary input are decoded straight from memory, and going to a
+ * checkpoint only moves the position.
+ * 
+ * VGM writes carry their chip, so when a write goes to another chip
+ * than the last one, the decoder returns a chip select event first and
+ * holds the write back until the next call.
+ * 
+ * The frame offset of a time t is t * frame_rate / ctl_rate rounded
+ * down.  If the control rate divides the frame rate, that is a single
+ * multiplication by the number of frames in each control cycle, and
+ * otherwise t is split into whole seconds and the cycles left over, so
+ * that the products can not overflow.
+ */
+
+#include "opl_input.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "opl_bin.h"
+#include "vgm_reader.h"
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The size in bytes of the block buffer for scripts.
+ */
+#define INPUT_BLOCK (65536)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * OPL_INPUT structure.
+ * 
+ * Prototype given in header.
+ */
+struct OPL_INPUT_TAG {
+  
+  /*
+   * Flag set while the decoder has an input open.
+   */
+  int open;
+  
+  /*
+   * The kind of input, one of the OPL_INPUT kinds.
+   */
+  int kind;
+  
+  /*
+   * For scripts and text files read from a file or stream, the handle
+   * to it, and a flag set if the decoder opened it and must close it.
+   * Otherwise, pIn is NULL.
+   */
+  FILE *pIn;
+  int own_in;
+  
+  /*
+   * The VGM reader, which is kept between inputs once a VGM file has
+   * been opened, or NULL if none has been opened yet.
+   */
+  VGM_READER *pv;
+  
+  /*
+   * For VGM files, the path and the repeat count, so that the file can
+   * be opened again when the input is rewound.  The path buffer is kept
+   * between inputs, along with its capacity in bytes.
+   */
+  char *pPath;
+  size_t path_cap;
+  int rep_count;
+  
+  /*
+   * For a VGM write that comes after a chip select event the decoder
+   * made up, the write and a flag set while it is held back.
+   */
+  VGM_EVENT held;
+  int holding;
+  
+  /*
+   * For binary event streams read from a file, the memory-mapped file
+   * and its length in bytes.  Otherwise, pMap is NULL.
+   */
+  void *pMap;
+  size_t map_len;
+  
+  /*
+   * For inputs in memory and binary event streams, the whole input, its
+   * length in bytes, and the offset of the first byte that has not been
+   * decoded or copied into the block buffer yet.  For binary event
+   * streams, body is the offset of the first event.  Otherwise, pData
+   * is NULL.
+   */
+  const uint8_t *pData;
+  size_t data_len;
+  size_t data_pos;
+  size_t body;
+  
+  /*
+   * For scripts and text files, the line number of the last line that
+   * was read, and that line as a nul-terminated string stored in place
+   * in the block buffer.
+   */
+  int32_t line_count;
+  const uint8_t *pLine;
+  
+  /*
+   * For scripts and text files, the block buffer, the offset of the
+   * first byte in it that has not been parsed yet, and the number of
+   * bytes in it.  The extra byte at the end makes room for the nul
+   * after a last line that has no line break.
+   */
+  uint8_t i_buf[INPUT_BLOCK + 1];
+  size_t i_pos;
+  size_t i_len;
+  
+  /*
+   * The frame rate, the control rate of the input, and the number of
+   * frames in each control cycle if the control rate divides the frame
+   * rate, or zero otherwise.
+   */
+  int32_t frame_rate;
+  int32_t ctl_rate;
+  int64_t ctl_step;
+  
+  /*
+   * The number of chips the input uses, and the selected chip.
+   */
+  int32_t chips;
+  int32_t chip;
+  
+  /*
+   * The time in control cycles since the start of the input, and the
+   * frame offset it converts to.
+   */
+  int64_t t;
+  int64_t frame;
+  
+  /*
+   * Flag set once an event has been decoded since the input was opened
+   * or rewound, and flag set once the end of the input was decoded.
+   */
+  int used;
+  int at_end;
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static uint32_t readDword(const uint8_t *pd);
+static int isBlank(const uint8_t *pstr);
+static int32_t hexDigit(int c);
+static const uint8_t *parseByte(const uint8_t *pstr, uint8_t *pb);
+static const uint8_t *parseInt(const uint8_t *pstr, int32_t *pv);
+static int vgmErr(int err);
+static int32_t fillInput(OPL_INPUT *pi);
+static int readLine(OPL_INPUT *pi, int *perr);
+static int beginClock(OPL_INPUT *pi, int32_t ctl_rate, int32_t chips);
+static int toFrame(OPL_INPUT *pi, int *perr);
+static int advance(OPL_INPUT *pi, int32_t cycles, int *perr);
+static int selectChip(OPL_INPUT *pi, int32_t chip, int *perr);
+static int readHeader(OPL_INPUT *pi, int *perr);
+static int checkBinary(OPL_INPUT *pi, int *perr);
+static int startVGM(OPL_INPUT *pi, int *perr);
+static int nextText(OPL_INPUT *pi, OPL_INPUT_EVENT *pe, int *perr);
+static int nextBinary(OPL_INPUT *pi, OPL_INPUT_EVENT *pe, int *perr);
+static int nextVGM(OPL_INPUT *pi, OPL_INPUT_EVENT *pe, int *perr);
+static int failOpen(OPL_INPUT *pi, int err, int *perr);
+
+/*
+ * Read a 32-bit unsigned dword in little-endian order from memory.
+ * 
+ * Parameters:
+ * 
+ *   pd - pointer to the four bytes of the dword
+ * 
+ * Return:
+ * 
+ *   the dword value
+ */
+static uint32_t readDword(const uint8_t *pd) {
+  return ((uint32_t) pd[0]) |
+          (((uint32_t) pd[1]) << 8) |
+          (((uint32_t) pd[2]) << 16) |
+          (((uint32_t) pd[3]) << 24);
+}
+
+/*
+ * Check whether a given string is blank.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the string
+ * 
+ * Return:
+ * 
+ *   non-zero if string is empty or only contains tabs and spaces; zero
+ *   otherwise
+ */
+static int isBlank(const uint8_t *pstr) {
+  while (*pstr != 0) {
+    if ((*pstr != ' ') && (*pstr != '\t')) {
+      return 0;
+    }
+    pstr++;
+  }
+  return 1;
+}
+
+/*
+ * Get the value of a base-16 digit.
+ * 
+ * Parameters:
+ * 
+ *   c - the character
+ * 
+ * Return:
+ * 
+ *   the value of the digit, or -1 if the character is not a base-16
+ *   digit
+ */
+static int32_t hexDigit(int c) {
+  if ((c >= '0') && (c <= '9')) {
+    return (int32_t) (c - '0');
+  } else if ((c >= 'A') && (c <= 'F')) {
+    return (int32_t) (c - 'A' + 10);
+  } else if ((c >= 'a') && (c <= 'f')) {
+    return (int32_t) (c - 'a' + 10);
+  }
+  return -1;
+}
+
+/*
+ * Parse a base-16 byte value from a string.
+ * 
+ * Parsing skips any spaces and tabs, then reads exactly two base-16
+ * digits, which must not be followed by another base-16 digit.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the location to start parsing
+ * 
+ *   pb - variable to receive the parsed byte value
+ * 
+ * Return:
+ * 
+ *   pointer to character immediately after byte value that was parsed,
+ *   or NULL if parsing failed
+ */
+static const uint8_t *parseByte(const uint8_t *pstr, uint8_t *pb) {
+  int32_t result = 0;
+  int32_t d = 0;
+  int i = 0;
+  
+  /* Skip over any tabs and spaces */
+  while ((*pstr == '\t') || (*pstr == ' ')) {
+    pstr++;
+  }
+  
+  /* Parse two base-16 digits */
+  for(i = 0; i < 2; i++) {
+    d = hexDigit(*pstr);
+    if (d < 0) {
+      return NULL;
+    }
+    result = (result << 4) + d;
+    pstr++;
+  }
+  
+  /* Make sure we landed on something other than a base-16 digit */
+  if (hexDigit(*pstr) >= 0) {
+    return NULL;
+  }
+  
+  *pb = (uint8_t) result;
+  return pstr;
+}
+
+/*
+ * Parse an unsigned decimal integer from a string.
+ * 
+ * See opl_input_parse_int() for the syntax.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the location to start parsing
+ * 
+ *   pv - variable to receive the parsed integer value
+ * 
+ * Return:
+ * 
+ *   pointer to character immediately after decimal integer that was
+ *   parsed, or NULL if parsing failed or the value overflowed
+ */
+static const uint8_t *parseInt(const uint8_t *pstr, int32_t *pv) {
+  int32_t result = 0;
+  int32_t d = 0;
+  
+  /* Skip over any tabs and spaces */
+  while ((*pstr == '\t') || (*pstr == ' ')) {
+    pstr++;
+  }
+  
+  /* Check that we found a decimal digit */
+  if ((*pstr < '0') || (*pstr > '9')) {
+    return NULL;
+  }
+  
+  /* Parse sequence of decimal digits, watching for overflow */
+  while ((*pstr >= '0') && (*pstr <= '9')) {
+    d = (int32_t) (*pstr - '0');
+    if (result > (INT32_MAX - d) / 10) {
+      return NULL;
+    }
+    result = (result * 10) + d;
+    pstr++;
+  }
+  
+  *pv = result;
+  return pstr;
+}
+
+/*
+ * Convert a VGM reader error code into a decoder error code.
+ * 
+ * Parameters:
+ * 
+ *   err - the VGM_ERR code
+ * 
+ * Return:
+ * 
+ *   the OPL_INPUT_ERR code
+ */
+static int vgmErr(int err) {
+  int result = OPL_INPUT_ERR_VGM;
+  
+  if (err == VGM_ERR_OPEN) {
+    result = OPL_INPUT_ERR_OPEN;
+  } else if (err == VGM_ERR_IO) {
+    result = OPL_INPUT_ERR_IO;
+  } else if (err == VGM_ERR_MEM) {
+    result = OPL_INPUT_ERR_MEM;
+  } else if (err == VGM_ERR_SIG) {
+    result = OPL_INPUT_ERR_HEADER;
+  } else if (err == VGM_ERR_OPCODE) {
+    result = OPL_INPUT_ERR_OPCODE;
+  }
+  
+  return result;
+}
+
+/*
+ * Add more text to the block buffer.
+ * 
+ * Text in memory is copied from the input, and text in a file or
+ * stream is read from it.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the number of bytes added, which is zero at the end of the input,
+ *   or -1 if there was an I/O error
+ */
+static int32_t fillInput(OPL_INPUT *pi) {
+  size_t room = 0;
+  ssize_t got = 0;
+  
+  room = INPUT_BLOCK - pi->i_len;
+  
+  /* Copy from memory */
+  if (pi->pData != NULL) {
+    if (room > pi->data_len - pi->data_pos) {
+      room = pi->data_len - pi->data_pos;
+    }
+    memcpy(&(pi->i_buf[pi->i_len]), pi->pData + pi->data_pos, room);
+    pi->data_pos += room;
+    pi->i_len += room;
+    return (int32_t) room;
+  }
+  
+  /* Read as much as is available from the file */
+  do {
+    got = read(fileno(pi->pIn), &(pi->i_buf[pi->i_len]), room);
+  } while ((got < 0) && (errno == EINTR));
+  if (got < 0) {
+    return -1;
+  }
+  pi->i_len += (size_t) got;
+  return (int32_t) got;
+}
+
+/*
+ * Read the next line of a script or text file.
+ * 
+ * The line break is replaced with a nul in the block buffer, so the
+ * line becomes a string that the parsing functions can work on
+ * directly, and pLine is set to it.  The line is checked for invalid
+ * characters, stray CRs, and excessive length in the same pass that
+ * finds where it ends.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   1 if another line was read, 0 at the end of the input, or -1 if
+ *   there was an error
+ */
+static int readLine(OPL_INPUT *pi, int *perr) {
+  uint8_t *ps = NULL;
+  uint8_t *pe = NULL;
+  size_t avail = 0;
+  size_t len = 0;
+  size_t i = 0;
+  int32_t got = 0;
+  int at_end = 0;
+  int c = 0;
+  
+  /* Find the line break at the end of the next line, adding another
+   * block whenever the rest of the buffer holds neither a line break
+   * nor enough bytes to prove the line too long */
+  while (1) {
+    ps = &(pi->i_buf[pi->i_pos]);
+    avail = pi->i_len - pi->i_pos;
+    pe = (uint8_t *) memchr(ps, '\n', avail);
+    if ((pe != NULL) || (avail > OPL_INPUT_LINE_MAX + 1) || at_end) {
+      break;
+    }
+    
+    /* Move the partial line to the front of the buffer */
+    if (pi->i_pos > 0) {
+      memmove(pi->i_buf, ps, avail);
+      pi->i_pos = 0;
+      pi->i_len = avail;
+    }
+    
+    got = fillInput(pi);
+    if (got < 0) {
+      *perr = OPL_INPUT_ERR_IO;
+      return -1;
+    }
+    if (got == 0) {
+      at_end = 1;
+    }
+  }
+  
+  /* If there are no bytes left, the input is at its end */
+  if (avail < 1) {
+    return 0;
+  }
+  
+  /* We got at least one character, so count the line first */
+  if (pi->line_count >= INT32_MAX) {
+    *perr = OPL_INPUT_ERR_LINE;
+    return -1;
+  }
+  pi->line_count++;
+  
+  /* The line runs up to the line break, or to the end of the input */
+  if (pe != NULL) {
+    len = (size_t) (pe - ps);
+    pi->i_pos += len + 1;
+  } else {
+    len = avail;
+    pi->i_pos += len;
+  }
+  
+  /* Check that all characters are in normal printing US-ASCII range
+   * and that the line is not too long; a CR is only allowed right
+   * before the LF that ends the line */
+  for(i = 0; i < len; i++) {
+    c = ps[i];
+    if (((c < 0x20) || (c > 0x7e)) && (c != '\t')) {
+      if ((c != '\r') || (i + 1 < len) || (pe == NULL)) {
+        *perr = OPL_INPUT_ERR_LINE;
+        return -1;
+      }
+      len = i;
+      break;
+    }
+    if (i >= OPL_INPUT_LINE_MAX) {
+      *perr = OPL_INPUT_ERR_LINE;
+      return -1;
+    }
+  }
+  
+  /* Terminate the line in place */
+  ps[len] = 0;
+  pi->pLine = ps;
+  return 1;
+}
+
+/*
+ * Set the control rate and the chip count of the input, and start its
+ * time at zero with the first chip selected.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   ctl_rate - the control rate in Hz
+ * 
+ *   chips - the number of chips
+ * 
+ * Return:
+ * 
+ *   OPL_INPUT_ERR_NONE if successful, or the error code if the control
+ *   rate or the chip count is out of range
+ */
+static int beginClock(OPL_INPUT *pi, int32_t ctl_rate, int32_t chips) {
+  if ((ctl_rate < 1) || (ctl_rate > OPL_INPUT_RATE_MAX)) {
+    return OPL_INPUT_ERR_RATE;
+  }
+  if ((chips < 1) || (chips > OPL_INPUT_CHIPS_MAX)) {
+    return OPL_INPUT_ERR_CHIPS;
+  }
+  
+  pi->ctl_rate = ctl_rate;
+  pi->ctl_step = 0;
+  if ((pi->frame_rate > 0) && ((pi->frame_rate % ctl_rate) == 0)) {
+    pi->ctl_step = pi->frame_rate / ctl_rate;
+  }
+  pi->chips = chips;
+  pi->chip = 0;
+  pi->t = 0;
+  pi->frame = 0;
+  pi->holding = 0;
+  pi->used = 0;
+  pi->at_end = 0;
+  return OPL_INPUT_ERR_NONE;
+}
+
+/*
+ * Convert the time of the input into its frame offset.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the offset is out of range or would
+ *   move backward
+ */
+static int toFrame(OPL_INPUT *pi, int *perr) {
+  int64_t soi = 0;
+  int64_t q = 0;
+  int64_t r = 0;
+  
+  if (pi->frame_rate < 1) {
+    return 1;
+  }
+  
+  if (pi->ctl_step > 0) {
+    if (pi->t > INT64_MAX / pi->ctl_step) {
+      *perr = OPL_INPUT_ERR_TIME;
+      return 0;
+    }
+    soi = pi->t * pi->ctl_step;
+    
+  } else {
+    q = pi->t / pi->ctl_rate;
+    r = pi->t % pi->ctl_rate;
+    if (q > (INT64_MAX - pi->frame_rate) / pi->frame_rate) {
+      *perr = OPL_INPUT_ERR_TIME;
+      return 0;
+    }
+    soi = (q * pi->frame_rate) + ((r * pi->frame_rate) / pi->ctl_rate);
+  }
+  
+  /* Control rates above the frame rate may have waits shorter than a
+   * frame, but time never moves backward */
+  if (soi < pi->frame) {
+    *perr = OPL_INPUT_ERR_TIME;
+    return 0;
+  }
+  pi->frame = soi;
+  return 1;
+}
+
+/*
+ * Move the time of the input forward.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   cycles - the number of control cycles, which must be at least one
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int advance(OPL_INPUT *pi, int32_t cycles, int *perr) {
+  if (cycles < 1) {
+    *perr = OPL_INPUT_ERR_WAIT;
+    return 0;
+  }
+  if (pi->t > INT64_MAX - cycles) {
+    *perr = OPL_INPUT_ERR_TIME;
+    return 0;
+  }
+  pi->t += cycles;
+  return toFrame(pi, perr);
+}
+
+/*
+ * Select a chip for the writes that follow.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   chip - the chip to select
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the chip does not exist
+ */
+static int selectChip(OPL_INPUT *pi, int32_t chip, int *perr) {
+  if ((chip < 0) || (chip >= pi->chips)) {
+    *perr = OPL_INPUT_ERR_CHIP;
+    return 0;
+  }
+  pi->chip = chip;
+  return 1;
+}
+
+/*
+ * Read and check the header line of a script.
+ * 
+ * The header line is "OPL2" followed by the control rate and an
+ * optional chip count, which defaults to one.  The block buffer must
+ * be empty and the input at its start.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int readHeader(OPL_INPUT *pi, int *perr) {
+  const uint8_t *pstr = NULL;
+  int32_t ctl_rate = 0;
+  int32_t chips = 1;
+  int status = 0;
+  int err = 0;
+  
+  status = readLine(pi, perr);
+  if (status < 0) {
+    return 0;
+  }
+  if ((status == 0) ||
+      (strncmp((const char *) pi->pLine, "OPL2", 4) != 0)) {
+    *perr = OPL_INPUT_ERR_HEADER;
+    return 0;
+  }
+  
+  pstr = parseInt(&(pi->pLine[4]), &ctl_rate);
+  if ((pstr != NULL) && (!isBlank(pstr))) {
+    pstr = parseInt(pstr, &chips);
+  }
+  if ((pstr == NULL) || (!isBlank(pstr))) {
+    *perr = OPL_INPUT_ERR_HEADER;
+    return 0;
+  }
+  
+  err = beginClock(pi, ctl_rate, chips);
+  if (err != OPL_INPUT_ERR_NONE) {
+    *perr = err;
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Check the header of a binary event stream and go to its first event.
+ * 
+ * The stream must already be set as the input data.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int checkBinary(OPL_INPUT *pi, int *perr) {
+  uint32_t ver = 0;
+  uint32_t rate = 0;
+  uint32_t chips = 1;
+  int err = 0;
+  
+  if ((pi->data_len < BIN_HEADER_SIZE) ||
+      (memcmp(pi->pData, BIN_SIGNATURE, BIN_SIGNATURE_SIZE) != 0)) {
+    *perr = OPL_INPUT_ERR_HEADER;
+    return 0;
+  }
+  ver = readDword(pi->pData + 4);
+  rate = readDword(pi->pData + 8);
+  pi->body = BIN_HEADER_SIZE;
+  
+  /* Version 2 headers add a chip count */
+  if (ver == BIN_VERSION_CHIPS) {
+    if (pi->data_len < BIN_HEADER_CHIPS) {
+      *perr = OPL_INPUT_ERR_HEADER;
+      return 0;
+    }
+    chips = readDword(pi->pData + 12);
+    pi->body = BIN_HEADER_CHIPS;
+    
+  } else if (ver != BIN_VERSION) {
+    *perr = OPL_INPUT_ERR_HEADER;
+    return 0;
+  }
+  
+  if (rate > OPL_INPUT_RATE_MAX) {
+    rate = 0;
+  }
+  if (chips > OPL_INPUT_CHIPS_MAX) {
+    chips = 0;
+  }
+  err = beginClock(pi, (int32_t) rate, (int32_t) chips);
+  if (err != OPL_INPUT_ERR_NONE) {
+    *perr = err;
+    return 0;
+  }
+  pi->data_pos = pi->body;
+  return 1;
+}
+
+/*
+ * Open the VGM file of the input in the VGM reader, creating the
+ * reader if there is none yet.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder, with the path and repeat count set
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int startVGM(OPL_INPUT *pi, int *perr) {
+  int status = 0;
+  int err = 0;
+  
+  if (pi->pv == NULL) {
+    pi->pv = vgm_open(pi->pPath, pi->rep_count, &err);
+    status = (pi->pv != NULL);
+  } else {
+    status = vgm_reopen(pi->pv, pi->pPath, pi->rep_count, &err);
+  }
+  if (!status) {
+    *perr = vgmErr(err);
+    return 0;
+  }
+  
+  err = beginClock(pi, VGM_SAMPLE_RATE, (int32_t) vgm_chips(pi->pv));
+  if (err != OPL_INPUT_ERR_NONE) {
+    *perr = err;
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Decode the next event of a script.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   pe - the structure to receive the event
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int nextText(OPL_INPUT *pi, OPL_INPUT_EVENT *pe, int *perr) {
+  const uint8_t *pstr = NULL;
+  int32_t iv32 = 0;
+  int status = 0;
+  
+  /* Find the next line with a command */
+  while (1) {
+    status = readLine(pi, perr);
+    if (status < 0) {
+      return 0;
+    } else if (status == 0) {
+      pi->at_end = 1;
+      return 1;
+    }
+    if ((pi->pLine[0] != '\'') && (!isBlank(pi->pLine))) {
+      break;
+    }
+  }
+  
+  /* Second character must be space or tab */
+  if ((pi->pLine[1] != ' ') && (pi->pLine[1] != '\t')) {
+    *perr = OPL_INPUT_ERR_SYNTAX;
+    return 0;
+  }
+  
+  /* Parse the arguments of the command */
+  pstr = &(pi->pLine[1]);
+  if (pi->pLine[0] == 'r') {
+    pstr = parseByte(pstr, &(pe->reg));
+    if (pstr != NULL) {
+      pstr = parseByte(pstr, &(pe->val));
+    }
+  } else if ((pi->pLine[0] == 'w') || (pi->pLine[0] == 'c')) {
+    pstr = parseInt(pstr, &iv32);
+  } else {
+    pstr = NULL;
+  }
+  if ((pstr == NULL) || (!isBlank(pstr))) {
+    *perr = OPL_INPUT_ERR_SYNTAX;
+    return 0;
+  }
+  
+  /* Make the event */
+  if (pi->pLine[0] == 'r') {
+    pe->type = OPL_INPUT_EVENT_WRITE;
+    return 1;
+    
+  } else if (pi->pLine[0] == 'w') {
+    pe->type = OPL_INPUT_EVENT_WAIT;
+    pe->cycles = iv32;
+    if (!advance(pi, iv32, perr)) {
+      return 0;
+    }
+    pe->frame = pi->frame;
+    return 1;
+  }
+  
+  pe->type = OPL_INPUT_EVENT_CHIP;
+  pe->chip = iv32;
+  return selectChip(pi, iv32, perr);
+}
+
+/*
+ * Decode the next event of a binary event stream.
+ * 
+ * The position only moves past the event if it is decoded without an
+ * error.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   pe - the structure to receive the event
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int nextBinary(OPL_INPUT *pi, OPL_INPUT_EVENT *pe, int *perr) {
+  const uint8_t *pd = NULL;
+  const uint8_t *pEnd = NULL;
+  uint32_t uv = 0;
+  int shift = 0;
+  
+  pd = pi->pData + pi->data_pos;
+  pEnd = pi->pData + pi->data_len;
+  
+  if (pd >= pEnd) {
+    pi->at_end = 1;
+    return 1;
+  }
+  
+  if (*pd == BIN_EVENT_WRITE) {
+    /* Fixed-width register write */
+    if (pEnd - pd < 3) {
+      *perr = OPL_INPUT_ERR_STREAM;
+      return 0;
+    }
+    pe->type = OPL_INPUT_EVENT_WRITE;
+    pe->reg = pd[1];
+    pe->val = pd[2];
+    pi->data_pos += 3;
+    return 1;
+    
+  } else if (*pd == BIN_EVENT_WAIT) {
+    /* Wait with a base-128 count of at most five groups, the last of
+     * which may only use the bits that still fit into 32 bits */
+    pd++;
+    for(shift = 0; shift < BIN_WAIT_GROUPS * 7; shift += 7) {
+      if (pd >= pEnd) {
+        *perr = OPL_INPUT_ERR_STREAM;
+        return 0;
+      }
+      if ((shift == (BIN_WAIT_GROUPS - 1) * 7) && ((*pd & 0x7f) > 0x0f)) {
+        *perr = OPL_INPUT_ERR_STREAM;
+        return 0;
+      }
+      uv |= ((uint32_t) (*pd & 0x7f)) << shift;
+      if ((*(pd++) & 0x80) == 0) {
+        break;
+      }
+    }
+    if ((shift >= BIN_WAIT_GROUPS * 7) || (uv > INT32_MAX)) {
+      *perr = OPL_INPUT_ERR_STREAM;
+      return 0;
+    }
+    pe->type = OPL_INPUT_EVENT_WAIT;
+    pe->cycles = (int32_t) uv;
+    if (!advance(pi, (int32_t) uv, perr)) {
+      return 0;
+    }
+    pe->frame = pi->frame;
+    pi->data_pos = (size_t) (pd - pi->pData);
+    return 1;
+    
+  } else if (*pd == BIN_EVENT_CHIP) {
+    /* Chip select with the chip number byte */
+    if (pEnd - pd < 2) {
+      *perr = OPL_INPUT_ERR_STREAM;
+      return 0;
+    }
+    pe->type = OPL_INPUT_EVENT_CHIP;
+    pe->chip = (int32_t) pd[1];
+    if (!selectChip(pi, pe->chip, perr)) {
+      return 0;
+    }
+    pi->data_pos += 2;
+    return 1;
+  }
+  
+  *perr = OPL_INPUT_ERR_STREAM;
+  return 0;
+}
+
+/*
+ * Decode the next event of a VGM file.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   pe - the structure to receive the event
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int nextVGM(OPL_INPUT *pi, OPL_INPUT_EVENT *pe, int *perr) {
+  VGM_EVENT ev;
+  int err = 0;
+  
+  /* Take a write that was held back behind a chip select first */
+  if (pi->holding) {
+    ev = pi->held;
+    pi->holding = 0;
+    
+  } else if (!vgm_next(pi->pv, &ev, &err)) {
+    *perr = vgmErr(err);
+    return 0;
+  }
+  
+  if (ev.type == VGM_EVENT_END) {
+    pi->at_end = 1;
+    
+  } else if (ev.type == VGM_EVENT_WRITE) {
+    if ((int32_t) ev.chip != pi->chip) {
+      /* Select the chip of the write first */
+      pe->type = OPL_INPUT_EVENT_CHIP;
+      pe->chip = (int32_t) ev.chip;
+      if (!selectChip(pi, pe->chip, perr)) {
+        return 0;
+      }
+      pi->held = ev;
+      pi->holding = 1;
+    } else {
+      pe->type = OPL_INPUT_EVENT_WRITE;
+      pe->reg = ev.reg;
+      pe->val = ev.val;
+    }
+    
+  } else if (ev.type == VGM_EVENT_WAIT) {
+    pe->type = OPL_INPUT_EVENT_WAIT;
+    pe->cycles = ev.samples;
+    if (!advance(pi, ev.samples, perr)) {
+      return 0;
+    }
+    pe->frame = pi->frame;
+  }
+  
+  return 1;
+}
+
+/*
+ * Give up on opening an input.
+ * 
+ * The decoder is left with no input.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   err - the error code
+ * 
+ *   perr - variable to receive the error code
+ * 
+ * Return:
+ * 
+ *   always zero
+ */
+static int failOpen(OPL_INPUT *pi, int err, int *perr) {
+  opl_input_close(pi);
+  *perr = err;
+  return 0;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * opl_input_new function.
+ */
+OPL_INPUT *opl_input_new(int32_t frame_rate, int *perr) {
+  OPL_INPUT *pi = NULL;
+  
+  /* Check parameters */
+  if ((frame_rate < 0) || (perr == NULL)) {
+    abort();
+  }
+  
+  pi = (OPL_INPUT *) calloc(1, sizeof(OPL_INPUT));
+  if (pi == NULL) {
+    *perr = OPL_INPUT_ERR_MEM;
+    return NULL;
+  }
+  pi->frame_rate = frame_rate;
+  opl_input_close(pi);
+  
+  *perr = OPL_INPUT_ERR_NONE;
+  return pi;
+}
+
+/*
+ * opl_input_free function.
+ */
+void opl_input_free(OPL_INPUT *pi) {
+  if (pi != NULL) {
+    opl_input_close(pi);
+    vgm_close(pi->pv);
+    free(pi->pPath);
+    free(pi);
+  }
+}
+
+/*
+ * opl_input_set_rate function.
+ */
+void opl_input_set_rate(OPL_INPUT *pi, int32_t frame_rate) {
+  int err = 0;
+  
+  if ((pi == NULL) || (frame_rate < 0)) {
+    abort();
+  }
+  pi->frame_rate = frame_rate;
+  
+  /* Convert the time of an open input at the new rate */
+  if (pi->ctl_rate > 0) {
+    pi->ctl_step = 0;
+    if ((frame_rate > 0) && ((frame_rate % pi->ctl_rate) == 0)) {
+      pi->ctl_step = frame_rate / pi->ctl_rate;
+    }
+    pi->frame = 0;
+    if (!toFrame(pi, &err)) {
+      pi->frame = 0;
+    }
+  }
+}
+
+/*
+ * opl_input_open function.
+ */
+int opl_input_open(
+          OPL_INPUT * pi,
+    const char      * pPath,
+          int         rep_count,
+          int       * perr) {
+          
+  uint8_t sig[4];
+  struct stat st;
+  size_t len = 0;
+  char *pBuf = NULL;
+  FILE *pf = NULL;
+  
+  /* Check parameters */
+  if ((pi == NULL) || (pPath == NULL) || (perr == NULL) ||
+      ((rep_count != 1) && (rep_count != 2))) {
+    abort();
+  }
+  
+  opl_input_close(pi);
+  
+  /* Open the input file and read its signature */
+  pf = fopen(pPath, "rb");
+  if (pf == NULL) {
+    return failOpen(pi, OPL_INPUT_ERR_OPEN, perr);
+  }
+  memset(sig, 0, 4);
+  if (fread(sig, 1, 4, pf) != 4) {
+    memset(sig, 0, 4);
+  }
+  
+  if (memcmp(sig, BIN_SIGNATURE, BIN_SIGNATURE_SIZE) == 0) {
+    /* Binary event stream, so map it into memory */
+    pi->kind = OPL_INPUT_BINARY;
+    if (fstat(fileno(pf), &st)) {
+      fclose(pf);
+      return failOpen(pi, OPL_INPUT_ERR_IO, perr);
+    }
+    pi->map_len = (size_t) st.st_size;
+    pi->pMap = mmap(NULL, pi->map_len, PROT_READ, MAP_PRIVATE,
+                    fileno(pf), 0);
+    fclose(pf);
+    if (pi->pMap == MAP_FAILED) {
+      pi->pMap = NULL;
+      pi->map_len = 0;
+      return failOpen(pi, OPL_INPUT_ERR_IO, perr);
+    }
+    pi->open = 1;
+    pi->pData = (const uint8_t *) pi->pMap;
+    pi->data_len = pi->map_len;
+    if (!checkBinary(pi, perr)) {
+      return failOpen(pi, *perr, perr);
+    }
+    
+  } else if ((memcmp(sig, "Vgm ", 4) == 0) ||
+              ((sig[0] == 0x1f) && (sig[1] == 0x8b))) {
+    /* VGM file or gzip-compressed VGZ file, which the VGM reader opens
+     * by itself, so keep the path for opening it again */
+    fclose(pf);
+    pi->kind = OPL_INPUT_VGM;
+    len = strlen(pPath) + 1;
+    if (len > pi->path_cap) {
+      pBuf = (char *) realloc(pi->pPath, len);
+      if (pBuf == NULL) {
+        return failOpen(pi, OPL_INPUT_ERR_MEM, perr);
+      }
+      pi->pPath = pBuf;
+      pi->path_cap = len;
+    }
+    memcpy(pi->pPath, pPath, len);
+    pi->rep_count = rep_count;
+    pi->open = 1;
+    if (!startVGM(pi, perr)) {
+      return failOpen(pi, *perr, perr);
+    }
+    
+  } else {
+    /* OPL2 hardware script, parsed from the start */
+    if (fseek(pf, 0, SEEK_SET)) {
+      fclose(pf);
+      return failOpen(pi, OPL_INPUT_ERR_IO, perr);
+    }
+    pi->kind = OPL_INPUT_TEXT;
+    pi->pIn = pf;
+    pi->own_in = 1;
+    pi->open = 1;
+    if (!readHeader(pi, perr)) {
+      return failOpen(pi, *perr, perr);
+    }
+  }
+  
+  *perr = OPL_INPUT_ERR_NONE;
+  return 1;
+}
+
+/*
+ * opl_input_open_mem function.
+ */
+int opl_input_open_mem(
+          OPL_INPUT * pi,
+    const void      * pData,
+          size_t      len,
+          int       * perr) {
+          
+  const uint8_t *pd = NULL;
+  
+  /* Check parameters */
+  if ((pi == NULL) || (perr == NULL) ||
+      ((pData == NULL) && (len > 0))) {
+    abort();
+  }
+  
+  opl_input_close(pi);
+  pd = (const uint8_t *) pData;
+  
+  if ((len >= 4) && (memcmp(pd, "Vgm ", 4) == 0)) {
+    return failOpen(pi, OPL_INPUT_ERR_KIND, perr);
+  }
+  if ((len >= 2) && (pd[0] == 0x1f) && (pd[1] == 0x8b)) {
+    return failOpen(pi, OPL_INPUT_ERR_KIND, perr);
+  }
+  
+  pi->open = 1;
+  pi->pData = pd;
+  pi->data_len = len;
+  if ((len >= BIN_SIGNATURE_SIZE) &&
+      (memcmp(pd, BIN_SIGNATURE, BIN_SIGNATURE_SIZE) == 0)) {
+    pi->kind = OPL_INPUT_BINARY;
+    if (!checkBinary(pi, perr)) {
+      return failOpen(pi, *perr, perr);
+    }
+  } else {
+    pi->kind = OPL_INPUT_TEXT;
+    if (!readHeader(pi, perr)) {
+      return failOpen(pi, *perr, perr);
+    }
+  }
+  
+  *perr = OPL_INPUT_ERR_NONE;
+  return 1;
+}
+
+/*
+ * opl_input_open_stream function.
+ */
+int opl_input_open_stream(
+    OPL_INPUT * pi,
+    FILE      * pf,
+    int         kind,
+    int       * perr) {
+    
+  /* Check parameters */
+  if ((pi == NULL) || (pf == NULL) || (perr == NULL) ||
+      ((kind != OPL_INPUT_TEXT) && (kind != OPL_INPUT_LINES))) {
+    abort();
+  }
+  
+  opl_input_close(pi);
+  pi->kind = kind;
+  pi->pIn = pf;
+  pi->own_in = 0;
+  pi->open = 1;
+  
+  if (kind == OPL_INPUT_TEXT) {
+    if (!readHeader(pi, perr)) {
+      return failOpen(pi, *perr, perr);
+    }
+  } else {
+    pi->at_end = 0;
+  }
+  
+  *perr = OPL_INPUT_ERR_NONE;
+  return 1;
+}
+
+/*
+ * opl_input_close function.
+ */
+void opl_input_close(OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  
+  if (pi->pMap != NULL) {
+    munmap(pi->pMap, pi->map_len);
+    pi->pMap = NULL;
+    pi->map_len = 0;
+  }
+  if ((pi->pIn != NULL) && pi->own_in) {
+    fclose(pi->pIn);
+  }
+  pi->pIn = NULL;
+  pi->own_in = 0;
+  
+  pi->open = 0;
+  pi->kind = OPL_INPUT_TEXT;
+  pi->holding = 0;
+  pi->pData = NULL;
+  pi->data_len = 0;
+  pi->data_pos = 0;
+  pi->body = 0;
+  pi->line_count = 0;
+  pi->pLine = NULL;
+  pi->i_pos = 0;
+  pi->i_len = 0;
+  
+  pi->ctl_rate = 1;
+  pi->ctl_step = 0;
+  pi->chips = 1;
+  pi->chip = 0;
+  pi->t = 0;
+  pi->frame = 0;
+  pi->used = 0;
+  pi->at_end = 1;
+}
+
+/*
+ * opl_input_rewind function.
+ */
+int opl_input_rewind(OPL_INPUT *pi, int *perr) {
+  int32_t chips = 0;
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pi == NULL) || (perr == NULL) || (!(pi->open))) {
+    abort();
+  }
+  
+  *perr = OPL_INPUT_ERR_NONE;
+  
+  /* Nothing to do if nothing has been decoded yet */
+  if (!(pi->used)) {
+    return 1;
+  }
+  
+  if (pi->kind == OPL_INPUT_BINARY) {
+    /* Go back to the first event */
+    chips = pi->chips;
+    beginClock(pi, pi->ctl_rate, chips);
+    pi->data_pos = pi->body;
+    
+  } else if (pi->kind == OPL_INPUT_VGM) {
+    /* Open the VGM file again */
+    status = startVGM(pi, perr);
+    
+  } else {
+    /* Parse the text again from the start */
+    if (pi->pIn != NULL) {
+      if (fseek(pi->pIn, 0, SEEK_SET)) {
+        return failOpen(pi, OPL_INPUT_ERR_SEEK, perr);
+      }
+    } else {
+      pi->data_pos = 0;
+    }
+    pi->line_count = 0;
+    pi->i_pos = 0;
+    pi->i_len = 0;
+    if (pi->kind == OPL_INPUT_TEXT) {
+      status = readHeader(pi, perr);
+    } else {
+      pi->used = 0;
+      pi->at_end = 0;
+    }
+  }
+  
+  if (!status) {
+    return failOpen(pi, *perr, perr);
+  }
+  return 1;
+}
+
+/*
+ * opl_input_next function.
+ */
+int opl_input_next(OPL_INPUT *pi, OPL_INPUT_EVENT *pe, int *perr) {
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pi == NULL) || (pe == NULL) || (perr == NULL) ||
+      (pi->kind == OPL_INPUT_LINES)) {
+    abort();
+  }
+  
+  *perr = OPL_INPUT_ERR_NONE;
+  pe->type = OPL_INPUT_EVENT_END;
+  pi->used = 1;
+  if (pi->at_end) {
+    return 1;
+  }
+  
+  if (pi->kind == OPL_INPUT_BINARY) {
+    status = nextBinary(pi, pe, perr);
+  } else if (pi->kind == OPL_INPUT_VGM) {
+    status = nextVGM(pi, pe, perr);
+  } else {
+    status = nextText(pi, pe, perr);
+  }
+  
+  if (!status) {
+    pe->type = OPL_INPUT_EVENT_END;
+  }
+  return status;
+}
+
+/*
+ * opl_input_getline function.
+ */
+const char *opl_input_getline(OPL_INPUT *pi, int *perr) {
+  int status = 0;
+  
+  /* Check parameters */
+  if ((pi == NULL) || (perr == NULL) || (pi->kind != OPL_INPUT_LINES)) {
+    abort();
+  }
+  
+  *perr = OPL_INPUT_ERR_NONE;
+  pi->used = 1;
+  if (pi->at_end) {
+    return NULL;
+  }
+  
+  status = readLine(pi, perr);
+  if (status < 1) {
+    pi->at_end = 1;
+    return NULL;
+  }
+  return (const char *) pi->pLine;
+}
+
+/*
+ * opl_input_seek function.
+ */
+int opl_input_seek(
+    OPL_INPUT * pi,
+    size_t      pos,
+    int32_t     chip,
+    int64_t     t,
+    int       * perr) {
+    
+  /* Check parameters */
+  if ((pi == NULL) || (perr == NULL)) {
+    abort();
+  }
+  
+  if ((pi->kind != OPL_INPUT_BINARY) || (!(pi->open)) ||
+      (pos < pi->body) || (pos > pi->data_len) ||
+      (chip < 0) || (chip >= pi->chips) || (t < 0)) {
+    *perr = OPL_INPUT_ERR_SEEK;
+    return 0;
+  }
+  
+  pi->data_pos = pos;
+  pi->chip = chip;
+  pi->t = t;
+  pi->frame = 0;
+  pi->used = 1;
+  pi->at_end = 0;
+  if (!toFrame(pi, perr)) {
+    *perr = OPL_INPUT_ERR_SEEK;
+    return 0;
+  }
+  
+  *perr = OPL_INPUT_ERR_NONE;
+  return 1;
+}
+
+/*
+ * opl_input_kind function.
+ */
+int opl_input_kind(const OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  return pi->kind;
+}
+
+/*
+ * opl_input_rate function.
+ */
+int32_t opl_input_rate(const OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  return pi->ctl_rate;
+}
+
+/*
+ * opl_input_chips function.
+ */
+int32_t opl_input_chips(const OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  return pi->chips;
+}
+
+/*
+ * opl_input_time function.
+ */
+int64_t opl_input_time(const OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  return pi->t;
+}
+
+/*
+ * opl_input_frame function.
+ */
+int64_t opl_input_frame(const OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  return pi->frame;
+}
+
+/*
+ * opl_input_line function.
+ */
+int32_t opl_input_line(const OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  return pi->line_count;
+}
+
+/*
+ * opl_input_tell function.
+ */
+size_t opl_input_tell(const OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  if (pi->kind != OPL_INPUT_BINARY) {
+    return 0;
+  }
+  return pi->data_pos;
+}
+
+/*
+ * opl_input_size function.
+ */
+size_t opl_input_size(const OPL_INPUT *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  if (pi->kind != OPL_INPUT_BINARY) {
+    return 0;
+  }
+  return pi->data_len;
+}
+
+/*
+ * opl_input_blank function.
+ */
+int opl_input_blank(const char *pstr) {
+  if (pstr == NULL) {
+    abort();
+  }
+  return isBlank((const uint8_t *) pstr);
+}
+
+/*
+ * opl_input_parse_int function.
+ */
+const char *opl_input_parse_int(const char *pstr, int32_t *pv) {
+  if ((pstr == NULL) || (pv == NULL)) {
+    abort();
+  }
+  return (const char *) parseInt((const uint8_t *) pstr, pv);
+}
+
+/*
+ * opl_input_errstr function.
+ */
+const char *opl_input_errstr(int code) {
+  const char *pResult = NULL;
+  
+  switch (code) {
+    case OPL_INPUT_ERR_NONE:
+      pResult = "No error";
+      break;
+      
+    case OPL_INPUT_ERR_OPEN:
+      pResult = "Failed to open input file";
+      break;
+      
+    case OPL_INPUT_ERR_IO:
+      pResult = "I/O error reading input";
+      break;
+      
+    case OPL_INPUT_ERR_MEM:
+      pResult = "Memory allocation failed";
+      break;
+      
+    case OPL_INPUT_ERR_HEADER:
+      pResult = "Input does not have a valid header";
+      break;
+      
+    case OPL_INPUT_ERR_RATE:
+      pResult = "Control rate out of range";
+      break;
+      
+    case OPL_INPUT_ERR_CHIPS:
+      pResult = "Chip count out of range";
+      break;
+      
+    case OPL_INPUT_ERR_LINE:
+      pResult = "Line has invalid characters or is too long";
+      break;
+      
+    case OPL_INPUT_ERR_SYNTAX:
+      pResult = "Invalid command syntax";
+      break;
+      
+    case OPL_INPUT_ERR_STREAM:
+      pResult = "Truncated or invalid binary event";
+      break;
+      
+    case OPL_INPUT_ERR_VGM:
+      pResult = "Invalid VGM data";
+      break;
+      
+    case OPL_INPUT_ERR_OPCODE:
+      pResult = "Unsupported VGM opcode";
+      break;
+      
+    case OPL_INPUT_ERR_WAIT:
+      pResult = "Wait must be at least one cycle";
+      break;
+      
+    case OPL_INPUT_ERR_CHIP:
+      pResult = "Chip select out of range";
+      break;
+      
+    case OPL_INPUT_ERR_TIME:
+      pResult = "Time offset out of range";
+      break;
+      
+    case OPL_INPUT_ERR_SEEK:
+      pResult = "Input can not go to the position";
+      break;
+      
+    case OPL_INPUT_ERR_KIND:
+      pResult = "VGM input must be read from a file";
+      break;
+      
+    default:
+      pResult = "Unknown error";
+  }
+  
+  return pResult;
+}
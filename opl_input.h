@@ -0,0 +1,561 @@
+#ifndef OPL_INPUT_H_INCLUDED
+#define OPL_INPUT_H_INCLUDED
+
+/*
+ * opl_input.h
+ * ===========
+ * 
+ * Decoder for the inputs of the OPL2 renderers.
+ * 
+ * An input is an OPL2 hardware script, a compiled binary event stream,
+ * or a VGM or VGZ file.  The decoder checks the header of the input and
+ * then decodes the rest into a sequence of register write, wait, and
+ * chip select events that look the same for every kind of input.  Both
+ * retro_opl and the render library in opl_render.h read their inputs
+ * through this decoder, so they accept exactly the same inputs and
+ * time them exactly the same way.
+ * 
+ * The decoder keeps the time of the input.  Each wait event carries the
+ * time in control cycles since the start of the input, converted into
+ * a frame offset at the frame rate of the decoder, which is the rate
+ * the emulator runs at.  The offset is rounded down and computed
+ * exactly in integers.
+ * 
+ * Scripts are read in large blocks, and each line is parsed in place
+ * in the block buffer.  Binary event streams are memory-mapped.  VGM
+ * files are streamed by the VGM reader in vgm_reader.h.  Scripts and
+ * binary event streams can also be decoded straight from memory.
+ * 
+ * The decoder can also read the lines of other text files in the same
+ * format as script lines, such as the batch manifests of retro_opl.
+ * 
+ * A decoder can be used for any number of inputs one after another.
+ * Its buffers and its VGM reader are kept between inputs, so a decoder
+ * that is reused only allocates what zlib needs for each VGZ file.
+ * 
+ * Separate decoders may be used concurrently from separate threads.
+ * 
+ * You must compile with vgm_reader.c and link with zlib.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Error codes.
+ * 
+ * Use opl_input_errstr() to get an error message for a code.
+ */
+#define OPL_INPUT_ERR_NONE    (0)   /* No error */
+#define OPL_INPUT_ERR_OPEN    (1)   /* Failed to open file */
+#define OPL_INPUT_ERR_IO      (2)   /* I/O error reading input */
+#define OPL_INPUT_ERR_MEM     (3)   /* Memory allocation failed */
+#define OPL_INPUT_ERR_HEADER  (4)   /* Missing or invalid header */
+#define OPL_INPUT_ERR_RATE    (5)   /* Control rate out of range */
+#define OPL_INPUT_ERR_CHIPS   (6)   /* Chip count out of range */
+#define OPL_INPUT_ERR_LINE    (7)   /* Invalid character or long line */
+#define OPL_INPUT_ERR_SYNTAX  (8)   /* Invalid command syntax */
+#define OPL_INPUT_ERR_STREAM  (9)   /* Truncated or invalid event */
+#define OPL_INPUT_ERR_VGM     (10)  /* Invalid VGM data */
+#define OPL_INPUT_ERR_OPCODE  (11)  /* Unsupported VGM opcode */
+#define OPL_INPUT_ERR_WAIT    (12)  /* Wait of zero cycles */
+#define OPL_INPUT_ERR_CHIP    (13)  /* Chip select out of range */
+#define OPL_INPUT_ERR_TIME    (14)  /* Time out of range */
+#define OPL_INPUT_ERR_SEEK    (15)  /* Input can not go to position */
+#define OPL_INPUT_ERR_KIND    (16)  /* VGM input not from a file */
+
+/*
+ * The kinds of input.
+ * 
+ * OPL_INPUT_LINES is a text file that is only read line by line with
+ * opl_input_getline(), without any header or events.
+ */
+#define OPL_INPUT_TEXT   (0)   /* OPL2 hardware script */
+#define OPL_INPUT_BINARY (1)   /* Compiled binary event stream */
+#define OPL_INPUT_VGM    (2)   /* VGM or VGZ file */
+#define OPL_INPUT_LINES  (3)   /* Plain lines of text */
+
+/*
+ * Event types.
+ */
+#define OPL_INPUT_EVENT_END   (0)   /* End of the input */
+#define OPL_INPUT_EVENT_WRITE (1)   /* OPL2 register write */
+#define OPL_INPUT_EVENT_WAIT  (2)   /* Wait a number of control cycles */
+#define OPL_INPUT_EVENT_CHIP  (3)   /* Select the chip for writes */
+
+/*
+ * The largest number of chips an input may use.
+ */
+#define OPL_INPUT_CHIPS_MAX (2)
+
+/*
+ * The largest control rate in Hz.
+ */
+#define OPL_INPUT_RATE_MAX (192000)
+
+/*
+ * The largest number of characters in a line, not including the line
+ * break.
+ */
+#define OPL_INPUT_LINE_MAX (1023)
+
+/*
+ * Structure prototype for a decoder.
+ * 
+ * The actual structure is defined in the implementation.
+ */
+struct OPL_INPUT_TAG;
+typedef struct OPL_INPUT_TAG OPL_INPUT;
+
+/*
+ * Structure holding a decoded event.
+ */
+typedef struct {
+  
+  /*
+   * The event type, one of the OPL_INPUT_EVENT constants.
+   */
+  int type;
+  
+  /*
+   * For register writes, the OPL2 register and the value to write.
+   * The write goes to the chip selected by the last chip select event,
+   * or to the first chip if there was none.
+   */
+  uint8_t reg;
+  uint8_t val;
+  
+  /*
+   * For chip selects, the chip to select, which is zero for the first
+   * chip and always less than the chip count of the input.
+   */
+  int32_t chip;
+  
+  /*
+   * For waits, the number of control cycles to wait, which is always
+   * at least one.
+   */
+  int32_t cycles;
+  
+  /*
+   * For waits, the frame offset at the frame rate of the decoder that
+   * the wait ends at.  Offsets never move backward.
+   */
+  int64_t frame;
+  
+} OPL_INPUT_EVENT;
+
+/*
+ * Create a decoder with no input.
+ * 
+ * frame_rate is the rate that times are converted to frame offsets at.
+ * If it is zero, no frame offsets are computed, and the frame field of
+ * wait events is always zero.
+ * 
+ * If the decoder can not be allocated, NULL is returned and an error
+ * code is written to *perr.
+ * 
+ * Parameters:
+ * 
+ *   frame_rate - the frame rate in Hz, or zero
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   the new decoder, or NULL if there was an error
+ */
+OPL_INPUT *opl_input_new(int32_t frame_rate, int *perr);
+
+/*
+ * Free a decoder along with any input it has open.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder to free, or NULL
+ */
+void opl_input_free(OPL_INPUT *pi);
+
+/*
+ * Change the frame rate of a decoder.
+ * 
+ * The frame offset of an open input is converted to the new rate right
+ * away, so the rate is best changed while the input is at its start.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   frame_rate - the frame rate in Hz, or zero
+ */
+void opl_input_set_rate(OPL_INPUT *pi, int32_t frame_rate);
+
+/*
+ * Open an input file, replacing any input the decoder had.
+ * 
+ * The kind of input is detected from its first bytes, and the header
+ * is checked.  VGM and VGZ files use rep_count, which is 1 to decode
+ * the data once through, or 2 to loop back once using any looping
+ * information present in the VGM file.  VGM files are read as having
+ * a control rate of VGM_SAMPLE_RATE.
+ * 
+ * If there is an error, zero is returned, an error code is written to
+ * *perr, and the decoder has no input.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   pPath - the path to the input file
+ * 
+ *   rep_count - 1 for no loop, 2 for loop once
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_input_open(
+          OPL_INPUT * pi,
+    const char      * pPath,
+          int         rep_count,
+          int       * perr);
+
+/*
+ * Open an input in memory, replacing any input the decoder had.
+ * 
+ * This works like opl_input_open(), except that VGM and VGZ files are
+ * refused with OPL_INPUT_ERR_KIND.  The memory is not copied, so it
+ * must stay valid and unchanged until the decoder is done with it.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   pData - the whole input
+ * 
+ *   len - the length of the input in bytes
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_input_open_mem(
+          OPL_INPUT * pi,
+    const void      * pData,
+          size_t      len,
+          int       * perr);
+
+/*
+ * Open a script or a text file of plain lines from a stream that is
+ * already open, replacing any input the decoder had.
+ * 
+ * kind is OPL_INPUT_TEXT for a script, whose header is checked, or
+ * OPL_INPUT_LINES for plain lines.  Reading starts at the current
+ * position of the stream.  The stream is not closed by the decoder.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   pf - the stream
+ * 
+ *   kind - OPL_INPUT_TEXT or OPL_INPUT_LINES
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_input_open_stream(
+    OPL_INPUT * pi,
+    FILE      * pf,
+    int         kind,
+    int       * perr);
+
+/*
+ * Close the input of a decoder, so that it has no input.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ */
+void opl_input_close(OPL_INPUT *pi);
+
+/*
+ * Go back to the first event of the input.
+ * 
+ * The time goes back to zero and the first chip is selected.  If no
+ * event has been decoded since the input was opened or last rewound,
+ * this does nothing, so that a stream that can not be seeked can still
+ * be decoded once.  Otherwise, VGM files are opened again and streams
+ * are seeked back to their start, which fails with OPL_INPUT_ERR_SEEK
+ * if the stream can not be seeked.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_input_rewind(OPL_INPUT *pi, int *perr);
+
+/*
+ * Decode the next event.
+ * 
+ * Script lines that are blank or start with an apostrophe are skipped.
+ * Once OPL_INPUT_EVENT_END has been returned, all further calls also
+ * return OPL_INPUT_EVENT_END.
+ * 
+ * If there is an error, zero is returned and an error code is written
+ * to *perr.  For scripts, opl_input_line() is then the line with the
+ * error, and for binary event streams, opl_input_tell() is the offset
+ * of the event with the error.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   pe - the structure to receive the event
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_input_next(OPL_INPUT *pi, OPL_INPUT_EVENT *pe, int *perr);
+
+/*
+ * Read the next line of a text file opened as OPL_INPUT_LINES.
+ * 
+ * The line has no line break, and it is checked for invalid characters
+ * and excessive length in the same way as script lines.  It is stored
+ * in place in the block buffer, so it is only valid until the next
+ * line is read.
+ * 
+ * At the end of the file, NULL is returned and *perr is set to
+ * OPL_INPUT_ERR_NONE.  If there is an error, NULL is returned and an
+ * error code is written to *perr.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   the line as a nul-terminated string, or NULL at the end of the file
+ *   or if there was an error
+ */
+const char *opl_input_getline(OPL_INPUT *pi, int *perr);
+
+/*
+ * Move a binary event stream to a saved position.
+ * 
+ * The position is a byte offset returned by opl_input_tell() after a
+ * wait event, along with the chip selected and the time at that point.
+ * The frame offset is computed from the time again, so it can be
+ * compared with a saved one to check that the position belongs to the
+ * input.
+ * 
+ * If the input is not a binary event stream, or the position or the
+ * chip is out of range, zero is returned and OPL_INPUT_ERR_SEEK is
+ * written to *perr.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ *   pos - the byte offset of the next event
+ * 
+ *   chip - the selected chip
+ * 
+ *   t - the time in control cycles
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_input_seek(
+    OPL_INPUT * pi,
+    size_t      pos,
+    int32_t     chip,
+    int64_t     t,
+    int       * perr);
+
+/*
+ * Return the kind of the open input, one of the OPL_INPUT kinds.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the kind of input
+ */
+int opl_input_kind(const OPL_INPUT *pi);
+
+/*
+ * Return the control rate of the open input in Hz.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the control rate, in range [1, OPL_INPUT_RATE_MAX]
+ */
+int32_t opl_input_rate(const OPL_INPUT *pi);
+
+/*
+ * Return the number of chips the open input uses.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the chip count, in range [1, OPL_INPUT_CHIPS_MAX]
+ */
+int32_t opl_input_chips(const OPL_INPUT *pi);
+
+/*
+ * Return the time of the open input in control cycles since its start.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the time in control cycles
+ */
+int64_t opl_input_time(const OPL_INPUT *pi);
+
+/*
+ * Return the frame offset of the open input, which is its time
+ * converted to the frame rate.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the frame offset
+ */
+int64_t opl_input_frame(const OPL_INPUT *pi);
+
+/*
+ * Return the number of the last line read from a script or text file,
+ * which is zero before the first line has been read and for other
+ * kinds of input.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the line number
+ */
+int32_t opl_input_line(const OPL_INPUT *pi);
+
+/*
+ * Return the byte offset of the next event of a binary event stream,
+ * which is zero for other kinds of input.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the byte offset
+ */
+size_t opl_input_tell(const OPL_INPUT *pi);
+
+/*
+ * Return the length of a binary event stream in bytes, which is zero
+ * for other kinds of input.
+ * 
+ * Parameters:
+ * 
+ *   pi - the decoder
+ * 
+ * Return:
+ * 
+ *   the length in bytes
+ */
+size_t opl_input_size(const OPL_INPUT *pi);
+
+/*
+ * Check whether a string is blank.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the string
+ * 
+ * Return:
+ * 
+ *   non-zero if the string is empty or only contains tabs and spaces,
+ *   zero otherwise
+ */
+int opl_input_blank(const char *pstr);
+
+/*
+ * Parse an unsigned decimal integer from a string.
+ * 
+ * Parsing skips any spaces and tabs, then reads a sequence of at least
+ * one decimal digit.  This is how scripts parse their numbers, and it
+ * lets other line formats read by the decoder parse theirs the same
+ * way.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the location to start parsing
+ * 
+ *   pv - variable to receive the parsed integer value
+ * 
+ * Return:
+ * 
+ *   pointer to character immediately after decimal integer that was
+ *   parsed, or NULL if parsing failed or the value overflowed
+ */
+const char *opl_input_parse_int(const char *pstr, int32_t *pv);
+
+/*
+ * Get an error message for an error code.
+ * 
+ * The message does not have any punctuation at the end.  An unknown
+ * error code returns a generic message.
+ * 
+ * Parameters:
+ * 
+ *   code - the error code
+ * 
+ * Return:
+ * 
+ *   the error message
+ */
+const char *opl_input_errstr(int code);
+
+#endif
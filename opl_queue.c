@@ -0,0 +1,308 @@
+/*
+ * opl_queue.c
+ * ===========
+ * 
+ * Implementation of opl_queue.h
+ * 
+ * See the header for further information.
+ * 
+ * The ring buffer uses C11 atomics.  The producer owns the tail index
+ * and the consumer owns the head index.  Each side publishes its index
+ * with a release store and reads the other side's index with an
+ * acquire load, so the contents of a slot are always visible before
+ * the index that covers it.  The two indices are kept on separate
+ * cache lines so that the threads do not keep stealing the same line
+ * from each other.
+ */
+
+#include "opl_queue.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The maximum capacity of a queue.
+ */
+#define MAX_CAPACITY (INT32_C(1) << 24)
+
+/*
+ * The assumed size of a cache line in bytes.
+ */
+#define CACHE_LINE (64)
+
+/*
+ * The maximum number of queued writes that opl_queue_render() hands to
+ * the driver with a single block of samples.
+ */
+#define RENDER_BATCH (256)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * OPL_QUEUE structure.
+ * 
+ * Prototype given in header.
+ */
+struct OPL_QUEUE_TAG {
+  
+  /*
+   * The index of the next slot to read, which is only written by the
+   * consumer.
+   */
+  _Alignas(CACHE_LINE) atomic_uint_least32_t head;
+  
+  /*
+   * The number of late writes, which is only used by the consumer.
+   */
+  int32_t late;
+  
+  /*
+   * The index of the next slot to write, which is only written by the
+   * producer.
+   */
+  _Alignas(CACHE_LINE) atomic_uint_least32_t tail;
+  
+  /*
+   * The end of the stream, or -1 if the end is not known yet.  This is
+   * only written by the producer.
+   */
+  atomic_int_least64_t end;
+  
+  /*
+   * The ring buffer, its capacity, and the mask that maps indices to
+   * slots.  These do not change after the queue is created.
+   */
+  _Alignas(CACHE_LINE) OPL_QWRITE *pRing;
+  uint32_t capacity;
+  uint32_t mask;
+};
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * opl_queue_new function.
+ */
+OPL_QUEUE *opl_queue_new(int32_t capacity) {
+  OPL_QUEUE *pq = NULL;
+  
+  /* Check parameter */
+  if ((capacity < 2) || (capacity > MAX_CAPACITY) ||
+      ((capacity & (capacity - 1)) != 0)) {
+    abort();
+  }
+  
+  /* Allocate the queue, aligned so the indices are on their own cache
+   * lines */
+  pq = (OPL_QUEUE *) aligned_alloc(_Alignof(OPL_QUEUE),
+                                   sizeof(OPL_QUEUE));
+  if (pq == NULL) {
+    return NULL;
+  }
+  
+  /* Allocate the ring buffer */
+  pq->pRing = (OPL_QWRITE *) calloc((size_t) capacity,
+                                    sizeof(OPL_QWRITE));
+  if (pq->pRing == NULL) {
+    free(pq);
+    return NULL;
+  }
+  
+  /* Initialize the rest of the queue */
+  pq->capacity = (uint32_t) capacity;
+  pq->mask = (uint32_t) (capacity - 1);
+  pq->late = 0;
+  atomic_init(&(pq->head), 0);
+  atomic_init(&(pq->tail), 0);
+  atomic_init(&(pq->end), -1);
+  
+  return pq;
+}
+
+/*
+ * opl_queue_free function.
+ */
+void opl_queue_free(OPL_QUEUE *pq) {
+  if (pq != NULL) {
+    free(pq->pRing);
+    pq->pRing = NULL;
+    free(pq);
+  }
+}
+
+/*
+ * opl_queue_push function.
+ */
+int opl_queue_push(OPL_QUEUE *pq, const OPL_QWRITE *pw) {
+  
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  
+  /* Check parameters */
+  if ((pq == NULL) || (pw == NULL)) {
+    abort();
+  }
+  
+  /* Fail if the queue is full; the indices run freely and wrap
+   * around, so their difference is the number of queued writes */
+  tail = (uint32_t) atomic_load_explicit(
+                      &(pq->tail), memory_order_relaxed);
+  head = (uint32_t) atomic_load_explicit(
+                      &(pq->head), memory_order_acquire);
+  if (tail - head >= pq->capacity) {
+    return 0;
+  }
+  
+  /* Fill the slot and then publish it */
+  (pq->pRing)[tail & pq->mask] = *pw;
+  atomic_store_explicit(&(pq->tail), tail + 1, memory_order_release);
+  
+  return 1;
+}
+
+/*
+ * opl_queue_end function.
+ */
+void opl_queue_end(OPL_QUEUE *pq, int64_t offs) {
+  /* Check parameters */
+  if ((pq == NULL) || (offs < 0)) {
+    abort();
+  }
+  
+  /* Publish the end after all the writes */
+  atomic_store_explicit(&(pq->end), offs, memory_order_release);
+}
+
+/*
+ * opl_queue_ended function.
+ */
+int opl_queue_ended(OPL_QUEUE *pq, int64_t *pOffs) {
+  int64_t offs = 0;
+  
+  /* Check parameters */
+  if ((pq == NULL) || (pOffs == NULL)) {
+    abort();
+  }
+  
+  /* Check for the end */
+  offs = (int64_t) atomic_load_explicit(
+                    &(pq->end), memory_order_acquire);
+  if (offs < 0) {
+    return 0;
+  }
+  
+  *pOffs = offs;
+  return 1;
+}
+
+/*
+ * opl_queue_render function.
+ */
+void opl_queue_render(
+    OPL_QUEUE   * pq,
+    OPL_CONTEXT * pc,
+    int64_t       pos,
+    int16_t     * pbuf,
+    int32_t       count) {
+  
+  OPL_EVENT ev[RENDER_BATCH];
+  const OPL_QWRITE *pw = NULL;
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  int32_t i = 0;
+  int32_t n = 0;
+  int32_t k = 0;
+  
+  /* Check parameters */
+  if ((pq == NULL) || (pc == NULL) || (pos < 0) || (pbuf == NULL) ||
+      (count < 1) || (pos > INT64_MAX - count)) {
+    abort();
+  }
+  
+  head = (uint32_t) atomic_load_explicit(
+                      &(pq->head), memory_order_relaxed);
+  
+  while (i < count) {
+    
+    /* See what the producer has published so far */
+    tail = (uint32_t) atomic_load_explicit(
+                        &(pq->tail), memory_order_acquire);
+    
+    /* Apply all writes that take effect at the current offset, and
+     * count the ones that should have been applied earlier */
+    while (head != tail) {
+      pw = &((pq->pRing)[head & pq->mask]);
+      if (pw->offs > pos + i) {
+        break;
+      }
+      if (pw->offs < pos + i) {
+        (pq->late)++;
+      }
+      opl_ctx_write(pc, pw->reg, pw->val);
+      head++;
+    }
+    
+    /* Gather the writes inside the rest of the range, so that the
+     * driver applies them while generating; if the batch fills up, or a
+     * write does not fit in an OPL_EVENT, the block ends at that write
+     * instead */
+    n = count - i;
+    k = 0;
+    while (head != tail) {
+      pw = &((pq->pRing)[head & pq->mask]);
+      if (pw->offs - (pos + i) >= (int64_t) n) {
+        break;
+      }
+      if ((k >= RENDER_BATCH) ||
+          (pw->reg < 0) || (pw->reg > 255) ||
+          (pw->val < 0) || (pw->val > 255)) {
+        n = (int32_t) (pw->offs - (pos + i));
+        break;
+      }
+      ev[k].offs = (int32_t) (pw->offs - (pos + i));
+      ev[k].reg = (uint8_t) pw->reg;
+      ev[k].val = (uint8_t) pw->val;
+      k++;
+      head++;
+    }
+    
+    /* Writes at the offset where the block ended early belong to the
+     * next block, so put them back into the queue */
+    while (k > 0) {
+      if (ev[k - 1].offs < n) {
+        break;
+      }
+      k--;
+      head--;
+    }
+    
+    /* Release the slots that were applied or gathered */
+    atomic_store_explicit(&(pq->head), head, memory_order_release);
+    
+    /* Generate the block */
+    opl_ctx_generate_events(pc, pbuf + i, n, 1, ev, k);
+    i += n;
+  }
+}
+
+/*
+ * opl_queue_late function.
+ */
+int32_t opl_queue_late(const OPL_QUEUE *pq) {
+  if (pq == NULL) {
+    abort();
+  }
+  return pq->late;
+}
@@ -0,0 +1,189 @@
+#ifndef OPL_QUEUE_H_INCLUDED
+#define OPL_QUEUE_H_INCLUDED
+
+/*
+ * opl_queue.h
+ * ===========
+ * 
+ * Lock-free queue of timestamped OPL register writes.
+ * 
+ * The queue connects a control thread that produces register writes,
+ * such as a sequencer, with an audio thread that generates samples.
+ * Only the audio thread ever touches the emulator context, so the
+ * register writes and the sample generation can not race with each
+ * other.  The audio thread pulls samples with opl_queue_render(),
+ * which applies each queued write right before the sample at its
+ * timestamp.
+ * 
+ * The queue is a fixed-size ring buffer with a single producer and a
+ * single consumer.  Neither side ever takes a lock or blocks.  If the
+ * queue is full, opl_queue_push() fails and the producer can decide
+ * what to do, such as waiting a bit and trying again.  If several
+ * threads produce register writes, they must make sure that only one
+ * of them pushes at a time.
+ * 
+ * Timestamps are sample offsets from the start of the stream, and they
+ * must not decrease from one push to the next.  Writes that arrive
+ * after their sample has already been generated are applied as soon
+ * as possible and counted as late.
+ * 
+ * You must link with the opl_driver implementation.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "opl_driver.h"
+
+/*
+ * Structure prototype for a register write queue.
+ * 
+ * The actual structure is defined in the implementation.
+ */
+struct OPL_QUEUE_TAG;
+typedef struct OPL_QUEUE_TAG OPL_QUEUE;
+
+/*
+ * A timestamped register write.
+ */
+typedef struct {
+  
+  /*
+   * The sample offset at which the write takes effect.
+   */
+  int64_t offs;
+  
+  /*
+   * The OPL hardware register index and the value to write.
+   */
+  int32_t reg;
+  int32_t val;
+  
+} OPL_QWRITE;
+
+/*
+ * Create a new, empty register write queue.
+ * 
+ * The capacity is the number of writes the queue can hold.  It must be
+ * a power of two in range [2, 2^24].
+ * 
+ * Parameters:
+ * 
+ *   capacity - the capacity of the queue
+ * 
+ * Return:
+ * 
+ *   the new queue, or NULL if memory allocation failed
+ */
+OPL_QUEUE *opl_queue_new(int32_t capacity);
+
+/*
+ * Free a register write queue.
+ * 
+ * Neither the producer nor the consumer may be using the queue.  If
+ * NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pq - the queue to free, or NULL
+ */
+void opl_queue_free(OPL_QUEUE *pq);
+
+/*
+ * Push a register write onto the queue.
+ * 
+ * This may only be called from the producer thread.  It never blocks.
+ * 
+ * Parameters:
+ * 
+ *   pq - the queue
+ * 
+ *   pw - the register write to push
+ * 
+ * Return:
+ * 
+ *   non-zero if the write was queued, zero if the queue is full
+ */
+int opl_queue_push(OPL_QUEUE *pq, const OPL_QWRITE *pw);
+
+/*
+ * Indicate that the stream ends at the given sample offset.
+ * 
+ * This may only be called from the producer thread, after the last
+ * write has been pushed.  It may only be called once.
+ * 
+ * Parameters:
+ * 
+ *   pq - the queue
+ * 
+ *   offs - the sample offset of the end of the stream
+ */
+void opl_queue_end(OPL_QUEUE *pq, int64_t offs);
+
+/*
+ * Check whether the producer has indicated the end of the stream.
+ * 
+ * This may only be called from the consumer thread.  Once this returns
+ * non-zero, all writes of the stream are in the queue.
+ * 
+ * Parameters:
+ * 
+ *   pq - the queue
+ * 
+ *   pOffs - variable to receive the sample offset of the end of the
+ *   stream, if it is known
+ * 
+ * Return:
+ * 
+ *   non-zero if the end of the stream is known, zero otherwise
+ */
+int opl_queue_ended(OPL_QUEUE *pq, int64_t *pOffs);
+
+/*
+ * Generate samples while applying queued register writes.
+ * 
+ * This may only be called from the consumer thread.  It never blocks.
+ * 
+ * The samples at offsets pos up to pos + count - 1 are generated.
+ * Each queued write with a timestamp in that range is applied right
+ * before the sample at its timestamp.  Queued writes with a timestamp
+ * before pos are late, and they are applied before the first sample.
+ * Writes with timestamps after the range stay in the queue.
+ * 
+ * Parameters:
+ * 
+ *   pq - the queue
+ * 
+ *   pc - the emulator context
+ * 
+ *   pos - the sample offset of the first sample to generate
+ * 
+ *   pbuf - pointer to the sample buffer to fill
+ * 
+ *   count - the number of samples to generate, greater than zero
+ */
+void opl_queue_render(
+    OPL_QUEUE   * pq,
+    OPL_CONTEXT * pc,
+    int64_t       pos,
+    int16_t     * pbuf,
+    int32_t       count);
+
+/*
+ * Return the number of writes that opl_queue_render() has applied
+ * late.
+ * 
+ * This may only be called from the consumer thread, or after the
+ * consumer thread has stopped.
+ * 
+ * Parameters:
+ * 
+ *   pq - the queue
+ * 
+ * Return:
+ * 
+ *   the number of late writes
+ */
+int32_t opl_queue_late(const OPL_QUEUE *pq);
+
+#endif
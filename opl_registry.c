@@ -0,0 +1,358 @@
+/*
+ * opl_registry.c
+ * ==============
+ * 
+ * Implementation of opl_driver.h that dispatches to the emulator core
+ * backends declared in opl_core.h.
+ * 
+ * All the cores are compiled into the program, and the core is chosen
+ * at runtime with opl_core_select().  Each context records the core
+ * that created it, and every context function calls through to that
+ * core.  The first core in the table is selected by default.
+ */
+
+#include "opl_core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * OPL_CONTEXT structure.
+ * 
+ * Prototype given in header.
+ */
+struct OPL_CONTEXT_TAG {
+  
+  /*
+   * The core that created the context.
+   */
+  const OPL_CORE *pCore;
+  
+  /*
+   * The context of the core.
+   */
+  void *pImpl;
+};
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The table of available cores, with the default core first.
+ */
+static const OPL_CORE *core_table[] = {
+  &opl_core_dosbox,
+  &opl_core_null,
+  &opl_core_native,
+  &opl_core_native_scalar,
+  &opl_core_native_preview
+};
+
+/*
+ * The currently selected core.
+ */
+static const OPL_CORE *pSelected = &opl_core_dosbox;
+
+/*
+ * The number of contexts that currently exist.
+ */
+static int32_t ctx_count = 0;
+
+/*
+ * The default context used by opl_init() and related functions, or
+ * NULL if there is no default context.
+ */
+static OPL_CONTEXT *pDefault = NULL;
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * opl_core_count function.
+ */
+int32_t opl_core_count(void) {
+  return (int32_t) (sizeof(core_table) / sizeof(core_table[0]));
+}
+
+/*
+ * opl_core_key function.
+ */
+const char *opl_core_key(int32_t i) {
+  /* Check parameter */
+  if ((i < 0) || (i >= opl_core_count())) {
+    abort();
+  }
+  
+  return core_table[i]->pKey;
+}
+
+/*
+ * opl_core_select function.
+ */
+int opl_core_select(const char *pKey) {
+  int32_t i = 0;
+  
+  /* Check parameter and state */
+  if ((pKey == NULL) || (ctx_count > 0)) {
+    abort();
+  }
+  
+  /* Look up the core */
+  for(i = 0; i < opl_core_count(); i++) {
+    if (strcmp(core_table[i]->pKey, pKey) == 0) {
+      pSelected = core_table[i];
+      return 1;
+    }
+  }
+  
+  return 0;
+}
+
+/*
+ * opl_ctx_name function.
+ */
+const char *opl_ctx_name(void) {
+  return pSelected->pName;
+}
+
+/*
+ * opl_ctx_limit function.
+ */
+int32_t opl_ctx_limit(void) {
+  return pSelected->limit;
+}
+
+/*
+ * opl_ctx_rate function.
+ */
+int32_t opl_ctx_rate(int32_t sample_rate) {
+  return pSelected->rate(sample_rate);
+}
+
+/*
+ * opl_ctx_new function.
+ */
+OPL_CONTEXT *opl_ctx_new(int32_t sample_rate) {
+  OPL_CONTEXT *pc = NULL;
+  
+  /* Allocate the wrapper */
+  pc = (OPL_CONTEXT *) malloc(sizeof(OPL_CONTEXT));
+  if (pc == NULL) {
+    return NULL;
+  }
+  
+  /* Create the context of the selected core */
+  pc->pCore = pSelected;
+  pc->pImpl = pSelected->ctx_new(sample_rate);
+  if (pc->pImpl == NULL) {
+    free(pc);
+    return NULL;
+  }
+  
+  ctx_count++;
+  return pc;
+}
+
+/*
+ * opl_ctx_free function.
+ */
+void opl_ctx_free(OPL_CONTEXT *pc) {
+  if (pc != NULL) {
+    pc->pCore->ctx_free(pc->pImpl);
+    free(pc);
+    ctx_count--;
+  }
+}
+
+/*
+ * opl_ctx_reset function.
+ */
+void opl_ctx_reset(OPL_CONTEXT *pc, int32_t sample_rate) {
+  if (pc == NULL) {
+    abort();
+  }
+  pc->pCore->reset(pc->pImpl, sample_rate);
+}
+
+/*
+ * opl_ctx_write function.
+ */
+void opl_ctx_write(OPL_CONTEXT *pc, int32_t reg, int32_t val) {
+  if (pc == NULL) {
+    abort();
+  }
+  pc->pCore->write(pc->pImpl, reg, val);
+}
+
+/*
+ * opl_ctx_write_bulk function.
+ */
+void opl_ctx_write_bulk(
+          OPL_CONTEXT * pc,
+    const uint8_t     * pPairs,
+          int32_t       count) {
+  
+  if (pc == NULL) {
+    abort();
+  }
+  pc->pCore->write_bulk(pc->pImpl, pPairs, count);
+}
+
+/*
+ * opl_ctx_generate function.
+ */
+void opl_ctx_generate(OPL_CONTEXT *pc, int16_t *pbuf, int32_t count) {
+  if (pc == NULL) {
+    abort();
+  }
+  pc->pCore->generate(pc->pImpl, pbuf, count);
+}
+
+/*
+ * opl_ctx_generate_stride function.
+ */
+void opl_ctx_generate_stride(
+    OPL_CONTEXT * pc,
+    int16_t     * pbuf,
+    int32_t       count,
+    int32_t       stride) {
+  
+  if (pc == NULL) {
+    abort();
+  }
+  pc->pCore->generate_stride(pc->pImpl, pbuf, count, stride);
+}
+
+/*
+ * opl_ctx_generate_events function.
+ */
+void opl_ctx_generate_events(
+          OPL_CONTEXT * pc,
+          int16_t     * pbuf,
+          int32_t       count,
+          int32_t       stride,
+    const OPL_EVENT   * pEv,
+          int32_t       ev_count) {
+  
+  if (pc == NULL) {
+    abort();
+  }
+  pc->pCore->generate_events(
+      pc->pImpl, pbuf, count, stride, pEv, ev_count);
+}
+
+/*
+ * opl_ctx_set_skip function.
+ */
+void opl_ctx_set_skip(OPL_CONTEXT *pc, int enable) {
+  if (pc == NULL) {
+    abort();
+  }
+  pc->pCore->set_skip(pc->pImpl, enable);
+}
+
+/*
+ * opl_ctx_idle function.
+ */
+int opl_ctx_idle(const OPL_CONTEXT *pc) {
+  if (pc == NULL) {
+    abort();
+  }
+  return pc->pCore->idle(pc->pImpl);
+}
+
+/*
+ * opl_ctx_state_size function.
+ */
+int32_t opl_ctx_state_size(void) {
+  return pSelected->state_size;
+}
+
+/*
+ * opl_ctx_state_exact function.
+ */
+int opl_ctx_state_exact(void) {
+  return pSelected->state_exact;
+}
+
+/*
+ * opl_ctx_save function.
+ */
+void opl_ctx_save(const OPL_CONTEXT *pc, uint8_t *pState) {
+  if (pc == NULL) {
+    abort();
+  }
+  pc->pCore->save(pc->pImpl, pState);
+}
+
+/*
+ * opl_ctx_restore function.
+ */
+int opl_ctx_restore(OPL_CONTEXT *pc, const uint8_t *pState) {
+  if (pc == NULL) {
+    abort();
+  }
+  return pc->pCore->restore(pc->pImpl, pState);
+}
+
+/*
+ * opl_init function.
+ */
+void opl_init(int32_t sample_rate) {
+  /* Check state */
+  if (pDefault != NULL) {
+    abort();
+  }
+  
+  /* Create the default context */
+  pDefault = opl_ctx_new(sample_rate);
+  if (pDefault == NULL) {
+    abort();
+  }
+}
+
+/*
+ * opl_finish function.
+ */
+void opl_finish(void) {
+  /* Free the default context */
+  opl_ctx_free(pDefault);
+  pDefault = NULL;
+}
+
+/*
+ * opl_write function.
+ */
+void opl_write(int32_t reg, int32_t val) {
+  /* Check state */
+  if (pDefault == NULL) {
+    abort();
+  }
+  
+  /* Call through */
+  opl_ctx_write(pDefault, reg, val);
+}
+
+/*
+ * opl_generate function.
+ */
+void opl_generate(int16_t *pbuf, int32_t count) {
+  /* Check state */
+  if (pDefault == NULL) {
+    abort();
+  }
+  
+  /* Call through */
+  opl_ctx_generate(pDefault, pbuf, count);
+}
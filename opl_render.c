@@ -0,0 +1,1452 @@
+/*
+ * opl_render.c
+ * ============
+ * 
+ * Implementation of opl_render.h
+ * 
+ * See the header for further information.
+ * 
+ * The input is decoded by the decoder in opl_input.h, the same one
+ * that retro_opl uses, and its events are handled the same way as in
+ * retro_opl.  Register writes are queued for each chip with their
+ * offsets from the synthesis offset, and synthesis runs over a whole
+ * block of frames with the queued writes applied at their offsets.
+ * The difference is that the input is decoded on demand: each pull
+ * decodes just far enough ahead to cover the next block of frames it
+ * needs, and then synthesizes that block directly into the caller's
+ * buffer, or into the sample rate converter when resampling.
+ * 
+ * If the write queue of a chip fills up within a block, the frames up
+ * to the current offset are synthesized into a holding buffer, so that
+ * the writes can be applied directly.  Decoding only goes on once the
+ * holding buffer has been passed on to the output.  Since writes are
+ * only decoded while the current offset lies within one block of the
+ * synthesis offset, the holding buffer never needs more than one
+ * block.
+ * 
+ * A checkpoint stops decoding right after the wait event that reaches
+ * it, so that synthesis runs up to the end of the wait with nothing
+ * queued after it.  The checkpoint function is called once synthesis
+ * gets there, and decoding then goes on.
+ * 
+ * A render is a session that can handle any number of inputs one after
+ * another.  The emulator contexts, coalescers, sample rate converters,
+ * and decoder it creates are kept when an input is dropped, and are
+ * reset rather than created again for the next input, so that a render
+ * that is reused stops allocating once it has seen every chip count.
+ */
+
+#include "opl_render.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opl_coalesce.h"
+#include "opl_driver.h"
+#include "opl_input.h"
+#include "resample.h"
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of samples in a block of synthesis.  Each block holds
+ * this number of samples divided by the chip count in frames.
+ */
+#define BUFFER_SAMPLES (4096)
+
+/*
+ * The maximum number of register writes queued for each chip.
+ */
+#define EVENT_BATCH (1024)
+
+/*
+ * The maximum number of chips.
+ */
+#define MAX_CHIPS (OPL_INPUT_CHIPS_MAX)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * OPL_RENDER structure.
+ * 
+ * Prototype given in header.
+ */
+struct OPL_RENDER_TAG {
+  
+  /*
+   * The emulator context of each chip, or NULL if no input has used
+   * the chip yet.
+   */
+  OPL_CONTEXT *pc[MAX_CHIPS];
+  
+  /*
+   * Flag for each chip set once an input has used its context, so that
+   * it must be reset before the next input uses it.
+   */
+  int dirty[MAX_CHIPS];
+  
+  /*
+   * The register write coalescer of each chip, or NULL if writes are
+   * not coalesced or no input has used the chip yet.
+   */
+  OPL_COALESCE *pcs[MAX_CHIPS];
+  
+  /*
+   * The sample rate converter for each chip count, or NULL if no input
+   * with that chip count has needed one yet.
+   */
+  RESAMPLER *prs_chips[MAX_CHIPS];
+  
+  /*
+   * The sample rate converter of the current input, or NULL if the
+   * emulator runs at the output rate.
+   */
+  RESAMPLER *prs;
+  
+  /*
+   * The OPL_RENDER option flags given when the render was created.
+   */
+  int flags;
+  
+  /*
+   * The decoder of the input, which is kept between inputs, or NULL if
+   * no input has been loaded yet.
+   */
+  OPL_INPUT *pi;
+  
+  /*
+   * The output sample rate, and the emulator rate chosen by the OPL
+   * driver for it.
+   */
+  int32_t sample_rate;
+  int32_t emu_rate;
+  
+  /*
+   * The number of chips the input uses, and the chip selected by the
+   * last chip select event.
+   */
+  int32_t chips;
+  int32_t chip;
+  
+  /*
+   * The output range in frames at the emulator rate for the inputs
+   * loaded afterwards, and the range of the current input.  Frames
+   * before r_from are synthesized but dropped, and frames at or after
+   * r_to are not synthesized at all.
+   */
+  int64_t range_from;
+  int64_t range_to;
+  int64_t r_from;
+  int64_t r_to;
+  
+  /*
+   * The current offset in frames at the emulator rate, which is the
+   * frame offset of the decoder.
+   */
+  int64_t current;
+  
+  /*
+   * The synthesis offset, which is the number of frames synthesized so
+   * far at the emulator rate.
+   */
+  int64_t e_pos;
+  
+  /*
+   * The queued register writes of each chip, with their offsets from
+   * the synthesis offset, and the number of writes queued.
+   */
+  OPL_EVENT e_buf[MAX_CHIPS][EVENT_BATCH];
+  int32_t e_fill[MAX_CHIPS];
+  
+  /*
+   * The holding buffer, the number of frames in it that have been
+   * passed on to the output, the number of frames in it, and the
+   * synthesis offset of its first frame.
+   */
+  int16_t h_buf[BUFFER_SAMPLES];
+  int32_t h_pos;
+  int32_t h_len;
+  int64_t h_base;
+  
+  /*
+   * The buffer that frames are synthesized into before they go into
+   * the sample rate converter.
+   */
+  int16_t r_buf[BUFFER_SAMPLES];
+  
+  /*
+   * Flag set once all events of the input have been handled.
+   */
+  int at_end;
+  
+  /*
+   * Flag set once the end of the input has been signaled to the sample
+   * rate converter.
+   */
+  int drained;
+  
+  /*
+   * The function called at checkpoints and its argument, or NULL if
+   * there are no checkpoints, and the time between checkpoints in
+   * seconds.
+   */
+  OPL_RENDER_FUNC ck_fn;
+  void *ck_arg;
+  int32_t ck_interval;
+  
+  /*
+   * The frame offset at the emulator rate at which the next checkpoint
+   * is due, or INT64_MAX if there is none, and flag set while decoding
+   * waits at a checkpoint for synthesis to reach it.
+   */
+  int64_t ck_next;
+  int ck_wait;
+  
+  /*
+   * The clock that times the stages, or NULL if they are not timed.
+   */
+  OPL_RENDER_CLOCK clock;
+  
+  /*
+   * The counters of the work done so far.
+   * 
+   * The events within the current second of emulator output are those
+   * after event st_base of the ev_count events of the input, and the
+   * second ends at frame offset st_end.
+   */
+  OPL_RENDER_STATS st;
+  int64_t ev_count;
+  int64_t st_base;
+  int64_t st_end;
+  
+  /*
+   * The error code of the first error, or OPL_RENDER_ERR_NONE, and the
+   * decoder error code it came from, or OPL_INPUT_ERR_NONE if it did
+   * not come from the decoder.
+   */
+  int err;
+  int in_err;
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Record an error in a render.
+ * 
+ * Only the first error is kept.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   code - the error code
+ */
+static void setErr(OPL_RENDER *pr, int code) {
+  if (pr->err == OPL_RENDER_ERR_NONE) {
+    pr->err = code;
+  }
+}
+
+/*
+ * Convert a decoder error code into a render error code.
+ * 
+ * Parameters:
+ * 
+ *   err - the OPL_INPUT_ERR code
+ * 
+ * Return:
+ * 
+ *   the OPL_RENDER_ERR code
+ */
+static int inputCode(int err) {
+  int result = OPL_RENDER_ERR_STREAM;
+  
+  switch (err) {
+    case OPL_INPUT_ERR_OPEN:
+      result = OPL_RENDER_ERR_OPEN;
+      break;
+    
+    case OPL_INPUT_ERR_IO:
+    case OPL_INPUT_ERR_SEEK:
+      result = OPL_RENDER_ERR_IO;
+      break;
+    
+    case OPL_INPUT_ERR_MEM:
+      result = OPL_RENDER_ERR_MEM;
+      break;
+    
+    case OPL_INPUT_ERR_HEADER:
+    case OPL_INPUT_ERR_RATE:
+    case OPL_INPUT_ERR_CHIPS:
+      result = OPL_RENDER_ERR_HEADER;
+      break;
+    
+    case OPL_INPUT_ERR_LINE:
+    case OPL_INPUT_ERR_SYNTAX:
+      result = OPL_RENDER_ERR_SYNTAX;
+      break;
+    
+    case OPL_INPUT_ERR_VGM:
+    case OPL_INPUT_ERR_OPCODE:
+      result = OPL_RENDER_ERR_VGM;
+      break;
+    
+    case OPL_INPUT_ERR_KIND:
+      result = OPL_RENDER_ERR_KIND;
+      break;
+    
+    case OPL_INPUT_ERR_CHIP:
+      result = OPL_RENDER_ERR_CHIP;
+      break;
+    
+    case OPL_INPUT_ERR_WAIT:
+    case OPL_INPUT_ERR_TIME:
+      result = OPL_RENDER_ERR_TIME;
+      break;
+  }
+  
+  return result;
+}
+
+/*
+ * Record an error from the decoder in a render.
+ * 
+ * Only the first error is kept, along with the decoder error code.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   err - the OPL_INPUT_ERR code
+ */
+static void inputErr(OPL_RENDER *pr, int err) {
+  if (pr->err == OPL_RENDER_ERR_NONE) {
+    pr->in_err = err;
+  }
+  setErr(pr, inputCode(err));
+}
+
+/*
+ * Synthesize frames with the queued register writes applied at their
+ * offsets.
+ * 
+ * The queued writes after the frames stay queued, and their offsets are
+ * made relative to the new synthesis offset.  If synthesis reaches the
+ * current offset, the writes left over are applied directly, so that
+ * no writes are queued afterwards.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   pbuf - the buffer to receive the interleaved frames
+ * 
+ *   count - the number of frames to synthesize
+ */
+static void generateFrames(
+    OPL_RENDER * pr,
+    int16_t    * pbuf,
+    int32_t      count) {
+  
+  OPL_EVENT *pe = NULL;
+  double clk = 0.0;
+  int32_t c = 0;
+  int32_t n = 0;
+  int32_t i = 0;
+  
+  if (pr->clock != NULL) {
+    clk = pr->clock();
+  }
+  
+  for(c = 0; c < pr->chips; c++) {
+    pe = pr->e_buf[c];
+    
+    /* Find the queued writes inside the frames */
+    for(n = 0; n < pr->e_fill[c]; n++) {
+      if (pe[n].offs >= count) {
+        break;
+      }
+    }
+    
+    opl_ctx_generate_events(pr->pc[c], pbuf + c, count, pr->chips,
+                            pe, n);
+    
+    /* Keep the rest relative to the new synthesis offset */
+    if (n > 0) {
+      memmove(pe, pe + n, ((size_t) (pr->e_fill[c] - n)) *
+                            sizeof(OPL_EVENT));
+      pr->e_fill[c] -= n;
+    }
+    for(i = 0; i < pr->e_fill[c]; i++) {
+      pe[i].offs -= count;
+    }
+  }
+  pr->e_pos += count;
+  pr->st.samples += ((int64_t) count) * pr->chips;
+  if (pr->clock != NULL) {
+    pr->st.gen_secs += pr->clock() - clk;
+  }
+  
+  /* Once synthesis has caught up, the rest take effect right away */
+  if (pr->e_pos >= pr->current) {
+    for(c = 0; c < pr->chips; c++) {
+      pe = pr->e_buf[c];
+      for(i = 0; i < pr->e_fill[c]; i++) {
+        opl_ctx_write(pr->pc[c], pe[i].reg, pe[i].val);
+      }
+      pr->e_fill[c] = 0;
+    }
+  }
+}
+
+/*
+ * Apply a register write to the chip selected by the last chip select
+ * event.
+ * 
+ * The write is queued if synthesis lags behind the current offset, or
+ * else goes to the emulator directly.  If the queue of the chip is
+ * full, the frames up to the current offset are synthesized into the
+ * holding buffer first.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void applyWrite(OPL_RENDER *pr, uint8_t reg, uint8_t val) {
+  OPL_EVENT *pe = NULL;
+  int32_t count = 0;
+  
+  (pr->st.issued[reg >> 5])++;
+  
+  if ((pr->current > pr->e_pos) &&
+      (pr->e_fill[pr->chip] >= EVENT_BATCH)) {
+    count = (int32_t) (pr->current - pr->e_pos);
+    if ((pr->h_len > 0) || (count > BUFFER_SAMPLES / pr->chips)) {
+      abort();
+    }
+    pr->h_base = pr->e_pos;
+    generateFrames(pr, pr->h_buf, count);
+    pr->h_pos = 0;
+    pr->h_len = count;
+  }
+  
+  if (pr->current > pr->e_pos) {
+    pe = &(pr->e_buf[pr->chip][pr->e_fill[pr->chip]]);
+    pe->offs = (int32_t) (pr->current - pr->e_pos);
+    pe->reg = reg;
+    pe->val = val;
+    (pr->e_fill[pr->chip])++;
+  } else {
+    opl_ctx_write(pr->pc[pr->chip], reg, val);
+  }
+}
+
+/*
+ * Callback that receives the coalesced register writes.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the render
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void coalesceOut(void *pArg, int32_t reg, int32_t val) {
+  applyWrite((OPL_RENDER *) pArg, (uint8_t) reg, (uint8_t) val);
+}
+
+/*
+ * Apply any pending coalesced register writes of the selected chip.
+ * 
+ * This does nothing if writes are not being coalesced.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ */
+static void flushWrites(OPL_RENDER *pr) {
+  if (pr->pcs[pr->chip] != NULL) {
+    opl_coalesce_flush(pr->pcs[pr->chip]);
+  }
+}
+
+/*
+ * Handle a chip select event.
+ * 
+ * The decoder has already checked that the chip exists.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   chip - the chip to select, zero for the first chip
+ */
+static void eventChip(OPL_RENDER *pr, int32_t chip) {
+  (pr->st.selects)++;
+  (pr->ev_count)++;
+  
+  /* Pending writes belong to the chip selected before */
+  flushWrites(pr);
+  pr->chip = chip;
+}
+
+/*
+ * Handle a register write event.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void eventWrite(OPL_RENDER *pr, uint8_t reg, uint8_t val) {
+  (pr->st.writes)++;
+  (pr->ev_count)++;
+  
+  /* Hold the write back until time moves forward if coalescing */
+  if (pr->pcs[pr->chip] != NULL) {
+    opl_coalesce_write(pr->pcs[pr->chip], reg, val);
+  } else {
+    applyWrite(pr, reg, val);
+  }
+}
+
+/*
+ * Count the events of the current second of emulator output towards
+ * the peak event rate once the current offset has moved past it.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ */
+static void countSecond(OPL_RENDER *pr) {
+  if (pr->current >= pr->st_end) {
+    if (pr->ev_count - pr->st_base > pr->st.peak_events) {
+      pr->st.peak_events = pr->ev_count - pr->st_base;
+    }
+    pr->st_base = pr->ev_count;
+    pr->st_end = ((pr->current / pr->emu_rate) + 1) * pr->emu_rate;
+  }
+}
+
+/*
+ * Handle a wait event.
+ * 
+ * If the wait reaches the next checkpoint, decoding stops until
+ * synthesis has caught up with it.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   frame - the offset in frames at the emulator rate that the wait
+ *   ends at, as computed by the decoder
+ */
+static void eventWait(OPL_RENDER *pr, int64_t frame) {
+  (pr->st.waits)++;
+  (pr->ev_count)++;
+  
+  /* Time moves forward, so apply any pending coalesced writes */
+  flushWrites(pr);
+  pr->current = frame;
+  countSecond(pr);
+  
+  if (pr->current >= pr->ck_next) {
+    pr->ck_wait = 1;
+  }
+}
+
+/*
+ * Handle the end of the input.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ */
+static void eventEnd(OPL_RENDER *pr) {
+  flushWrites(pr);
+  pr->at_end = 1;
+  
+  /* The last, partial second also counts towards the peak */
+  if (pr->ev_count - pr->st_base > pr->st.peak_events) {
+    pr->st.peak_events = pr->ev_count - pr->st_base;
+  }
+  if (opl_input_kind(pr->pi) == OPL_INPUT_TEXT) {
+    pr->st.lines += opl_input_line(pr->pi);
+  }
+}
+
+/*
+ * Call the checkpoint function at the checkpoint that decoding waits
+ * at, and schedule the next checkpoint after the current offset.
+ * 
+ * Synthesis must have caught up with the current offset.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ */
+static void checkpoint(OPL_RENDER *pr) {
+  int64_t step = 0;
+  
+  pr->ck_wait = 0;
+  pr->ck_fn(pr->ck_arg, pr, pr->chip);
+  
+  step = ((int64_t) pr->ck_interval) * pr->emu_rate;
+  while (pr->ck_next <= pr->current) {
+    if (pr->ck_next <= INT64_MAX - step) {
+      pr->ck_next += step;
+    } else {
+      pr->ck_next = INT64_MAX;
+      break;
+    }
+  }
+}
+
+/*
+ * Handle events until they cover a given number of frames past the
+ * synthesis offset.
+ * 
+ * This also stops at the end of the input, when the holding buffer is
+ * used, or when the write queue of a chip is full.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   count - the number of frames to cover
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int parseAhead(OPL_RENDER *pr, int32_t count) {
+  OPL_INPUT_EVENT ev;
+  int err = 0;
+  
+  while ((!(pr->at_end)) && (pr->h_len < 1) && (!(pr->ck_wait)) &&
+          (pr->current - pr->e_pos < count) &&
+          (pr->e_fill[0] < EVENT_BATCH) &&
+          (pr->e_fill[MAX_CHIPS - 1] < EVENT_BATCH)) {
+    
+    if (!opl_input_next(pr->pi, &ev, &err)) {
+      inputErr(pr, err);
+      return 0;
+    }
+    
+    if (ev.type == OPL_INPUT_EVENT_END) {
+      eventEnd(pr);
+    } else if (ev.type == OPL_INPUT_EVENT_WRITE) {
+      eventWrite(pr, ev.reg, ev.val);
+    } else if (ev.type == OPL_INPUT_EVENT_WAIT) {
+      eventWait(pr, ev.frame);
+    } else {
+      eventChip(pr, ev.chip);
+    }
+  }
+  
+  return 1;
+}
+
+/*
+ * Get everything a render needs to handle the events of its input.
+ * 
+ * This is called once the decoder has opened the input, so that the
+ * chip count is known.  Each chip gets an emulator context, along with
+ * a coalescer if requested, and a sample rate converter is used if the
+ * emulator rate differs from the output rate.  Any of these that the
+ * render already has from an earlier input are reset instead of being
+ * created again.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int beginEvents(OPL_RENDER *pr) {
+  int32_t chips = 0;
+  int32_t i = 0;
+  
+  chips = opl_input_chips(pr->pi);
+  pr->chips = chips;
+  
+  for(i = 0; i < chips; i++) {
+    if (pr->pc[i] == NULL) {
+      pr->pc[i] = opl_ctx_new(pr->emu_rate);
+      if (pr->pc[i] == NULL) {
+        setErr(pr, OPL_RENDER_ERR_CONTEXT);
+        return 0;
+      }
+      opl_ctx_set_skip(pr->pc[i], (pr->flags & OPL_RENDER_SKIP) != 0);
+    
+    } else if (pr->dirty[i]) {
+      opl_ctx_reset(pr->pc[i], pr->emu_rate);
+    }
+    pr->dirty[i] = 1;
+    
+    if (pr->flags & OPL_RENDER_COALESCE) {
+      if (pr->pcs[i] == NULL) {
+        pr->pcs[i] = opl_coalesce_new(&coalesceOut, pr);
+        if (pr->pcs[i] == NULL) {
+          setErr(pr, OPL_RENDER_ERR_MEM);
+          return 0;
+        }
+      }
+      opl_coalesce_reset(pr->pcs[i]);
+    }
+  }
+  
+  if (pr->emu_rate != pr->sample_rate) {
+    if (pr->prs_chips[chips - 1] == NULL) {
+      pr->prs_chips[chips - 1] = resample_new(
+                                  pr->emu_rate, pr->sample_rate, chips);
+      if (pr->prs_chips[chips - 1] == NULL) {
+        setErr(pr, OPL_RENDER_ERR_MEM);
+        return 0;
+      }
+    }
+    pr->prs = pr->prs_chips[chips - 1];
+    resample_reset(pr->prs);
+  }
+  
+  pr->r_from = pr->range_from;
+  pr->r_to = pr->range_to;
+  pr->at_end = 0;
+  pr->drained = 0;
+  
+  pr->ck_next = INT64_MAX;
+  if ((pr->ck_fn != NULL) && (pr->ck_interval > 0)) {
+    pr->ck_next = ((int64_t) pr->ck_interval) * pr->emu_rate;
+  }
+  pr->ev_count = 0;
+  pr->st_base = 0;
+  pr->st_end = pr->emu_rate;
+  return 1;
+}
+
+/*
+ * Get the decoder of a render, creating it if the render has none yet.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int getInput(OPL_RENDER *pr) {
+  int err = 0;
+  
+  if (pr->pi == NULL) {
+    pr->pi = opl_input_new(pr->emu_rate, &err);
+    if (pr->pi == NULL) {
+      inputErr(pr, err);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Release the input of a render and return to the state with no input.
+ * 
+ * The emulator contexts are reset later, when the next input begins,
+ * so that contexts the next input does not use are not reset for
+ * nothing.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ */
+static void dropInput(OPL_RENDER *pr) {
+  int32_t i = 0;
+  
+  if (pr->pi != NULL) {
+    opl_input_close(pr->pi);
+  }
+  
+  pr->chips = 1;
+  pr->chip = 0;
+  pr->current = 0;
+  pr->e_pos = 0;
+  for(i = 0; i < MAX_CHIPS; i++) {
+    pr->e_fill[i] = 0;
+  }
+  pr->h_pos = 0;
+  pr->h_len = 0;
+  pr->prs = NULL;
+  pr->ck_wait = 0;
+  
+  pr->at_end = 1;
+  pr->drained = 1;
+  pr->err = OPL_RENDER_ERR_NONE;
+  pr->in_err = OPL_INPUT_ERR_NONE;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * opl_render_new function.
+ */
+OPL_RENDER *opl_render_new(int32_t sample_rate, int flags, int *perr) {
+  OPL_RENDER *pr = NULL;
+  
+  /* Check parameters */
+  if ((sample_rate < RESAMPLE_RATE_MIN) ||
+      (sample_rate > RESAMPLE_RATE_MAX) || (perr == NULL)) {
+    abort();
+  }
+  
+  pr = (OPL_RENDER *) calloc(1, sizeof(OPL_RENDER));
+  if (pr == NULL) {
+    *perr = OPL_RENDER_ERR_MEM;
+    return NULL;
+  }
+  pr->sample_rate = sample_rate;
+  pr->emu_rate = opl_ctx_rate(sample_rate);
+  pr->flags = flags;
+  pr->range_from = 0;
+  pr->range_to = INT64_MAX;
+  dropInput(pr);
+  
+  /* Every input uses the first chip, so get its context right away */
+  pr->pc[0] = opl_ctx_new(pr->emu_rate);
+  if (pr->pc[0] == NULL) {
+    *perr = OPL_RENDER_ERR_CONTEXT;
+    opl_render_close(pr);
+    return NULL;
+  }
+  opl_ctx_set_skip(pr->pc[0], (flags & OPL_RENDER_SKIP) != 0);
+  
+  *perr = OPL_RENDER_ERR_NONE;
+  return pr;
+}
+
+/*
+ * opl_render_range function.
+ */
+void opl_render_range(OPL_RENDER *pr, double from, double to) {
+  double f = 0.0;
+  
+  /* Check parameters */
+  if ((pr == NULL) || (!(from >= 0.0)) ||
+      ((to >= 0.0) && (!(to > from)))) {
+    abort();
+  }
+  
+  /* Round to the nearest frame at the emulator rate */
+  f = floor((from * ((double) pr->emu_rate)) + 0.5);
+  pr->range_from = (f < (double) INT64_MAX) ? (int64_t) f : INT64_MAX;
+  
+  pr->range_to = INT64_MAX;
+  if (to >= 0.0) {
+    f = floor((to * ((double) pr->emu_rate)) + 0.5);
+    if (f < (double) INT64_MAX) {
+      pr->range_to = (int64_t) f;
+    }
+  }
+}
+
+/*
+ * opl_render_checkpoints function.
+ */
+void opl_render_checkpoints(
+    OPL_RENDER      * pr,
+    int32_t           interval,
+    OPL_RENDER_FUNC   fn,
+    void            * pArg) {
+  
+  /* Check parameters */
+  if ((pr == NULL) || (interval < 0)) {
+    abort();
+  }
+  
+  pr->ck_fn = fn;
+  pr->ck_arg = pArg;
+  pr->ck_interval = interval;
+}
+
+/*
+ * opl_render_clock function.
+ */
+void opl_render_clock(OPL_RENDER *pr, OPL_RENDER_CLOCK fn) {
+  if (pr == NULL) {
+    abort();
+  }
+  pr->clock = fn;
+}
+
+/*
+ * opl_render_load function.
+ */
+int opl_render_load(
+          OPL_RENDER * pr,
+    const char       * pPath,
+          int          rep_count,
+          int        * perr) {
+  
+  int err = 0;
+  
+  /* Check parameters */
+  if ((pr == NULL) || (pPath == NULL) || (perr == NULL) ||
+      (rep_count < 1) || (rep_count > 2)) {
+    abort();
+  }
+  
+  dropInput(pr);
+  if (!getInput(pr)) {
+    *perr = pr->err;
+    return 0;
+  }
+  
+  /* Open the input and begin handling its events */
+  if (!opl_input_open(pr->pi, pPath, rep_count, &err)) {
+    inputErr(pr, err);
+  } else if (!beginEvents(pr)) {
+    pr->at_end = 1;
+    pr->drained = 1;
+  }
+  
+  *perr = pr->err;
+  return (pr->err == OPL_RENDER_ERR_NONE);
+}
+
+/*
+ * opl_render_load_mem function.
+ */
+int opl_render_load_mem(
+          OPL_RENDER * pr,
+    const uint8_t    * pData,
+          size_t       len,
+          int        * perr) {
+  
+  int err = 0;
+  
+  /* Check parameters */
+  if ((pr == NULL) || (perr == NULL) ||
+      ((pData == NULL) && (len > 0))) {
+    abort();
+  }
+  
+  dropInput(pr);
+  if (!getInput(pr)) {
+    *perr = pr->err;
+    return 0;
+  }
+  
+  /* Open the input and begin handling its events */
+  if (!opl_input_open_mem(pr->pi, pData, len, &err)) {
+    inputErr(pr, err);
+  } else if (!beginEvents(pr)) {
+    pr->at_end = 1;
+    pr->drained = 1;
+  }
+  
+  *perr = pr->err;
+  return (pr->err == OPL_RENDER_ERR_NONE);
+}
+
+/*
+ * opl_render_load_stream function.
+ */
+int opl_render_load_stream(OPL_RENDER *pr, FILE *pf, int *perr) {
+  int err = 0;
+  
+  /* Check parameters */
+  if ((pr == NULL) || (pf == NULL) || (perr == NULL)) {
+    abort();
+  }
+  
+  dropInput(pr);
+  if (!getInput(pr)) {
+    *perr = pr->err;
+    return 0;
+  }
+  
+  /* Open the input and begin handling its events */
+  if (!opl_input_open_stream(pr->pi, pf, OPL_INPUT_TEXT, &err)) {
+    inputErr(pr, err);
+  } else if (!beginEvents(pr)) {
+    pr->at_end = 1;
+    pr->drained = 1;
+  }
+  
+  *perr = pr->err;
+  return (pr->err == OPL_RENDER_ERR_NONE);
+}
+
+/*
+ * opl_render_seek function.
+ */
+int opl_render_seek(
+          OPL_RENDER * pr,
+          size_t       pos,
+          int32_t      chip,
+          int64_t      t,
+    const uint8_t    * pState,
+          int        * perr) {
+  
+  int64_t step = 0;
+  int32_t size = 0;
+  int32_t c = 0;
+  int err = 0;
+  
+  /* Check parameters */
+  if ((pr == NULL) || (pState == NULL) || (perr == NULL)) {
+    abort();
+  }
+  
+  /* Check state */
+  if ((pr->pi == NULL) || (pr->e_pos != 0) || (pr->h_len > 0)) {
+    abort();
+  }
+  
+  /* Move the decoder and restore the chips */
+  if (pr->err == OPL_RENDER_ERR_NONE) {
+    if (!opl_input_seek(pr->pi, pos, chip, t, &err)) {
+      inputErr(pr, err);
+    }
+  }
+  if (pr->err == OPL_RENDER_ERR_NONE) {
+    size = opl_ctx_state_size();
+    for(c = 0; c < pr->chips; c++) {
+      if (!opl_ctx_restore(pr->pc[c], pState + (c * size))) {
+        setErr(pr, OPL_RENDER_ERR_STATE);
+        break;
+      }
+    }
+  }
+  if (pr->err != OPL_RENDER_ERR_NONE) {
+    pr->at_end = 1;
+    pr->drained = 1;
+    *perr = pr->err;
+    return 0;
+  }
+  
+  /* Synthesis goes on from the saved position */
+  pr->chip = chip;
+  pr->current = opl_input_frame(pr->pi);
+  pr->e_pos = pr->current;
+  pr->st_end = ((pr->current / pr->emu_rate) + 1) * pr->emu_rate;
+  
+  /* The next checkpoint is the first one after the position */
+  if (pr->ck_next < INT64_MAX) {
+    step = ((int64_t) pr->ck_interval) * pr->emu_rate;
+    while (pr->ck_next <= pr->current) {
+      if (pr->ck_next <= INT64_MAX - step) {
+        pr->ck_next += step;
+      } else {
+        pr->ck_next = INT64_MAX;
+        break;
+      }
+    }
+  }
+  
+  *perr = OPL_RENDER_ERR_NONE;
+  return 1;
+}
+
+/*
+ * opl_render_reset function.
+ */
+void opl_render_reset(OPL_RENDER *pr) {
+  if (pr == NULL) {
+    abort();
+  }
+  dropInput(pr);
+}
+
+/*
+ * opl_render_open function.
+ */
+OPL_RENDER *opl_render_open(
+    const char    * pPath,
+          int32_t   sample_rate,
+          int       rep_count,
+          int       flags,
+          int     * perr) {
+  
+  OPL_RENDER *pr = NULL;
+  
+  pr = opl_render_new(sample_rate, flags, perr);
+  if (pr != NULL) {
+    if (!opl_render_load(pr, pPath, rep_count, perr)) {
+      opl_render_close(pr);
+      pr = NULL;
+    }
+  }
+  
+  return pr;
+}
+
+/*
+ * opl_render_open_mem function.
+ */
+OPL_RENDER *opl_render_open_mem(
+    const uint8_t * pData,
+          size_t    len,
+          int32_t   sample_rate,
+          int       flags,
+          int     * perr) {
+  
+  OPL_RENDER *pr = NULL;
+  
+  pr = opl_render_new(sample_rate, flags, perr);
+  if (pr != NULL) {
+    if (!opl_render_load_mem(pr, pData, len, perr)) {
+      opl_render_close(pr);
+      pr = NULL;
+    }
+  }
+  
+  return pr;
+}
+
+/*
+ * opl_render_close function.
+ */
+void opl_render_close(OPL_RENDER *pr) {
+  int32_t i = 0;
+  
+  if (pr != NULL) {
+    dropInput(pr);
+    for(i = 0; i < MAX_CHIPS; i++) {
+      opl_coalesce_free(pr->pcs[i]);
+      opl_ctx_free(pr->pc[i]);
+      resample_free(pr->prs_chips[i]);
+    }
+    opl_input_free(pr->pi);
+    free(pr);
+  }
+}
+
+/*
+ * opl_render_channels function.
+ */
+int32_t opl_render_channels(const OPL_RENDER *pr) {
+  if (pr == NULL) {
+    abort();
+  }
+  return pr->chips;
+}
+
+/*
+ * opl_render_pull function.
+ */
+int32_t opl_render_pull(
+    OPL_RENDER * pr,
+    int16_t    * pbuf,
+    int32_t      max_frames,
+    int        * perr) {
+  
+  double clk = 0.0;
+  int32_t done = 0;
+  int32_t work = 0;
+  int64_t avail = 0;
+  int64_t pos = 0;
+  
+  /* Check parameters */
+  if ((pr == NULL) || (max_frames < 0) || (perr == NULL) ||
+      ((pbuf == NULL) && (max_frames > 0))) {
+    abort();
+  }
+  
+  while ((done < max_frames) && (pr->err == OPL_RENDER_ERR_NONE)) {
+    
+    /* Take whatever the sample rate converter can produce first */
+    if (pr->prs != NULL) {
+      if (pr->clock != NULL) {
+        clk = pr->clock();
+      }
+      work = resample_read(pr->prs, pbuf + (done * pr->chips),
+                            max_frames - done);
+      if (pr->clock != NULL) {
+        pr->st.resample_secs += pr->clock() - clk;
+      }
+      done += work;
+      if (work > 0) {
+        continue;
+      }
+      if (pr->drained) {
+        break;
+      }
+    }
+    
+    /* Pass on the frames in the holding buffer, dropping the frames
+     * outside of the range */
+    if (pr->h_len > 0) {
+      work = pr->h_len - pr->h_pos;
+      pos = pr->h_base + pr->h_pos;
+      if ((pos < pr->r_from) || (pos >= pr->r_to)) {
+        if ((pos < pr->r_from) && (work > pr->r_from - pos)) {
+          work = (int32_t) (pr->r_from - pos);
+        }
+        pr->h_pos += work;
+        if (pr->h_pos >= pr->h_len) {
+          pr->h_pos = 0;
+          pr->h_len = 0;
+        }
+        continue;
+      }
+      if (work > pr->r_to - pos) {
+        work = (int32_t) (pr->r_to - pos);
+      }
+      if (pr->prs != NULL) {
+        if (work > resample_room(pr->prs)) {
+          work = resample_room(pr->prs);
+        }
+        if (pr->clock != NULL) {
+          clk = pr->clock();
+        }
+        resample_write(pr->prs, pr->h_buf + (pr->h_pos * pr->chips),
+                        work);
+        if (pr->clock != NULL) {
+          pr->st.resample_secs += pr->clock() - clk;
+        }
+      } else {
+        if (work > max_frames - done) {
+          work = max_frames - done;
+        }
+        memcpy(pbuf + (done * pr->chips),
+                pr->h_buf + (pr->h_pos * pr->chips),
+                ((size_t) (work * pr->chips)) * sizeof(int16_t));
+        done += work;
+      }
+      pr->h_pos += work;
+      if (pr->h_pos >= pr->h_len) {
+        pr->h_pos = 0;
+        pr->h_len = 0;
+      }
+      continue;
+    }
+    
+    /* Find the number of frames for the next block */
+    if (pr->e_pos < pr->r_from) {
+      work = BUFFER_SAMPLES;
+    } else if (pr->prs != NULL) {
+      work = resample_room(pr->prs);
+    } else {
+      work = max_frames - done;
+    }
+    if (work > BUFFER_SAMPLES / pr->chips) {
+      work = BUFFER_SAMPLES / pr->chips;
+    }
+    
+    /* Handle the events of the block */
+    if (!parseAhead(pr, work)) {
+      break;
+    }
+    if (pr->h_len > 0) {
+      continue;
+    }
+    
+    /* Once synthesis has reached a checkpoint, call the checkpoint
+     * function before decoding goes on */
+    if (pr->ck_wait && (pr->e_pos >= pr->current)) {
+      checkpoint(pr);
+      continue;
+    }
+    
+    /* Events only stop short of any frames at the end of the input,
+     * where the sample rate converter gives up its last frames; the
+     * range ends the output in the same way */
+    avail = pr->current - pr->e_pos;
+    if (pr->e_pos < pr->r_from) {
+      if (avail > pr->r_from - pr->e_pos) {
+        avail = pr->r_from - pr->e_pos;
+      }
+    } else if (avail > pr->r_to - pr->e_pos) {
+      avail = pr->r_to - pr->e_pos;
+    }
+    if (avail < 1) {
+      if (pr->prs == NULL) {
+        break;
+      }
+      resample_end(pr->prs);
+      pr->drained = 1;
+      continue;
+    }
+    if (work > avail) {
+      work = (int32_t) avail;
+    }
+    
+    /* Synthesize the block, and drop it if it lies before the range */
+    if (pr->e_pos < pr->r_from) {
+      generateFrames(pr, pr->r_buf, work);
+    } else if (pr->prs != NULL) {
+      generateFrames(pr, pr->r_buf, work);
+      if (pr->clock != NULL) {
+        clk = pr->clock();
+      }
+      resample_write(pr->prs, pr->r_buf, work);
+      if (pr->clock != NULL) {
+        pr->st.resample_secs += pr->clock() - clk;
+      }
+    } else {
+      generateFrames(pr, pbuf + (done * pr->chips), work);
+      done += work;
+    }
+  }
+  
+  *perr = pr->err;
+  return done;
+}
+
+/*
+ * opl_render_save function.
+ */
+void opl_render_save(const OPL_RENDER *pr, uint8_t *pState) {
+  int32_t size = 0;
+  int32_t c = 0;
+  
+  /* Check parameters */
+  if ((pr == NULL) || (pState == NULL)) {
+    abort();
+  }
+  
+  size = opl_ctx_state_size();
+  for(c = 0; c < pr->chips; c++) {
+    opl_ctx_save(pr->pc[c], pState + (c * size));
+  }
+}
+
+/*
+ * opl_render_input function.
+ */
+const OPL_INPUT *opl_render_input(const OPL_RENDER *pr) {
+  if (pr == NULL) {
+    abort();
+  }
+  return pr->pi;
+}
+
+/*
+ * opl_render_stats function.
+ */
+void opl_render_stats(const OPL_RENDER *pr, OPL_RENDER_STATS *pst) {
+  if ((pr == NULL) || (pst == NULL)) {
+    abort();
+  }
+  memcpy(pst, &(pr->st), sizeof(OPL_RENDER_STATS));
+}
+
+/*
+ * opl_render_line function.
+ */
+int32_t opl_render_line(const OPL_RENDER *pr) {
+  if (pr == NULL) {
+    abort();
+  }
+  if (pr->pi == NULL) {
+    return 0;
+  }
+  if (opl_input_kind(pr->pi) != OPL_INPUT_TEXT) {
+    return 0;
+  }
+  return opl_input_line(pr->pi);
+}
+
+/*
+ * opl_render_message function.
+ */
+const char *opl_render_message(const OPL_RENDER *pr) {
+  if (pr == NULL) {
+    abort();
+  }
+  if (pr->in_err != OPL_INPUT_ERR_NONE) {
+    return opl_input_errstr(pr->in_err);
+  }
+  return opl_render_errstr(pr->err);
+}
+
+/*
+ * opl_render_errstr function.
+ */
+const char *opl_render_errstr(int code) {
+  const char *pResult = NULL;
+  
+  switch (code) {
+    case OPL_RENDER_ERR_NONE:
+      pResult = "No error";
+      break;
+    
+    case OPL_RENDER_ERR_OPEN:
+      pResult = "Failed to open input file";
+      break;
+    
+    case OPL_RENDER_ERR_IO:
+      pResult = "I/O error reading input";
+      break;
+    
+    case OPL_RENDER_ERR_MEM:
+      pResult = "Memory allocation failed";
+      break;
+    
+    case OPL_RENDER_ERR_CONTEXT:
+      pResult = "OPL driver has no more emulator contexts";
+      break;
+    
+    case OPL_RENDER_ERR_HEADER:
+      pResult = "Invalid input header";
+      break;
+    
+    case OPL_RENDER_ERR_SYNTAX:
+      pResult = "Invalid script syntax";
+      break;
+    
+    case OPL_RENDER_ERR_STREAM:
+      pResult = "Invalid binary event stream";
+      break;
+    
+    case OPL_RENDER_ERR_VGM:
+      pResult = "Invalid or unsupported VGM file";
+      break;
+    
+    case OPL_RENDER_ERR_KIND:
+      pResult = "VGM input must be read from a file";
+      break;
+    
+    case OPL_RENDER_ERR_CHIP:
+      pResult = "Chip select out of range";
+      break;
+    
+    case OPL_RENDER_ERR_TIME:
+      pResult = "Invalid wait or time offset";
+      break;
+    
+    case OPL_RENDER_ERR_STATE:
+      pResult = "Invalid state snapshot";
+      break;
+    
+    default:
+      pResult = "Unknown error";
+  }
+  
+  return pResult;
+}
@@ -0,0 +1,637 @@
+#ifndef OPL_RENDER_H_INCLUDED
+#define OPL_RENDER_H_INCLUDED
+
+/*
+ * opl_render.h
+ * ============
+ * 
+ * Embeddable render engine that turns OPL2 input into PCM samples on
+ * demand.
+ * 
+ * A render is opened on an OPL2 hardware script, a compiled binary
+ * event stream, or a VGM or VGZ file, and the caller then pulls sample
+ * frames from it into buffers that the caller owns, as many at a time
+ * as it likes.  The input is only parsed as far ahead as the requested
+ * frames need, so a render of any length uses a fixed amount of
+ * memory, and an audio callback or a decoder plugin can pull a period
+ * at a time directly.
+ * 
+ * The frames are interleaved signed 16-bit samples in native byte
+ * order, with one channel per chip: mono for single-chip inputs, and
+ * stereo with the first chip on the left for dual-chip inputs.  They
+ * are at the sample rate given when the render was opened, resampled
+ * from the emulator rate if necessary.  The samples are the same as
+ * the ones that retro_opl writes to a WAV file for the same input,
+ * without any gain.
+ * 
+ * Errors are reported to the caller with error codes, and nothing is
+ * ever printed.  The engine has no global state of its own.
+ * 
+ * A render can also be used as a session for many inputs in turn.  It
+ * is created once with opl_render_new(), each input is loaded into it
+ * with opl_render_load() or opl_render_load_mem() and pulled from, and
+ * it is closed at the end.  The emulator contexts, buffers, and VGM
+ * reader of the session are reset between inputs rather than freed
+ * and allocated again, so a batch renderer or a player that goes
+ * through a playlist keeps the same memory for the whole session.
+ * opl_render_open() and opl_render_open_mem() are shortcuts for a
+ * session with a single input.
+ * 
+ * Separate renders may be pulled from concurrently from separate
+ * threads, but a single render must only be used from one thread at a
+ * time.  Creating, loading, and closing renders may create and free
+ * emulator contexts, so just like opl_ctx_new() and opl_ctx_free() in
+ * opl_driver.h, those calls must not run at the same time from
+ * different threads.
+ * 
+ * You must compile with the OPL driver and with opl_coalesce.c,
+ * opl_input.c, resample.c, and vgm_reader.c, and link with zlib.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "opl_input.h"
+
+/*
+ * Error codes.
+ */
+#define OPL_RENDER_ERR_NONE     (0)   /* No error */
+#define OPL_RENDER_ERR_OPEN     (1)   /* Failed to open input file */
+#define OPL_RENDER_ERR_IO       (2)   /* I/O error reading input */
+#define OPL_RENDER_ERR_MEM      (3)   /* Memory allocation failed */
+#define OPL_RENDER_ERR_CONTEXT  (4)   /* No emulator contexts left */
+#define OPL_RENDER_ERR_HEADER   (5)   /* Invalid input header */
+#define OPL_RENDER_ERR_SYNTAX   (6)   /* Invalid script syntax */
+#define OPL_RENDER_ERR_STREAM   (7)   /* Invalid binary event stream */
+#define OPL_RENDER_ERR_VGM      (8)   /* Invalid or unsupported VGM */
+#define OPL_RENDER_ERR_KIND     (9)   /* VGM input not from a file */
+#define OPL_RENDER_ERR_CHIP     (10)  /* Chip select out of range */
+#define OPL_RENDER_ERR_TIME     (11)  /* Invalid wait or time offset */
+#define OPL_RENDER_ERR_STATE    (12)  /* Invalid state snapshot */
+
+/*
+ * Option flags for opening a render.
+ * 
+ * OPL_RENDER_COALESCE coalesces register writes that happen at the
+ * same time, as described in opl_coalesce.h.
+ * 
+ * OPL_RENDER_SKIP lets the emulator skip synthesis while the chips are
+ * silent, see opl_ctx_set_skip() in opl_driver.h.
+ */
+#define OPL_RENDER_COALESCE (1)
+#define OPL_RENDER_SKIP     (2)
+
+/*
+ * The number of register ranges that issued register writes are
+ * counted in by the render counters.  Each range covers 32 registers.
+ */
+#define OPL_RENDER_RANGES (8)
+
+/*
+ * OPL_RENDER structure prototype.
+ * 
+ * The actual structure is defined in the implementation.
+ */
+struct OPL_RENDER_TAG;
+typedef struct OPL_RENDER_TAG OPL_RENDER;
+
+/*
+ * Counters of the work done by a render, see opl_render_stats().
+ */
+typedef struct {
+  
+  /*
+   * The number of script lines read, and the number of register write,
+   * wait, and chip select events handled.
+   */
+  int64_t lines;
+  int64_t writes;
+  int64_t waits;
+  int64_t selects;
+  
+  /*
+   * The number of register writes that went on to an emulator after
+   * any coalescing, counted by register range.
+   */
+  int64_t issued[OPL_RENDER_RANGES];
+  
+  /*
+   * The number of samples generated by the emulators, one for each chip
+   * in each frame.
+   */
+  int64_t samples;
+  
+  /*
+   * The largest number of events within one second of emulator output.
+   */
+  int64_t peak_events;
+  
+  /*
+   * The time in seconds spent in the emulators and in the sample rate
+   * converter, which is only measured if the render has a clock.
+   */
+  double gen_secs;
+  double resample_secs;
+  
+} OPL_RENDER_STATS;
+
+/*
+ * Function that reads a clock for the render counters.
+ * 
+ * Return:
+ * 
+ *   the current time in seconds from some arbitrary starting point
+ */
+typedef double (*OPL_RENDER_CLOCK)(void);
+
+/*
+ * Function called at each checkpoint of a render, see
+ * opl_render_checkpoints().
+ * 
+ * Parameters:
+ * 
+ *   pArg - the custom parameter passed to opl_render_checkpoints()
+ * 
+ *   pr - the render
+ * 
+ *   chip - the chip selected by the last chip select event
+ */
+typedef void (*OPL_RENDER_FUNC)(
+    void       * pArg,
+    OPL_RENDER * pr,
+    int32_t      chip);
+
+/*
+ * Create a render session with no input.
+ * 
+ * Pulling from a render with no input returns no frames.  The output
+ * sample rate and the flags apply to every input loaded into the
+ * session.
+ * 
+ * The sample rate must be in range [RESAMPLE_RATE_MIN,
+ * RESAMPLE_RATE_MAX] from resample.h.  If there is an error, NULL is
+ * returned and an error code is written to *perr.
+ * 
+ * Parameters:
+ * 
+ *   sample_rate - the output sample rate in Hz
+ * 
+ *   flags - zero or more OPL_RENDER option flags combined with OR
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   the new render, or NULL if there was an error
+ */
+OPL_RENDER *opl_render_new(int32_t sample_rate, int flags, int *perr);
+
+/*
+ * Limit the output of a render to a range of time.
+ * 
+ * The range applies to every input loaded into the render afterwards.
+ * Only the frames from time from up to time to are output, with the
+ * times in seconds rounded to the nearest frame at the emulator rate,
+ * so that the output is exactly what retro_opl writes with its -from
+ * and -to options.  The frames before the range are still synthesized,
+ * so the chips are in the right state when the range starts.  A
+ * negative to means that the range lasts to the end of the input.
+ * 
+ * The default range is the whole input.  from must not be negative,
+ * and to must be negative or greater than from.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   from - the start of the range in seconds
+ * 
+ *   to - the end of the range in seconds, or negative for no end
+ */
+void opl_render_range(OPL_RENDER *pr, double from, double to);
+
+/*
+ * Call a function at checkpoints of the inputs loaded into a render
+ * afterwards.
+ * 
+ * A checkpoint is due at every multiple of interval seconds of the
+ * output.  The function is called at the first wait event that reaches
+ * a checkpoint, once the frames up to the end of the wait have been
+ * synthesized and all earlier register writes applied, and before any
+ * later event is decoded.  The function may then save the state of the
+ * chips with opl_render_save(), and read the position of the input
+ * with the decoder from opl_render_input().  Together with the chip it
+ * is given, these are what opl_render_seek() needs to start there
+ * again.  Checkpoints after the end of the output range are not
+ * reached.
+ * 
+ * An interval of zero or a NULL function turns checkpoints off, which
+ * is the default.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   interval - the time between checkpoints in seconds, or zero
+ * 
+ *   fn - the function to call, or NULL
+ * 
+ *   pArg - custom parameter passed through to the function
+ */
+void opl_render_checkpoints(
+    OPL_RENDER      * pr,
+    int32_t           interval,
+    OPL_RENDER_FUNC   fn,
+    void            * pArg);
+
+/*
+ * Measure the time spent in the stages of a render with a clock.
+ * 
+ * Without a clock, which is the default, the render counts its work
+ * but does not measure any time.  Reading a clock costs time of its
+ * own, so only set one when the times are wanted.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   fn - the function that reads the clock, or NULL for none
+ */
+void opl_render_clock(OPL_RENDER *pr, OPL_RENDER_CLOCK fn);
+
+/*
+ * Load an input file into a render, replacing any input it had.
+ * 
+ * The kind of input is detected from its first bytes.  VGM and VGZ
+ * files use rep_count, which is 1 to decode the data once through, or
+ * 2 to loop back once using any looping information present in the
+ * file.  Other inputs ignore it.
+ * 
+ * The header of the input is read and checked before this returns.
+ * If there is an error, zero is returned and an error code is written
+ * to *perr.  The render then has no input, pulling from it returns the
+ * same error code, and another input may be loaded.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   pPath - path to the input file
+ * 
+ *   rep_count - 1 for no loop, 2 for loop once
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_render_load(
+          OPL_RENDER * pr,
+    const char       * pPath,
+          int          rep_count,
+          int        * perr);
+
+/*
+ * Load an input held in memory into a render, replacing any input it
+ * had.
+ * 
+ * The input may be an OPL2 hardware script or a compiled binary event
+ * stream.  VGM and VGZ files are only read from files, and give the
+ * error OPL_RENDER_ERR_KIND here.
+ * 
+ * The input is not copied, so the memory must stay valid and unchanged
+ * until another input is loaded, the render is reset, or the render is
+ * closed.
+ * 
+ * Otherwise, this is the same as opl_render_load().
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   pData - the input
+ * 
+ *   len - the length of the input in bytes
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_render_load_mem(
+          OPL_RENDER * pr,
+    const uint8_t    * pData,
+          size_t       len,
+          int        * perr);
+
+/*
+ * Load an OPL2 hardware script from a stream that is already open,
+ * such as standard input, into a render, replacing any input it had.
+ * 
+ * Reading starts at the current position of the stream, and the
+ * stream is not closed by the render.  The stream must stay open
+ * until another input is loaded, the render is reset, or the render is
+ * closed.
+ * 
+ * Otherwise, this is the same as opl_render_load().
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   pf - the stream
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_render_load_stream(OPL_RENDER *pr, FILE *pf, int *perr);
+
+/*
+ * Start the input of a render at a saved position in a binary event
+ * stream, with saved states of the chips.
+ * 
+ * This must be called right after the input is loaded, before any
+ * frames are pulled.  The position is that of a checkpoint, as given
+ * by opl_input_tell(), opl_input_time(), and the chip passed to the
+ * checkpoint function.  pState holds a state snapshot from
+ * opl_ctx_save() for each chip of the input in turn, as written by
+ * opl_render_save().  The output range still counts from the start of
+ * the input, so the frames between the position and the start of the
+ * range are synthesized and dropped as usual.
+ * 
+ * If the input is not a binary event stream or the position is out of
+ * range, the error is OPL_RENDER_ERR_IO.  If the driver does not
+ * accept a state snapshot, the error is OPL_RENDER_ERR_STATE.  If
+ * there is an error, zero is returned and an error code is written to
+ * *perr, and the render then has the error just like after a failed
+ * load.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   pos - the byte offset of the next event
+ * 
+ *   chip - the selected chip
+ * 
+ *   t - the time in control cycles
+ * 
+ *   pState - the state snapshots of the chips
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int opl_render_seek(
+          OPL_RENDER * pr,
+          size_t       pos,
+          int32_t      chip,
+          int64_t      t,
+    const uint8_t    * pState,
+          int        * perr);
+
+/*
+ * Drop the input of a render, so that it has no input.
+ * 
+ * Any input file is closed, and the rest of the output of the input is
+ * discarded.  The render keeps its memory for the next input.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ */
+void opl_render_reset(OPL_RENDER *pr);
+
+/*
+ * Open a render on an input file.
+ * 
+ * This is the same as creating a render with opl_render_new() and
+ * loading the file with opl_render_load(), except that the render is
+ * closed again if the load fails.  If there is an error, NULL is
+ * returned and an error code is written to *perr.
+ * 
+ * Parameters:
+ * 
+ *   pPath - path to the input file
+ * 
+ *   sample_rate - the output sample rate in Hz
+ * 
+ *   rep_count - 1 for no loop, 2 for loop once
+ * 
+ *   flags - zero or more OPL_RENDER option flags combined with OR
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   the new render, or NULL if there was an error
+ */
+OPL_RENDER *opl_render_open(
+    const char    * pPath,
+          int32_t   sample_rate,
+          int       rep_count,
+          int       flags,
+          int     * perr);
+
+/*
+ * Open a render on an input held in memory.
+ * 
+ * This is the same as creating a render with opl_render_new() and
+ * loading the input with opl_render_load_mem(), except that the render
+ * is closed again if the load fails.  If there is an error, NULL is
+ * returned and an error code is written to *perr.
+ * 
+ * Parameters:
+ * 
+ *   pData - the input
+ * 
+ *   len - the length of the input in bytes
+ * 
+ *   sample_rate - the output sample rate in Hz
+ * 
+ *   flags - zero or more OPL_RENDER option flags combined with OR
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   the new render, or NULL if there was an error
+ */
+OPL_RENDER *opl_render_open_mem(
+    const uint8_t * pData,
+          size_t    len,
+          int32_t   sample_rate,
+          int       flags,
+          int     * perr);
+
+/*
+ * Close a render.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render to close, or NULL
+ */
+void opl_render_close(OPL_RENDER *pr);
+
+/*
+ * Return the number of channels in each frame of a render.
+ * 
+ * This is the number of chips the input uses, either one or two.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ * Return:
+ * 
+ *   the number of channels
+ */
+int32_t opl_render_channels(const OPL_RENDER *pr);
+
+/*
+ * Pull the next sample frames from a render.
+ * 
+ * Up to max_frames frames are written to pbuf, which must have room
+ * for max_frames times opl_render_channels() samples.  The return
+ * value is the number of frames written.
+ * 
+ * Fewer frames than requested are only returned at the end of the
+ * output or when there is an error.  At the end of the output, *perr
+ * is set to OPL_RENDER_ERR_NONE, and all further calls return zero.
+ * If there is an error, *perr is set to its error code, and all
+ * further calls return zero with the same error code.  The frames
+ * before the error are still written and counted.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   pbuf - the buffer to receive the frames
+ * 
+ *   max_frames - the maximum number of frames to write
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   the number of frames written
+ */
+int32_t opl_render_pull(
+    OPL_RENDER * pr,
+    int16_t    * pbuf,
+    int32_t      max_frames,
+    int        * perr);
+
+/*
+ * Save the state of the chips of a render.
+ * 
+ * A state snapshot from opl_ctx_save() is written to pState for each
+ * chip of the input in turn, so pState must have room for
+ * opl_render_channels() times opl_ctx_state_size() bytes.  The state
+ * is that of the frames synthesized so far; in a checkpoint function,
+ * this is the state at the checkpoint.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   pState - the buffer to receive the state snapshots
+ */
+void opl_render_save(const OPL_RENDER *pr, uint8_t *pState);
+
+/*
+ * Get the input decoder of a render.
+ * 
+ * The decoder may be inspected with the functions in opl_input.h that
+ * take a constant decoder, such as opl_input_kind() or
+ * opl_input_tell(), but it must not be changed.  It describes the
+ * current input, or the input that failed to load.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ * Return:
+ * 
+ *   the decoder, or NULL if no input has been loaded yet
+ */
+const OPL_INPUT *opl_render_input(const OPL_RENDER *pr);
+
+/*
+ * Get the counters of the work done by a render.
+ * 
+ * The counters add up everything the render has done since it was
+ * created, over all of its inputs.  The times are zero unless the
+ * render has a clock.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ *   pst - the structure to receive the counters
+ */
+void opl_render_stats(const OPL_RENDER *pr, OPL_RENDER_STATS *pst);
+
+/*
+ * Return the line of an OPL2 hardware script that was being parsed
+ * when an error occurred.
+ * 
+ * For other inputs, or if no line has been read, this is zero.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ * Return:
+ * 
+ *   the one-based line number, or zero
+ */
+int32_t opl_render_line(const OPL_RENDER *pr);
+
+/*
+ * Get the error message for the error of a render.
+ * 
+ * Errors in the input are described more precisely than the error
+ * code does, with the same message that retro_opl prints for the same
+ * error.  If there was no error, this is the message for
+ * OPL_RENDER_ERR_NONE.  Like opl_render_errstr(), the message does not
+ * have any punctuation at the end.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render
+ * 
+ * Return:
+ * 
+ *   the error message
+ */
+const char *opl_render_message(const OPL_RENDER *pr);
+
+/*
+ * Get an error message for an error code.
+ * 
+ * The message does not have any punctuation at the end.  An unknown
+ * error code returns a generic message.
+ * 
+ * Parameters:
+ * 
+ *   code - the error code
+ * 
+ * Return:
+ * 
+ *   the error message
+ */
+const char *opl_render_errstr(int code);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * pcm_conv.c
+ * ==========
+ * 
+ * Implementation of pcm_conv.h
+ * 
+ * See the header for further information.
+ * 
+ * Every output sample is computed as a float by multiplying the input
+ * sample, or the sum of the input samples for mixing, with a single
+ * scale factor that combines the gain, the mixing, and the range of
+ * the output format.  Integer formats are then clipped in float and
+ * rounded with the current rounding mode, which is round to nearest
+ * even by default.  The SSE2 version does the same operations four
+ * samples at a time, so both versions give the same results.
+ */
+
+#include "pcm_conv.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Clip a float sample to the range of an integer format and round it.
+ * 
+ * Parameters:
+ * 
+ *   v - the scaled sample
+ * 
+ *   lo - the lowest integer value
+ * 
+ *   hi - the highest integer value
+ * 
+ * Return:
+ * 
+ *   the rounded and clipped integer value
+ */
+static int32_t clipRound(float v, float lo, float hi) {
+  if (v < lo) {
+    v = lo;
+  } else if (v > hi) {
+    v = hi;
+  }
+  return (int32_t) lrintf(v);
+}
+
+/*
+ * Write one output sample in little-endian order.
+ * 
+ * Parameters:
+ * 
+ *   v - the scaled sample
+ * 
+ *   format - the output format
+ * 
+ *   pOut - where to write the sample
+ */
+static void storeSample(float v, int format, uint8_t *pOut) {
+  union {
+    float f;
+    uint32_t u;
+  } fu;
+  uint32_t u = 0;
+  
+  if (format == PCM_S16) {
+    u = (uint32_t) clipRound(v, -32768.0f, 32767.0f);
+    pOut[0] = (uint8_t) (u & 0xff);
+    pOut[1] = (uint8_t) ((u >> 8) & 0xff);
+  
+  } else if (format == PCM_S24) {
+    u = (uint32_t) clipRound(v, -8388608.0f, 8388607.0f);
+    pOut[0] = (uint8_t) (u & 0xff);
+    pOut[1] = (uint8_t) ((u >> 8) & 0xff);
+    pOut[2] = (uint8_t) ((u >> 16) & 0xff);
+  
+  } else {
+    fu.f = v;
+    u = fu.u;
+    pOut[0] = (uint8_t) (u & 0xff);
+    pOut[1] = (uint8_t) ((u >> 8) & 0xff);
+    pOut[2] = (uint8_t) ((u >> 16) & 0xff);
+    pOut[3] = (uint8_t) (u >> 24);
+  }
+}
+
+#if defined(__SSE2__)
+
+/*
+ * Write four output samples in little-endian order, which is the byte
+ * order of every processor with SSE2.
+ * 
+ * Parameters:
+ * 
+ *   v - the four scaled samples
+ * 
+ *   format - the output format
+ * 
+ *   pOut - where to write the samples
+ */
+static void storeVector(__m128 v, int format, uint8_t *pOut) {
+  __m128i iv;
+  int32_t lane[4];
+  int i = 0;
+  
+  if (format == PCM_S16) {
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-32768.0f)),
+                    _mm_set1_ps(32767.0f));
+    iv = _mm_cvtps_epi32(v);
+    _mm_storel_epi64((__m128i *) pOut, _mm_packs_epi32(iv, iv));
+  
+  } else if (format == PCM_S24) {
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-8388608.0f)),
+                    _mm_set1_ps(8388607.0f));
+    _mm_storeu_si128((__m128i *) lane, _mm_cvtps_epi32(v));
+    for(i = 0; i < 4; i++) {
+      pOut[(i * 3)] = (uint8_t) (lane[i] & 0xff);
+      pOut[(i * 3) + 1] = (uint8_t) ((lane[i] >> 8) & 0xff);
+      pOut[(i * 3) + 2] = (uint8_t) ((lane[i] >> 16) & 0xff);
+    }
+  
+  } else {
+    _mm_storeu_ps((float *) pOut, v);
+  }
+}
+
+#endif
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * pcm_conv_width function.
+ */
+int32_t pcm_conv_width(int format) {
+  if (format == PCM_S16) {
+    return 2;
+  } else if (format == PCM_S24) {
+    return 3;
+  } else if (format == PCM_F32) {
+    return 4;
+  }
+  abort();
+}
+
+/*
+ * pcm_conv function.
+ */
+void pcm_conv(
+    const int16_t * pIn,
+          int32_t   frames,
+          int32_t   chans,
+          int       mix,
+          float     gain,
+          int       format,
+          uint8_t * pOut) {
+  
+  int32_t width = 0;
+  int32_t count = 0;
+  int32_t i = 0;
+  float scale = 0.0f;
+  float v = 0.0f;
+#if defined(__SSE2__)
+  __m128 vscale;
+  __m128i iv;
+#endif
+  
+  /* Check parameters */
+  if ((pIn == NULL) || (pOut == NULL) || (frames < 0) ||
+      (chans < 1) || (chans > 2)) {
+    abort();
+  }
+  width = pcm_conv_width(format);
+  
+  /* Combine the gain, the mixing, and the format range into one scale
+   * factor */
+  scale = gain;
+  if (format == PCM_S24) {
+    scale *= 256.0f;
+  } else if (format == PCM_F32) {
+    scale /= 32768.0f;
+  }
+  if (mix && (chans > 1)) {
+    scale *= 0.5f;
+  } else {
+    mix = 0;
+  }
+  
+  /* Get the number of output samples */
+  count = frames;
+  if (!mix) {
+    count *= chans;
+  }
+  
+  i = 0;
+
+#if defined(__SSE2__)
+  /* Convert four output samples at a time */
+  vscale = _mm_set1_ps(scale);
+  if (mix) {
+    /* Pairwise sums of the channels are exact in 32 bits */
+    for( ; i + 4 <= count; i += 4) {
+      iv = _mm_loadu_si128((const __m128i *) (pIn + (i * 2)));
+      iv = _mm_madd_epi16(iv, _mm_set1_epi16(1));
+      storeVector(_mm_mul_ps(_mm_cvtepi32_ps(iv), vscale),
+                  format, pOut + (i * width));
+    }
+  } else {
+    /* Sign-extend four samples to 32 bits */
+    for( ; i + 4 <= count; i += 4) {
+      iv = _mm_loadl_epi64((const __m128i *) (pIn + i));
+      iv = _mm_srai_epi32(_mm_unpacklo_epi16(iv, iv), 16);
+      storeVector(_mm_mul_ps(_mm_cvtepi32_ps(iv), vscale),
+                  format, pOut + (i * width));
+    }
+  }
+#endif
+  
+  /* Convert the remaining samples one at a time */
+  for( ; i < count; i++) {
+    if (mix) {
+      v = (float) (((int32_t) pIn[i * 2]) +
+                    ((int32_t) pIn[(i * 2) + 1]));
+    } else {
+      v = (float) pIn[i];
+    }
+    storeSample(v * scale, format, pOut + (i * width));
+  }
+}
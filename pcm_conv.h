@@ -0,0 +1,90 @@
+#ifndef PCM_CONV_H_INCLUDED
+#define PCM_CONV_H_INCLUDED
+
+/*
+ * pcm_conv.h
+ * ==========
+ * 
+ * Conversion of 16-bit samples into output sample formats.
+ * 
+ * The converter takes a block of interleaved 16-bit frames, applies a
+ * gain, optionally mixes all channels of each frame down into one, and
+ * writes the result in one of the output sample formats.  The output
+ * is always little-endian, as WAVE files require, no matter what the
+ * byte order of the host is.
+ * 
+ * Results are rounded to the nearest integer, with ties going to the
+ * even integer, and integer formats are clipped to their range.  Float
+ * output is not clipped, so samples may exceed the range [-1.0, 1.0]
+ * when the gain is above one.
+ * 
+ * On processors with SSE2, whole groups of samples are converted at a
+ * time.  The portable version computes exactly the same results.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The output sample formats.
+ */
+#define PCM_S16 (0)   /* 16-bit signed integer */
+#define PCM_S24 (1)   /* 24-bit signed integer */
+#define PCM_F32 (2)   /* 32-bit IEEE float */
+
+/*
+ * The maximum number of bytes in one output sample.
+ */
+#define PCM_WIDTH_MAX (4)
+
+/*
+ * Return the number of bytes in one output sample.
+ * 
+ * Parameters:
+ * 
+ *   format - one of the PCM format constants
+ * 
+ * Return:
+ * 
+ *   the number of bytes per sample
+ */
+int32_t pcm_conv_width(int format);
+
+/*
+ * Convert a block of frames.
+ * 
+ * If mix is non-zero, then the output has one sample for each frame,
+ * which is the sum of the channels of the frame divided by the number
+ * of channels.  Otherwise, each channel is converted separately and
+ * the output has the same number of channels as the input.  Mixing is
+ * only supported for one or two channels.
+ * 
+ * The output buffer must have room for the output samples at the width
+ * given by pcm_conv_width().
+ * 
+ * Parameters:
+ * 
+ *   pIn - the input frames
+ * 
+ *   frames - the number of input frames, zero or greater
+ * 
+ *   chans - the number of channels in each input frame, one or two
+ * 
+ *   mix - non-zero to mix the channels down into one
+ * 
+ *   gain - the linear gain to apply
+ * 
+ *   format - the output format, one of the PCM format constants
+ * 
+ *   pOut - the buffer to receive the output samples
+ */
+void pcm_conv(
+    const int16_t * pIn,
+          int32_t   frames,
+          int32_t   chans,
+          int       mix,
+          float     gain,
+          int       format,
+          uint8_t * pOut);
+
+#endif
@@ -0,0 +1,636 @@
+/*
+ * resample.c
+ * ==========
+ * 
+ * Implementation of resample.h
+ * 
+ * See the header for further information.
+ * 
+ * The filter is a Kaiser-windowed sinc.  Input samples are kept as
+ * floats in a separate buffer for each channel, so that each output
+ * sample is a dot product of consecutive input samples with one row
+ * of the filter table.  On processors with SSE, the dot product is
+ * computed four samples at a time.  The portable version uses four
+ * separate sums in the same order, so both versions give the same
+ * results.
+ */
+
+#include "resample.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * Half the length of the filter in input frames when the sample rate
+ * is not reduced.  When the sample rate is reduced, the filter is
+ * lengthened in proportion.
+ */
+#define FILTER_HALF (16)
+
+/*
+ * The cutoff of the filter relative to the lower of the two Nyquist
+ * frequencies.
+ */
+#define FILTER_CUTOFF (0.95)
+
+/*
+ * The ratio of a circle's circumference to its diameter.
+ */
+#define PI (3.14159265358979323846)
+
+/*
+ * The shape parameter of the Kaiser window.
+ */
+#define FILTER_BETA (8.0)
+
+/*
+ * The largest reduced output rate for which every output position has
+ * its own filter phase.  Above this, the filter is interpolated
+ * between TABLE_PHASES phases.
+ */
+#define EXACT_MAX (512)
+#define TABLE_PHASES (256)
+
+/*
+ * The number of input frames that may be written between reads, not
+ * counting the frames the filter needs to hold on to.
+ */
+#define BLOCK_FRAMES (4096)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * RESAMPLER structure.
+ * 
+ * Prototype given in header.
+ */
+struct RESAMPLER_TAG {
+  
+  /*
+   * The parameters the converter was created with.
+   */
+  int32_t in_rate;
+  int32_t out_rate;
+  int32_t chans;
+  
+  /*
+   * The ratio of output rate to input rate as a reduced fraction.
+   * Each output frame advances the input position by down/up frames.
+   */
+  int32_t up;
+  int32_t down;
+  
+  /*
+   * Half the filter length, and the full filter length, in input
+   * frames.  The full length is always a multiple of four.
+   */
+  int32_t half;
+  int32_t taps;
+  
+  /*
+   * The number of filter phases, and flag set if there is one phase
+   * for each output position.  Otherwise, the table has an extra phase
+   * at the end so that phases can always be interpolated.
+   */
+  int32_t rows;
+  int exact;
+  
+  /*
+   * The filter table, with taps coefficients for each phase, and a
+   * scratch row for interpolated phases.
+   */
+  float *pTable;
+  float *pRow;
+  
+  /*
+   * The input buffers for each channel, the number of input frames the
+   * buffers may hold before a read is needed, and the number of frames
+   * currently in the buffers.  The buffers have room for another half
+   * filter length of silence after the capacity.
+   */
+  float *pBuf[RESAMPLE_CHANNELS_MAX];
+  int32_t cap;
+  int32_t fill;
+  
+  /*
+   * The stream position of the first frame in the buffers, which is
+   * negative at the start of the stream, and the total number of input
+   * frames written.
+   */
+  int64_t start;
+  int64_t total;
+  
+  /*
+   * The position of the next output frame in input frames, as a whole
+   * part and a fraction numerator over up.
+   */
+  int64_t pos;
+  int32_t frac;
+  
+  /*
+   * Flag set once the end of the input has been marked.
+   */
+  int ended;
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Compute the greatest common divisor of two positive integers.
+ * 
+ * Parameters:
+ * 
+ *   a - the first integer
+ * 
+ *   b - the second integer
+ * 
+ * Return:
+ * 
+ *   the greatest common divisor
+ */
+static int32_t gcd(int32_t a, int32_t b) {
+  int32_t r = 0;
+  
+  while (b != 0) {
+    r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+/*
+ * Compute the zeroth-order modified Bessel function of the first kind,
+ * which is needed for the Kaiser window.
+ * 
+ * Parameters:
+ * 
+ *   x - the argument
+ * 
+ * Return:
+ * 
+ *   the function value
+ */
+static double besselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  double q = (x * x) / 4.0;
+  int k = 0;
+  
+  for(k = 1; k < 64; k++) {
+    term *= q / ((double) k * (double) k);
+    sum += term;
+    if (term < sum * 1.0e-12) {
+      break;
+    }
+  }
+  return sum;
+}
+
+/*
+ * Fill one phase of the filter table.
+ * 
+ * Coefficient k of the phase applies to the input frame that is
+ * (half - 1 - k + d) frames before the output position, where d is the
+ * fractional part of the output position.  The coefficients are scaled
+ * so that they add up to one, which keeps silence and constant levels
+ * exact.
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter
+ * 
+ *   pRow - the phase to fill
+ * 
+ *   d - the fractional output position, in range [0, 1]
+ * 
+ *   fc - the filter cutoff in cycles per input frame
+ */
+static void fillPhase(
+    const RESAMPLER * prs,
+          float     * pRow,
+          double      d,
+          double      fc) {
+  
+  int32_t k = 0;
+  double x = 0.0;
+  double r = 0.0;
+  double v = 0.0;
+  double sum = 0.0;
+  double w0 = 0.0;
+  
+  w0 = besselI0(FILTER_BETA);
+  
+  for(k = 0; k < prs->taps; k++) {
+    x = d + (double) (prs->half - 1 - k);
+    r = x / (double) prs->half;
+    if ((r <= -1.0) || (r >= 1.0)) {
+      v = 0.0;
+    } else {
+      v = 2.0 * fc;
+      if (x != 0.0) {
+        v = sin(2.0 * PI * fc * x) / (PI * x);
+      }
+      v *= besselI0(FILTER_BETA * sqrt(1.0 - (r * r))) / w0;
+    }
+    pRow[k] = (float) v;
+    sum += v;
+  }
+  
+  for(k = 0; k < prs->taps; k++) {
+    pRow[k] = (float) (((double) pRow[k]) / sum);
+  }
+}
+
+/*
+ * Compute the dot product of two float arrays.
+ * 
+ * Parameters:
+ * 
+ *   pa - the first array
+ * 
+ *   pb - the second array
+ * 
+ *   n - the length of the arrays, which must be a multiple of four
+ * 
+ * Return:
+ * 
+ *   the dot product
+ */
+#if defined(__SSE__)
+static float dotProduct(const float *pa, const float *pb, int32_t n) {
+  __m128 acc;
+  float lane[4];
+  int32_t k = 0;
+  
+  acc = _mm_setzero_ps();
+  for(k = 0; k < n; k += 4) {
+    acc = _mm_add_ps(acc,
+            _mm_mul_ps(_mm_loadu_ps(pa + k), _mm_loadu_ps(pb + k)));
+  }
+  _mm_storeu_ps(lane, acc);
+  
+  return (lane[0] + lane[1]) + (lane[2] + lane[3]);
+}
+#else
+static float dotProduct(const float *pa, const float *pb, int32_t n) {
+  float a0 = 0.0f;
+  float a1 = 0.0f;
+  float a2 = 0.0f;
+  float a3 = 0.0f;
+  int32_t k = 0;
+  
+  for(k = 0; k < n; k += 4) {
+    a0 += pa[k] * pb[k];
+    a1 += pa[k + 1] * pb[k + 1];
+    a2 += pa[k + 2] * pb[k + 2];
+    a3 += pa[k + 3] * pb[k + 3];
+  }
+  
+  return (a0 + a1) + (a2 + a3);
+}
+#endif
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * resample_new function.
+ */
+RESAMPLER *resample_new(
+    int32_t in_rate,
+    int32_t out_rate,
+    int32_t chans) {
+  
+  RESAMPLER *prs = NULL;
+  int32_t g = 0;
+  int32_t i = 0;
+  double fc = 0.0;
+  int ok = 1;
+  
+  /* Check parameters */
+  if ((in_rate < RESAMPLE_RATE_MIN) ||
+      (in_rate > RESAMPLE_RATE_MAX) ||
+      (out_rate < RESAMPLE_RATE_MIN) ||
+      (out_rate > RESAMPLE_RATE_MAX) ||
+      (chans < 1) || (chans > RESAMPLE_CHANNELS_MAX)) {
+    abort();
+  }
+  
+  /* Allocate the structure */
+  prs = (RESAMPLER *) calloc(1, sizeof(RESAMPLER));
+  if (prs == NULL) {
+    return NULL;
+  }
+  prs->in_rate = in_rate;
+  prs->out_rate = out_rate;
+  prs->chans = chans;
+  
+  /* Reduce the ratio */
+  g = gcd(out_rate, in_rate);
+  prs->up = out_rate / g;
+  prs->down = in_rate / g;
+  
+  /* Lengthen the filter and lower the cutoff when reducing the rate,
+   * keeping the length a multiple of four */
+  prs->half = FILTER_HALF;
+  fc = 0.5 * FILTER_CUTOFF;
+  if (out_rate < in_rate) {
+    prs->half = (int32_t) ceil(
+      ((double) FILTER_HALF * (double) in_rate) / (double) out_rate);
+    prs->half = (prs->half + 1) & ~((int32_t) 1);
+    fc = (fc * (double) out_rate) / (double) in_rate;
+  }
+  prs->taps = 2 * prs->half;
+  
+  /* Choose the phase table layout */
+  if (prs->up <= EXACT_MAX) {
+    prs->rows = prs->up;
+    prs->exact = 1;
+  } else {
+    prs->rows = TABLE_PHASES;
+    prs->exact = 0;
+  }
+  
+  /* Allocate the table and the buffers */
+  prs->cap = BLOCK_FRAMES + prs->taps;
+  prs->pTable = (float *) malloc(
+    ((size_t) (prs->rows + 1)) * ((size_t) prs->taps) * sizeof(float));
+  prs->pRow = (float *) malloc(((size_t) prs->taps) * sizeof(float));
+  if ((prs->pTable == NULL) || (prs->pRow == NULL)) {
+    ok = 0;
+  }
+  for(i = 0; i < chans; i++) {
+    prs->pBuf[i] = (float *) malloc(
+      ((size_t) (prs->cap + prs->half)) * sizeof(float));
+    if (prs->pBuf[i] == NULL) {
+      ok = 0;
+    }
+  }
+  if (!ok) {
+    resample_free(prs);
+    return NULL;
+  }
+  
+  /* Fill the table, including the extra phase at the end */
+  for(i = 0; i <= prs->rows; i++) {
+    fillPhase(prs, prs->pTable + (((size_t) i) * ((size_t) prs->taps)),
+      ((double) i) / ((double) prs->rows), fc);
+  }
+  
+  /* Start the first stream */
+  resample_reset(prs);
+  return prs;
+}
+
+/*
+ * resample_free function.
+ */
+void resample_free(RESAMPLER *prs) {
+  int32_t i = 0;
+  
+  if (prs == NULL) {
+    return;
+  }
+  
+  for(i = 0; i < RESAMPLE_CHANNELS_MAX; i++) {
+    free(prs->pBuf[i]);
+  }
+  free(prs->pRow);
+  free(prs->pTable);
+  free(prs);
+}
+
+/*
+ * resample_match function.
+ */
+int resample_match(
+    const RESAMPLER * prs,
+          int32_t     in_rate,
+          int32_t     out_rate,
+          int32_t     chans) {
+  
+  if (prs == NULL) {
+    abort();
+  }
+  
+  return ((prs->in_rate == in_rate) && (prs->out_rate == out_rate) &&
+          (prs->chans == chans));
+}
+
+/*
+ * resample_reset function.
+ */
+void resample_reset(RESAMPLER *prs) {
+  int32_t i = 0;
+  
+  if (prs == NULL) {
+    abort();
+  }
+  
+  /* The buffers start with silence before the start of the stream, so
+   * that the first output frame has all the input it needs */
+  prs->fill = prs->half - 1;
+  prs->start = -((int64_t) prs->fill);
+  for(i = 0; i < prs->chans; i++) {
+    memset(prs->pBuf[i], 0, ((size_t) prs->fill) * sizeof(float));
+  }
+  
+  prs->total = 0;
+  prs->pos = 0;
+  prs->frac = 0;
+  prs->ended = 0;
+}
+
+/*
+ * resample_length function.
+ */
+int64_t resample_length(const RESAMPLER *prs, int64_t frames) {
+  int64_t q = 0;
+  int64_t r = 0;
+  
+  if ((prs == NULL) || (frames < 0)) {
+    abort();
+  }
+  
+  /* Output frame j is at input position j * down / up, and there is an
+   * output frame for each position before the end of the input; split
+   * the input into whole multiples of down and a remainder so that the
+   * products can not overflow */
+  q = frames / prs->down;
+  r = frames % prs->down;
+  if (q > (INT64_MAX - prs->up) / prs->up) {
+    return -1;
+  }
+  return (q * prs->up) + ((r * prs->up + (prs->down - 1)) / prs->down);
+}
+
+/*
+ * resample_room function.
+ */
+int32_t resample_room(const RESAMPLER *prs) {
+  if (prs == NULL) {
+    abort();
+  }
+  
+  if (prs->ended) {
+    return 0;
+  }
+  return prs->cap - prs->fill;
+}
+
+/*
+ * resample_write function.
+ */
+void resample_write(
+          RESAMPLER * prs,
+    const int16_t   * pIn,
+          int32_t     frames) {
+  
+  int32_t i = 0;
+  int32_t c = 0;
+  float *pb = NULL;
+  
+  if ((prs == NULL) || (pIn == NULL) || (frames < 0) ||
+      (frames > resample_room(prs))) {
+    abort();
+  }
+  
+  /* Split the channels into their buffers */
+  for(c = 0; c < prs->chans; c++) {
+    pb = prs->pBuf[c] + prs->fill;
+    for(i = 0; i < frames; i++) {
+      pb[i] = (float) pIn[(i * prs->chans) + c];
+    }
+  }
+  
+  prs->fill += frames;
+  prs->total += frames;
+}
+
+/*
+ * resample_end function.
+ */
+void resample_end(RESAMPLER *prs) {
+  int32_t c = 0;
+  
+  if (prs == NULL) {
+    abort();
+  }
+  
+  /* Follow the input with silence, so the last output frames have all
+   * the input they need */
+  if (!(prs->ended)) {
+    for(c = 0; c < prs->chans; c++) {
+      memset(prs->pBuf[c] + prs->fill, 0,
+              ((size_t) prs->half) * sizeof(float));
+    }
+    prs->fill += prs->half;
+    prs->ended = 1;
+  }
+}
+
+/*
+ * resample_read function.
+ */
+int32_t resample_read(
+    RESAMPLER * prs,
+    int16_t   * pOut,
+    int32_t     max_frames) {
+  
+  int32_t count = 0;
+  int32_t c = 0;
+  int32_t k = 0;
+  int32_t base = 0;
+  int32_t drop = 0;
+  const float *pr = NULL;
+  const float *pr2 = NULL;
+  double f = 0.0;
+  float w = 0.0f;
+  float v = 0.0f;
+  
+  if ((prs == NULL) || (pOut == NULL) || (max_frames < 0)) {
+    abort();
+  }
+  
+  for(count = 0; count < max_frames; count++) {
+    
+    /* Stop at the end of the stream, or when the filter would need
+     * input frames that have not been written yet */
+    if (prs->ended && (prs->pos >= prs->total)) {
+      break;
+    }
+    if (prs->pos + prs->half >= prs->start + prs->fill) {
+      break;
+    }
+    
+    /* Get the filter phase for the output position */
+    if (prs->exact) {
+      pr = prs->pTable + (((size_t) prs->frac) * ((size_t) prs->taps));
+    } else {
+      f = (((double) prs->frac) * (double) prs->rows) /
+            (double) prs->up;
+      k = (int32_t) f;
+      w = (float) (f - (double) k);
+      pr2 = prs->pTable + (((size_t) k) * ((size_t) prs->taps));
+      for(k = 0; k < prs->taps; k++) {
+        prs->pRow[k] = pr2[k] + (w * (pr2[k + prs->taps] - pr2[k]));
+      }
+      pr = prs->pRow;
+    }
+    
+    /* Filter each channel */
+    base = (int32_t) (prs->pos - prs->half + 1 - prs->start);
+    for(c = 0; c < prs->chans; c++) {
+      v = dotProduct(prs->pBuf[c] + base, pr, prs->taps);
+      v = floorf(v + 0.5f);
+      if (v > 32767.0f) {
+        v = 32767.0f;
+      } else if (v < -32768.0f) {
+        v = -32768.0f;
+      }
+      pOut[(count * prs->chans) + c] = (int16_t) v;
+    }
+    
+    /* Advance the output position */
+    prs->frac += prs->down;
+    prs->pos += prs->frac / prs->up;
+    prs->frac %= prs->up;
+  }
+  
+  /* Drop the input frames that no later output frame needs */
+  drop = (int32_t) (prs->pos - prs->half + 1 - prs->start);
+  if (drop > prs->fill) {
+    drop = prs->fill;
+  }
+  if (drop > 0) {
+    for(c = 0; c < prs->chans; c++) {
+      memmove(prs->pBuf[c], prs->pBuf[c] + drop,
+              ((size_t) (prs->fill - drop)) * sizeof(float));
+    }
+    prs->fill -= drop;
+    prs->start += drop;
+  }
+  
+  return count;
+}
@@ -0,0 +1,214 @@
+#ifndef RESAMPLE_H_INCLUDED
+#define RESAMPLE_H_INCLUDED
+
+/*
+ * resample.h
+ * ==========
+ * 
+ * Sample rate converter for 16-bit PCM.
+ * 
+ * The converter changes a stream of interleaved 16-bit frames from one
+ * sample rate to another with a windowed-sinc filter.  The ratio
+ * between the two rates is reduced to a fraction, and the position of
+ * each output frame is tracked exactly as a fraction of input frames,
+ * so the converter does not drift over long streams.  When the
+ * reduced fraction has a small enough numerator, each possible output
+ * position has its own precomputed filter phase.  Otherwise, the
+ * filter is interpolated between neighboring phases of a fixed table.
+ * 
+ * When reducing the sample rate, the filter cutoff is lowered to the
+ * new Nyquist frequency and the filter is made longer to match, so
+ * that frequencies the output can not represent are removed instead of
+ * aliasing.
+ * 
+ * Input is written into the converter in blocks with resample_write(),
+ * and converted output is read back with resample_read().  The
+ * converter holds on to the input frames that later output frames
+ * still need.  Once all input has been written, resample_end() lets
+ * the final output frames be read.
+ * 
+ * The number of output frames for a given number of input frames is
+ * exactly known in advance, see resample_length().
+ * 
+ * Separate converters may be used concurrently from separate threads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The minimum and maximum sample rates in Hz.
+ */
+#define RESAMPLE_RATE_MIN (4000)
+#define RESAMPLE_RATE_MAX (192000)
+
+/*
+ * The maximum number of channels in each frame.
+ */
+#define RESAMPLE_CHANNELS_MAX (2)
+
+/*
+ * Structure prototype for a sample rate converter.
+ * 
+ * The actual structure is defined in the implementation.
+ */
+struct RESAMPLER_TAG;
+typedef struct RESAMPLER_TAG RESAMPLER;
+
+/*
+ * Create a new sample rate converter.
+ * 
+ * Both rates must be in range [RESAMPLE_RATE_MIN, RESAMPLE_RATE_MAX].
+ * The channel count must be in range [1, RESAMPLE_CHANNELS_MAX].
+ * 
+ * Parameters:
+ * 
+ *   in_rate - the sample rate of the input in Hz
+ * 
+ *   out_rate - the sample rate of the output in Hz
+ * 
+ *   chans - the number of channels in each frame
+ * 
+ * Return:
+ * 
+ *   the new converter, or NULL if memory allocation failed
+ */
+RESAMPLER *resample_new(
+    int32_t in_rate,
+    int32_t out_rate,
+    int32_t chans);
+
+/*
+ * Free a sample rate converter.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter to free, or NULL
+ */
+void resample_free(RESAMPLER *prs);
+
+/*
+ * Check whether a converter was created with the given parameters.
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter
+ * 
+ *   in_rate - the sample rate of the input in Hz
+ * 
+ *   out_rate - the sample rate of the output in Hz
+ * 
+ *   chans - the number of channels in each frame
+ * 
+ * Return:
+ * 
+ *   non-zero if the parameters match, zero otherwise
+ */
+int resample_match(
+    const RESAMPLER * prs,
+          int32_t     in_rate,
+          int32_t     out_rate,
+          int32_t     chans);
+
+/*
+ * Reset a converter to the start of a new stream.
+ * 
+ * Any buffered input is discarded.
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter
+ */
+void resample_reset(RESAMPLER *prs);
+
+/*
+ * Return the number of output frames a stream of a given length has.
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter
+ * 
+ *   frames - the number of input frames in the whole stream, zero or
+ *   greater
+ * 
+ * Return:
+ * 
+ *   the number of output frames, or -1 if it would exceed INT64_MAX
+ */
+int64_t resample_length(const RESAMPLER *prs, int64_t frames);
+
+/*
+ * Return how many input frames the converter can currently accept.
+ * 
+ * Reading output frees up room again.  After resample_end(), this is
+ * always zero.
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter
+ * 
+ * Return:
+ * 
+ *   the number of input frames that may be written
+ */
+int32_t resample_room(const RESAMPLER *prs);
+
+/*
+ * Write input frames into the converter.
+ * 
+ * The frames are interleaved, with one sample for each channel.  The
+ * frame count must not exceed resample_room().
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter
+ * 
+ *   pIn - the input frames
+ * 
+ *   frames - the number of input frames
+ */
+void resample_write(
+          RESAMPLER * prs,
+    const int16_t   * pIn,
+          int32_t     frames);
+
+/*
+ * Mark the end of the input stream.
+ * 
+ * Afterwards, resample_read() returns the rest of the output frames,
+ * and no more input may be written.
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter
+ */
+void resample_end(RESAMPLER *prs);
+
+/*
+ * Read converted output frames.
+ * 
+ * As many output frames are read as the input written so far allows,
+ * up to the given maximum.  The frames are interleaved, with one
+ * sample for each channel.
+ * 
+ * Parameters:
+ * 
+ *   prs - the converter
+ * 
+ *   pOut - the buffer to receive the output frames
+ * 
+ *   max_frames - the maximum number of frames to read, zero or greater
+ * 
+ * Return:
+ * 
+ *   the number of frames read, which is zero if more input is needed
+ *   or if the stream has ended and all output has been read
+ */
+int32_t resample_read(
+    RESAMPLER * prs,
+    int16_t   * pOut,
+    int32_t     max_frames);
+
+#endif
@@ -7,25 +7,101 @@
  * This standalone component of the Retro synthesizer is able to run a
  * software emulation of OPL hardware to generate a WAV file.
  * 
- * You must compile with one of the opl_driver implementations, along
- * with anything that opl_driver implementation requires.
+ * You must compile with the opl_registry.c driver and all of the
+ * emulator cores it lists, along with anything those cores require,
+ * and with one of the audio_out implementations.  You must also
+ * compile with opl_coalesce.c, opl_input.c, opl_queue.c,
+ * opl_render.c, pcm_conv.c, resample.c, sha256.c, and vgm_reader.c and
+ * link with zlib, the math library, and the POSIX threads library.
  * 
  * The program takes a two arguments.  The first is the path to the
- * output WAV file to create.  The second is either "44100" or "48000"
- * indicating the sampling rate for the output WAV file.
+ * output WAV file to create, or "-" to write the WAV file to standard
+ * output.  The second is the sampling rate for the output WAV file,
+ * in range [4000, 192000].  If the OPL driver can not emulate at that
+ * rate directly, the emulator output is resampled to it.
  * 
  * An OPL2 hardware script in the format defined by the Retro
  * Specification is read from standard input.
+ * 
+ * As an extension, the header line of a script may declare two OPL2
+ * chips after the control rate, and "c" commands then select the chip
+ * that following register writes go to.  The output WAV file is then
+ * stereo, with the first chip on the left and the second chip on the
+ * right.  Dual-chip VGM files are rendered the same way.
+ * 
+ * Alternatively, the program can be invoked with "-batch" as the first
+ * argument and the path to a batch manifest as the second argument.
+ * Each job line in the manifest has a sampling rate, the path to an
+ * input OPL2 hardware script, the path to an output WAV file, and
+ * optionally the emulator core that renders the job, separated by
+ * spaces or tabs.  Blank lines and lines beginning with an apostrophe
+ * are ignored.  The jobs are rendered on a pool of worker threads.
+ * 
+ * With "-play" as the first argument, the program plays the input in
+ * real time on an audio device instead of writing a WAV file.  The
+ * second argument is the sampling rate, and the optional third argument
+ * is the input file.
+ * 
+ * A single long input file can also be split into segments that are
+ * rendered on separate threads with the "-split" option, if the OPL
+ * driver supports enough emulator contexts.  Each segment after the
+ * first starts from the registers with a short pre-roll, so it is
+ * close to a plain render but not exactly the same.
+ * 
+ * With "-index" as the first argument, the program builds a checkpoint
+ * index for a binary event stream.  The second argument is the path to
+ * the index file to create, the third is the sampling rate, and the
+ * fourth is the binary event stream.  The "-from" and "-to" options
+ * render only a range of time, and the "-checkpoints" option lets a
+ * render of a binary event stream use an index to start near the
+ * beginning of the range instead of at the beginning of the stream.
+ * 
+ * The "-cache" option keeps rendered files in a cache directory, keyed
+ * by a hash of the input file and everything else that affects the
+ * output, so that an input rendered before is copied from the cache
+ * instead of being rendered again.
+ * 
+ * If compiled with RETRO_OPL_STATS defined, the "-stats" option prints
+ * counters and timings of the processing stages when the program
+ * exits.  Without that definition, the instrumentation is compiled out
+ * entirely.
+ * 
+ * Everything that is rendered is synthesized through the render
+ * sessions of opl_render.h, the same library that other programs
+ * embed.  The program itself only runs the decoded events of an input
+ * for compiling, for real-time playback, and for the event log of a
+ * split render.
  */
 
+#include <errno.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "audio_out.h"
+#include "opl_bin.h"
+#include "opl_coalesce.h"
 #include "opl_driver.h"
+#include "opl_input.h"
+#include "opl_render.h"
+#include "opl_queue.h"
+#include "pcm_conv.h"
+#include "resample.h"
+#include "sha256.h"
 
 /*
  * Constants
@@ -38,10 +114,511 @@
 #define BUFFER_SAMPLES (4096)
 
 /*
- * The maximum number of bytes in an input line, not including the
- * terminating nul.
+ * The maximum number of register writes per chip that a segment of a
+ * split render applies within one buffer of synthesis.
+ */
+#define EVENT_BATCH (1024)
+
+/*
+ * The maximum number of worker threads used in batch mode.
+ */
+#define MAX_WORKERS (64)
+
+/*
+ * The maximum number of OPL2 chips that a script may use.
+ */
+#define MAX_CHIPS (OPL_INPUT_CHIPS_MAX)
+
+/*
+ * The number of seconds that synthesis starts ahead of the first frame
+ * that is written when resuming from a state that only holds the
+ * registers, so that envelopes can settle after the restore.  This is
+ * used by seeking with a checkpoint index and by the segments of a
+ * split render.
+ */
+#define PREROLL (2)
+
+/*
+ * The minimum length in seconds of each segment of a split render.
+ */
+#define SPLIT_MIN (10)
+
+/*
+ * The number of OPL2 register addresses.
+ */
+#define REG_COUNT (256)
+
+/*
+ * The size in bytes of the largest WAVE headers, which are those with a
+ * WAVE_FORMAT_EXTENSIBLE format chunk and a fact chunk, and how many
+ * bytes longer the headers are in RF64 files, which have a ds64 chunk
+ * with 64-bit sizes in front of the format chunk.  headerBytes() gives
+ * the size of the headers for the selected format.
+ */
+#define WAV_HEADER_MAX (80)
+#define RF64_EXTRA (36)
+
+/*
+ * The largest data size in bytes that fits in a RIFF file.  The RIFF
+ * chunk size must fit in 32 bits along with the largest headers, and
+ * 0xFFFFFFFF is set aside to mean that the size is unknown.  Larger
+ * outputs are written as RF64 files.
+ */
+#define RIFF_DATA_MAX (INT64_C(0xfffffffe) - (WAV_HEADER_MAX - 8))
+
+/*
+ * The size in bytes of the header of a checkpoint index, the format
+ * version, the size of the fixed part of each checkpoint, and the
+ * default number of seconds between checkpoints.
+ */
+#define INDEX_HEADER_SIZE (36)
+#define INDEX_VERSION (2)
+#define INDEX_ENTRY_SIZE (24)
+#define INDEX_INTERVAL (10)
+
+/*
+ * The revision of the render cache keys.
+ * 
+ * Increase this each time a change to this program may change the
+ * output rendered from the same input with the same options, so that
+ * files cached by earlier versions are no longer used.
+ */
+#define CACHE_VERSION (4)
+
+/*
+ * The number of frames of each step of the emulator probe that
+ * fingerprints the emulator core for render cache keys.
+ */
+#define PROBE_FRAMES (4096)
+
+/*
+ * The number of bytes read at a time while hashing an input file or
+ * copying a file into or out of the render cache.
+ */
+#define CACHE_CHUNK (65536)
+
+/*
+ * The default period size in sample frames for real-time playback, and
+ * the number of periods in the audio device buffer.
+ */
+#define PLAY_PERIOD  (256)
+#define PLAY_PERIODS (3)
+
+/*
+ * The capacity of the register write queue used for real-time
+ * playback, and the number of samples that must be queued ahead before
+ * playback starts.
+ */
+#define PLAY_QUEUE   (16384)
+#define PLAY_PREFILL (8192)
+
+/*
+ * The minimum time in seconds that each benchmark stage runs for.
+ * Stages are repeated over the same input until this much time has
+ * passed.
+ */
+#define BENCH_MIN_TIME (0.5)
+
+/*
+ * The number of lines in the synthetic dense script that the benchmark
+ * uses when no inputs are given.
+ */
+#define BENCH_DENSE_LINES (200000)
+
+/*
+ * The number of register ranges that issued register writes are
+ * counted in.  Each range covers 32 registers.
+ */
+#define STAT_RANGES (OPL_RENDER_RANGES)
+
+/*
+ * Non-zero if instrumentation is enabled.
+ * 
+ * Unless RETRO_OPL_STATS is defined when compiling, this is constant
+ * zero, so the compiler leaves the instrumentation out of the hot paths
+ * altogether.
+ */
+#ifdef RETRO_OPL_STATS
+#define STATS_ON (stats_enabled)
+#else
+#define STATS_ON (0)
+#endif
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * A register write recorded in the event log of a split render.
+ */
+typedef struct {
+  
+  /*
+   * The sample offset at which the write takes effect.
+   */
+  int64_t offs;
+  
+  /*
+   * The chip that the write goes to, the OPL2 register, and the value
+   * to write.
+   */
+  uint8_t chip;
+  uint8_t reg;
+  uint8_t val;
+  
+} LOGWRITE;
+
+/*
+ * Instrumentation counters of a rendering operation.
+ * 
+ * The counts and times cover every pass over the input, so an input
+ * that gets a first pass before it is rendered is counted twice.
+ */
+typedef struct {
+  
+  /*
+   * The number of script lines read, and the number of register write,
+   * wait, and chip select events handled.
+   */
+  int64_t lines;
+  int64_t writes;
+  int64_t waits;
+  int64_t selects;
+  
+  /*
+   * The number of register writes that went on to an emulator after
+   * any coalescing, counted by register range.
+   */
+  int64_t issued[STAT_RANGES];
+  
+  /*
+   * The number of samples generated by the emulators, one for each chip
+   * in each frame.
+   */
+  int64_t samples;
+  
+  /*
+   * The time in seconds spent in the emulators, in the sample rate
+   * converter, in converting and writing output, and in everything else
+   * while handling events, which is mostly parsing the input.
+   */
+  double gen_secs;
+  double resample_secs;
+  double out_secs;
+  double parse_secs;
+  
+  /*
+   * The largest number of events within one second of emulator output.
+   */
+  int64_t peak_events;
+  
+} STATS;
+
+/*
+ * The options that select the format of the output files.
+ */
+typedef struct {
+  
+  /*
+   * Flag set if the output files have the raw PCM samples only, without
+   * any WAVE headers.
+   */
+  int raw;
+  
+  /*
+   * The output sample format, one of the PCM format constants, the
+   * linear gain applied to the output, and flag set if all chips are
+   * mixed down into one channel.
+   */
+  int format;
+  float gain;
+  int mono;
+  
+} OUTFMT;
+
+/*
+ * The state of a rendering operation.
+ * 
+ * Each batch worker has its own render state, which is reused for each
+ * job that the worker handles.
+ */
+typedef struct {
+  
+  /*
+   * The path of the input file, for use in error reports, or NULL if
+   * input is from standard input.
+   */
+  const char *pInPath;
+  
+  /*
+   * The render session that synthesizes the output, or NULL if the
+   * render state has not rendered anything yet.  The session holds the
+   * emulator contexts, and it is kept between inputs as long as the
+   * sample rate stays the same.
+   */
+  OPL_RENDER *ps;
+  
+  /*
+   * The output sample rate of the render session.
+   */
+  int32_t ps_rate;
+  
+  /*
+   * The time in seconds spent pulling frames from the session since its
+   * counters were last added to the instrumentation counters.  This is
+   * only measured if instrumentation is enabled.
+   */
+  double pull_secs;
+  
+  /*
+   * The decoder that runs the events of an input for compiling, for
+   * real-time playback, and for split renders, or NULL if no input has
+   * been opened that way yet.  The decoder is kept between inputs, so
+   * that its buffers are reused.
+   */
+  OPL_INPUT *pi;
+  
+  /*
+   * The emulator context that real-time playback synthesizes with, or
+   * NULL if not playing.
+   */
+  OPL_CONTEXT *pc;
+  
+  /*
+   * The format of the output files.
+   */
+  OUTFMT fmt;
+  
+  /*
+   * The handle to the WAV output file, or NULL if not open.
+   */
+  FILE *pOut;
+  
+  /*
+   * Flag set if the output is standard output or some other file that
+   * is not a regular file, such as a pipe.  Such output can not be
+   * seeked, so the WAVE header must be written correctly up front.
+   */
+  int o_stream;
+  
+  /*
+   * The path to the WAV output file and its sample rate.
+   */
+  const char *pOutPath;
+  int32_t sample_rate;
+  
+  /*
+   * The sample rate that the emulator runs at, as chosen by the OPL
+   * driver for the output sample rate.  Timing is computed in samples
+   * at this rate.
+   */
+  int32_t emu_rate;
+  
+  /*
+   * The register write coalescer for each chip when the events of an
+   * input are run with writes being coalesced, or NULL otherwise.
+   */
+  OPL_COALESCE *pcs[MAX_CHIPS];
+  
+  /*
+   * The handle to the binary event stream being compiled, or NULL if
+   * the events are run for something else.
+   */
+  FILE *pComp;
+  
+  /*
+   * The total number of output frames, as measured by a first pass, or
+   * -1 if this is not known in advance.
+   */
+  int64_t s_known;
+  
+  /*
+   * Flag set if register writes are pushed into the playback queue
+   * while the events are run.
+   */
+  int rec;
+  
+  /*
+   * During real-time playback, the register write queue, the audio
+   * output, and the playback thread.  The thread that runs the input
+   * pushes register writes into the queue, and the playback thread is
+   * the only one that touches the emulator context.
+   */
+  OPL_QUEUE *pq;
+  AUDIO_OUT *pa;
+  pthread_t play_tid;
+  
+  /*
+   * Flag set once the playback thread has been started, and the error
+   * code from the audio output if the playback thread failed.
+   */
+  int play_live;
+  int play_err;
+  
+  /*
+   * The sample offset of the next sample that the playback thread will
+   * generate.  This is only used by the playback thread.
+   */
+  int64_t p_pos;
+  
+  /*
+   * When building a checkpoint index, the index file and the number of
+   * checkpoints written so far.  Otherwise, pIndex is NULL.
+   */
+  FILE *pIndex;
+  int32_t ix_count;
+  
+  /*
+   * A buffer for a state snapshot of each chip, or NULL if not allocated
+   * yet.
+   */
+  uint8_t *pSnap;
+  
+  /*
+   * Flag set if register writes are recorded into the event log while
+   * the events are run, and the event log with its length and capacity.
+   * The log is used for split renders.
+   */
+  int logging;
+  LOGWRITE *pLog;
+  int32_t log_count;
+  int32_t log_cap;
+  
+  /*
+   * The current sample offset while the events are run.  The decoder
+   * keeps the time of the input in control cycles and converts it to
+   * sample offsets.
+   */
+  int64_t current;
+  
+  /*
+   * The number of write, wait, and chip select events handled since the
+   * events began.
+   */
+  int64_t ev_count;
+  
+  /*
+   * The instrumentation counters, which are only updated if
+   * instrumentation is enabled.
+   * 
+   * While events are handled, st_begin is the clock time and st_busy is
+   * the time spent in the stages other than parsing when the events
+   * began.  The events within the current second of emulator output are
+   * those after event st_base, and the second ends at sample offset
+   * st_end.
+   */
+  STATS st;
+  double st_begin;
+  double st_busy;
+  int64_t st_base;
+  int64_t st_end;
+  
+  /*
+   * The number of chips that the input uses, and the chip that register
+   * writes currently go to.  Without mixing, each chip has its own
+   * output channel, with the first chip on the left.
+   */
+  int32_t chips;
+  int32_t chip;
+  
+  /*
+   * The total number of samples that have been written to output.
+   * 
+   * This is updated during flush operations, not when the samples are
+   * just written into the buffer.
+   */
+  int64_t s_total;
+  
+  /*
+   * The sample buffer and a count of how many samples have been
+   * written into it.  With more than one chip, the buffer holds
+   * interleaved frames with one sample per chip.
+   */
+  int32_t s_fill;
+  int16_t s_buf[BUFFER_SAMPLES];
+  
+  /*
+   * The binary buffer receives the samples of the sample buffer in the
+   * output format.  It is not used for 16-bit output on little-endian
+   * systems without gain or mixing, since the sample buffer can then
+   * be written as it is.
+   */
+  uint8_t b_buf[BUFFER_SAMPLES * PCM_WIDTH_MAX];
+
+} RENDER;
+
+/*
+ * One segment of a split render.
+ */
+typedef struct {
+  
+  /*
+   * The render state that owns the event log and the output file.  The
+   * segment only reads from it.
+   */
+  const RENDER *pr;
+  
+  /*
+   * The emulator contexts for each chip of the segment.
+   */
+  OPL_CONTEXT *pc[MAX_CHIPS];
+  
+  /*
+   * The sample offset of the first frame of the segment, and the sample
+   * offset just after its last frame.
+   */
+  int64_t start;
+  int64_t end;
+  
+  /*
+   * The sample buffer and the binary buffer of the segment.
+   */
+  int16_t s_buf[BUFFER_SAMPLES];
+  uint8_t b_buf[BUFFER_SAMPLES * PCM_WIDTH_MAX];
+  
+  /*
+   * For each chip, the register writes inside the sample buffer that is
+   * being synthesized, and the number of them.
+   */
+  OPL_EVENT e_buf[MAX_CHIPS][EVENT_BATCH];
+  int32_t e_fill[MAX_CHIPS];
+  
+  /*
+   * The instrumentation counters of the segment, which are added to the
+   * render state once the segment is done.
+   */
+  STATS st;
+  
+} SEGMENT;
+
+/*
+ * A job in a batch manifest.
  */
-#define LINE_MAXIMUM (1023)
+typedef struct {
+  
+  /*
+   * The sampling rate of the output WAV file.
+   */
+  int32_t sample_rate;
+  
+  /*
+   * The path to the input OPL2 hardware script.
+   */
+  char *pInPath;
+  
+  /*
+   * The path to the output WAV file.
+   */
+  char *pOutPath;
+  
+  /*
+   * The index of the emulator core that renders the job, as passed to
+   * opl_core_key().
+   */
+  int32_t core;
+
+} JOB;
 
 /*
  * Local data
@@ -64,46 +641,139 @@ static const char *pModule = NULL;
 static int endian_state = 0;
 
 /*
- * The line number in the input file.
+ * The job list in batch mode.
+ * 
+ * The jobs are run in one pass for each emulator core, and job_core is
+ * the core of the current pass.  job_next is the index in the list
+ * where the workers look for the next job of that core.  It is
+ * protected by job_lock.
+ */
+static JOB *pJobs = NULL;
+static int32_t job_count = 0;
+static int32_t job_cap = 0;
+static int32_t job_core = 0;
+static int32_t job_next = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Lock that protects creating and freeing emulator contexts on worker
+ * threads in batch mode, where render sessions are replaced and inputs
+ * for two chips are loaded.
+ */
+static pthread_mutex_t ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The repeat count for VGM input files.
  * 
- * This starts out zero so that the first line read will be line 1.
+ * 1 to play the VGM data once, 2 to loop back once.  This is set by
+ * the -loop option before any rendering starts.
+ */
+static int vgm_rep = 1;
+
+/*
+ * Flag set if emulator contexts skip synthesis while the emulated chips
+ * are idle.  This is set by the -skip option before any rendering
+ * starts.
+ */
+static int skip_silence = 0;
+
+/*
+ * Flag set if register writes that happen at the same time are
+ * coalesced before they reach the emulator or the compiled output.
+ * This is set by the -coalesce option before any rendering starts.
+ */
+static int coalesce_writes = 0;
+
+/*
+ * The number of segments that a single render is split into for
+ * rendering on separate threads, or one to render on a single thread.
+ * This is set by the -split option before any rendering starts.
+ */
+static int32_t split_count = 1;
+
+/*
+ * The data offset in the output file of a split render.  This is set
+ * before the segment threads start, and they only read it.
+ */
+static off_t split_data = 0;
+
+/*
+ * The range of time in seconds that is rendered, set by the -from and
+ * -to options.  A negative end means the range lasts to the end of the
+ * input.
+ */
+static double range_from = 0.0;
+static double range_to = -1.0;
+
+/*
+ * The number of seconds between checkpoints when building a checkpoint
+ * index, set by the -interval option.
  */
-static int32_t line_count = 0;
+static int32_t index_interval = INDEX_INTERVAL;
 
 /*
- * The input line buffer and a flag indicating whether it is
- * initialized.
+ * The checkpoint index loaded with the -checkpoints option and its
+ * length in bytes, or NULL if there is none.
+ */
+static uint8_t *pIndexData = NULL;
+static size_t index_len = 0;
+
+/*
+ * The render cache directory set by the -cache option, or NULL if
+ * there is no render cache.
  * 
- * When initialized, it stores the line content as a nul-terminated
- * string, not including any line break at the end.
+ * The cache statistics count the renders that were copied from the
+ * cache and the renders that had to be synthesized, along with the
+ * bytes copied out of the cache and the bytes stored into it.  The
+ * statistics and the serial number used for temporary file names are
+ * protected by cache_lock, since batch workers update them.
+ */
+static const char *pCacheDir = NULL;
+static int32_t cache_hits = 0;
+static int32_t cache_misses = 0;
+static int64_t cache_hit_bytes = 0;
+static int64_t cache_stored_bytes = 0;
+static int32_t cache_serial = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The fingerprint of the emulator core in render cache keys, as
+ * hexadecimal digits, set by cacheProbe() before any rendering starts,
+ * and again for each core that batch mode selects.
  */
-static int     l_init = 0;
-static uint8_t l_buf[LINE_MAXIMUM + 1];
+static char cache_probe[(SHA256_DIGEST_SIZE * 2) + 1];
 
 /*
- * The handle to the WAV output file, or NULL if not open.
+ * The requested period size in sample frames for real-time playback,
+ * and the path to the audio device or NULL for the default device.
+ * These are set by the -period and -device options.
  */
-static FILE *pOut = NULL;
+static int32_t play_period = PLAY_PERIOD;
+static const char *pPlayDevice = NULL;
 
 /*
- * The total number of samples that have been written to output.
+ * Flag set by the -stats option, and the instrumentation counters of
+ * all render states that have been freed so far.
  * 
- * This is updated during flush operations, not when the samples are
- * just written into the buffer.
+ * Render states are only freed on the main thread, so the totals need
+ * no lock.
  */
-static int32_t s_total = 0;
+static int stats_enabled = 0;
+static STATS stats_total;
 
 /*
- * The sample buffer and a count of how many samples have been written
- * into it.
+ * The emulator core selected with the -core option, or NULL if the
+ * default core is used.  The benchmark compares all cores unless one
+ * was selected.
  */
-static int32_t s_fill = 0;
-static int16_t s_buf[BUFFER_SAMPLES];
+static const char *pCoreKey = NULL;
 
 /*
- * The binary buffer is used for byte output of samples.
+ * The index of the emulator core selected for the run, as passed to
+ * opl_core_key().  This is the core of the batch jobs that do not name
+ * one.
  */
-static uint8_t b_buf[BUFFER_SAMPLES * 2];
+static int32_t run_core = 0;
 
 /*
  * Local functions
@@ -112,24 +782,168 @@ static uint8_t b_buf[BUFFER_SAMPLES * 2];
 
 /* Prototypes */
 static void raiseErr(void);
+static void renderErr(const RENDER *pr);
 static int isLittleEndian(void);
 
-static void writeByte(uint8_t val);
-static void writeWord(uint16_t val);
-static void writeDword(uint32_t val);
+static RENDER *newRender(int32_t sample_rate, const OUTFMT *pFmt);
+static OPL_RENDER *newSession(RENDER *pr, int32_t sample_rate);
+static RENDER *newWorker(const OUTFMT *pFmt);
+static void freeRender(RENDER *pr);
+static void setRate(RENDER *pr, int32_t sample_rate);
+static int isRate(int32_t sample_rate);
+
+static void writeByte(RENDER *pr, uint8_t val);
+static void writeWord(RENDER *pr, uint16_t val);
+static void writeDword(RENDER *pr, uint32_t val);
+static void writeQword(RENDER *pr, uint64_t val);
+
+static int isStreamPath(const char *pPath);
+static int32_t outChannels(const RENDER *pr);
+static int64_t dataBytes(const RENDER *pr, int64_t samples);
+static int64_t knownSamples(const RENDER *pr);
+static int extensible(const RENDER *pr);
+static int32_t headerBytes(const RENDER *pr);
+static void writeHeaders(RENDER *pr, int64_t data_size);
+static void moveSamples(RENDER *pr, int64_t data_size);
+static void beginWAV(RENDER *pr, const char *pPath,
+                     int32_t sample_rate);
+static void finishWAV(RENDER *pr);
+
+static const void *convertSamples(
+    const int16_t * pIn,
+          int32_t   samples,
+          int32_t   chips,
+    const OUTFMT  * pFmt,
+          uint8_t * pBin,
+          size_t  * pCount);
+static void flushBuffer(RENDER *pr);
+
+static const char *parsePath(
+    const RENDER *  pr,
+    const char   *  pstr,
+          char   ** ppPath);
+
+static void inputErr(
+    const RENDER    * pr,
+    const OPL_INPUT * pi,
+    const char      * pMsg);
+
+static void writeBinByte(FILE *pf, uint8_t val);
+static void writeBinDword(FILE *pf, uint32_t val);
+static void writeBinQword(FILE *pf, uint64_t val);
+static uint32_t readBinDword(const uint8_t *pd);
+static uint64_t readBinQword(const uint8_t *pd);
 
-static void beginWAV(const char *pPath, int32_t sample_rate);
-static void finishWAV(void);
+static void beginEvents(RENDER *pr);
+static void endEvents(RENDER *pr);
+static void applyWrite(RENDER *pr, uint8_t reg, uint8_t val);
+static void coalesceOut(void *pArg, int32_t reg, int32_t val);
+static void flushWrites(RENDER *pr);
 
-static void flushBuffer(void);
-static void computeSamples(int32_t count);
+static void eventChip(RENDER *pr, int32_t chip);
+static void eventWrite(RENDER *pr, uint8_t reg, uint8_t val);
+static void eventWait(RENDER *pr, int32_t cycles, int64_t frame);
 
-static int isBlankStr(const uint8_t *pstr);
-static const uint8_t *parseByte(const uint8_t *pstr, uint8_t *pb);
-static const uint8_t *parseInt(const uint8_t *pstr, int32_t *pv);
+static OPL_INPUT *getInput(RENDER *pr);
+static void openInput(RENDER *pr, const char *pInPath);
+static void openStream(RENDER *pr, FILE *pf, int kind);
+static void runInput(RENDER *pr);
+static void closeInput(RENDER *pr);
 
-static int readInput(void);
-static int32_t readHeader(void);
+static uint8_t *snapBuffer(RENDER *pr);
+static void indexPoint(void *pArg, OPL_RENDER *ps, int32_t chip);
+static void buildIndex(
+          RENDER * pr,
+    const char   * pIndexPath,
+    const char   * pInPath);
+static void loadIndex(const char *pPath);
+static const uint8_t *findCheckpoint(const RENDER *pr);
+static void seekCheckpoint(RENDER *pr);
+
+static void logWrite(RENDER *pr, uint8_t reg, uint8_t val);
+static void splitOut(SEGMENT *ps, int64_t pos, int32_t count);
+static void splitSynth(
+    SEGMENT * ps,
+    int64_t   pos,
+    int64_t   end,
+    int32_t   i);
+static void *splitMain(void *pArg);
+static int renderSplit(RENDER *pr);
+
+static void renderFile(
+          RENDER * pr,
+    const char   * pInPath,
+    const char   * pOutPath,
+          int32_t  sample_rate);
+static void sessionErr(const RENDER *pr);
+static void loadSession(RENDER *pr, FILE *pf);
+static void renderSession(
+          RENDER * pr,
+    const char   * pInPath,
+          FILE   * pf,
+    const char   * pOutPath,
+          int32_t  sample_rate);
+static void compileScript(RENDER *pr, const char *pOutPath);
+
+static int64_t copyData(int fd_in, int fd_out);
+static void cacheProbe(void);
+static char *cacheKey(
+    const RENDER  * pr,
+    const char    * pInPath,
+          int32_t   sample_rate);
+static int cacheFetch(
+          RENDER * pr,
+    const char   * pKeyPath,
+    const char   * pOutPath);
+static void cacheStore(
+    const char * pKeyPath,
+    const char * pOutPath);
+static void renderCached(
+          RENDER * pr,
+    const char   * pInPath,
+    const char   * pOutPath,
+          int32_t  sample_rate);
+static void cacheReport(void);
+
+static double statsBusy(const STATS *pst);
+static void statsMerge(STATS *pDst, const STATS *pSrc);
+static void statsBegin(RENDER *pr);
+static void statsSecond(RENDER *pr);
+static void statsEnd(RENDER *pr);
+static void statsSession(RENDER *pr);
+static void statsReport(void);
+
+static void queueWrite(RENDER *pr, uint8_t reg, uint8_t val);
+static int playFill(void *pArg, int16_t *pbuf, int32_t frames);
+static void *playMain(void *pArg);
+static void startPlayback(RENDER *pr);
+static void playInput(RENDER *pr);
+
+static int32_t findCore(const char *pKey);
+static void readManifest(RENDER *pr);
+static JOB *nextJob(void);
+static void *workerMain(void *pArg);
+static void runBatch(const char *pPath, const OUTFMT *pFmt);
+
+static double benchClock(void);
+static void benchPrint(
+    const char    * pLabel,
+    const char    * pStage,
+    const char    * pUnit,
+          double    count,
+          double    secs);
+static void benchInput(RENDER *pr, const char *pLabel, FILE *pf);
+static FILE *benchDense(void);
+static void runBench(
+          int32_t    sample_rate,
+    const OUTFMT   * pFmt,
+          int        argc,
+          char     * argv[]);
+
+static int32_t parseOptInt(const char *pName, const char *pstr);
+static double parseTime(const char *pName, const char *pstr);
+static int32_t parseRate(const char *pstr);
+static float parseGain(const char *pstr);
 
 /*
  * Function called when the program is stopping on an error.
@@ -150,10 +964,33 @@ static void raiseErr(void) {
   exit(1);
 }
 
+/*
+ * Function called when a rendering operation is stopping on an error.
+ * 
+ * This function will not return.  If the render state has an input path
+ * (which is the case in batch mode), the path is reported so that the
+ * failed job can be identified.  Then, raiseErr() is called.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void renderErr(const RENDER *pr) {
+  if (pr != NULL) {
+    if (pr->pInPath != NULL) {
+      fprintf(stderr, "%s: Error while processing '%s'!\n",
+              pModule, pr->pInPath);
+    }
+  }
+  raiseErr();
+}
+
 /*
  * Check whether this system is little endian.
  * 
- * The result is cached after the first invocation.
+ * The result is cached after the first invocation.  In batch mode, this
+ * is called once before the worker threads are started, so that the
+ * workers only read the cached value.
  * 
  * Return:
  * 
@@ -180,7 +1017,7 @@ static int isLittleEndian(void) {
   if (endian_state == 1) {
     result = 1;
   } else if (endian_state == 2) {
-    result = 2;
+    result = 0;
   } else {
     fprintf(stderr, "%s: Failed to detect endianness!\n", pModule);
     raiseErr();
@@ -189,575 +1026,4284 @@ static int isLittleEndian(void) {
 }
 
 /*
- * Write a single byte to output.
+ * Allocate a new render state.
  * 
- * This function is used by all output functions, except flushBuffer,
- * which has its own bulk output function.
+ * The render state gets its render session once it renders something,
+ * see newSession().
  * 
  * Parameters:
  * 
- *   val - the byte value to write
+ *   sample_rate - the initial output sample rate
+ * 
+ *   pFmt - the format of the output files
+ * 
+ * Return:
+ * 
+ *   the new render state
  */
-static void writeByte(uint8_t val) {
-  /* Check state */
-  if (pOut == NULL) {
-    raiseErr();
-  }
+static RENDER *newRender(int32_t sample_rate, const OUTFMT *pFmt) {
+  RENDER *pr = NULL;
   
-  /* Write byte */
-  if (fputc((int) val, pOut) != val) {
-    fprintf(stderr, "%s: I/O error writing to output!\n", pModule);
+  /* Allocate and clear the structure */
+  pr = (RENDER *) calloc(1, sizeof(RENDER));
+  if (pr == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
     raiseErr();
   }
+  
+  /* Output length is not known in advance, and there is one chip until
+   * an input says otherwise */
+  pr->s_known = -1;
+  pr->chips = 1;
+  memcpy(&(pr->fmt), pFmt, sizeof(OUTFMT));
+  setRate(pr, sample_rate);
+  
+  return pr;
 }
 
 /*
- * Write a 16-bit unsigned word in little-endian order to output.
+ * Create a render session for a render state, closing the session it
+ * had before.
+ * 
+ * The session has the output sample rate given, the -from and -to
+ * range, and the -coalesce and -skip options.  If instrumentation is
+ * enabled, the session is timed with benchClock(), and the counters of
+ * the old session are added to the render state first.  This is safe
+ * to call from worker threads, since the old session is closed and the
+ * new one created while holding ctx_lock, so other workers can not
+ * take the emulator context in between.
  * 
  * Parameters:
  * 
- *   val - the word value to write
+ *   pr - the render state of the worker
+ * 
+ *   sample_rate - the output sample rate
+ * 
+ * Return:
+ * 
+ *   the new session, or NULL if the driver can not create any more
+ *   emulator contexts
  */
-static void writeWord(uint16_t val) {
-  writeByte((uint8_t) (val & 0xff));
-  writeByte((uint8_t) (val >> 8));
+static OPL_RENDER *newSession(RENDER *pr, int32_t sample_rate) {
+  OPL_RENDER *ps = NULL;
+  int flags = 0;
+  int err = OPL_RENDER_ERR_NONE;
+  
+  if (coalesce_writes) {
+    flags |= OPL_RENDER_COALESCE;
+  }
+  if (skip_silence) {
+    flags |= OPL_RENDER_SKIP;
+  }
+  
+  if (STATS_ON && (pr->ps != NULL)) {
+    statsSession(pr);
+  }
+  
+  pthread_mutex_lock(&ctx_lock);
+  opl_render_close(pr->ps);
+  pr->ps = NULL;
+  ps = opl_render_new(sample_rate, flags, &err);
+  pthread_mutex_unlock(&ctx_lock);
+  
+  if (ps != NULL) {
+    pr->ps_rate = sample_rate;
+    opl_render_range(ps, range_from, range_to);
+    if (STATS_ON) {
+      opl_render_clock(ps, &benchClock);
+    }
+  } else if (err != OPL_RENDER_ERR_CONTEXT) {
+    fprintf(stderr, "%s: %s!\n", pModule, opl_render_errstr(err));
+    renderErr(pr);
+  }
+  return ps;
 }
 
 /*
- * Write a 32-bit unsigned dword in little-endian order to output.
+ * Allocate a new render state for a batch worker.
+ * 
+ * The render state gets its render session right away, so that the
+ * number of workers is limited by the number of emulator contexts.
+ * 
+ * This must not be called while worker threads are running.
  * 
  * Parameters:
  * 
- *   val - the dword value to write
+ *   pFmt - the format of the output files
+ * 
+ * Return:
+ * 
+ *   the new render state, or NULL if the driver can not create any
+ *   more emulator contexts
  */
-static void writeDword(uint32_t val) {
-  writeByte((uint8_t) (val & 0xff));
-  writeByte((uint8_t) ((val >> 8) & 0xff));
-  writeByte((uint8_t) ((val >> 16) & 0xff));
-  writeByte((uint8_t) (val >> 24));
+static RENDER *newWorker(const OUTFMT *pFmt) {
+  RENDER *pr = NULL;
+  
+  /* Create the session at the rate that most jobs use */
+  pr = newRender(44100, pFmt);
+  pr->ps = newSession(pr, pr->sample_rate);
+  if (pr->ps == NULL) {
+    free(pr);
+    pr = NULL;
+  }
+  
+  return pr;
 }
 
 /*
- * Open output file and write WAVE headers.
+ * Free a render state along with its render session.
  * 
- * A few WAVE header values are not known until all samples have been
- * written.  These are written with finishWAV().
+ * This must not be called while worker threads are running, because
+ * freeing emulator contexts is not thread-safe.
  * 
  * Parameters:
  * 
- *   pPath - path to the output file to create
- * 
- *   sample_rate - either 44100 or 48000
+ *   pr - the render state to free
  */
-static void beginWAV(const char *pPath, int32_t sample_rate) {
-  /* Check parameters */
-  if ((pPath == NULL) ||
-      ((sample_rate != 48000) && (sample_rate != 44100))) {
-    raiseErr();
-  }
+static void freeRender(RENDER *pr) {
+  int32_t i = 0;
   
-  /* Check state */
-  if (pOut != NULL) {
-    raiseErr();
+  if (STATS_ON) {
+    if (pr->ps != NULL) {
+      statsSession(pr);
+    }
+    statsMerge(&stats_total, &(pr->st));
   }
   
-  /* Open output file */
-  pOut = fopen(pPath, "wb");
-  if (pOut == NULL) {
-    fprintf(stderr, "%s: Failed to create file '%s'!\n",
-            pModule, pPath);
-    raiseErr();
+  for(i = 0; i < MAX_CHIPS; i++) {
+    opl_coalesce_free(pr->pcs[i]);
+    pr->pcs[i] = NULL;
   }
-  
-  /* Write the WAVE header (string constants are backwards because this
-   * is little endian) */
-  writeDword(UINT32_C(0x46464952));   /* "RIFF" */
-  writeDword(0);                      /* Chunk size (done later) */
-  writeDword(UINT32_C(0x45564157));   /* "WAVE" */
-  writeDword(UINT32_C(0x20746d66));   /* "fmt " */
-  writeDword(UINT32_C(16));           /* Format chunk size */
-  writeWord(UINT16_C(1));             /* WAVE_FORMAT_PCM */
-  writeWord(UINT16_C(1));             /* Number of channels */
-  writeDword((uint32_t) sample_rate); /* Sample rate */
-  writeDword((uint32_t)
-          (sample_rate * 2));         /* Bytes per second */
-  writeWord(UINT16_C(2));             /* Block align */
-  writeWord(UINT16_C(16));            /* Bits per sample */
-  writeDword(UINT32_C(0x61746164));   /* "data" */
-  writeDword(0);                      /* Data size (done later) */
+  free(pr->pLog);
+  pr->pLog = NULL;
+  free(pr->pSnap);
+  pr->pSnap = NULL;
+  opl_input_free(pr->pi);
+  pr->pi = NULL;
+  opl_render_close(pr->ps);
+  pr->ps = NULL;
+  free(pr);
 }
 
 /*
- * Finish writing the WAV file and close it.
+ * Set the output sample rate of a render state.
  * 
- * The sample buffer will automatically be flushed by this function.
+ * This also sets the emulator rate that the OPL driver chooses for the
+ * output rate.  It does not reset any emulator contexts.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   sample_rate - the output sample rate, which must pass isRate()
  */
-static void finishWAV(void) {
-  int32_t data_size = 0;
-  int32_t chunk_size = 0;
-  
+static void setRate(RENDER *pr, int32_t sample_rate) {
+  if (!isRate(sample_rate)) {
+    renderErr(pr);
+  }
+  pr->sample_rate = sample_rate;
+  pr->emu_rate = opl_ctx_rate(sample_rate);
+  if (pr->pi != NULL) {
+    opl_input_set_rate(pr->pi, pr->emu_rate);
+  }
+}
+
+/*
+ * Check whether a sample rate is supported for output.
+ * 
+ * Parameters:
+ * 
+ *   sample_rate - the sample rate to check
+ * 
+ * Return:
+ * 
+ *   non-zero if supported, zero if not
+ */
+static int isRate(int32_t sample_rate) {
+  return ((sample_rate >= RESAMPLE_RATE_MIN) &&
+          (sample_rate <= RESAMPLE_RATE_MAX));
+}
+
+/*
+ * Write a single byte to output.
+ * 
+ * This function is used by all output functions, except flushBuffer,
+ * which has its own bulk output function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   val - the byte value to write
+ */
+static void writeByte(RENDER *pr, uint8_t val) {
+  /* Check state */
+  if (pr->pOut == NULL) {
+    renderErr(pr);
+  }
+  
+  /* Write byte */
+  if (fputc((int) val, pr->pOut) != val) {
+    fprintf(stderr, "%s: I/O error writing to output!\n", pModule);
+    renderErr(pr);
+  }
+}
+
+/*
+ * Write a 16-bit unsigned word in little-endian order to output.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   val - the word value to write
+ */
+static void writeWord(RENDER *pr, uint16_t val) {
+  writeByte(pr, (uint8_t) (val & 0xff));
+  writeByte(pr, (uint8_t) (val >> 8));
+}
+
+/*
+ * Write a 32-bit unsigned dword in little-endian order to output.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   val - the dword value to write
+ */
+static void writeDword(RENDER *pr, uint32_t val) {
+  writeByte(pr, (uint8_t) (val & 0xff));
+  writeByte(pr, (uint8_t) ((val >> 8) & 0xff));
+  writeByte(pr, (uint8_t) ((val >> 16) & 0xff));
+  writeByte(pr, (uint8_t) (val >> 24));
+}
+
+/*
+ * Write a 64-bit unsigned qword in little-endian order to output.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   val - the qword value to write
+ */
+static void writeQword(RENDER *pr, uint64_t val) {
+  writeDword(pr, (uint32_t) (val & UINT32_C(0xffffffff)));
+  writeDword(pr, (uint32_t) (val >> 32));
+}
+
+/*
+ * Check whether an output path refers to an output that can not be
+ * seeked.
+ * 
+ * This is the case for the special path "-" that selects standard
+ * output, and for existing files that are not regular files, such as
+ * named pipes.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the output path
+ * 
+ * Return:
+ * 
+ *   non-zero if the output is a stream, zero otherwise
+ */
+static int isStreamPath(const char *pPath) {
+  struct stat st;
+  
+  if (strcmp(pPath, "-") == 0) {
+    return 1;
+  }
+  
+  if (stat(pPath, &st) == 0) {
+    if (!S_ISREG(st.st_mode)) {
+      return 1;
+    }
+  }
+  
+  return 0;
+}
+
+/*
+ * Return the number of channels in the output.
+ * 
+ * This is the number of chips, unless they are mixed down into one
+ * channel.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ * Return:
+ * 
+ *   the number of output channels
+ */
+static int32_t outChannels(const RENDER *pr) {
+  if (pr->fmt.mono) {
+    return 1;
+  }
+  return pr->chips;
+}
+
+/*
+ * Compute the WAVE data size for a given number of samples.
+ * 
+ * The sample count is the number of samples generated, with one sample
+ * for each chip in each frame.  The data size accounts for mixing and
+ * for the width of the output format.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, for error reports
+ * 
+ *   samples - the total number of samples
+ * 
+ * Return:
+ * 
+ *   the data size in bytes
+ */
+static int64_t dataBytes(const RENDER *pr, int64_t samples) {
+  int64_t data_size = 0;
+  int32_t width = 0;
+  
+  /* Compute data size in bytes, watching for overflow */
+  width = pcm_conv_width(pr->fmt.format);
+  data_size = (samples / pr->chips) * outChannels(pr);
+  if (data_size <= INT64_MAX / width) {
+    data_size *= width;
+  } else {
+    fprintf(stderr, "%s: Overflow computing file size!\n", pModule);
+    renderErr(pr);
+  }
+  return data_size;
+}
+
+/*
+ * Compute the total number of output samples from the length measured
+ * by a first pass.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, with s_known set
+ * 
+ * Return:
+ * 
+ *   the total number of output samples
+ */
+static int64_t knownSamples(const RENDER *pr) {
+  
+  /* Check state */
+  if (pr->s_known < 0) {
+    renderErr(pr);
+  }
+  
+  /* Convert frames to samples */
+  if (pr->s_known > INT64_MAX / pr->chips) {
+    fprintf(stderr, "%s: Overflow computing file size!\n", pModule);
+    renderErr(pr);
+  }
+  return pr->s_known * pr->chips;
+}
+
+/*
+ * Check whether the WAVE format chunk for the selected output must be
+ * WAVE_FORMAT_EXTENSIBLE.
+ * 
+ * Integer samples wider than 16 bits and layouts with more than two
+ * channels are ambiguous in the plain format chunk, so they use the
+ * extensible one.  Mono and stereo float samples keep the plain
+ * WAVE_FORMAT_IEEE_FLOAT tag, which every reader understands.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ * Return:
+ * 
+ *   non-zero if the format chunk is extensible, zero otherwise
+ */
+static int extensible(const RENDER *pr) {
+  if (outChannels(pr) > 2) {
+    return 1;
+  }
+  return ((pr->fmt.format != PCM_F32) &&
+          (pcm_conv_width(pr->fmt.format) > 2));
+}
+
+/*
+ * Compute the size in bytes of the WAVE headers of a RIFF file for the
+ * selected output, up to and including the data chunk header.
+ * 
+ * The format chunk holds 16 bytes for integer samples, 18 bytes for
+ * float samples, whose cbSize field is zero, and 40 bytes if it is
+ * extensible.  Float samples also have a fact chunk with the number of
+ * sample frames, as every format other than integer PCM requires.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ * Return:
+ * 
+ *   the size of the headers in bytes
+ */
+static int32_t headerBytes(const RENDER *pr) {
+  int32_t size = 0;
+  
+  /* RIFF header, format chunk header, and data chunk header */
+  size = 12 + 8 + 8;
+  
+  /* Format chunk */
+  if (extensible(pr)) {
+    size += 40;
+  } else if (pr->fmt.format == PCM_F32) {
+    size += 18;
+  } else {
+    size += 16;
+  }
+  
+  /* Fact chunk */
+  if (pr->fmt.format == PCM_F32) {
+    size += 12;
+  }
+  return size;
+}
+
+/*
+ * Write the WAVE headers at the current position in the output file.
+ * 
+ * If the data size fits in a RIFF file, the headers are the
+ * headerBytes() of the format.  Otherwise, they are RF64 headers,
+ * which are RF64_EXTRA bytes longer.  The 32-bit size fields are then
+ * set to 0xFFFFFFFF, and the actual sizes are in a ds64 chunk.  A data
+ * size of -1 means that the size is unknown, which gives RIFF headers
+ * with the size fields set to 0xFFFFFFFF.
+ * 
+ * A data chunk with an odd size is followed by a pad byte, as RIFF
+ * requires, which is counted in the RIFF or RF64 chunk size but not in
+ * the data size.  finishWAV() writes the pad byte.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   data_size - the data size in bytes, or -1 if unknown
+ */
+static void writeHeaders(RENDER *pr, int64_t data_size) {
+  int32_t chans = 0;
+  int32_t width = 0;
+  int32_t align = 0;
+  int32_t tag = 0;
+  int32_t header = 0;
+  int64_t pad = 0;
+  int64_t frames = 0;
+  uint32_t mask = 0;
+  
+  /* Get the layout of the sample format; float samples use
+   * WAVE_FORMAT_IEEE_FLOAT, and integer samples use WAVE_FORMAT_PCM */
+  chans = outChannels(pr);
+  width = pcm_conv_width(pr->fmt.format);
+  align = chans * width;
+  tag = (pr->fmt.format == PCM_F32) ? 3 : 1;
+  header = headerBytes(pr);
+  pad = (data_size > 0) ? (data_size & 1) : 0;
+  frames = (data_size > 0) ? (data_size / align) : 0;
+  
+  /* Write the RIFF or RF64 header (string constants are backwards
+   * because this is little endian) */
+  if (data_size > RIFF_DATA_MAX) {
+    writeDword(pr, UINT32_C(0x34364652));   /* "RF64" */
+    writeDword(pr, UINT32_C(0xffffffff));   /* Chunk size in ds64 */
+    writeDword(pr, UINT32_C(0x45564157));   /* "WAVE" */
+    writeDword(pr, UINT32_C(0x34367364));   /* "ds64" */
+    writeDword(pr, UINT32_C(28));           /* ds64 chunk size */
+    writeQword(pr, (uint64_t)
+            (data_size + pad + header +
+              RF64_EXTRA - 8));             /* RF64 chunk size */
+    writeQword(pr, (uint64_t) data_size);   /* Data size */
+    writeQword(pr, (uint64_t) frames);      /* Sample frames */
+    writeDword(pr, UINT32_C(0));            /* Size table length */
+  } else {
+    writeDword(pr, UINT32_C(0x46464952));   /* "RIFF" */
+    writeDword(pr, (data_size < 0) ? UINT32_C(0xffffffff) :
+            (uint32_t) (data_size + pad + header - 8)); /* Chunk size */
+    writeDword(pr, UINT32_C(0x45564157));   /* "WAVE" */
+  }
+  
+  /* Write the format chunk; an extensible one names the speakers of
+   * mono and stereo layouts, and carries the actual format tag in the
+   * first field of its subformat GUID */
+  writeDword(pr, UINT32_C(0x20746d66));   /* "fmt " */
+  if (extensible(pr)) {
+    writeDword(pr, UINT32_C(40));         /* Format chunk size */
+    writeWord(pr, UINT16_C(0xfffe));      /* WAVE_FORMAT_EXTENSIBLE */
+  } else {
+    writeDword(pr, (uint32_t)
+            ((tag == 1) ? 16 : 18));      /* Format chunk size */
+    writeWord(pr, (uint16_t) tag);        /* Format tag */
+  }
+  writeWord(pr, (uint16_t) chans);        /* Number of channels */
+  writeDword(pr, (uint32_t) pr->sample_rate); /* Sample rate */
+  writeDword(pr, (uint32_t)
+          (pr->sample_rate * align));     /* Bytes per second */
+  writeWord(pr, (uint16_t) align);        /* Block align */
+  writeWord(pr, (uint16_t) (width * 8));  /* Bits per sample */
+  if (extensible(pr)) {
+    if (chans == 1) {
+      mask = UINT32_C(0x4);               /* Front center */
+    } else if (chans == 2) {
+      mask = UINT32_C(0x3);               /* Front left and right */
+    }
+    writeWord(pr, UINT16_C(22));          /* Extension size */
+    writeWord(pr, (uint16_t) (width * 8)); /* Valid bits per sample */
+    writeDword(pr, mask);                 /* Channel mask */
+    writeDword(pr, (uint32_t) tag);       /* Subformat GUID */
+    writeDword(pr, UINT32_C(0x00100000));
+    writeDword(pr, UINT32_C(0xaa000080));
+    writeDword(pr, UINT32_C(0x719b3800));
+  } else if (tag != 1) {
+    writeWord(pr, UINT16_C(0));           /* Extension size */
+  }
+  
+  /* Write the fact chunk of float samples, whose sample frame count is
+   * in the ds64 chunk if it does not fit, and the data header */
+  if (pr->fmt.format == PCM_F32) {
+    writeDword(pr, UINT32_C(0x74636166)); /* "fact" */
+    writeDword(pr, UINT32_C(4));          /* Fact chunk size */
+    writeDword(pr, ((data_size < 0) || (data_size > RIFF_DATA_MAX) ||
+            (frames > INT64_C(0xffffffff))) ? UINT32_C(0xffffffff) :
+            (uint32_t) frames);           /* Sample frames */
+  }
+  writeDword(pr, UINT32_C(0x61746164));   /* "data" */
+  writeDword(pr, ((data_size < 0) || (data_size > RIFF_DATA_MAX)) ?
+          UINT32_C(0xffffffff) :
+          (uint32_t) data_size);          /* Data size */
+}
+
+/*
+ * Move the samples in a finished output file further into the file to
+ * make room for RF64 headers.
+ * 
+ * The file must have been written with RIFF headers.  The samples are
+ * moved back to front in blocks through the binary buffer, so that no
+ * block overwrites samples that have not been moved yet.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   data_size - the data size in bytes
+ */
+static void moveSamples(RENDER *pr, int64_t data_size) {
+  int64_t remain = 0;
+  off_t src = 0;
+  size_t n = 0;
+  int fd = 0;
+  
+  if (fflush(pr->pOut)) {
+    fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+    renderErr(pr);
+  }
+  fd = fileno(pr->pOut);
+  
+  for(remain = data_size; remain > 0; remain -= (int64_t) n) {
+    n = sizeof(pr->b_buf);
+    if ((int64_t) n > remain) {
+      n = (size_t) remain;
+    }
+    src = (off_t) (headerBytes(pr) + remain - ((int64_t) n));
+    if ((pread(fd, pr->b_buf, n, src) != (ssize_t) n) ||
+        (pwrite(fd, pr->b_buf, n, src + RF64_EXTRA) != (ssize_t) n)) {
+      fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+      renderErr(pr);
+    }
+  }
+}
+
+/*
+ * Open output file and write WAVE headers.
+ * 
+ * If the path is "-", output is written to standard output.  If raw
+ * output is selected, no headers are written.
+ * 
+ * If the total number of samples is known in advance, the headers are
+ * written with their final values.  Otherwise, a few WAVE header values
+ * are not known until all samples have been written.  For regular
+ * files, these are written with finishWAV().  For streams that can not
+ * be seeked, they are set to 0xFFFFFFFF, which most programs reading
+ * WAVE data from a pipe take to mean that the length is unknown.
+ * 
+ * Outputs with more than about 4 GiB of samples are written as RF64
+ * files, see writeHeaders().  If the length is not known in advance,
+ * finishWAV() turns the file into an RF64 file if it turns out to be
+ * that long.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pPath - path to the output file to create
+ * 
+ *   sample_rate - the sample rate of the output
+ */
+static void beginWAV(RENDER *pr, const char *pPath,
+                     int32_t sample_rate) {
+  
+  struct stat st;
+  int64_t data_size = 0;
+  
+  /* Check parameters */
+  if ((pPath == NULL) || (!isRate(sample_rate))) {
+    renderErr(pr);
+  }
+  
+  /* Check state */
+  if (pr->pOut != NULL) {
+    renderErr(pr);
+  }
+  
+  /* Open output file, or use standard output */
+  if (strcmp(pPath, "-") == 0) {
+    pr->pOut = stdout;
+    pr->o_stream = 1;
+    
+  } else {
+    /* Open for reading as well, in case the samples must be moved to
+     * make room for RF64 headers */
+    pr->pOut = fopen(pPath, "w+b");
+    if (pr->pOut == NULL) {
+      fprintf(stderr, "%s: Failed to create file '%s'!\n",
+              pModule, pPath);
+      renderErr(pr);
+    }
+    if (fstat(fileno(pr->pOut), &st)) {
+      fprintf(stderr, "%s: Failed to query file '%s'!\n",
+              pModule, pPath);
+      renderErr(pr);
+    }
+    pr->o_stream = !S_ISREG(st.st_mode);
+  }
+  
+  /* Reset the sample counters */
+  pr->s_total = 0;
+  pr->s_fill = 0;
+  
+  /* Raw output has no headers */
+  if (pr->fmt.raw) {
+    return;
+  }
+  
+  /* Determine the size fields, unless they must be done later, and
+   * write the headers */
+  if (pr->s_known >= 0) {
+    data_size = dataBytes(pr, knownSamples(pr));
+  } else if (pr->o_stream) {
+    data_size = -1;
+  } else {
+    data_size = 0;
+  }
+  writeHeaders(pr, data_size);
+}
+
+/*
+ * Finish writing the WAV file and close it.
+ * 
+ * The sample buffer will automatically be flushed by this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void finishWAV(RENDER *pr) {
+  int64_t data_size = 0;
+  int64_t pad = 0;
+  off_t offs = 0;
+  
   /* Check state */
-  if (pOut == NULL) {
+  if (pr->pOut == NULL) {
+    renderErr(pr);
+  }
+  
+  /* Flush sample buffer */
+  flushBuffer(pr);
+  
+  /* If the length was known in advance, make sure it was right */
+  if ((pr->s_known >= 0) && (pr->s_total != knownSamples(pr))) {
+    fprintf(stderr, "%s: Output length differs from first pass!\n",
+            pModule);
+    renderErr(pr);
+  }
+  
+  /* Write the pad byte after a data chunk of odd size; files are
+   * seeked to the end of the data first, since split renders write
+   * their samples in place */
+  if (!(pr->fmt.raw)) {
+    data_size = dataBytes(pr, pr->s_total);
+    pad = data_size & 1;
+  }
+  if (pad) {
+    if (!(pr->o_stream)) {
+      offs = (off_t) (headerBytes(pr) + data_size);
+      if ((pr->s_known >= 0) && (data_size > RIFF_DATA_MAX)) {
+        offs += RF64_EXTRA;
+      }
+      if (fseeko(pr->pOut, offs, SEEK_SET)) {
+        fprintf(stderr, "%s: I/O error seeking output!\n", pModule);
+        renderErr(pr);
+      }
+    }
+    if (putc(0, pr->pOut) == EOF) {
+      fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+      renderErr(pr);
+    }
+  }
+  
+  /* Patch the size fields if they were not known in advance */
+  if ((!(pr->fmt.raw)) && (pr->s_known < 0) && (!(pr->o_stream))) {
+    
+    /* Make room for RF64 headers if the output got too long, moving
+     * the pad byte along with the samples */
+    if (data_size > RIFF_DATA_MAX) {
+      moveSamples(pr, data_size + pad);
+    }
+    
+    /* Seek to the start and write the headers again */
+    if (fseeko(pr->pOut, 0, SEEK_SET)) {
+      fprintf(stderr, "%s: I/O error seeking output!\n", pModule);
+      renderErr(pr);
+    }
+    writeHeaders(pr, data_size);
+  }
+  
+  /* Close the file, or just flush standard output */
+  if (pr->pOut == stdout) {
+    if (fflush(pr->pOut)) {
+      fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+      renderErr(pr);
+    }
+  } else {
+    if (fclose(pr->pOut)) {
+      fprintf(stderr, "%s: Warning: failed to close file!\n",
+              pModule);
+    }
+  }
+  pr->pOut = NULL;
+}
+
+/*
+ * Convert samples into the output format.
+ * 
+ * The samples are converted all at once, straight into the binary
+ * buffer.  If the samples already are the exact bytes of the output,
+ * they are returned as they are instead.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the samples, interleaved with one sample for each chip
+ * 
+ *   samples - the number of samples
+ * 
+ *   chips - the number of chips
+ * 
+ *   pFmt - the output format
+ * 
+ *   pBin - the binary buffer, with room for the output samples
+ * 
+ *   pCount - variable to receive the number of output samples
+ * 
+ * Return:
+ * 
+ *   the output bytes, which are either in the binary buffer or the
+ *   input samples themselves
+ */
+static const void *convertSamples(
+    const int16_t * pIn,
+          int32_t   samples,
+          int32_t   chips,
+    const OUTFMT  * pFmt,
+          uint8_t * pBin,
+          size_t  * pCount) {
+  
+  int mix = 0;
+  
+  mix = (pFmt->mono && (chips > 1));
+  *pCount = (size_t) samples;
+  if (mix) {
+    *pCount /= (size_t) chips;
+  }
+  
+  if ((pFmt->format == PCM_S16) && (pFmt->gain == 1.0f) && (!mix) &&
+      isLittleEndian()) {
+    return pIn;
+  }
+  pcm_conv(pIn, samples / chips, chips, mix, pFmt->gain, pFmt->format,
+            pBin);
+  return pBin;
+}
+
+/*
+ * Flush the sample buffer to the output file.
+ * 
+ * The samples are converted to the output format over the whole buffer
+ * at once with convertSamples().
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void flushBuffer(RENDER *pr) {
+  const void *pData = NULL;
+  size_t count = 0;
+  int32_t width = 0;
+  double clk = 0.0;
+  
+  /* Only do something if there is something in the buffer */
+  if (pr->s_fill > 0) {
+    
+    /* Check state */
+    if (pr->pOut == NULL) {
+      renderErr(pr);
+    }
+    
+    /* Get the output samples in the output format */
+    if (STATS_ON) {
+      clk = benchClock();
+    }
+    width = pcm_conv_width(pr->fmt.format);
+    pData = convertSamples(pr->s_buf, pr->s_fill, pr->chips, &(pr->fmt),
+                            pr->b_buf, &count);
+    
+    /* Write to output */
+    if (fwrite(pData, (size_t) width, count, pr->pOut) != count) {
+      fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+      renderErr(pr);
+    }
+    if (STATS_ON) {
+      pr->st.out_secs += benchClock() - clk;
+    }
+    
+    /* Update total sample count, watching for overflow */
+    if (pr->s_total <= INT64_MAX - pr->s_fill) {
+      pr->s_total += pr->s_fill;
+    } else {
+      fprintf(stderr, "%s: Sample count overflow!\n", pModule);
+      renderErr(pr);
+    }
+    
+    /* Clear the buffer */
+    pr->s_fill = 0;
+  }
+}
+
+/*
+ * Parse a file path from a string.
+ * 
+ * pstr points to where to start parsing.  Parsing starts with an
+ * optional sequence of space and horizontal tab characters that are
+ * skipped.  The path is then the sequence of characters up to the next
+ * space, horizontal tab, or the end of the string.  The path may not be
+ * empty.
+ * 
+ * A copy of the path is dynamically allocated and written to *ppPath.
+ * The return value points to the first character after the path.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, for line numbers in error reports
+ * 
+ *   pstr - the location to start parsing
+ * 
+ *   ppPath - variable to receive the dynamically allocated copy of the
+ *   path
+ * 
+ * Return:
+ * 
+ *   pointer to character immediately after the path that was parsed
+ */
+static const char *parsePath(
+    const RENDER *  pr,
+    const char   *  pstr,
+          char   ** ppPath) {
+  
+  const char *pStart = NULL;
+  size_t len = 0;
+  
+  /* Check parameters */
+  if ((pstr == NULL) || (ppPath == NULL)) {
+    renderErr(pr);
+  }
+  
+  /* Skip over any tabs and spaces */
+  while ((*pstr == '\t') || (*pstr == ' ')) {
+    pstr++;
+  }
+  
+  /* Find the end of the path */
+  pStart = pstr;
+  while ((*pstr != 0) && (*pstr != '\t') && (*pstr != ' ')) {
+    pstr++;
+  }
+  len = (size_t) (pstr - pStart);
+  if (len < 1) {
+    fprintf(stderr, "%s: Missing path on line %ld!\n",
+            pModule, (long) opl_input_line(pr->pi));
+    renderErr(pr);
+  }
+  
+  /* Make a copy of the path */
+  *ppPath = (char *) malloc(len + 1);
+  if (*ppPath == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+    renderErr(pr);
+  }
+  memcpy(*ppPath, pStart, len);
+  (*ppPath)[len] = 0;
+  
+  /* Return pointer after path */
+  return pstr;
+}
+
+/*
+ * Report an error from an input decoder and stop.
+ * 
+ * Errors in scripts and other text files are reported with the line
+ * number, and errors in binary event streams with the byte offset of
+ * the event.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pi - the decoder that failed, or NULL if there is none
+ * 
+ *   pMsg - the error message
+ */
+static void inputErr(
+    const RENDER    * pr,
+    const OPL_INPUT * pi,
+    const char      * pMsg) {
+  
+  int kind = OPL_INPUT_TEXT;
+  
+  if (pi != NULL) {
+    kind = opl_input_kind(pi);
+  }
+  
+  if ((pi != NULL) &&
+      ((kind == OPL_INPUT_TEXT) || (kind == OPL_INPUT_LINES)) &&
+      (opl_input_line(pi) > 0)) {
+    fprintf(stderr, "%s: %s on line %ld!\n",
+            pModule, pMsg, (long) opl_input_line(pi));
+    
+  } else if ((pi != NULL) && (kind == OPL_INPUT_BINARY) &&
+              (opl_input_tell(pi) > 0)) {
+    fprintf(stderr, "%s: %s at offset %ld!\n",
+            pModule, pMsg, (long) opl_input_tell(pi));
+    
+  } else {
+    fprintf(stderr, "%s: %s!\n", pModule, pMsg);
+  }
+  renderErr(pr);
+}
+
+/*
+ * Write a single byte to a binary event stream.
+ * 
+ * Parameters:
+ * 
+ *   pf - the binary event stream file
+ * 
+ *   val - the byte value to write
+ */
+static void writeBinByte(FILE *pf, uint8_t val) {
+  if (putc((int) val, pf) != val) {
+    fprintf(stderr, "%s: I/O error writing to output!\n", pModule);
+    raiseErr();
+  }
+}
+
+/*
+ * Write a 32-bit unsigned dword in little-endian order to a binary
+ * event stream.
+ * 
+ * Parameters:
+ * 
+ *   pf - the binary event stream file
+ * 
+ *   val - the dword value to write
+ */
+static void writeBinDword(FILE *pf, uint32_t val) {
+  writeBinByte(pf, (uint8_t) (val & 0xff));
+  writeBinByte(pf, (uint8_t) ((val >> 8) & 0xff));
+  writeBinByte(pf, (uint8_t) ((val >> 16) & 0xff));
+  writeBinByte(pf, (uint8_t) (val >> 24));
+}
+
+/*
+ * Write a 64-bit unsigned qword in little-endian order to a binary
+ * output file.
+ * 
+ * Parameters:
+ * 
+ *   pf - the binary output file
+ * 
+ *   val - the qword value to write
+ */
+static void writeBinQword(FILE *pf, uint64_t val) {
+  writeBinDword(pf, (uint32_t) (val & UINT32_C(0xffffffff)));
+  writeBinDword(pf, (uint32_t) (val >> 32));
+}
+
+/*
+ * Read a 32-bit unsigned dword in little-endian order from memory.
+ * 
+ * Parameters:
+ * 
+ *   pd - pointer to the four bytes of the dword
+ * 
+ * Return:
+ * 
+ *   the dword value
+ */
+static uint32_t readBinDword(const uint8_t *pd) {
+  return ((uint32_t) pd[0]) |
+          (((uint32_t) pd[1]) << 8) |
+          (((uint32_t) pd[2]) << 16) |
+          (((uint32_t) pd[3]) << 24);
+}
+
+/*
+ * Read a 64-bit unsigned qword in little-endian order from memory.
+ * 
+ * Parameters:
+ * 
+ *   pd - pointer to the eight bytes of the qword
+ * 
+ * Return:
+ * 
+ *   the qword value
+ */
+static uint64_t readBinQword(const uint8_t *pd) {
+  return ((uint64_t) readBinDword(pd)) |
+          (((uint64_t) readBinDword(pd + 4)) << 32);
+}
+
+/*
+ * Begin handling events for a script.
+ * 
+ * This is called once the decoder has read the header of the input,
+ * so that the control rate and chip count are known.  If the render
+ * state is compiling, the header of the binary event stream is
+ * written.  When coalescing register writes, each chip gets a
+ * coalescer with all registers unknown.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void beginEvents(RENDER *pr) {
+  
+  int32_t ctl_rate = 0;
+  int32_t chips = 0;
+  int32_t i = 0;
+  
+  /* Get the control rate and the chip count from the decoder */
+  ctl_rate = opl_input_rate(pr->pi);
+  chips = opl_input_chips(pr->pi);
+  
+  /* Reset timing and chip state */
+  pr->current = 0;
+  pr->ev_count = 0;
+  pr->chips = chips;
+  pr->chip = 0;
+  
+  if (STATS_ON) {
+    statsBegin(pr);
+  }
+  
+  /* Real-time playback only drives a single emulator */
+  if ((pr->rec) && (chips > 1)) {
+    fprintf(stderr, "%s: Real-time playback only supports one chip!\n",
+            pModule);
+    renderErr(pr);
+  }
+  
+  /* Get a register write coalescer for each chip if requested */
+  if (coalesce_writes) {
+    for(i = 0; i < chips; i++) {
+      if (pr->pcs[i] == NULL) {
+        pr->pcs[i] = opl_coalesce_new(&coalesceOut, pr);
+        if (pr->pcs[i] == NULL) {
+          fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+          renderErr(pr);
+        }
+      }
+      opl_coalesce_reset(pr->pcs[i]);
+    }
+  }
+  
+  /* Write the header of the binary event stream if compiling */
+  if (pr->pComp != NULL) {
+    for(i = 0; i < BIN_SIGNATURE_SIZE; i++) {
+      writeBinByte(pr->pComp, (uint8_t) BIN_SIGNATURE[i]);
+    }
+    if (chips == 1) {
+      writeBinDword(pr->pComp, (uint32_t) BIN_VERSION);
+      writeBinDword(pr->pComp, (uint32_t) ctl_rate);
+    } else {
+      writeBinDword(pr->pComp, (uint32_t) BIN_VERSION_CHIPS);
+      writeBinDword(pr->pComp, (uint32_t) ctl_rate);
+      writeBinDword(pr->pComp, (uint32_t) chips);
+    }
+  }
+}
+
+/*
+ * Finish handling events for a script.
+ * 
+ * Any pending coalesced register writes are handled first.  When
+ * compiling, the caller owns the compiled output file, so nothing else
+ * is done here.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void endEvents(RENDER *pr) {
+  flushWrites(pr);
+  
+  if (STATS_ON) {
+    statsEnd(pr);
+  }
+}
+
+/*
+ * Apply a register write to the chip selected by the last chip select
+ * event.
+ * 
+ * When compiling, the write is written to the binary event stream.
+ * Otherwise, it is queued for playback or recorded in the event log,
+ * whichever the render state is doing.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void applyWrite(RENDER *pr, uint8_t reg, uint8_t val) {
+  if (pr->pComp != NULL) {
+    /* Compiling, so write a fixed-width write event */
+    writeBinByte(pr->pComp, BIN_EVENT_WRITE);
+    writeBinByte(pr->pComp, reg);
+    writeBinByte(pr->pComp, val);
+    return;
+  }
+  
+  if (pr->rec) {
+    queueWrite(pr, reg, val);
+  }
+  if (pr->logging) {
+    logWrite(pr, reg, val);
+    if (STATS_ON) {
+      (pr->st.issued[reg >> 5])++;
+    }
+  }
+}
+
+/*
+ * Callback that receives the coalesced register writes.
+ * 
+ * Coalescers are flushed before every chip select, so the writes
+ * always belong to the currently selected chip.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the render state
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void coalesceOut(void *pArg, int32_t reg, int32_t val) {
+  applyWrite((RENDER *) pArg, (uint8_t) reg, (uint8_t) val);
+}
+
+/*
+ * Apply any pending coalesced register writes.
+ * 
+ * This does nothing if writes are not being coalesced.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void flushWrites(RENDER *pr) {
+  if (pr->pcs[pr->chip] != NULL) {
+    opl_coalesce_flush(pr->pcs[pr->chip]);
+  }
+}
+
+/*
+ * Handle a chip select event.
+ * 
+ * Register writes after this event go to the selected chip.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   chip - the chip to select, zero for the first chip
+ */
+static void eventChip(RENDER *pr, int32_t chip) {
+  (pr->ev_count)++;
+  if (STATS_ON) {
+    (pr->st.selects)++;
+  }
+  
+  /* Check parameter */
+  if ((chip < 0) || (chip >= pr->chips)) {
+    renderErr(pr);
+  }
+  
+  /* Pending writes belong to the chip selected before */
+  flushWrites(pr);
+  
+  if (pr->pComp != NULL) {
+    /* Compiling, so write a chip select event */
+    writeBinByte(pr->pComp, BIN_EVENT_CHIP);
+    writeBinByte(pr->pComp, (uint8_t) chip);
+  } else {
+    pr->chip = chip;
+  }
+}
+
+/*
+ * Handle a register write event.
+ * 
+ * The write goes to the chip selected by the last chip select event.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void eventWrite(RENDER *pr, uint8_t reg, uint8_t val) {
+  (pr->ev_count)++;
+  if (STATS_ON) {
+    (pr->st.writes)++;
+  }
+  
+  /* Hold the write back until time moves forward if coalescing */
+  if (pr->pcs[pr->chip] != NULL) {
+    opl_coalesce_write(pr->pcs[pr->chip], reg, val);
+  } else {
+    applyWrite(pr, reg, val);
+  }
+}
+
+/*
+ * Handle a wait event.
+ * 
+ * The decoder has already moved the time of the input forward and
+ * converted it to a sample offset at the emulator rate.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   cycles - the number of control cycles to wait
+ * 
+ *   frame - the sample offset that the wait ends at
+ */
+static void eventWait(RENDER *pr, int32_t cycles, int64_t frame) {
+  
+  uint32_t uv = 0;
+  
+  /* Check parameters */
+  if ((cycles < 1) || (frame < pr->current)) {
+    renderErr(pr);
+  }
+  
+  (pr->ev_count)++;
+  if (STATS_ON) {
+    (pr->st.waits)++;
+  }
+  
+  /* Time moves forward, so apply any pending coalesced writes */
+  flushWrites(pr);
+  
+  /* If compiling, write a wait event with a base-128 count, with the
+   * least significant group first and the high bit set on all groups
+   * except the last */
+  if (pr->pComp != NULL) {
+    writeBinByte(pr->pComp, BIN_EVENT_WAIT);
+    uv = (uint32_t) cycles;
+    while (uv >= 0x80) {
+      writeBinByte(pr->pComp, (uint8_t) ((uv & 0x7f) | 0x80));
+      uv >>= 7;
+    }
+    writeBinByte(pr->pComp, (uint8_t) uv);
+    return;
+  }
+  
+  /* Update current pointer to the new offset */
+  pr->current = frame;
+  
+  if (STATS_ON) {
+    statsSecond(pr);
+  }
+  
+  /* When feeding real-time playback, start playing once enough has
+   * been queued ahead */
+  if ((pr->rec) && (!(pr->play_live)) &&
+      (pr->current >= PLAY_PREFILL)) {
+    startPlayback(pr);
+  }
+}
+
+/*
+ * Return the input decoder of a render state, creating it if
+ * necessary.
+ * 
+ * The decoder converts times into sample offsets at the emulator rate.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ * Return:
+ * 
+ *   the decoder
+ */
+static OPL_INPUT *getInput(RENDER *pr) {
+  int err = 0;
+  
+  if (pr->pi == NULL) {
+    pr->pi = opl_input_new(pr->emu_rate, &err);
+    if (pr->pi == NULL) {
+      inputErr(pr, NULL, opl_input_errstr(err));
+    }
+  }
+  return pr->pi;
+}
+
+/*
+ * Open an input file and detect its kind.
+ * 
+ * The input file may either be an OPL2 hardware script, a compiled
+ * binary event stream, or a VGM or VGZ file.  The decoder detects the
+ * kind of input and checks its header.  Binary event streams are
+ * memory-mapped so that they can be played back directly.  VGM files
+ * use the repeat count from vgm_rep.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pInPath - the path to the input file
+ */
+static void openInput(RENDER *pr, const char *pInPath) {
+  int err = 0;
+  
+  pr->pInPath = pInPath;
+  if (!opl_input_open(getInput(pr), pInPath, vgm_rep, &err)) {
+    inputErr(pr, pr->pi, opl_input_errstr(err));
+  }
+}
+
+/*
+ * Open a script or a text file of plain lines from a stream that is
+ * already open, such as standard input.
+ * 
+ * The stream is not closed by closeInput().  Scripts on a stream that
+ * can not be seeked can only be run once.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pf - the stream
+ * 
+ *   kind - OPL_INPUT_TEXT or OPL_INPUT_LINES
+ */
+static void openStream(RENDER *pr, FILE *pf, int kind) {
+  int err = 0;
+  
+  if (!opl_input_open_stream(getInput(pr), pf, kind, &err)) {
+    inputErr(pr, pr->pi, opl_input_errstr(err));
+  }
+}
+
+/*
+ * Run one pass over the input through the event functions.
+ * 
+ * The input must have been opened with openInput() or openStream().
+ * Each pass starts over from the first event of the input.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void runInput(RENDER *pr) {
+  
+  OPL_INPUT_EVENT ev;
+  int err = 0;
+  
+  /* Go back to the start and begin handling events */
+  if (!opl_input_rewind(pr->pi, &err)) {
+    inputErr(pr, pr->pi, opl_input_errstr(err));
+  }
+  beginEvents(pr);
+  
+  /* Dispatch each event */
+  while (1) {
+    if (!opl_input_next(pr->pi, &ev, &err)) {
+      inputErr(pr, pr->pi, opl_input_errstr(err));
+    }
+    
+    if (ev.type == OPL_INPUT_EVENT_END) {
+      break;
+    } else if (ev.type == OPL_INPUT_EVENT_WRITE) {
+      eventWrite(pr, ev.reg, ev.val);
+    } else if (ev.type == OPL_INPUT_EVENT_WAIT) {
+      eventWait(pr, ev.cycles, ev.frame);
+    } else if (ev.type == OPL_INPUT_EVENT_CHIP) {
+      eventChip(pr, ev.chip);
+    }
+  }
+  
+  /* Finish handling events */
+  endEvents(pr);
+}
+
+/*
+ * Close the input opened with openInput() or openStream().
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void closeInput(RENDER *pr) {
+  opl_input_close(pr->pi);
+  pr->pInPath = NULL;
+}
+
+/*
+ * Return the state snapshot buffer of a render state, allocating it if
+ * necessary.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ * Return:
+ * 
+ *   the buffer, with room for a snapshot of each chip
+ */
+static uint8_t *snapBuffer(RENDER *pr) {
+  if (pr->pSnap == NULL) {
+    pr->pSnap = (uint8_t *) malloc(
+                  ((size_t) MAX_CHIPS) * ((size_t) opl_ctx_state_size()));
+    if (pr->pSnap == NULL) {
+      fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+      renderErr(pr);
+    }
+  }
+  return pr->pSnap;
+}
+
+/*
+ * Write a checkpoint into the index being built.
+ * 
+ * This is the checkpoint function of the render session that builds
+ * the index, see opl_render_checkpoints().
+ * 
+ * Parameters:
+ * 
+ *   pArg - the render state
+ * 
+ *   ps - the render session
+ * 
+ *   chip - the chip selected at the checkpoint
+ */
+static void indexPoint(void *pArg, OPL_RENDER *ps, int32_t chip) {
+  RENDER *pr = NULL;
+  const OPL_INPUT *pi = NULL;
+  uint8_t *pState = NULL;
+  size_t size = 0;
+  
+  pr = (RENDER *) pArg;
+  pi = opl_render_input(ps);
+  
+  /* Write the position and the chip state at the checkpoint */
+  pState = snapBuffer(pr);
+  size = ((size_t) pr->chips) * ((size_t) opl_ctx_state_size());
+  
+  writeBinDword(pr->pIndex, (uint32_t) opl_input_tell(pi));
+  writeBinDword(pr->pIndex, (uint32_t) chip);
+  writeBinQword(pr->pIndex, (uint64_t) opl_input_time(pi));
+  writeBinQword(pr->pIndex, (uint64_t) opl_input_frame(pi));
+  
+  opl_render_save(ps, pState);
+  if (fwrite(pState, 1, size, pr->pIndex) != size) {
+    fprintf(stderr, "%s: I/O error writing index!\n", pModule);
+    renderErr(pr);
+  }
+  (pr->ix_count)++;
+}
+
+/*
+ * Build a checkpoint index for a binary event stream.
+ * 
+ * The stream is rendered once through a render session at the
+ * emulator rate with the samples thrown away, and a checkpoint with a
+ * state snapshot of each chip is written at the first wait that
+ * reaches each multiple of the index interval.  If the driver's
+ * snapshots only hold the registers, the synthesis is not needed for
+ * the snapshots, but it is still done so that the index is built the
+ * same way for every driver.
+ * 
+ * The index file starts with a header of nine dwords: "OPLI", the
+ * format version, the emulator rate, the snapshot size, a flag set if
+ * snapshots are exact, the number of chips, the interval in samples,
+ * the number of checkpoints, and the length of the binary event stream
+ * in bytes.  Each checkpoint has two dwords with the byte offset of
+ * the next event and the selected chip, and two qwords with the time
+ * in control cycles and the sample offset, followed by a snapshot for
+ * each chip.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, with no render session
+ * 
+ *   pIndexPath - the path to the index file to create
+ * 
+ *   pInPath - the path to the binary event stream
+ */
+static void buildIndex(
+          RENDER * pr,
+    const char   * pIndexPath,
+    const char   * pInPath) {
+  
+  const OPL_INPUT *pi = NULL;
+  int err = 0;
+  
+  /* Run at the emulator rate over the whole stream, since the samples
+   * are not kept */
+  setRate(pr, pr->emu_rate);
+  pr->ps = newSession(pr, pr->sample_rate);
+  if (pr->ps == NULL) {
+    fprintf(stderr, "%s: Failed to create emulator context!\n",
+            pModule);
+    renderErr(pr);
+  }
+  opl_render_range(pr->ps, 0.0, -1.0);
+  opl_render_checkpoints(pr->ps, index_interval, &indexPoint, pr);
+  
+  /* Load the input, which must be a binary event stream */
+  pr->pInPath = pInPath;
+  loadSession(pr, NULL);
+  pi = opl_render_input(pr->ps);
+  if (opl_input_kind(pi) != OPL_INPUT_BINARY) {
+    fprintf(stderr, "%s: Index input must be a binary event stream!\n",
+            pModule);
+    renderErr(pr);
+  }
+  if (opl_input_size(pi) > UINT32_MAX) {
+    fprintf(stderr, "%s: Binary event stream is too long!\n", pModule);
+    renderErr(pr);
+  }
+  
+  /* Create the index and write the header, with the chip count and the
+   * checkpoint count filled in at the end */
+  pr->pIndex = fopen(pIndexPath, "wb");
+  if (pr->pIndex == NULL) {
+    fprintf(stderr, "%s: Failed to create file '%s'!\n",
+            pModule, pIndexPath);
+    renderErr(pr);
+  }
+  pr->ix_count = 0;
+  
+  writeBinDword(pr->pIndex, UINT32_C(0x494c504f));   /* "OPLI" */
+  writeBinDword(pr->pIndex, (uint32_t) INDEX_VERSION);
+  writeBinDword(pr->pIndex, (uint32_t) pr->emu_rate);
+  writeBinDword(pr->pIndex, (uint32_t) opl_ctx_state_size());
+  writeBinDword(pr->pIndex, (uint32_t) (opl_ctx_state_exact() != 0));
+  writeBinDword(pr->pIndex, 0);
+  writeBinDword(pr->pIndex, (uint32_t) (index_interval * pr->emu_rate));
+  writeBinDword(pr->pIndex, 0);
+  writeBinDword(pr->pIndex, (uint32_t) opl_input_size(pi));
+  
+  /* Render the stream, writing checkpoints along the way */
+  while (opl_render_pull(pr->ps, pr->s_buf,
+                          BUFFER_SAMPLES / pr->chips, &err) > 0);
+  if (err != OPL_RENDER_ERR_NONE) {
+    sessionErr(pr);
+  }
+  
+  /* Fill in the chip count and the checkpoint count */
+  if (fseek(pr->pIndex, 20, SEEK_SET)) {
+    fprintf(stderr, "%s: I/O error seeking index!\n", pModule);
+    renderErr(pr);
+  }
+  writeBinDword(pr->pIndex, (uint32_t) pr->chips);
+  if (fseek(pr->pIndex, 28, SEEK_SET)) {
+    fprintf(stderr, "%s: I/O error seeking index!\n", pModule);
+    renderErr(pr);
+  }
+  writeBinDword(pr->pIndex, (uint32_t) pr->ix_count);
+  
+  /* Close the index and drop the input */
+  if (fclose(pr->pIndex)) {
+    fprintf(stderr, "%s: I/O error writing index!\n", pModule);
+    renderErr(pr);
+  }
+  pr->pIndex = NULL;
+  opl_render_reset(pr->ps);
+  pr->pInPath = NULL;
+}
+
+/*
+ * Load a checkpoint index into memory.
+ * 
+ * The index must have been built with the same OPL driver.  Whether it
+ * matches the input and the sample rate is checked when it is used.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the index file
+ */
+static void loadIndex(const char *pPath) {
+  FILE *pf = NULL;
+  long flen = 0;
+  uint32_t chips = 0;
+  uint32_t count = 0;
+  size_t entry = 0;
+  
+  /* Read the whole file */
+  pf = fopen(pPath, "rb");
+  if (pf == NULL) {
+    fprintf(stderr, "%s: Failed to open file '%s'!\n", pModule, pPath);
+    raiseErr();
+  }
+  if (fseek(pf, 0, SEEK_END) || ((flen = ftell(pf)) < 0) ||
+      fseek(pf, 0, SEEK_SET)) {
+    fprintf(stderr, "%s: I/O error reading index!\n", pModule);
+    raiseErr();
+  }
+  
+  index_len = (size_t) flen;
+  pIndexData = (uint8_t *) malloc(index_len + 1);
+  if (pIndexData == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+    raiseErr();
+  }
+  if (fread(pIndexData, 1, index_len, pf) != index_len) {
+    fprintf(stderr, "%s: I/O error reading index!\n", pModule);
+    raiseErr();
+  }
+  fclose(pf);
+  
+  /* Check the header */
+  if ((index_len < INDEX_HEADER_SIZE) ||
+      (memcmp(pIndexData, "OPLI", 4) != 0) ||
+      (readBinDword(pIndexData + 4) != INDEX_VERSION)) {
+    fprintf(stderr, "%s: File is not a checkpoint index!\n", pModule);
+    raiseErr();
+  }
+  if ((readBinDword(pIndexData + 12) !=
+          (uint32_t) opl_ctx_state_size()) ||
+      (readBinDword(pIndexData + 16) !=
+          (uint32_t) (opl_ctx_state_exact() != 0))) {
+    fprintf(stderr, "%s: Checkpoint index is for another driver!\n",
+            pModule);
+    raiseErr();
+  }
+  
+  /* Check the length */
+  chips = readBinDword(pIndexData + 20);
+  count = readBinDword(pIndexData + 28);
+  if ((chips < 1) || (chips > MAX_CHIPS)) {
+    fprintf(stderr, "%s: Checkpoint index is damaged!\n", pModule);
+    raiseErr();
+  }
+  entry = INDEX_ENTRY_SIZE +
+            ((size_t) chips) * ((size_t) opl_ctx_state_size());
+  if ((index_len - INDEX_HEADER_SIZE) / entry != count) {
+    fprintf(stderr, "%s: Checkpoint index is damaged!\n", pModule);
+    raiseErr();
+  }
+}
+
+/*
+ * Choose the checkpoint that a render starts from.
+ * 
+ * This is the latest checkpoint in the loaded index that is at or
+ * before the start of the output range.  If snapshots only hold the
+ * registers, the checkpoint must also leave room for the pre-roll.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, with the input loaded into its session
+ * 
+ * Return:
+ * 
+ *   the checkpoint, or NULL if no index is loaded or no checkpoint is
+ *   early enough, so that the render starts at the beginning
+ */
+static const uint8_t *findCheckpoint(const RENDER *pr) {
+  const OPL_INPUT *pi = NULL;
+  const uint8_t *pe = NULL;
+  const uint8_t *pCheck = NULL;
+  size_t entry = 0;
+  uint32_t count = 0;
+  uint32_t i = 0;
+  int64_t target = 0;
+  
+  if (pIndexData == NULL) {
+    return NULL;
+  }
+  
+  /* The index must be for this input and this emulator rate */
+  pi = opl_render_input(pr->ps);
+  if (opl_input_kind(pi) != OPL_INPUT_BINARY) {
+    fprintf(stderr, "%s: Checkpoints need a binary event stream!\n",
+            pModule);
+    renderErr(pr);
+  }
+  if (readBinDword(pIndexData + 8) != (uint32_t) pr->emu_rate) {
+    fprintf(stderr, "%s: Checkpoint index is for another rate!\n",
+            pModule);
+    renderErr(pr);
+  }
+  if (readBinDword(pIndexData + 32) != (uint32_t) opl_input_size(pi)) {
+    fprintf(stderr, "%s: Checkpoint index does not match input!\n",
+            pModule);
+    renderErr(pr);
+  }
+  
+  /* Find the target offset, rounding the start of the range to the
+   * nearest sample */
+  target = (int64_t) floor(
+              (range_from * ((double) pr->emu_rate)) + 0.5);
+  if (!opl_ctx_state_exact()) {
+    target -= pr->emu_rate * PREROLL;
+  }
+  
+  /* Checkpoints are in order, so take the last one in time */
+  entry = INDEX_ENTRY_SIZE + ((size_t) readBinDword(pIndexData + 20)) *
+            ((size_t) opl_ctx_state_size());
+  count = readBinDword(pIndexData + 28);
+  for(i = 0; i < count; i++) {
+    pe = pIndexData + INDEX_HEADER_SIZE + ((size_t) i) * entry;
+    if ((int64_t) readBinQword(pe + 16) > target) {
+      break;
+    }
+    pCheck = pe;
+  }
+  return pCheck;
+}
+
+/*
+ * Start the input of a render session at the checkpoint chosen by
+ * findCheckpoint(), if there is one.
+ * 
+ * The decoder jumps to the event of the checkpoint, and the state of
+ * the chips is restored from its snapshots.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, with the input just loaded into its session
+ */
+static void seekCheckpoint(RENDER *pr) {
+  const uint8_t *pe = NULL;
+  int err = 0;
+  
+  pe = findCheckpoint(pr);
+  if (pe == NULL) {
+    return;
+  }
+  
+  if (readBinDword(pIndexData + 20) != (uint32_t) pr->chips) {
+    fprintf(stderr, "%s: Checkpoint index does not match input!\n",
+            pModule);
+    renderErr(pr);
+  }
+  if (!opl_render_seek(pr->ps,
+                        (size_t) readBinDword(pe),
+                        (int32_t) readBinDword(pe + 4),
+                        (int64_t) readBinQword(pe + 8),
+                        pe + INDEX_ENTRY_SIZE,
+                        &err)) {
+    if (err == OPL_RENDER_ERR_STATE) {
+      fprintf(stderr, "%s: Checkpoint index is damaged!\n", pModule);
+    } else {
+      fprintf(stderr, "%s: Checkpoint index does not match input!\n",
+              pModule);
+    }
+    renderErr(pr);
+  }
+  if (opl_input_frame(opl_render_input(pr->ps)) !=
+        (int64_t) readBinQword(pe + 16)) {
+    fprintf(stderr, "%s: Checkpoint index does not match input!\n",
+            pModule);
+    renderErr(pr);
+  }
+}
+
+/*
+ * Record a register write in the event log.
+ * 
+ * The write goes to the chip selected by the last chip select event,
+ * at the current sample offset.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void logWrite(RENDER *pr, uint8_t reg, uint8_t val) {
+  LOGWRITE *pl = NULL;
+  int32_t new_cap = 0;
+  
+  /* Grow the log if it is full */
+  if (pr->log_count >= pr->log_cap) {
+    if (pr->log_cap < 1) {
+      new_cap = 4096;
+    } else if (pr->log_cap <= INT32_MAX / 2) {
+      new_cap = pr->log_cap * 2;
+    } else {
+      fprintf(stderr, "%s: Event log overflow!\n", pModule);
+      renderErr(pr);
+    }
+    
+    pl = (LOGWRITE *) realloc(pr->pLog,
+                        ((size_t) new_cap) * sizeof(LOGWRITE));
+    if (pl == NULL) {
+      fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+      renderErr(pr);
+    }
+    pr->pLog = pl;
+    pr->log_cap = new_cap;
+  }
+  
+  /* Add the write */
+  pl = &(pr->pLog[pr->log_count]);
+  pl->offs = pr->current;
+  pl->chip = (uint8_t) pr->chip;
+  pl->reg = reg;
+  pl->val = val;
+  (pr->log_count)++;
+}
+
+/*
+ * Write the frames in a segment's sample buffer to their place in the
+ * output file.
+ * 
+ * Only the frames from the start of the segment onwards are written,
+ * so this skips the frames synthesized during the pre-roll.
+ * 
+ * Parameters:
+ * 
+ *   ps - the segment
+ * 
+ *   pos - the sample offset of the first frame in the sample buffer
+ * 
+ *   count - the number of frames in the sample buffer
+ */
+static void splitOut(SEGMENT *ps, int64_t pos, int32_t count) {
+  const void *pData = NULL;
+  const int16_t *pIn = NULL;
+  size_t out_count = 0;
+  size_t width = 0;
+  off_t offs = 0;
+  int32_t chips = 0;
+  double clk = 0.0;
+  
+  /* Skip the frames before the start of the segment */
+  chips = ps->pr->chips;
+  pIn = ps->s_buf;
+  if (pos < ps->start) {
+    if (pos + count <= ps->start) {
+      return;
+    }
+    pIn += ((int32_t) (ps->start - pos)) * chips;
+    count -= (int32_t) (ps->start - pos);
+    pos = ps->start;
+  }
+  
+  /* Convert the frames and write them where they go in the file */
+  if (STATS_ON) {
+    clk = benchClock();
+  }
+  width = (size_t) pcm_conv_width(ps->pr->fmt.format);
+  pData = convertSamples(pIn, count * chips, chips, &(ps->pr->fmt),
+                          ps->b_buf, &out_count);
+  offs = split_data + ((off_t) pos) * ((off_t) outChannels(ps->pr)) *
+            ((off_t) width);
+  if (pwrite(fileno(ps->pr->pOut), pData, out_count * width, offs) !=
+        (ssize_t) (out_count * width)) {
+    fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+    renderErr(ps->pr);
+  }
+  if (STATS_ON) {
+    ps->st.out_secs += benchClock() - clk;
+  }
+}
+
+/*
+ * Synthesize a stretch of a split render on the contexts of a segment
+ * and write it into the output file.
+ * 
+ * The writes from the event log are played back at their offsets, with
+ * the frames in between synthesized.  Each buffer of frames is
+ * synthesized with a single opl_ctx_generate_events() call for each
+ * chip, which applies the writes inside the buffer at their offsets.
+ * Writes at the end offset are left for whatever synthesizes the frame
+ * at that offset.  Frames before the start of the segment are not
+ * written, see splitOut().
+ * 
+ * Parameters:
+ * 
+ *   ps - the segment
+ * 
+ *   pos - the sample offset of the first frame to synthesize
+ * 
+ *   end - the sample offset just after the last frame to synthesize
+ * 
+ *   i - the index in the event log of the first write at or after pos
+ */
+static void splitSynth(
+    SEGMENT * ps,
+    int64_t   pos,
+    int64_t   end,
+    int32_t   i) {
+  
+  const RENDER *pr = NULL;
+  const LOGWRITE *pl = NULL;
+  OPL_EVENT *pe = NULL;
+  int32_t j = 0;
+  int32_t work = 0;
+  int32_t c = 0;
+  double clk = 0.0;
+  
+  pr = ps->pr;
+  
+  for( ; pos < end; pos += work) {
+    
+    /* Apply the writes that take effect at this offset */
+    for( ; i < pr->log_count; i++) {
+      pl = &(pr->pLog[i]);
+      if (pl->offs > pos) {
+        break;
+      }
+      opl_ctx_write(ps->pc[pl->chip], pl->reg, pl->val);
+    }
+    
+    /* Synthesize a buffer of frames, or up to the end of the segment */
+    work = BUFFER_SAMPLES / pr->chips;
+    if (end - pos < work) {
+      work = (int32_t) (end - pos);
+    }
+    
+    /* Gather the writes inside the buffer for each chip; if the batch
+     * of a chip fills up, the buffer ends at that write instead */
+    for(c = 0; c < pr->chips; c++) {
+      ps->e_fill[c] = 0;
+    }
+    for(j = i; j < pr->log_count; j++) {
+      pl = &(pr->pLog[j]);
+      if (pl->offs >= pos + work) {
+        break;
+      }
+      if (ps->e_fill[pl->chip] >= EVENT_BATCH) {
+        work = (int32_t) (pl->offs - pos);
+        break;
+      }
+      pe = &(ps->e_buf[pl->chip][ps->e_fill[pl->chip]]);
+      pe->offs = (int32_t) (pl->offs - pos);
+      pe->reg = pl->reg;
+      pe->val = pl->val;
+      (ps->e_fill[pl->chip])++;
+    }
+    
+    /* Writes at the offset where the buffer ended early belong to the
+     * next buffer */
+    for(c = 0; c < pr->chips; c++) {
+      while (ps->e_fill[c] > 0) {
+        if (ps->e_buf[c][ps->e_fill[c] - 1].offs < work) {
+          break;
+        }
+        (ps->e_fill[c])--;
+      }
+    }
+    while (i < pr->log_count) {
+      if (pr->pLog[i].offs >= pos + work) {
+        break;
+      }
+      i++;
+    }
+    
+    if (STATS_ON) {
+      clk = benchClock();
+    }
+    for(c = 0; c < pr->chips; c++) {
+      opl_ctx_generate_events(ps->pc[c], ps->s_buf + c, work, pr->chips,
+                              ps->e_buf[c], ps->e_fill[c]);
+    }
+    if (STATS_ON) {
+      ps->st.gen_secs += benchClock() - clk;
+      ps->st.samples += ((int64_t) work) * pr->chips;
+    }
+    splitOut(ps, pos, work);
+  }
+}
+
+/*
+ * Procedure of the thread that renders one segment of a split render.
+ * 
+ * The segment does not synthesize what comes before it, since that
+ * would leave all but the first segment waiting for a serial pass.
+ * Instead, it starts PREROLL seconds early, and the writes in the event
+ * log before the pre-roll are only replayed into a copy of the
+ * registers, which is written into the fresh emulator contexts of the
+ * segment, with the key-on and rhythm registers last.  The pre-roll
+ * lets the envelopes settle, and its frames are not written.  The
+ * phases of the operators and of the vibrato and tremolo oscillators,
+ * and envelopes still moving after the pre-roll, are not restored, so
+ * every segment but the first is close to a plain render but not
+ * exactly the same.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the SEGMENT
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *splitMain(void *pArg) {
+  SEGMENT *ps = NULL;
+  const RENDER *pr = NULL;
+  const LOGWRITE *pl = NULL;
+  uint8_t regs[MAX_CHIPS][REG_COUNT];
+  uint8_t used[MAX_CHIPS][REG_COUNT];
+  int64_t pos = 0;
+  int32_t i = 0;
+  int32_t c = 0;
+  int32_t r = 0;
+  
+  ps = (SEGMENT *) pArg;
+  pr = ps->pr;
+  
+  /* Start the pre-roll ahead of the segment */
+  pos = ps->start - ((int64_t) pr->emu_rate) * PREROLL;
+  if (pos < 0) {
+    pos = 0;
+  }
+  
+  /* Replay the writes before the pre-roll into the registers */
+  memset(used, 0, sizeof(used));
+  for(i = 0; i < pr->log_count; i++) {
+    pl = &(pr->pLog[i]);
+    if (pl->offs >= pos) {
+      break;
+    }
+    regs[pl->chip][pl->reg] = pl->val;
+    used[pl->chip][pl->reg] = 1;
+  }
+  
+  /* Write the registers, keying on the channels and the rhythm
+   * instruments only once everything else is in place */
+  for(c = 0; c < pr->chips; c++) {
+    for(r = 0; r < REG_COUNT; r++) {
+      if (used[c][r] && ((r < 0xb0) || (r > 0xbd))) {
+        opl_ctx_write(ps->pc[c], (uint8_t) r, regs[c][r]);
+      }
+    }
+    for(r = 0xb0; r <= 0xbd; r++) {
+      if (used[c][r]) {
+        opl_ctx_write(ps->pc[c], (uint8_t) r, regs[c][r]);
+      }
+    }
+  }
+  
+  /* Synthesize the pre-roll and the segment */
+  splitSynth(ps, pos, ps->end, i);
+  
+  return NULL;
+}
+
+/*
+ * Render the output of a split render.
+ * 
+ * This is called after the first pass has recorded the event log and
+ * measured the length.  The output is divided into segments of equal
+ * length, each with its own emulator contexts and its own thread,
+ * which all start right away.  Each segment starts from a copy of the
+ * registers with a pre-roll, see splitMain(), so the first segment is
+ * exactly the same as from a render on a single thread, while the
+ * others may differ slightly from it.  The output is still the same on
+ * every run.
+ * 
+ * If the output is too short to split, or the driver does not support
+ * enough emulator contexts, nothing is rendered.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ * Return:
+ * 
+ *   non-zero if the output was rendered, zero if the render could not
+ *   be split
+ */
+static int renderSplit(RENDER *pr) {
+  
+  SEGMENT *pSeg = NULL;
+  SEGMENT *ps = NULL;
+  pthread_t tid[MAX_WORKERS];
+  int64_t per_seg = 0;
+  int32_t seg_count = 0;
+  int32_t i = 0;
+  int32_t c = 0;
+  
+  /* Determine the number of segments */
+  seg_count = split_count;
+  per_seg = pr->s_known / (pr->emu_rate * SPLIT_MIN);
+  if (seg_count > per_seg) {
+    seg_count = (int32_t) per_seg;
+  }
+  if (seg_count < 2) {
+    return 0;
+  }
+  
+  /* Allocate the segments */
+  pSeg = (SEGMENT *) calloc((size_t) seg_count, sizeof(SEGMENT));
+  if (pSeg == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+    renderErr(pr);
+  }
+  
+  /* Create the emulator contexts for each segment; if the driver runs
+   * out of contexts, use fewer segments */
+  pthread_mutex_lock(&ctx_lock);
+  for(i = 0; i < seg_count; i++) {
+    for(c = 0; c < pr->chips; c++) {
+      pSeg[i].pc[c] = opl_ctx_new(pr->emu_rate);
+      if (pSeg[i].pc[c] == NULL) {
+        break;
+      }
+      opl_ctx_set_skip(pSeg[i].pc[c], skip_silence);
+    }
+    if (c < pr->chips) {
+      for(c = 0; c < pr->chips; c++) {
+        opl_ctx_free(pSeg[i].pc[c]);
+        pSeg[i].pc[c] = NULL;
+      }
+      seg_count = i;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ctx_lock);
+  
+  if (seg_count < 2) {
+    for(i = 0; i < seg_count; i++) {
+      for(c = 0; c < pr->chips; c++) {
+        opl_ctx_free(pSeg[i].pc[c]);
+      }
+    }
+    free(pSeg);
+    return 0;
+  }
+  
+  /* Divide the output into segments */
+  for(i = 0; i < seg_count; i++) {
+    ps = &(pSeg[i]);
+    ps->pr = pr;
+    ps->start = (pr->s_known / seg_count) * i +
+                  ((pr->s_known % seg_count) * i) / seg_count;
+    ps->end = (pr->s_known / seg_count) * (i + 1) +
+                ((pr->s_known % seg_count) * (i + 1)) / seg_count;
+  }
+  
+  /* Write the WAVE header and find where the samples go */
+  beginWAV(pr, pr->pOutPath, pr->sample_rate);
+  if (fflush(pr->pOut)) {
+    fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+    renderErr(pr);
+  }
+  split_data = ftello(pr->pOut);
+  if (split_data < 0) {
+    fprintf(stderr, "%s: I/O error seeking output!\n", pModule);
+    renderErr(pr);
+  }
+  
+  /* Start every segment on its own thread */
+  for(i = 0; i < seg_count; i++) {
+    ps = &(pSeg[i]);
+    if (pthread_create(&(tid[i]), NULL, &splitMain, ps)) {
+      fprintf(stderr, "%s: Failed to start worker thread!\n",
+              pModule);
+      renderErr(pr);
+    }
+  }
+  for(i = 0; i < seg_count; i++) {
+    if (pthread_join(tid[i], NULL)) {
+      fprintf(stderr, "%s: Failed to join worker thread!\n",
+              pModule);
+      renderErr(pr);
+    }
+  }
+  
+  /* Count the work of the segments */
+  if (STATS_ON) {
+    for(i = 0; i < seg_count; i++) {
+      statsMerge(&(pr->st), &(pSeg[i].st));
+    }
+  }
+  
+  /* All samples are in place, so finish the file */
+  pr->s_total = knownSamples(pr);
+  pr->s_fill = 0;
+  finishWAV(pr);
+  
+  /* Release the segments */
+  pthread_mutex_lock(&ctx_lock);
+  for(i = 0; i < seg_count; i++) {
+    for(c = 0; c < pr->chips; c++) {
+      opl_ctx_free(pSeg[i].pc[c]);
+    }
+  }
+  pthread_mutex_unlock(&ctx_lock);
+  free(pSeg);
+  
+  return 1;
+}
+
+/*
+ * Render an input file into a WAV file.
+ * 
+ * See openInput() for the kinds of input files.  The output is
+ * rendered through the render session with renderSession().
+ * 
+ * If the render is split, the input is first run through once to
+ * record the register writes into the event log and measure the
+ * length, and the output is then rendered with renderSplit() instead.
+ * If the render can not be split after all, it is rendered through
+ * the render session as usual.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pInPath - the path to the input file
+ * 
+ *   pOutPath - the path to the WAV file to create, or "-" for standard
+ *   output
+ * 
+ *   sample_rate - the output sample rate
+ */
+static void renderFile(
+          RENDER * pr,
+    const char   * pInPath,
+    const char   * pOutPath,
+          int32_t  sample_rate) {
+  
+  int done = 0;
+  
+  /* A split render writes the segments straight into place in a
+   * regular output file at the emulator rate over the whole input */
+  if ((split_count > 1) && (!isStreamPath(pOutPath)) &&
+      (opl_ctx_rate(sample_rate) == sample_rate) &&
+      (range_from == 0.0) && (range_to < 0.0) &&
+      (pIndexData == NULL)) {
+    
+    pr->pOutPath = pOutPath;
+    setRate(pr, sample_rate);
+    pr->pComp = NULL;
+    pr->rec = 0;
+    
+    openInput(pr, pInPath);
+    pr->logging = 1;
+    pr->log_count = 0;
+    runInput(pr);
+    pr->logging = 0;
+    
+    pr->s_known = pr->current;
+    done = renderSplit(pr);
+    pr->s_known = -1;
+    pr->log_count = 0;
+    closeInput(pr);
+    
+    if (done) {
+      return;
+    }
+  }
+  
+  renderSession(pr, pInPath, NULL, pOutPath, sample_rate);
+}
+
+/*
+ * Report the error of a render session and stop.
+ * 
+ * Errors are reported at the position in the input, like inputErr()
+ * does.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, with the session that failed
+ */
+static void sessionErr(const RENDER *pr) {
+  inputErr(pr, opl_render_input(pr->ps), opl_render_message(pr->ps));
+}
+
+/*
+ * Load the input of a render state into its render session.
+ * 
+ * The input is the file at pInPath of the render state, or a script on
+ * a stream if one is given.  Loading may create an emulator context
+ * for a second chip, so it is done while holding ctx_lock.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, which has a session
+ * 
+ *   pf - the stream with the script, or NULL to load the input file
+ */
+static void loadSession(RENDER *pr, FILE *pf) {
+  int err = OPL_RENDER_ERR_NONE;
+  int ok = 0;
+  
+  pthread_mutex_lock(&ctx_lock);
+  if (pf != NULL) {
+    ok = opl_render_load_stream(pr->ps, pf, &err);
+  } else {
+    ok = opl_render_load(pr->ps, pr->pInPath, vgm_rep, &err);
+  }
+  pthread_mutex_unlock(&ctx_lock);
+  
+  if ((!ok) && (err == OPL_RENDER_ERR_CONTEXT)) {
+    fprintf(stderr,
+      "%s: OPL driver does not support two chips at once!\n",
+      pModule);
+    renderErr(pr);
+  } else if (!ok) {
+    sessionErr(pr);
+  }
+  pr->chips = opl_render_channels(pr->ps);
+}
+
+/*
+ * Render an input into a WAV file through the render session of a
+ * render state.
+ * 
+ * The session pulls the frames straight into the sample buffer, which
+ * is then written out.  If the render state has no session yet, or its
+ * session has a different sample rate, a new session is created
+ * first.
+ * 
+ * If the output is a stream that can not be seeked, a first pass
+ * renders the input only to count the output frames, so that the WAVE
+ * header can be written with the correct sizes before any samples.
+ * The input is then loaded again.  A script on a stream can only be
+ * read once, so it gets no first pass.
+ * 
+ * Only the range of time selected with the -from and -to options is
+ * written.  If a checkpoint index is loaded, rendering starts from the
+ * latest checkpoint that is early enough for the range.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pInPath - the path to the input file, or NULL if reading a script
+ *   from a stream
+ * 
+ *   pf - the stream with the script, or NULL if reading a file
+ * 
+ *   pOutPath - the path to the WAV file to create, or "-" for standard
+ *   output
+ * 
+ *   sample_rate - the output sample rate
+ */
+static void renderSession(
+          RENDER * pr,
+    const char   * pInPath,
+          FILE   * pf,
+    const char   * pOutPath,
+          int32_t  sample_rate) {
+  
+  double clk = 0.0;
+  int32_t want = 0;
+  int32_t got = 0;
+  int first_pass = 0;
+  int pass = 0;
+  int err = OPL_RENDER_ERR_NONE;
+  
+  /* Set up the render state */
+  pr->pInPath = pInPath;
+  pr->pOutPath = pOutPath;
+  pr->s_known = -1;
+  
+  /* Switch to a session at the sample rate of the output */
+  setRate(pr, sample_rate);
+  if ((pr->ps == NULL) || (pr->ps_rate != sample_rate)) {
+    pr->ps = newSession(pr, sample_rate);
+    if (pr->ps == NULL) {
+      fprintf(stderr, "%s: Failed to create emulator context!\n",
+              pModule);
+      renderErr(pr);
+    }
+  }
+  
+  /* The WAVE header of an output that can not be seeked needs the
+   * total length up front */
+  first_pass = 1;
+  if ((pf == NULL) && (!(pr->fmt.raw)) && isStreamPath(pOutPath)) {
+    first_pass = 0;
+  }
+  
+  for(pass = first_pass; pass < 2; pass++) {
+    
+    /* Load the input and find where to start */
+    loadSession(pr, pf);
+    if (pf == NULL) {
+      seekCheckpoint(pr);
+    }
+    
+    if (pass == 0) {
+      pr->s_known = 0;
+    } else {
+      beginWAV(pr, pOutPath, sample_rate);
+    }
+    
+    /* Pull whole sample buffers until the end of the output */
+    want = BUFFER_SAMPLES / pr->chips;
+    do {
+      if (STATS_ON) {
+        clk = benchClock();
+      }
+      got = opl_render_pull(pr->ps, pr->s_buf, want, &err);
+      if (STATS_ON) {
+        pr->pull_secs += benchClock() - clk;
+      }
+      
+      if (pass == 0) {
+        pr->s_known += got;
+      } else {
+        pr->s_fill = got * pr->chips;
+        flushBuffer(pr);
+      }
+    } while (got == want);
+    if (err != OPL_RENDER_ERR_NONE) {
+      sessionErr(pr);
+    }
+    
+    if (pass > 0) {
+      finishWAV(pr);
+    }
+  }
+  
+  /* Close the input file but keep the session for the next input */
+  opl_render_reset(pr->ps);
+  pr->s_known = -1;
+  pr->pInPath = NULL;
+}
+
+/*
+ * Copy the rest of a file into another file.
+ * 
+ * If both are regular files on a file system that supports it, the
+ * output file is made a reflink of the input file, so that the two
+ * share their data blocks until one of them is changed.  Otherwise,
+ * the data is copied.  The output file must be empty for a reflink, so
+ * the input should be at its start.
+ * 
+ * Parameters:
+ * 
+ *   fd_in - the file descriptor to read from
+ * 
+ *   fd_out - the file descriptor to write to
+ * 
+ * Return:
+ * 
+ *   the number of bytes copied, or -1 if there was an I/O error
+ */
+static int64_t copyData(int fd_in, int fd_out) {
+  
+#ifdef FICLONE
+  struct stat st;
+#endif
+  uint8_t *pBuf = NULL;
+  int64_t total = 0;
+  ssize_t got = 0;
+  ssize_t put = 0;
+  ssize_t done = 0;
+  
+#ifdef FICLONE
+  /* Try a reflink first */
+  if (ioctl(fd_out, FICLONE, fd_in) == 0) {
+    if (fstat(fd_out, &st)) {
+      return -1;
+    }
+    return (int64_t) st.st_size;
+  }
+#endif
+  
+  /* Copy the data through a buffer */
+  pBuf = (uint8_t *) malloc(CACHE_CHUNK);
+  if (pBuf == NULL) {
+    return -1;
+  }
+  
+  for(got = read(fd_in, pBuf, CACHE_CHUNK); got > 0;
+      got = read(fd_in, pBuf, CACHE_CHUNK)) {
+    for(done = 0; done < got; done += put) {
+      put = write(fd_out, pBuf + done, (size_t) (got - done));
+      if (put <= 0) {
+        free(pBuf);
+        return -1;
+      }
+    }
+    total += (int64_t) got;
+  }
+  
+  free(pBuf);
+  if (got < 0) {
+    return -1;
+  }
+  return total;
+}
+
+/*
+ * Fingerprint the emulator core for the render cache keys.
+ * 
+ * The revision in the driver name only changes when a change to the
+ * driver remembers to increase it, and it can not tell apart builds of
+ * the external DOSBox emulator sources or of the native kernels.  So a
+ * fixed probe that keys on every channel with every waveform, then
+ * releases them, and then plays the rhythm instruments, is rendered
+ * with the selected core, and the SHA-256 digest of its samples goes
+ * into every key.  Any build of the emulator that renders differently
+ * gets keys of its own, so its renders never come from files cached by
+ * another build.
+ * 
+ * This must be called before any emulator context exists, since the
+ * DOSBox driver only supports a single context.
+ */
+static void cacheProbe(void) {
+  
+  static const uint8_t op_offs[9] = {
+    0x00, 0x01, 0x02, 0x08, 0x09, 0x0a, 0x10, 0x11, 0x12
+  };
+  
+  SHA256 hs;
+  OPL_CONTEXT *pc = NULL;
+  int16_t buf[PROBE_FRAMES];
+  uint8_t bytes[PROBE_FRAMES * 2];
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  int32_t step = 0;
+  int32_t ch = 0;
+  int32_t op = 0;
+  int32_t i = 0;
+  
+  pc = opl_ctx_new(opl_ctx_rate(44100));
+  if (pc == NULL) {
+    fprintf(stderr, "%s: Failed to create emulator context!\n",
+            pModule);
+    raiseErr();
+  }
+  
+  sha256_init(&hs);
+  for(step = 0; step < 4; step++) {
+    
+    if (step == 0) {
+      /* Key on every channel with its own settings and waveforms */
+      opl_ctx_write(pc, 0x01, 0x20);
+      opl_ctx_write(pc, 0xbd, 0xc0);
+      for(ch = 0; ch < 9; ch++) {
+        for(i = 0; i < 2; i++) {
+          op = op_offs[ch] + (i * 3);
+          opl_ctx_write(pc, 0x20 + op, 0x21 + (ch * 0x11) + (i * 0x40));
+          opl_ctx_write(pc, 0x40 + op, (i == 0) ? 0x10 + ch : ch);
+          opl_ctx_write(pc, 0x60 + op, 0xf2 - (ch * 0x10));
+          opl_ctx_write(pc, 0x80 + op, 0x13 + (ch * 0x11));
+          opl_ctx_write(pc, 0xe0 + op, (ch + i) & 3);
+        }
+        opl_ctx_write(pc, 0xc0 + ch, (ch * 3) & 0x0f);
+        opl_ctx_write(pc, 0xa0 + ch, 0x41 + (ch * 0x1d));
+        opl_ctx_write(pc, 0xb0 + ch, 0x21 + ((ch % 7) << 2));
+      }
+      
+    } else if (step == 1) {
+      /* Release every channel */
+      for(ch = 0; ch < 9; ch++) {
+        opl_ctx_write(pc, 0xb0 + ch, 0x01 + ((ch % 7) << 2));
+      }
+      
+    } else if (step == 2) {
+      /* Play every rhythm instrument */
+      opl_ctx_write(pc, 0xbd, 0xff);
+      
+    } else {
+      opl_ctx_write(pc, 0xbd, 0xe0);
+    }
+    
+    /* Hash the samples in little-endian order */
+    opl_ctx_generate(pc, buf, PROBE_FRAMES);
+    for(i = 0; i < PROBE_FRAMES; i++) {
+      bytes[2 * i] = (uint8_t) (((uint16_t) buf[i]) & 0xff);
+      bytes[2 * i + 1] = (uint8_t) (((uint16_t) buf[i]) >> 8);
+    }
+    sha256_update(&hs, bytes, sizeof(bytes));
+  }
+  sha256_final(&hs, digest);
+  opl_ctx_free(pc);
+  
+  for(i = 0; i < SHA256_DIGEST_SIZE; i++) {
+    snprintf(cache_probe + (i * 2), 3, "%02x", (unsigned int) digest[i]);
+  }
+}
+
+/*
+ * Compute the render cache path for rendering an input file.
+ * 
+ * The key is the SHA-256 digest of a description of everything besides
+ * the input that affects the output, followed by the contents of the
+ * input file.  The description has the cache key revision, the name of
+ * the OPL driver with its revision, the fingerprint of the emulator
+ * from cacheProbe(), the sample rate, and every option that changes
+ * the rendered samples or the format of the output file.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, with the output format
+ * 
+ *   pInPath - the path to the input file
+ * 
+ *   sample_rate - the output sample rate
+ * 
+ * Return:
+ * 
+ *   the path to the cached file in the cache directory, which the
+ *   caller must free, or NULL if the input file could not be read
+ */
+static char *cacheKey(
+    const RENDER  * pr,
+    const char    * pInPath,
+          int32_t   sample_rate) {
+  
+  SHA256 hs;
+  char desc[512];
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  uint8_t *pBuf = NULL;
+  char *pKeyPath = NULL;
+  size_t dir_len = 0;
+  ssize_t got = 0;
+  int fd = -1;
+  int i = 0;
+  
+  /* Describe the rendering settings */
+  sha256_init(&hs);
+  snprintf(desc, sizeof(desc),
+    "retro_opl render cache %d\n"
+    "driver %s\n"
+    "emulator %s\n"
+    "rate %ld\n"
+    "format %d\n"
+    "raw %d\n"
+    "gain %.9g\n"
+    "mono %d\n"
+    "loop %d\n"
+    "skip %d\n"
+    "coalesce %d\n"
+    "split %ld\n"
+    "from %.9g\n"
+    "to %.9g\n"
+    "\n",
+    CACHE_VERSION,
+    opl_ctx_name(),
+    cache_probe,
+    (long) sample_rate,
+    pr->fmt.format,
+    pr->fmt.raw,
+    (double) pr->fmt.gain,
+    pr->fmt.mono,
+    vgm_rep,
+    skip_silence,
+    coalesce_writes,
+    (long) split_count,
+    range_from,
+    range_to);
+  sha256_update(&hs, desc, strlen(desc));
+  
+  /* Hash the input file */
+  fd = open(pInPath, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  
+  pBuf = (uint8_t *) malloc(CACHE_CHUNK);
+  if (pBuf == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+    raiseErr();
+  }
+  
+  for(got = read(fd, pBuf, CACHE_CHUNK); got > 0;
+      got = read(fd, pBuf, CACHE_CHUNK)) {
+    sha256_update(&hs, pBuf, (size_t) got);
+  }
+  
+  free(pBuf);
+  close(fd);
+  if (got < 0) {
+    return NULL;
+  }
+  sha256_final(&hs, digest);
+  
+  /* Name the cached file after the digest */
+  dir_len = strlen(pCacheDir);
+  pKeyPath = (char *) malloc(dir_len + (SHA256_DIGEST_SIZE * 2) + 6);
+  if (pKeyPath == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+    raiseErr();
+  }
+  
+  memcpy(pKeyPath, pCacheDir, dir_len);
+  pKeyPath[dir_len] = '/';
+  for(i = 0; i < SHA256_DIGEST_SIZE; i++) {
+    snprintf(pKeyPath + dir_len + 1 + (i * 2), 3, "%02x",
+              (unsigned int) digest[i]);
+  }
+  strcpy(pKeyPath + dir_len + 1 + (SHA256_DIGEST_SIZE * 2), ".wav");
+  
+  return pKeyPath;
+}
+
+/*
+ * Copy a cached render to the output path.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pKeyPath - the path to the cached file
+ * 
+ *   pOutPath - the path to the WAV file to create, or "-" for standard
+ *   output
+ * 
+ * Return:
+ * 
+ *   non-zero if the output was copied from the cache, zero if the
+ *   cache does not have the file
+ */
+static int cacheFetch(
+          RENDER * pr,
+    const char   * pKeyPath,
+    const char   * pOutPath) {
+  
+  int fd_in = -1;
+  int fd_out = -1;
+  int64_t count = 0;
+  
+  /* Open the cached file, if there is one */
+  fd_in = open(pKeyPath, O_RDONLY);
+  if (fd_in < 0) {
+    return 0;
+  }
+  
+  /* Open output file, or use standard output */
+  if (strcmp(pOutPath, "-") == 0) {
+    fd_out = STDOUT_FILENO;
+  } else {
+    fd_out = open(pOutPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_out < 0) {
+      fprintf(stderr, "%s: Failed to create file '%s'!\n",
+              pModule, pOutPath);
+      renderErr(pr);
+    }
+  }
+  
+  /* Copy the cached file */
+  count = copyData(fd_in, fd_out);
+  if (count < 0) {
+    fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+    renderErr(pr);
+  }
+  
+  close(fd_in);
+  if (fd_out != STDOUT_FILENO) {
+    if (close(fd_out)) {
+      fprintf(stderr, "%s: Warning: failed to close file!\n",
+              pModule);
+    }
+  }
+  
+  /* Count the hit */
+  pthread_mutex_lock(&cache_lock);
+  cache_hits++;
+  cache_hit_bytes += count;
+  pthread_mutex_unlock(&cache_lock);
+  
+  return 1;
+}
+
+/*
+ * Store a rendered file in the render cache.
+ * 
+ * The file is copied into a temporary file in the cache directory
+ * first, which is then renamed to the cached file name, so that other
+ * processes using the same cache never see a partial file.  Failing to
+ * store the file only prints a warning, since the output itself has
+ * already been rendered.
+ * 
+ * Parameters:
+ * 
+ *   pKeyPath - the path to the cached file
+ * 
+ *   pOutPath - the path to the rendered WAV file
+ */
+static void cacheStore(
+    const char * pKeyPath,
+    const char * pOutPath) {
+  
+  char *pTmpPath = NULL;
+  size_t tmp_len = 0;
+  int32_t serial = 0;
+  int fd_in = -1;
+  int fd_out = -1;
+  int64_t count = -1;
+  
+  /* Make a temporary file name that is unique to this process and
+   * this store */
+  pthread_mutex_lock(&cache_lock);
+  serial = cache_serial;
+  cache_serial++;
+  pthread_mutex_unlock(&cache_lock);
+  
+  tmp_len = strlen(pKeyPath) + 48;
+  pTmpPath = (char *) malloc(tmp_len);
+  if (pTmpPath == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
     raiseErr();
   }
+  snprintf(pTmpPath, tmp_len, "%s.%ld-%ld.tmp",
+            pKeyPath, (long) getpid(), (long) serial);
+  
+  /* Copy the rendered file into the temporary file, creating the
+   * cache directory first if it does not exist yet */
+  mkdir(pCacheDir, 0777);
+  fd_in = open(pOutPath, O_RDONLY);
+  if (fd_in >= 0) {
+    fd_out = open(pTmpPath, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd_out >= 0) {
+      count = copyData(fd_in, fd_out);
+      if (close(fd_out)) {
+        count = -1;
+      }
+    }
+    close(fd_in);
+  }
+  
+  /* Move the temporary file into place */
+  if (count >= 0) {
+    if (rename(pTmpPath, pKeyPath)) {
+      count = -1;
+    }
+  }
+  
+  if (count < 0) {
+    if (fd_out >= 0) {
+      unlink(pTmpPath);
+    }
+    fprintf(stderr, "%s: Warning: failed to store '%s' in cache!\n",
+            pModule, pOutPath);
+  } else {
+    pthread_mutex_lock(&cache_lock);
+    cache_stored_bytes += count;
+    pthread_mutex_unlock(&cache_lock);
+  }
+  
+  free(pTmpPath);
+}
+
+/*
+ * Render an input file into a WAV file through the render cache.
+ * 
+ * If there is no render cache, this is the same as renderFile().
+ * Otherwise, the output is copied from the cache if the cache has a
+ * render of the same input with the same settings.  If not, the input
+ * is rendered with renderFile() and the output is then stored in the
+ * cache, unless it went to a stream that can not be read back.
+ * 
+ * Renders that use a checkpoint index are not cached, since their
+ * output may depend on the index as well.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pInPath - the path to the input file
+ * 
+ *   pOutPath - the path to the WAV file to create, or "-" for standard
+ *   output
+ * 
+ *   sample_rate - the output sample rate
+ */
+static void renderCached(
+          RENDER * pr,
+    const char   * pInPath,
+    const char   * pOutPath,
+          int32_t  sample_rate) {
+  
+  char *pKeyPath = NULL;
+  
+  /* Find the cached file, if caching applies */
+  if ((pCacheDir != NULL) && (pIndexData == NULL)) {
+    pKeyPath = cacheKey(pr, pInPath, sample_rate);
+  }
+  
+  /* Without a key, just render; renderFile() reports unreadable
+   * inputs */
+  if (pKeyPath == NULL) {
+    renderFile(pr, pInPath, pOutPath, sample_rate);
+    return;
+  }
+  
+  /* Copy from the cache, or render and store the output */
+  if (!cacheFetch(pr, pKeyPath, pOutPath)) {
+    pthread_mutex_lock(&cache_lock);
+    cache_misses++;
+    pthread_mutex_unlock(&cache_lock);
+    
+    renderFile(pr, pInPath, pOutPath, sample_rate);
+    if (!isStreamPath(pOutPath)) {
+      cacheStore(pKeyPath, pOutPath);
+    }
+  }
+  
+  free(pKeyPath);
+}
+
+/*
+ * Print the render cache statistics to standard error, if any renders
+ * went through the render cache.
+ */
+static void cacheReport(void) {
+  int32_t total = 0;
+  
+  total = cache_hits + cache_misses;
+  if (total < 1) {
+    return;
+  }
+  
+  fprintf(stderr, "%s: Cache: %ld hits, %ld misses, %.1f%% hit rate\n",
+          pModule, (long) cache_hits, (long) cache_misses,
+          (100.0 * cache_hits) / total);
+  fprintf(stderr, "%s: Cache: %.1f MB copied, %.1f MB stored\n",
+          pModule,
+          ((double) cache_hit_bytes) / (1024.0 * 1024.0),
+          ((double) cache_stored_bytes) / (1024.0 * 1024.0));
+}
+
+/*
+ * Get the time spent in the stages other than parsing.
+ * 
+ * Parameters:
+ * 
+ *   pst - the counters
+ * 
+ * Return:
+ * 
+ *   the time in seconds spent in the emulators, the sample rate
+ *   converter, and the output
+ */
+static double statsBusy(const STATS *pst) {
+  return pst->gen_secs + pst->resample_secs + pst->out_secs;
+}
+
+/*
+ * Add one set of instrumentation counters into another.
+ * 
+ * The counts and times are added, while the peak event rate is the
+ * larger of the two.
+ * 
+ * Parameters:
+ * 
+ *   pDst - the counters to add into
+ * 
+ *   pSrc - the counters to add
+ */
+static void statsMerge(STATS *pDst, const STATS *pSrc) {
+  int32_t i = 0;
+  
+  pDst->lines += pSrc->lines;
+  pDst->writes += pSrc->writes;
+  pDst->waits += pSrc->waits;
+  pDst->selects += pSrc->selects;
+  for(i = 0; i < STAT_RANGES; i++) {
+    pDst->issued[i] += pSrc->issued[i];
+  }
+  pDst->samples += pSrc->samples;
+  pDst->gen_secs += pSrc->gen_secs;
+  pDst->resample_secs += pSrc->resample_secs;
+  pDst->out_secs += pSrc->out_secs;
+  pDst->parse_secs += pSrc->parse_secs;
+  if (pSrc->peak_events > pDst->peak_events) {
+    pDst->peak_events = pSrc->peak_events;
+  }
+}
+
+/*
+ * Start timing the events of a script.
+ * 
+ * This is only called if instrumentation is enabled.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void statsBegin(RENDER *pr) {
+  pr->st_begin = benchClock();
+  pr->st_busy = statsBusy(&(pr->st));
+  pr->st_base = 0;
+  pr->st_end = pr->emu_rate;
+}
+
+/*
+ * Update the peak event rate after the current sample offset has moved
+ * forward.
+ * 
+ * Each time the offset reaches the end of a second of emulator output,
+ * the events since the previous second ended are counted towards the
+ * peak.
+ * 
+ * This is only called if instrumentation is enabled.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void statsSecond(RENDER *pr) {
+  int64_t n = 0;
+  
+  if (pr->current >= pr->st_end) {
+    n = pr->ev_count - pr->st_base;
+    if (n > pr->st.peak_events) {
+      pr->st.peak_events = n;
+    }
+    pr->st_base = pr->ev_count;
+    pr->st_end = ((pr->current / pr->emu_rate) + 1) * pr->emu_rate;
+  }
+}
+
+/*
+ * Finish timing the events of a script.
+ * 
+ * The time since the events began that was not spent in the other
+ * stages is counted as parsing time.  The events of the last, partial
+ * second also count towards the peak event rate.
+ * 
+ * This is only called if instrumentation is enabled.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void statsEnd(RENDER *pr) {
+  if (pr->ev_count - pr->st_base > pr->st.peak_events) {
+    pr->st.peak_events = pr->ev_count - pr->st_base;
+  }
+  if (opl_input_kind(pr->pi) == OPL_INPUT_TEXT) {
+    pr->st.lines += opl_input_line(pr->pi);
+  }
+  pr->st.parse_secs += (benchClock() - pr->st_begin) -
+                        (statsBusy(&(pr->st)) - pr->st_busy);
+}
+
+/*
+ * Add the counters of the render session of a render state into the
+ * counters of the render state.
+ * 
+ * The session counts its work from when it was created, so this is
+ * called once for each session, right before it is closed.  The time
+ * spent pulling frames from the session that was not spent in the
+ * emulators or the sample rate converter is counted as parsing time.
+ * 
+ * This is only called if instrumentation is enabled.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state, which has a session
+ */
+static void statsSession(RENDER *pr) {
+  OPL_RENDER_STATS rs;
+  int32_t i = 0;
+  
+  opl_render_stats(pr->ps, &rs);
+  
+  pr->st.lines += rs.lines;
+  pr->st.writes += rs.writes;
+  pr->st.waits += rs.waits;
+  pr->st.selects += rs.selects;
+  for(i = 0; i < STAT_RANGES; i++) {
+    pr->st.issued[i] += rs.issued[i];
+  }
+  pr->st.samples += rs.samples;
+  pr->st.gen_secs += rs.gen_secs;
+  pr->st.resample_secs += rs.resample_secs;
+  pr->st.parse_secs += pr->pull_secs - rs.gen_secs - rs.resample_secs;
+  if (rs.peak_events > pr->st.peak_events) {
+    pr->st.peak_events = rs.peak_events;
+  }
+  pr->pull_secs = 0.0;
+}
+
+/*
+ * Print the instrumentation counters of all render states that have
+ * been freed, if instrumentation is enabled.
+ * 
+ * The counters are printed on standard error as a single JSON object.
+ * Times are added up over all threads, so with several threads they can
+ * add up to more than the time that has passed.
+ */
+static void statsReport(void) {
+  int32_t i = 0;
+  
+  if (!STATS_ON) {
+    return;
+  }
+  
+  fprintf(stderr, "{\"lines\":%lld,\"writes\":%lld,\"waits\":%lld,"
+          "\"chip_selects\":%lld,\"issued\":{",
+          (long long) stats_total.lines,
+          (long long) stats_total.writes,
+          (long long) stats_total.waits,
+          (long long) stats_total.selects);
+  for(i = 0; i < STAT_RANGES; i++) {
+    fprintf(stderr, "%s\"%02x-%02x\":%lld",
+            (i > 0) ? "," : "", (int) (i * 32), (int) ((i * 32) + 31),
+            (long long) stats_total.issued[i]);
+  }
+  fprintf(stderr, "},\"samples\":%lld,\"parse_seconds\":%.6f,"
+          "\"synth_seconds\":%.6f,\"resample_seconds\":%.6f,"
+          "\"output_seconds\":%.6f,\"peak_events_per_second\":%lld}\n",
+          (long long) stats_total.samples,
+          stats_total.parse_secs,
+          stats_total.gen_secs,
+          stats_total.resample_secs,
+          stats_total.out_secs,
+          (long long) stats_total.peak_events);
+}
+
+/*
+ * Compile an OPL2 hardware script into a binary event stream.
+ * 
+ * The script must already be open as the input of the render state.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pOutPath - the path to the binary event stream to create
+ */
+static void compileScript(RENDER *pr, const char *pOutPath) {
+  
+  /* Open the compiled output file */
+  pr->pComp = fopen(pOutPath, "wb");
+  if (pr->pComp == NULL) {
+    fprintf(stderr, "%s: Failed to create file '%s'!\n",
+            pModule, pOutPath);
+    renderErr(pr);
+  }
+  
+  /* Only scripts can be compiled */
+  if (opl_input_kind(pr->pi) != OPL_INPUT_TEXT) {
+    fprintf(stderr, "%s: Compile input must be an OPL2 script!\n",
+            pModule);
+    renderErr(pr);
+  }
+  
+  /* Compile the script */
+  runInput(pr);
+  
+  /* Close the compiled output file */
+  if (fclose(pr->pComp)) {
+    fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+    renderErr(pr);
+  }
+  pr->pComp = NULL;
+}
+
+/*
+ * Push a register write into the playback queue.
+ * 
+ * The write takes effect at the current sample offset.  If the queue
+ * is full, this waits for the playback thread to make room, starting
+ * the playback thread first if necessary.  Only this thread waits; the
+ * playback thread never waits for the queue.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void queueWrite(RENDER *pr, uint8_t reg, uint8_t val) {
+  
+  OPL_QWRITE w;
+  struct timespec ts;
+  
+  w.offs = pr->current;
+  w.reg = reg;
+  w.val = val;
+  
+  while (!opl_queue_push(pr->pq, &w)) {
+    if (!(pr->play_live)) {
+      startPlayback(pr);
+    }
+    
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000L;
+    nanosleep(&ts, NULL);
+  }
+}
+
+/*
+ * Audio callback that fills a period during real-time playback.
+ * 
+ * Samples are generated from the emulator while the queued register
+ * writes are applied right before their samples, so timing is
+ * sample-accurate against the device clock.  Once the end of the
+ * stream is reached, the rest of the period is silent.
+ * 
+ * This runs on the playback thread.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the render state
+ * 
+ *   pbuf - the buffer to fill
+ * 
+ *   frames - the number of samples to write into the buffer
+ * 
+ * Return:
+ * 
+ *   non-zero if more periods follow, zero if this is the last period
+ */
+static int playFill(void *pArg, int16_t *pbuf, int32_t frames) {
   
-  /* Flush sample buffer */
-  flushBuffer();
+  RENDER *pr = NULL;
+  int64_t end = 0;
+  int32_t count = 0;
+  int ended = 0;
   
-  /* Compute data size in bytes, watching for overflow */
-  data_size = s_total;
-  if (data_size <= INT32_MAX / 2) {
-    data_size *= 2;
-  } else {
-    fprintf(stderr, "%s: Overflow computing file size!\n", pModule);
-    raiseErr();
+  pr = (RENDER *) pArg;
+  
+  /* Do not go past the end of the stream once it is known */
+  count = frames;
+  ended = opl_queue_ended(pr->pq, &end);
+  if (ended) {
+    if (count > end - pr->p_pos) {
+      count = (int32_t) (end - pr->p_pos);
+    }
   }
   
-  /* Compute chunk size in bytes, watching for overflow */
-  if (data_size <= INT32_MAX - 36) {
-    chunk_size = data_size + 36;
+  /* Generate samples while applying queued writes */
+  if (count > 0) {
+    opl_queue_render(pr->pq, pr->pc, pr->p_pos, pbuf, count);
+    pr->p_pos += count;
   } else {
-    fprintf(stderr, "%s: Overflow computing file size!\n", pModule);
-    raiseErr();
+    count = 0;
   }
   
-  /* Seek to chunk size field */
-  if (fseek(pOut, 4, SEEK_SET)) {
-    fprintf(stderr, "%s: I/O error seeking output!\n", pModule);
-    raiseErr();
+  /* Pad the rest of the period with silence */
+  if (count < frames) {
+    memset(pbuf + count, 0, ((size_t) (frames - count)) *
+                              sizeof(int16_t));
+  }
+  
+  return !(ended && (pr->p_pos >= end));
+}
+
+/*
+ * Procedure of the playback thread.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the render state
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *playMain(void *pArg) {
+  RENDER *pr = NULL;
+  int err = 0;
+  
+  pr = (RENDER *) pArg;
+  if (!audio_run(pr->pa, &playFill, pr, &err)) {
+    pr->play_err = err;
+  }
+  
+  return NULL;
+}
+
+/*
+ * Start the playback thread.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void startPlayback(RENDER *pr) {
+  if (pthread_create(&(pr->play_tid), NULL, &playMain, pr)) {
+    fprintf(stderr, "%s: Failed to start playback thread!\n",
+            pModule);
+    renderErr(pr);
   }
+  pr->play_live = 1;
+}
+
+/*
+ * Play the input in real time on an audio device.
+ * 
+ * The input must already be set up as for runInput().  Once the audio
+ * device is open, the input is run and all the register writes are
+ * pushed into the playback queue with their sample offsets.  The
+ * playback thread starts once PLAY_PREFILL samples are queued ahead,
+ * and playFill() generates the samples for each period on an emulator
+ * context of its own while the input keeps the queue filled.
+ * 
+ * When playback is done, the latency, the number of underruns, and the
+ * number of late register writes are reported on standard error, which
+ * helps with choosing a period size.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ */
+static void playInput(RENDER *pr) {
   
-  /* Write chunk size field */
-  writeDword((uint32_t) chunk_size);
+  AUDIO_STATS st;
+  int err = 0;
+  double rate = 0.0;
   
-  /* Seek to data size field */
-  if (fseek(pOut, 40, SEEK_SET)) {
-    fprintf(stderr, "%s: I/O error seeking output!\n", pModule);
-    raiseErr();
+  /* The playback thread generates samples straight into the device
+   * buffer, so the device must run at the emulator rate */
+  if (pr->emu_rate != pr->sample_rate) {
+    fprintf(stderr,
+      "%s: Real-time playback needs a rate the OPL driver emulates!\n",
+      pModule);
+    renderErr(pr);
+  }
+  
+  /* Create the emulator context that the playback thread drives */
+  pr->pc = opl_ctx_new(pr->emu_rate);
+  if (pr->pc == NULL) {
+    fprintf(stderr, "%s: Failed to create emulator context!\n",
+            pModule);
+    renderErr(pr);
+  }
+  opl_ctx_set_skip(pr->pc, skip_silence);
+  
+  /* Open the audio device and create the queue */
+  pr->pa = audio_open(pPlayDevice, pr->sample_rate, play_period,
+                      PLAY_PERIODS, &err);
+  if (pr->pa == NULL) {
+    fprintf(stderr, "%s: %s!\n", pModule, audio_errstr(err));
+    renderErr(pr);
+  }
+  
+  pr->pq = opl_queue_new(PLAY_QUEUE);
+  if (pr->pq == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+    renderErr(pr);
   }
+  pr->play_live = 0;
+  pr->play_err = 0;
+  pr->p_pos = 0;
+  
+  /* Feed the queue from the input */
+  pr->pComp = NULL;
+  pr->rec = 1;
+  runInput(pr);
+  opl_queue_end(pr->pq, pr->current);
+  pr->rec = 0;
   
-  /* Write data size field */
-  writeDword((uint32_t) data_size);
+  /* Wait for playback to finish */
+  if (!(pr->play_live)) {
+    startPlayback(pr);
+  }
+  if (pthread_join(pr->play_tid, NULL)) {
+    fprintf(stderr, "%s: Failed to join playback thread!\n", pModule);
+    renderErr(pr);
+  }
+  pr->play_live = 0;
   
-  /* Close the file */
-  if (fclose(pOut)) {
-    fprintf(stderr, "%s: Warning: failed to close file!\n", pModule);
+  if (pr->play_err) {
+    fprintf(stderr, "%s: %s!\n", pModule, audio_errstr(pr->play_err));
+    renderErr(pr);
   }
-  pOut = NULL;
+  
+  /* Report statistics */
+  memset(&st, 0, sizeof(AUDIO_STATS));
+  audio_stats(pr->pa, &st);
+  
+  rate = ((double) pr->sample_rate) / 1000.0;
+  fprintf(stderr, "%s: Played %ld periods of %ld frames\n",
+          pModule, (long) st.periods, (long) st.period);
+  fprintf(stderr, "%s: Device buffer %.1f ms, latency %.1f ms\n",
+          pModule, ((double) st.buffer) / rate,
+          ((double) (st.max_delay + st.period)) / rate);
+  fprintf(stderr, "%s: Underruns: %ld\n",
+          pModule, (long) st.underruns);
+  fprintf(stderr, "%s: Late register writes: %ld\n",
+          pModule, (long) opl_queue_late(pr->pq));
+  
+  /* Release the audio output, the queue, and the emulator context */
+  audio_close(pr->pa);
+  pr->pa = NULL;
+  opl_queue_free(pr->pq);
+  pr->pq = NULL;
+  opl_ctx_free(pr->pc);
+  pr->pc = NULL;
 }
 
 /*
- * Flush the sample buffer to the output file.
+ * Find an emulator core by its short name.
+ * 
+ * Parameters:
+ * 
+ *   pKey - the short name of the core
+ * 
+ * Return:
+ * 
+ *   the index of the core as passed to opl_core_key(), or -1 if there
+ *   is no such core
  */
-static void flushBuffer(void) {
+static int32_t findCore(const char *pKey) {
   int32_t i = 0;
-  uint8_t b1 = 0;
-  uint8_t b2 = 0;
-  
-  /* Only do something if there is something in the buffer */
-  if (s_fill > 0) {
   
-    /* Check state */
-    if (pOut == NULL) {
-      raiseErr();
+  for(i = 0; i < opl_core_count(); i++) {
+    if (strcmp(opl_core_key(i), pKey) == 0) {
+      return i;
     }
+  }
+  return -1;
+}
+
+/*
+ * Read a batch manifest into the job list.
+ * 
+ * The manifest file must already be opened as plain lines with
+ * openStream() in the given render state.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state used for reading the manifest
+ */
+static void readManifest(RENDER *pr) {
+  
+  const char *pLine = NULL;
+  const char *pstr = NULL;
+  char *pCore = NULL;
+  JOB *pj = NULL;
+  int32_t new_cap = 0;
+  int err = 0;
   
-    /* Copy samples to byte buffer */
-    memcpy(b_buf, s_buf, s_fill * 2);
+  /* Read each line of the manifest */
+  while (1) {
+    pLine = opl_input_getline(pr->pi, &err);
+    if (pLine == NULL) {
+      if (err != OPL_INPUT_ERR_NONE) {
+        inputErr(pr, pr->pi, opl_input_errstr(err));
+      }
+      break;
+    }
+    
+    /* If this line is blank or starts with an apostrophe, skip it */
+    if ((pLine[0] == '\'') || opl_input_blank(pLine)) {
+      continue;
+    }
     
-    /* If not little endian, reverse each pair of bytes */
-    if (!isLittleEndian()) {
-      for(i = 0; i < s_fill; i++) {
-        b1 = b_buf[(i * 2)];
-        b2 = b_buf[(i * 2) + 1];
-        b_buf[(i * 2)] = b2;
-        b_buf[(i * 2) + 1] = b1;
+    /* Expand the job list if necessary */
+    if (job_count >= job_cap) {
+      if (job_cap < 1) {
+        new_cap = 16;
+      } else if (job_cap <= INT32_MAX / 2) {
+        new_cap = job_cap * 2;
+      } else {
+        fprintf(stderr, "%s: Too many jobs in manifest!\n", pModule);
+        renderErr(pr);
+      }
+      
+      pj = (JOB *) realloc(pJobs, ((size_t) new_cap) * sizeof(JOB));
+      if (pj == NULL) {
+        fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+        renderErr(pr);
       }
+      pJobs = pj;
+      job_cap = new_cap;
     }
+    pj = &(pJobs[job_count]);
     
-    /* Write to output */
-    if (fwrite(b_buf, 2, (size_t) s_fill, pOut) != s_fill) {
-      fprintf(stderr, "%s: I/O error writing output!\n", pModule);
-      raiseErr();
+    /* Parse the sample rate */
+    pstr = opl_input_parse_int(pLine, &(pj->sample_rate));
+    if ((pstr == NULL) || (!isRate(pj->sample_rate))) {
+      fprintf(stderr, "%s: Unsupported sampling rate on line %ld!\n",
+              pModule, (long) opl_input_line(pr->pi));
+      renderErr(pr);
     }
     
-    /* Update total sample count, watching for overflow */
-    if (s_total <= INT32_MAX - s_fill) {
-      s_total += s_fill;
-    } else {
-      fprintf(stderr, "%s: Sample count overflow!\n", pModule);
-      raiseErr();
+    /* Parse the input and output paths */
+    pstr = parsePath(pr, pstr, &(pj->pInPath));
+    pstr = parsePath(pr, pstr, &(pj->pOutPath));
+    
+    /* Parse the emulator core, if the job names one */
+    pj->core = run_core;
+    if (!opl_input_blank(pstr)) {
+      pstr = parsePath(pr, pstr, &pCore);
+      pj->core = findCore(pCore);
+      free(pCore);
+      pCore = NULL;
+      if (pj->core < 0) {
+        fprintf(stderr, "%s: Unknown emulator core on line %ld!\n",
+                pModule, (long) opl_input_line(pr->pi));
+        renderErr(pr);
+      }
+    }
+    if (!opl_input_blank(pstr)) {
+      fprintf(stderr, "%s: Invalid job syntax on line %ld!\n",
+              pModule, (long) opl_input_line(pr->pi));
+      renderErr(pr);
     }
     
-    /* Clear the buffer */
-    s_fill = 0;
+    /* Jobs run in parallel, so they can not share standard output */
+    if (strcmp(pj->pOutPath, "-") == 0) {
+      fprintf(stderr,
+              "%s: Job writes to standard output on line %ld!\n",
+              pModule, (long) opl_input_line(pr->pi));
+      renderErr(pr);
+    }
+    
+    /* Job is now in the list */
+    job_count++;
+  }
+}
+
+/*
+ * Take the next job of the current pass from the job list.
+ * 
+ * This function is safe to call from multiple worker threads.
+ * 
+ * Return:
+ * 
+ *   the next job for the core in job_core, or NULL if there are no
+ *   more jobs for that core
+ */
+static JOB *nextJob(void) {
+  JOB *pj = NULL;
+  
+  if (pthread_mutex_lock(&job_lock)) {
+    fprintf(stderr, "%s: Failed to lock job list!\n", pModule);
+    raiseErr();
+  }
+  
+  while ((job_next < job_count) && (pJobs[job_next].core != job_core)) {
+    job_next++;
+  }
+  if (job_next < job_count) {
+    pj = &(pJobs[job_next]);
+    job_next++;
+  }
+  
+  if (pthread_mutex_unlock(&job_lock)) {
+    fprintf(stderr, "%s: Failed to unlock job list!\n", pModule);
+    raiseErr();
   }
+  
+  return pj;
 }
 
 /*
- * Compute a given number of samples with the current state of the
- * emulated OPL hardware and transfer through the sample buffer.
+ * Worker procedure for batch mode.
+ * 
+ * The worker keeps taking jobs from the job list until there are no
+ * jobs left.  Each job is rendered through the render session of the
+ * worker, so the emulator contexts and the buffers of the session and
+ * the render state are reused for each job.
  * 
  * Parameters:
  * 
- *   count - the number of samples to compute
+ *   pArg - the RENDER state owned by this worker
+ * 
+ * Return:
+ * 
+ *   always NULL
  */
-static void computeSamples(int32_t count) {
-  int32_t work = 0;
+static void *workerMain(void *pArg) {
+  RENDER *pr = NULL;
+  JOB *pj = NULL;
   
-  /* Check parameter */
-  if (count < 1) {
+  pr = (RENDER *) pArg;
+  
+  for(pj = nextJob(); pj != NULL; pj = nextJob()) {
+    renderCached(pr, pj->pInPath, pj->pOutPath, pj->sample_rate);
+  }
+  
+  return NULL;
+}
+
+/*
+ * Run all the jobs in a batch manifest.
+ * 
+ * The OPL driver only has one core selected at a time, so the jobs are
+ * run in one pass for each core that the manifest uses, in the order of
+ * the core table.  The number of worker threads in each pass is the
+ * number of processors, limited by the number of jobs for the core and
+ * the number of emulator contexts that the core supports.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the batch manifest
+ * 
+ *   pFmt - the format of the output files
+ */
+static void runBatch(const char *pPath, const OUTFMT *pFmt) {
+  
+  RENDER *pWork[MAX_WORKERS];
+  pthread_t tid[MAX_WORKERS];
+  FILE *pf = NULL;
+  long cpu_count = 0;
+  int32_t worker_count = 0;
+  int32_t core_jobs = 0;
+  int32_t core = 0;
+  int32_t i = 0;
+  
+  /* Clear the worker array */
+  memset(pWork, 0, sizeof(RENDER *) * MAX_WORKERS);
+  
+  /* Each job already has its own thread, so jobs are not split */
+  split_count = 1;
+  
+  /* A checkpoint index only belongs to a single input */
+  if (pIndexData != NULL) {
+    fprintf(stderr, "%s: Checkpoints can not be used in batch mode!\n",
+            pModule);
+    raiseErr();
+  }
+  
+  /* Prime the cached endian state before any worker runs */
+  isLittleEndian();
+  
+  /* Read the manifest with a render state that has no session, so that
+   * no emulator context exists when a core is selected */
+  pWork[0] = newRender(44100, pFmt);
+  pf = fopen(pPath, "rb");
+  if (pf == NULL) {
+    fprintf(stderr, "%s: Failed to open file '%s'!\n",
+            pModule, pPath);
     raiseErr();
   }
+  pWork[0]->pInPath = pPath;
+  openStream(pWork[0], pf, OPL_INPUT_LINES);
+  readManifest(pWork[0]);
+  closeInput(pWork[0]);
+  fclose(pf);
+  freeRender(pWork[0]);
+  pWork[0] = NULL;
   
-  /* Keep processing until we've done all the requested samples */
-  while (count > 0) {
-    /* If buffer is completely filled, flush it */
-    if (s_fill >= BUFFER_SAMPLES) {
-      flushBuffer();
+  /* Determine the number of processors */
+  cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpu_count < 1) {
+    cpu_count = 1;
+  } else if (cpu_count > MAX_WORKERS) {
+    cpu_count = MAX_WORKERS;
+  }
+  
+  for(core = 0; core < opl_core_count(); core++) {
+    /* Skip cores that no job uses */
+    core_jobs = 0;
+    for(i = 0; i < job_count; i++) {
+      if (pJobs[i].core == core) {
+        core_jobs++;
+      }
+    }
+    if (core_jobs < 1) {
+      continue;
+    }
+    
+    /* Select the core, and fingerprint it for the cache keys before
+     * any of its contexts exist */
+    opl_core_select(opl_core_key(core));
+    if (pCacheDir != NULL) {
+      cacheProbe();
+    }
+    
+    /* Determine the number of workers */
+    worker_count = (int32_t) cpu_count;
+    if (worker_count > opl_ctx_limit()) {
+      worker_count = opl_ctx_limit();
+    }
+    if (worker_count > core_jobs) {
+      worker_count = core_jobs;
+    }
+    if (worker_count < 1) {
+      worker_count = 1;
     }
     
-    /* The work count is the minimum of the remaining samples in the
-     * buffer and the remaining request count */
-    work = BUFFER_SAMPLES - s_fill;
-    if (count < work) {
-      work = count;
+    /* Create the render states; if the driver runs out of contexts
+     * early, just use fewer workers */
+    for(i = 0; i < worker_count; i++) {
+      pWork[i] = newWorker(pFmt);
+      if (pWork[i] == NULL) {
+        if (i < 1) {
+          fprintf(stderr, "%s: Failed to create emulator context!\n",
+                  pModule);
+          raiseErr();
+        }
+        worker_count = i;
+        break;
+      }
     }
     
-    /* Generate the work number of samples and add to buffer */
-    opl_generate(&(s_buf[s_fill]), work);
-    s_fill += work;
+    /* Run the first worker on this thread and the others on their own
+     * threads */
+    job_core = core;
+    job_next = 0;
+    for(i = 1; i < worker_count; i++) {
+      if (pthread_create(&(tid[i]), NULL, &workerMain, pWork[i])) {
+        fprintf(stderr, "%s: Failed to start worker thread!\n",
+                pModule);
+        raiseErr();
+      }
+    }
+    workerMain(pWork[0]);
+    for(i = 1; i < worker_count; i++) {
+      if (pthread_join(tid[i], NULL)) {
+        fprintf(stderr, "%s: Failed to join worker thread!\n",
+                pModule);
+        raiseErr();
+      }
+    }
     
-    /* Decrease the request count by the work samples */
-    count -= work;
+    /* Release the render states along with their contexts */
+    for(i = 0; i < worker_count; i++) {
+      freeRender(pWork[i]);
+      pWork[i] = NULL;
+    }
+  }
+  
+  /* Restore the core of the run and release the job list */
+  opl_core_select(opl_core_key(run_core));
+  for(i = 0; i < job_count; i++) {
+    free(pJobs[i].pInPath);
+    free(pJobs[i].pOutPath);
   }
+  free(pJobs);
+  pJobs = NULL;
+  job_count = 0;
+  job_cap = 0;
 }
 
 /*
- * Check whether a given string is blank.
+ * Read the monotonic clock.
  * 
- * Returns:
+ * Return:
+ * 
+ *   the current time in seconds from some arbitrary starting point
+ */
+static double benchClock(void) {
+  struct timespec ts;
+  
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    fprintf(stderr, "%s: Failed to read clock!\n", pModule);
+    raiseErr();
+  }
+  
+  return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1.0e9);
+}
+
+/*
+ * Print the result of a benchmark stage.
+ * 
+ * Results are printed on standard output as one JSON object per line,
+ * with the input label, the name of the emulator core, the stage name,
+ * the unit that was counted, the total count, the total time in
+ * seconds, and the count per second.
+ * 
+ * Parameters:
+ * 
+ *   pLabel - the label of the input
+ * 
+ *   pStage - the name of the stage
+ * 
+ *   pUnit - the unit of the count
+ * 
+ *   count - the total count over all repetitions
+ * 
+ *   secs - the total time in seconds over all repetitions
+ */
+static void benchPrint(
+    const char    * pLabel,
+    const char    * pStage,
+    const char    * pUnit,
+          double    count,
+          double    secs) {
+  
+  const char *pc = NULL;
+  
+  /* Print the label as a JSON string */
+  printf("{\"input\":\"");
+  for(pc = pLabel; *pc != 0; pc++) {
+    if ((*pc == '"') || (*pc == '\\')) {
+      printf("\\%c", *pc);
+    } else if ((*pc >= 0) && (*pc < 0x20)) {
+      printf("\\u%04x", (unsigned int) *pc);
+    } else {
+      putchar(*pc);
+    }
+  }
+  
+  /* Print the rest of the result */
+  printf("\",\"core\":\"%s\",\"stage\":\"%s\",\"unit\":\"%s\","
+          "\"count\":%.0f,\"seconds\":%.6f,\"per_second\":%.1f}\n",
+          opl_ctx_name(), pStage, pUnit, count, secs,
+          (secs > 0.0) ? (count / secs) : 0.0);
+  fflush(stdout);
+}
+
+/*
+ * Run all the benchmark stages on an input.
+ * 
+ * The input must already be set up as for runInput(), and the render
+ * state must have the sample rate set.  The stages are:
+ * 
+ *   parse - run the input without synthesis, counting events
+ * 
+ *   generate - render the input through the render session over its
+ *   whole length, discarding the samples
+ * 
+ *   write - write as many samples as the input produces through the
+ *   WAVE output functions to /dev/null
  * 
- *   non-zero if string is empty or only contains tabs and spaces; zero
- *   otherwise
+ * Each stage is repeated until it has run for at least BENCH_MIN_TIME
+ * seconds.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render state
+ * 
+ *   pLabel - the label of the input for the results
+ * 
+ *   pf - the stream the input was opened on, or NULL if it was opened
+ *   from the file at pInPath of the render state
+ */
+static void benchInput(RENDER *pr, const char *pLabel, FILE *pf) {
+  
+  double t0 = 0.0;
+  double secs = 0.0;
+  double total = 0.0;
+  int64_t samples = 0;
+  int64_t remain = 0;
+  int32_t n = 0;
+  int32_t i = 0;
+  int32_t got = 0;
+  int err = OPL_RENDER_ERR_NONE;
+  
+  pr->pComp = NULL;
+  pr->rec = 0;
+  pr->s_known = -1;
+  
+  /* Parse stage */
+  total = 0.0;
+  t0 = benchClock();
+  do {
+    runInput(pr);
+    total += (double) pr->ev_count;
+    secs = benchClock() - t0;
+  } while (secs < BENCH_MIN_TIME);
+  samples = pr->current;
+  benchPrint(pLabel, "parse", "events", total, secs);
+  
+  /* Nothing more to do if the input does not produce any samples */
+  if (samples < 1) {
+    return;
+  }
+  
+  /* Get a render session over the whole input */
+  if ((pr->ps == NULL) || (pr->ps_rate != pr->sample_rate)) {
+    pr->ps = newSession(pr, pr->sample_rate);
+    if (pr->ps == NULL) {
+      fprintf(stderr, "%s: Failed to create emulator context!\n",
+              pModule);
+      renderErr(pr);
+    }
+  }
+  opl_render_range(pr->ps, 0.0, -1.0);
+  
+  /* Generate stage */
+  total = 0.0;
+  t0 = benchClock();
+  do {
+    if (pf != NULL) {
+      rewind(pf);
+    }
+    loadSession(pr, pf);
+    samples = 0;
+    do {
+      got = opl_render_pull(pr->ps, pr->s_buf,
+                            BUFFER_SAMPLES / pr->chips, &err);
+      samples += ((int64_t) got) * pr->chips;
+    } while (got > 0);
+    if (err != OPL_RENDER_ERR_NONE) {
+      sessionErr(pr);
+    }
+    opl_render_reset(pr->ps);
+    total += (double) samples;
+    secs = benchClock() - t0;
+  } while (secs < BENCH_MIN_TIME);
+  benchPrint(pLabel, "generate", "samples", total, secs);
+  
+  /* The write stage writes as many samples as were generated, which
+   * accounts for resampling and for the number of channels */
+  
+  /* Write stage, using a test pattern as the samples */
+  for(i = 0; i < BUFFER_SAMPLES; i++) {
+    pr->s_buf[i] = (int16_t) (((i * 97) & 0x7fff) - 16384);
+  }
+  
+  total = 0.0;
+  t0 = benchClock();
+  do {
+    beginWAV(pr, "/dev/null", pr->sample_rate);
+    for(remain = samples; remain > 0; remain -= n) {
+      n = BUFFER_SAMPLES;
+      if (n > remain) {
+        n = (int32_t) remain;
+      }
+      pr->s_fill = n;
+      flushBuffer(pr);
+      total += (double) ((n / pr->chips) * outChannels(pr)) *
+                (double) pcm_conv_width(pr->fmt.format);
+    }
+    finishWAV(pr);
+    secs = benchClock() - t0;
+  } while (secs < BENCH_MIN_TIME);
+  benchPrint(pLabel, "write", "bytes", total, secs);
+}
+
+/*
+ * Generate the synthetic dense script for the benchmark.
+ * 
+ * The script has a register write or a one-cycle wait on every line,
+ * generated with a fixed pseudo-random sequence, and it only uses
+ * registers that do not affect the timers.
+ * 
+ * Return:
+ * 
+ *   a temporary file holding the script, which the caller must close
  */
-static int isBlankStr(const uint8_t *pstr) {
+static FILE *benchDense(void) {
+  
+  FILE *pf = NULL;
+  uint32_t seed = 0;
+  int32_t i = 0;
   
-  /* Check parameter */
-  if (pstr == NULL) {
+  pf = tmpfile();
+  if (pf == NULL) {
+    fprintf(stderr, "%s: Failed to create temporary file!\n",
+            pModule);
     raiseErr();
   }
-  
-  /* Scan characters */
-  while(*pstr != 0) {
-    if ((*pstr != ' ') && (*pstr != '\t')) {
-      return 0;
+  fprintf(pf, "OPL2 1024\n");
+  seed = UINT32_C(1);
+  for(i = 0; i < BENCH_DENSE_LINES; i++) {
+    seed = (seed * UINT32_C(1103515245)) + UINT32_C(12345);
+    if ((i % 4) == 3) {
+      fprintf(pf, "w 1\n");
+    } else {
+      fprintf(pf, "r %02x %02x\n",
+              (unsigned int) (0x20 + ((seed >> 16) % 0xd6)),
+              (unsigned int) ((seed >> 8) & 0xff));
     }
-    pstr++;
+  }
+  if (ferror(pf)) {
+    fprintf(stderr, "%s: I/O error writing temporary file!\n",
+            pModule);
+    raiseErr();
   }
   
-  /* If we got here, string is blank */
-  return 1;
+  return pf;
 }
 
 /*
- * Parse an base-16 byte value from a string.
+ * Run the benchmark on a set of inputs.
  * 
- * pstr points to where to start parsing.  The character indicated by
- * pstr must be a base-16 digit, space, or horizontal tab.  Parsing
- * starts with an optional sequence of space and horizontal tab
- * characters that are skipped.  The first non-space, non-tab character
- * encountered must be a base-16 digit.
+ * If no inputs are given, the benchmark runs on first.opl2 in the
+ * current directory, if it exists, and on a synthetic dense script
+ * with a register write or a one-cycle wait on every line.
  * 
- * This function will read exactly two base-16 digits and write the
- * parsed value to *pb.  After the two base-16 digits must come a
- * character that is not a base-16 digit.  The return value points to
- * this character immediately after the second base-16 digit.
+ * If no emulator core was chosen with the -core option, the inputs are
+ * benchmarked with each core in turn, so that the cores can be
+ * compared.
  * 
  * Parameters:
  * 
- *   pstr - the location to start parsing
+ *   sample_rate - the sample rate to benchmark with
  * 
- *   pb - variable to receive the parsed byte value
+ *   pFmt - the format of the output for the write stage
  * 
- * Return:
+ *   argc - the number of input paths
  * 
- *   pointer to character immediately after byte value that was parsed
+ *   argv - the input paths
  */
-static const uint8_t *parseByte(const uint8_t *pstr, uint8_t *pb) {
+static void runBench(
+          int32_t    sample_rate,
+    const OUTFMT   * pFmt,
+          int        argc,
+          char     * argv[]) {
   
-  uint8_t result = 0;
-  int i = 0;
-  
-  /* Check parameters */
-  if ((pstr == NULL) || (pb == NULL)) {
-    raiseErr();
-  }
+  RENDER *pr = NULL;
+  FILE *pf = NULL;
+  FILE *pDense = NULL;
+  int have_first = 0;
+  int32_t core = 0;
+  int32_t i = 0;
   
-  /* Skip over any tabs and spaces */
-  while ((*pstr == '\t') || (*pstr == ' ')) {
-    pstr++;
+  /* Without inputs, check for the sample script and generate the
+   * dense script once for all cores */
+  if (argc < 1) {
+    pf = fopen("first.opl2", "rb");
+    if (pf != NULL) {
+      fclose(pf);
+      pf = NULL;
+      have_first = 1;
+    }
+    pDense = benchDense();
   }
   
-  /* Parse two base-16 digits */
-  for(i = 0; i < 2; i++) {
-    if ((*pstr >= '0') && (*pstr <= '9')) {
-      result = (uint8_t) ((result << 4) + (*pstr - '0'));
+  for(core = 0; core < opl_core_count(); core++) {
+    /* Use the selected core, or else each core in turn */
+    if (pCoreKey != NULL) {
+      if (core > 0) {
+        break;
+      }
+    } else {
+      opl_core_select(opl_core_key(core));
+    }
     
-    } else if ((*pstr >= 'A') && (*pstr <= 'F')) {
-      result = (uint8_t) ((result << 4) + (*pstr - 'A' + 10));
+    /* Create the render state */
+    pr = newRender(sample_rate, pFmt);
     
-    } else if ((*pstr >= 'a') && (*pstr <= 'f')) {
-      result = (uint8_t) ((result << 4) + (*pstr - 'a' + 10));
+    if (argc > 0) {
+      /* Benchmark each given input */
+      for(i = 0; i < argc; i++) {
+        openInput(pr, argv[i]);
+        benchInput(pr, argv[i], NULL);
+        closeInput(pr);
+      }
       
     } else {
-      fprintf(stderr, "%s: Byte parse failed on line %ld!\n",
-              pModule, (long) line_count);
-      raiseErr();
+      /* Benchmark the sample script if it is available */
+      if (have_first) {
+        openInput(pr, "first.opl2");
+        benchInput(pr, "first.opl2", NULL);
+        closeInput(pr);
+      }
+      
+      /* Benchmark the dense script */
+      rewind(pDense);
+      pr->pInPath = "(dense)";
+      openStream(pr, pDense, OPL_INPUT_TEXT);
+      benchInput(pr, "(dense)", pDense);
+      closeInput(pr);
     }
-    pstr++;
+    
+    /* Release the render state, so that the next core can be
+     * selected */
+    freeRender(pr);
+    pr = NULL;
   }
   
-  /* Make sure we landed on something other than a base-16 digit */
-  if (((*pstr >= '0') && (*pstr <= '9')) ||
-      ((*pstr >= 'A') && (*pstr <= 'F')) ||
-      ((*pstr >= 'a') && (*pstr <= 'f'))) {
-    fprintf(stderr, "%s: Byte parse failed on line %ld!\n",
-            pModule, (long) line_count);
-    raiseErr();
+  if (pDense != NULL) {
+    fclose(pDense);
+    pDense = NULL;
   }
-  
-  /* Write result and return pointer */
-  *pb = result;
-  return pstr;
 }
 
 /*
- * Parse an unsigned decimal integer from a string.
- * 
- * pstr points to where to start parsing.  The character indicated by
- * pstr must be a decimal digit, space, or horizontal tab.  Parsing
- * starts with an optional sequence of space and horizontal tab
- * characters that are skipped.  The first non-space, non-tab character
- * encountered must be a decimal digit.
+ * Parse an unsigned decimal integer option value.
  * 
- * After the decimal digit is encountered, this function will read a
- * sequence of decimal digits until a character that is not a decimal
- * digit is found.  The parsed integer value is written to *pv, and the
- * return value points to the first character after the decimal
- * sequence.
+ * This function will not return if the value is not valid.
  * 
  * Parameters:
  * 
- *   pstr - the location to start parsing
+ *   pName - the name of the option, for use in error reports
  * 
- *   pv - variable to receive the parsed integer value
+ *   pstr - the option value
  * 
  * Return:
  * 
- *   pointer to character immediately after decimal integer that was
- *   parsed
+ *   the parsed value
  */
-static const uint8_t *parseInt(const uint8_t *pstr, int32_t *pv) {
-  
+static int32_t parseOptInt(const char *pName, const char *pstr) {
   int32_t result = 0;
-  int32_t d = 0;
-  
-  /* Check parameters */
-  if ((pstr == NULL) || (pv == NULL)) {
-    raiseErr();
-  }
-  
-  /* Skip over any tabs and spaces */
-  while ((*pstr == '\t') || (*pstr == ' ')) {
-    pstr++;
-  }
+  const char *pc = NULL;
   
-  /* Check that we found a decimal digit */
-  if ((*pstr < '0') || (*pstr > '9')) {
-    fprintf(stderr, "%s: Integer parse failed on line %ld!\n",
-            pModule, (long) line_count);
+  /* Value must be a non-empty string of decimal digits */
+  if (*pstr == 0) {
+    fprintf(stderr, "%s: Invalid value for %s!\n", pModule, pName);
     raiseErr();
   }
   
-  /* Parse sequence of decimal digits */
-  while ((*pstr >= '0') && (*pstr <= '9')) {
-    /* Get numeric value of current digit */
-    d = (int32_t) (*pstr - '0');
-    
-    /* Multiply result by 10, watching for overflow */
-    if (result <= INT32_MAX / 10) {
-      result *= 10;
-    } else {
-      fprintf(stderr, "%s: Integer value overflow on line %ld!\n",
-              pModule, (long) line_count);
-      raiseErr();
-    }
-    
-    /* Add current digit to result, watching for overflow */
-    if (result <= INT32_MAX - d) {
-      result += d;
-    } else {
-      fprintf(stderr, "%s: Integer value overflow on line %ld!\n",
-              pModule, (long) line_count);
+  for(pc = pstr; *pc != 0; pc++) {
+    if ((*pc < '0') || (*pc > '9') ||
+        (result > (INT32_MAX - (*pc - '0')) / 10)) {
+      fprintf(stderr, "%s: Invalid value for %s!\n", pModule, pName);
       raiseErr();
     }
-    
-    /* Advance to next character */
-    pstr++;
+    result = (result * 10) + (int32_t) (*pc - '0');
   }
   
-  /* Write result and return pointer */
-  *pv = result;
-  return pstr;
+  return result;
 }
 
 /*
- * Read a line from input.
+ * Parse a time from a program argument.
  * 
- * If at least one byte is read from input, then line_count, l_init, and
- * l_buf will be updated to hold the next line, and a non-zero value
- * will be returned.
+ * The time is a number of seconds, which may have a fraction, and which
+ * may be preceded by a number of minutes and a colon, such as "2:37".
+ * If the argument is not a valid time of at most a hundred days, an
+ * error is reported and the program stops.
+ * 
+ * Parameters:
  * 
- * If input returns EOF when attempting to read a character, this
- * function just returns zero right away.
+ *   pName - the name of the option, for error reports
  * 
- * In case of error, an error message is printed and raiseErr() is
- * called.
+ *   pstr - the string to parse
  * 
  * Return:
  * 
- *   non-zero if another input line was read, zero if EOF
+ *   the time in seconds, zero or greater
  */
-static int readInput(void) {
-  int c = 0;
-  int32_t written = 0;
+static double parseTime(const char *pName, const char *pstr) {
+  const char *pc = NULL;
+  char *pEnd = NULL;
+  double mins = 0.0;
+  double secs = 0.0;
   
-  /* Read first character */
-  c = getchar();
-  if (c == EOF) {
-    if (feof(stdin)) {
-      /* Stream is EOF, so return zero */
-      return 0;
-      
-    } else {
-      /* Reading character failed due to I/O error */
-      fprintf(stderr, "%s: I/O error reading input!\n", pModule);
+  /* Minutes, if given, are decimal digits followed by a colon */
+  pc = strchr(pstr, ':');
+  if (pc != NULL) {
+    if (pc == pstr) {
+      fprintf(stderr, "%s: Invalid value for %s!\n", pModule, pName);
       raiseErr();
     }
+    for( ; pstr < pc; pstr++) {
+      if ((*pstr < '0') || (*pstr > '9')) {
+        fprintf(stderr, "%s: Invalid value for %s!\n", pModule, pName);
+        raiseErr();
+      }
+      mins = (mins * 10.0) + (double) (*pstr - '0');
+    }
+    pstr++;
   }
   
-  /* We got at least one character, so increment line count first */
-  if (line_count < INT32_MAX) {
-    line_count++;
-  } else {
-    fprintf(stderr, "%s: Too many lines in input!\n", pModule);
+  /* The seconds must be an unsigned number */
+  if ((*pstr < '0') || (*pstr > '9')) {
+    fprintf(stderr, "%s: Invalid value for %s!\n", pModule, pName);
     raiseErr();
   }
-  
-  /* Initialize the line buffer */
-  l_init = 1;
-  memset(l_buf, 0, LINE_MAXIMUM + 1);
-  
-  /* Enter processing loop */
-  while (1) {
-    /* If character is CR, read next character, which must be LF, and
-     * then proceed */
-    if (c == '\r') {
-      c = getchar();
-      if ((c == EOF) && ferror(stdin)) {
-        fprintf(stderr, "%s: I/O error reading input!\n", pModule);
-        raiseErr();
-      }
-      if (c != '\n') {
-        fprintf(stderr, "%s: CR without following LF on line %ld!\n",
-                pModule, (long) line_count);
-        raiseErr();
-      }
-    }
-    
-    /* If character is LF, then leave loop */
-    if (c == '\n') {
-      break;
-    }
-    
-    /* If we got here, check that character is in normal printing
-     * US-ASCII range */
-    if ((c != '\t') && ((c < 0x20) || (c > 0x7e))) {
-      fprintf(stderr, "%s: Line %ld contains invalid character!\n",
-              pModule, (long) line_count);
-      raiseErr();
-    }
-    
-    /* Check that we haven't exceeded the buffer space */
-    if (written >= LINE_MAXIMUM) {
-      fprintf(stderr, "%s: Line %ld is too long!\n", (long) line_count);
-      raiseErr();
-    }
-    
-    /* Add character to line buffer */
-    l_buf[written] = (uint8_t) c;
-    written++;
-    
-    /* Read next character */
-    c = getchar();
-    if (c == EOF) {
-      if (feof(stdin)) {
-        /* Stream is EOF, so leave loop */
-        break;
-        
-      } else {
-        /* Reading character failed due to I/O error */
-        fprintf(stderr, "%s: I/O error reading input!\n", pModule);
-        raiseErr();
-      }
-    }
+  secs = strtod(pstr, &pEnd);
+  if ((*pEnd != 0) || (!isfinite(secs))) {
+    fprintf(stderr, "%s: Invalid value for %s!\n", pModule, pName);
+    raiseErr();
   }
   
-  /* If we got here, we successfully read a line */
-  return 1;
+  secs += mins * 60.0;
+  if (!(secs <= 8640000.0)) {
+    fprintf(stderr, "%s: Invalid value for %s!\n", pModule, pName);
+    raiseErr();
+  }
+  return secs;
 }
 
 /*
- * Read and parse the header line from input.
+ * Parse a sample rate from a program argument.
  * 
- * Returns:
+ * If the argument is not a decimal integer in the supported range, an
+ * error is reported and the program stops.
  * 
- *   the control rate in Hz, in range [1, 1024]
+ * Parameters:
+ * 
+ *   pstr - the argument
+ * 
+ * Return:
+ * 
+ *   the sample rate
  */
-static int32_t readHeader(void) {
-  
-  int32_t ctl_rate = 0;
-  const char *pstr = NULL;
+static int32_t parseRate(const char *pstr) {
+  int32_t result = 0;
+  const char *pc = NULL;
   
-  /* Read a line */
-  if (!readInput()) {
-    fprintf(stderr, "%s: Failed to read header line!\n", pModule);
-    raiseErr();
+  for(pc = pstr; *pc != 0; pc++) {
+    if ((*pc < '0') || (*pc > '9') || (result > RESAMPLE_RATE_MAX)) {
+      result = 0;
+      break;
+    }
+    result = (result * 10) + (int32_t) (*pc - '0');
   }
   
-  /* Check whether the line begins "OPL2" */
-  if (memcmp(l_buf, "OPL2", 4) != 0) {
-    fprintf(stderr, "%s: Input does not have OPL2 header!\n", pModule);
+  if (!isRate(result)) {
+    fprintf(stderr, "%s: Unsupported sampling rate!\n", pModule);
     raiseErr();
   }
   
-  /* Parse the control rate */
-  pstr = parseInt(&(l_buf[4]), &ctl_rate);
-  if ((ctl_rate < 1) || (ctl_rate > 1024)) {
-    fprintf(stderr, "%s: Control rate must be in range [1, 1024]!\n",
-            pModule);
-    raiseErr();
-  }
+  return result;
+}
+
+/*
+ * Parse an output gain in decibels from a program argument.
+ * 
+ * The gain may have a sign and a fractional part, and it must be in
+ * range [-60, 24].  If the argument is not valid, an error is reported
+ * and the program stops.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the argument
+ * 
+ * Return:
+ * 
+ *   the linear gain
+ */
+static float parseGain(const char *pstr) {
+  double db = 0.0;
+  char *pEnd = NULL;
   
-  /* Make sure rest of line is blank */
-  if (!isBlankStr(pstr)) {
-    fprintf(stderr, "%s: Invalid header line syntax!\n", pModule);
+  db = strtod(pstr, &pEnd);
+  if ((*pstr == 0) || (*pEnd != 0) || (!(db >= -60.0)) ||
+      (!(db <= 24.0))) {
+    fprintf(stderr, "%s: Invalid value for -gain!\n", pModule);
     raiseErr();
   }
   
-  /* Return control rate */
-  return ctl_rate;
+  return (float) pow(10.0, db / 20.0);
 }
 
 /*
@@ -768,19 +5314,11 @@ static int32_t readHeader(void) {
 int main(int argc, char *argv[]) {
   
   int i = 0;
+  int opt_count = 0;
   const char *pPath = NULL;
   int32_t sample_rate = 0;
-  
-  const uint8_t *pstr = NULL;
-  int32_t rate = 0;
-  uint8_t reg = 0;
-  uint8_t val = 0;
-  
-  int32_t t = 0;
-  int32_t iv32 = 0;
-  double so = 0.0;
-  int32_t soi = 0;
-  int32_t current = 0;
+  RENDER *pr = NULL;
+  OUTFMT fmt;
   
   /* Get the module name */
   pModule = NULL;
@@ -793,6 +5331,13 @@ int main(int argc, char *argv[]) {
     pModule = "retro_opl";
   }
   
+  /* Write 16-bit WAVE files at full gain unless the options say
+   * otherwise */
+  fmt.raw = 0;
+  fmt.format = PCM_S16;
+  fmt.gain = 1.0f;
+  fmt.mono = 0;
+  
   /* Check arguments */
   if (argc > 0) {
     if (argv == NULL) {
@@ -805,140 +5350,347 @@ int main(int argc, char *argv[]) {
     }
   }
   
-  /* If no arguments, print syntax and return error status */
-  if (argc < 2) {
-    fprintf(stderr, "Syntax:\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "  retro_opl [output] [sample_rate] < [input]\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "[output] is path to output WAV file\n");
-    fprintf(stderr, "[sample_rate] is 44100 or 48000\n");
-    fprintf(stderr, "OPL2 script read from standard input\n");
-    fprintf(stderr, "\n");
-    exit(1);
-  }
-  
-  /* Check that two arguments beyond module name */
-  if (argc != 3) {
-    fprintf(stderr, "%s: Wrong number of program arguments!\n",
-      pModule);
-    raiseErr();
-  }
-  
-  /* Get the output file name and the sample rate */
-  pPath = argv[1];
-  if (strcmp(argv[2], "44100") == 0) {
-    sample_rate = 44100;
-  
-  } else if (strcmp(argv[2], "48000") == 0) {
-    sample_rate = 48000;
-    
-  } else {
-    fprintf(stderr, "%s: Unsupported sampling rate!\n", pModule);
-    raiseErr();
-  }
-  
-  /* Start emulation */
-  opl_init(sample_rate);
-  
-  /* Read the header from input and the rate */
-  rate = readHeader();
-  
-  /* Start WAVE output */
-  beginWAV(pPath, sample_rate);
-  
-  /* Process the rest of the file */
-  while (readInput()) {
-    
-    /* If this line is blank or starts with an apostrophe, skip it */
-    if ((l_buf[0] == '\'') || (isBlankStr(l_buf))) {
-      continue;
-    }
-    
-    /* Second character must be space or tab */
-    if ((l_buf[1] != ' ') && (l_buf[1] != '\t')) {
-      fprintf(stderr, "%s: Invalid command on line %ld!\n",
-              pModule, (long) line_count);
-      raiseErr();
-    }
-    
-    /* Handle the command based on the first character */
-    if (l_buf[0] == 'r') {
-      /* Register command, so parse the address and data bytes */
-      pstr = &(l_buf[1]);
-      pstr = parseByte(pstr, &reg);
-      pstr = parseByte(pstr, &val);
-      if (!isBlankStr(pstr)) {
-        fprintf(stderr, "%s: Invalid command syntax on line %ld!\n",
-                pModule, (long) line_count);
+  /* Handle any options before the other arguments, and then shift the
+   * argument array so the first argument after the options is at index
+   * one */
+  opt_count = 0;
+  while (opt_count + 1 < argc) {
+    if (strcmp(argv[opt_count + 1], "-loop") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -loop!\n", pModule);
+        raiseErr();
+      }
+      if (strcmp(argv[opt_count + 2], "1") == 0) {
+        vgm_rep = 1;
+      } else if (strcmp(argv[opt_count + 2], "2") == 0) {
+        vgm_rep = 2;
+      } else {
+        fprintf(stderr, "%s: Unrecognized repeat code '%s'!\n",
+                pModule, argv[opt_count + 2]);
         raiseErr();
       }
+      opt_count += 2;
       
-      /* Update register in the emulated hardware */
-      opl_write(reg, val);
+    } else if (strcmp(argv[opt_count + 1], "-raw") == 0) {
+      fmt.raw = 1;
+      opt_count++;
       
-    } else if (l_buf[0] == 'w') {
-      /* Wait command, so parse the control cycle count */
-      pstr = &(l_buf[1]);
-      pstr = parseInt(pstr, &iv32);
-      if (!isBlankStr(pstr)) {
-        fprintf(stderr, "%s: Invalid command syntax on line %ld!\n",
-                pModule, (long) line_count);
+    } else if (strcmp(argv[opt_count + 1], "-format") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -format!\n", pModule);
         raiseErr();
       }
-      
-      /* Update the t value, watching for overflow */
-      if (t <= INT32_MAX - iv32) {
-        t += iv32;
+      if (strcmp(argv[opt_count + 2], "s16") == 0) {
+        fmt.format = PCM_S16;
+      } else if (strcmp(argv[opt_count + 2], "s24") == 0) {
+        fmt.format = PCM_S24;
+      } else if (strcmp(argv[opt_count + 2], "f32") == 0) {
+        fmt.format = PCM_F32;
       } else {
-        fprintf(stderr, "%s: Time counter overflow!\n", pModule);
+        fprintf(stderr, "%s: Unrecognized sample format '%s'!\n",
+                pModule, argv[opt_count + 2]);
         raiseErr();
       }
+      opt_count += 2;
       
-      /* Compute the sample offset in floating-point space */
-      so = (((double) t) * ((double) sample_rate)) / ((double) rate);
+    } else if (strcmp(argv[opt_count + 1], "-gain") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -gain!\n", pModule);
+        raiseErr();
+      }
+      fmt.gain = parseGain(argv[opt_count + 2]);
+      opt_count += 2;
       
-      /* Floor the offset to integer and make sure finite */
-      so = floor(so);
-      if (!isfinite(so)) {
-        fprintf(stderr, "%s: Numeric problem computing offset!\n",
-                pModule);
+    } else if (strcmp(argv[opt_count + 1], "-mono") == 0) {
+      fmt.mono = 1;
+      opt_count++;
+      
+    } else if (strcmp(argv[opt_count + 1], "-skip") == 0) {
+      skip_silence = 1;
+      opt_count++;
+      
+    } else if (strcmp(argv[opt_count + 1], "-coalesce") == 0) {
+      coalesce_writes = 1;
+      opt_count++;
+      
+    } else if (strcmp(argv[opt_count + 1], "-from") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -from!\n", pModule);
+        raiseErr();
+      }
+      range_from = parseTime("-from", argv[opt_count + 2]);
+      opt_count += 2;
+      
+    } else if (strcmp(argv[opt_count + 1], "-to") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -to!\n", pModule);
         raiseErr();
       }
+      range_to = parseTime("-to", argv[opt_count + 2]);
+      opt_count += 2;
       
-      /* Make sure sample offset in integer range and convert to
-       * integer */
-      if (!((so >= 0.0) && (so <= ((double) INT32_MAX)))) {
-        fprintf(stderr, "%s: Sample offset out of range!\n",
+    } else if (strcmp(argv[opt_count + 1], "-checkpoints") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -checkpoints!\n",
                 pModule);
         raiseErr();
       }
-      soi = (int32_t) so;
-      if (soi <= current) {
-        fprintf(stderr, "%s: Numeric problem computing offset!\n",
+      if (pIndexData != NULL) {
+        fprintf(stderr, "%s: Only one -checkpoints is allowed!\n",
                 pModule);
         raiseErr();
       }
+      loadIndex(argv[opt_count + 2]);
+      opt_count += 2;
+      
+    } else if (strcmp(argv[opt_count + 1], "-interval") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -interval!\n", pModule);
+        raiseErr();
+      }
+      index_interval = parseOptInt("-interval", argv[opt_count + 2]);
+      if ((index_interval < 1) || (index_interval > 3600)) {
+        fprintf(stderr, "%s: Invalid value for -interval!\n", pModule);
+        raiseErr();
+      }
+      opt_count += 2;
+      
+    } else if (strcmp(argv[opt_count + 1], "-split") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -split!\n", pModule);
+        raiseErr();
+      }
+      split_count = parseOptInt("-split", argv[opt_count + 2]);
+      if ((split_count < 1) || (split_count > MAX_WORKERS)) {
+        fprintf(stderr, "%s: Invalid value for -split!\n", pModule);
+        raiseErr();
+      }
+      opt_count += 2;
+    
+    } else if (strcmp(argv[opt_count + 1], "-period") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -period!\n", pModule);
+        raiseErr();
+      }
+      play_period = parseOptInt("-period", argv[opt_count + 2]);
+      opt_count += 2;
+      
+    } else if (strcmp(argv[opt_count + 1], "-device") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -device!\n", pModule);
+        raiseErr();
+      }
+      pPlayDevice = argv[opt_count + 2];
+      opt_count += 2;
+      
+    } else if (strcmp(argv[opt_count + 1], "-cache") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -cache!\n", pModule);
+        raiseErr();
+      }
+      pCacheDir = argv[opt_count + 2];
+      opt_count += 2;
       
-      /* Compute samples so as to bring current sample offset up to the
-       * soi we just computed */
-      computeSamples(soi - current);
+    } else if (strcmp(argv[opt_count + 1], "-core") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -core!\n", pModule);
+        raiseErr();
+      }
+      pCoreKey = argv[opt_count + 2];
+      run_core = findCore(pCoreKey);
+      if (run_core < 0) {
+        fprintf(stderr, "%s: Unknown emulator core '%s'!\n",
+                pModule, pCoreKey);
+        raiseErr();
+      }
+      opl_core_select(pCoreKey);
+      opt_count += 2;
       
-      /* Update current pointer to the soi value */
-      current = soi;
+    } else if (strcmp(argv[opt_count + 1], "-stats") == 0) {
+#ifndef RETRO_OPL_STATS
+      fprintf(stderr, "%s: Statistics were not compiled in!\n",
+              pModule);
+      raiseErr();
+#endif
+      stats_enabled = 1;
+      opt_count++;
       
     } else {
-      fprintf(stderr, "%s: Invalid command on line %ld!\n",
-              pModule, (long) line_count);
+      break;
+    }
+  }
+  argc -= opt_count;
+  argv += opt_count;
+  
+  /* The end of the range must come after its start */
+  if ((range_to >= 0.0) && (!(range_to > range_from))) {
+    fprintf(stderr, "%s: The -to time must be after the -from time!\n",
+            pModule);
+    raiseErr();
+  }
+  
+  /* Fingerprint the emulator for the cache keys before any context
+   * exists; batch mode does this for each core it uses */
+  if ((pCacheDir != NULL) && (argc >= 2) &&
+      (strcmp(argv[1], "-batch") != 0)) {
+    cacheProbe();
+  }
+  
+  /* If no arguments, print syntax and return error status */
+  if (argc < 2) {
+    fprintf(stderr, "Syntax:\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  retro_opl [options] [output] [rate] [input]\n");
+    fprintf(stderr, "  retro_opl -compile [output] [input]\n");
+    fprintf(stderr, "  retro_opl [options] -batch [manifest]\n");
+    fprintf(stderr, "  retro_opl [options] -play [rate] [input]\n");
+    fprintf(stderr, "  retro_opl [options] -bench [rate] [inputs]\n");
+    fprintf(stderr,
+      "  retro_opl [options] -index [index] [rate] [input]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[output] is path to output WAV file or -\n");
+    fprintf(stderr, "[rate] is sample rate, 4000 to 192000\n");
+    fprintf(stderr, "[input] is OPL2 script, binary, VGM, or VGZ\n");
+    fprintf(stderr, "Script read from standard input if no [input]\n");
+    fprintf(stderr, "Output - writes WAV to standard output\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-compile writes OPL2 script as binary events\n");
+    fprintf(stderr, "-play plays input in real time on audio device\n");
+    fprintf(stderr, "-bench times parsing, synthesis, and output\n");
+    fprintf(stderr, "-index builds checkpoints of a binary stream\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[options]:\n");
+    fprintf(stderr, "  -loop [r] - VGM repeat, 1 once, 2 loop once\n");
+    fprintf(stderr, "  -raw - write raw PCM without header\n");
+    fprintf(stderr, "  -format [f] - sample format, s16, s24, f32\n");
+    fprintf(stderr, "  -gain [db] - output gain, -60 to 24 dB\n");
+    fprintf(stderr, "  -mono - mix all chips into one channel\n");
+    fprintf(stderr, "  -skip - skip synthesis while chips are idle\n");
+    fprintf(stderr,
+      "  -coalesce - merge register writes at the same time\n");
+    fprintf(stderr, "  -split [n] - render in n segments, 1 to 64\n");
+    fprintf(stderr, "  -from [t] - start time, seconds or m:ss\n");
+    fprintf(stderr, "  -to [t] - end time, seconds or m:ss\n");
+    fprintf(stderr, "  -checkpoints [index] - index to seek with\n");
+    fprintf(stderr, "  -interval [s] - index interval, 1 to 3600\n");
+    fprintf(stderr, "  -period [n] - play period, 16 to 4096 frames\n");
+    fprintf(stderr, "  -device [path] - audio device for -play\n");
+    fprintf(stderr, "  -cache [dir] - reuse renders cached in dir\n");
+    fprintf(stderr, "  -stats - print stage counters and times\n");
+    fprintf(stderr, "  -core [name] - emulator core, one of:");
+    for(i = 0; i < opl_core_count(); i++) {
+      fprintf(stderr, " %s", opl_core_key(i));
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[manifest] lists jobs, one per line, as:\n");
+    fprintf(stderr, "  [rate] [input] [output] [core]\n");
+    fprintf(stderr, "[core] is optional and defaults to -core\n");
+    fprintf(stderr, "\n");
+    exit(1);
+  }
+  
+  /* Handle batch mode */
+  if (strcmp(argv[1], "-batch") == 0) {
+    if (argc != 3) {
+      fprintf(stderr, "%s: Wrong number of program arguments!\n",
+        pModule);
       raiseErr();
     }
+    runBatch(argv[2], &fmt);
+    cacheReport();
+    statsReport();
+    return 0;
   }
   
-  /* Finish emulation */
-  opl_finish();
+  /* Handle benchmark mode */
+  if (strcmp(argv[1], "-bench") == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "%s: Wrong number of program arguments!\n",
+        pModule);
+      raiseErr();
+    }
+    sample_rate = parseRate(argv[2]);
+    runBench(sample_rate, &fmt, argc - 3, argv + 3);
+    return 0;
+  }
+  
+  /* Handle index mode */
+  if (strcmp(argv[1], "-index") == 0) {
+    if (argc != 5) {
+      fprintf(stderr, "%s: Wrong number of program arguments!\n",
+        pModule);
+      raiseErr();
+    }
+    sample_rate = parseRate(argv[3]);
+    pr = newRender(sample_rate, &fmt);
+    buildIndex(pr, argv[2], argv[4]);
+    freeRender(pr);
+    statsReport();
+    return 0;
+  }
+  
+  /* Check that two or three arguments beyond module name */
+  if ((argc != 3) && (argc != 4)) {
+    fprintf(stderr, "%s: Wrong number of program arguments!\n",
+      pModule);
+    raiseErr();
+  }
+  
+  /* Handle compile mode, which does not need an emulator context */
+  if (strcmp(argv[1], "-compile") == 0) {
+    pr = (RENDER *) calloc(1, sizeof(RENDER));
+    if (pr == NULL) {
+      fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+      raiseErr();
+    }
+    
+    if (argc > 3) {
+      openInput(pr, argv[3]);
+    } else {
+      openStream(pr, stdin, OPL_INPUT_TEXT);
+    }
+    
+    compileScript(pr, argv[2]);
+    
+    closeInput(pr);
+    opl_input_free(pr->pi);
+    free(pr);
+    return 0;
+  }
+  
+  /* Get the output file name, or -play, and the sample rate */
+  pPath = argv[1];
+  sample_rate = parseRate(argv[2]);
+  
+  /* Start emulation */
+  pr = newRender(sample_rate, &fmt);
   
-  /* Finish WAVE output */
-  finishWAV();
+  if (strcmp(pPath, "-play") == 0) {
+    /* Play the input in real time */
+    if (argc > 3) {
+      openInput(pr, argv[3]);
+      playInput(pr);
+      closeInput(pr);
+    } else {
+      openStream(pr, stdin, OPL_INPUT_TEXT);
+      playInput(pr);
+      closeInput(pr);
+    }
+    
+  } else if (argc > 3) {
+    /* Render the given input file */
+    renderCached(pr, argv[3], pPath, sample_rate);
+    
+  } else {
+    /* Render the script from standard input */
+    renderSession(pr, NULL, stdin, pPath, sample_rate);
+  }
+  
+  /* Finish emulation */
+  freeRender(pr);
+  cacheReport();
+  statsReport();
   
   /* If we got here, return successful status */
   return 0;
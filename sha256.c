@@ -0,0 +1,227 @@
+/*
+ * sha256.c
+ * ========
+ * 
+ * Implementation of sha256.h
+ * 
+ * See the header for further information.
+ */
+
+#include "sha256.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The round constants.
+ */
+static const uint32_t k_round[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Rotate a 32-bit value right.
+ * 
+ * Parameters:
+ * 
+ *   x - the value
+ * 
+ *   n - the number of bits, in range [1, 31]
+ * 
+ * Return:
+ * 
+ *   the rotated value
+ */
+static uint32_t rotr(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+/*
+ * Process one 64-byte block of the message.
+ * 
+ * Parameters:
+ * 
+ *   ps - the digest computation
+ * 
+ *   pb - the block
+ */
+static void processBlock(SHA256 *ps, const uint8_t *pb) {
+  uint32_t w[64];
+  uint32_t v[8];
+  uint32_t t1 = 0;
+  uint32_t t2 = 0;
+  int i = 0;
+  
+  /* Prepare the message schedule */
+  for(i = 0; i < 16; i++) {
+    w[i] = (((uint32_t) pb[i * 4]) << 24) |
+            (((uint32_t) pb[(i * 4) + 1]) << 16) |
+            (((uint32_t) pb[(i * 4) + 2]) << 8) |
+            ((uint32_t) pb[(i * 4) + 3]);
+  }
+  for(i = 16; i < 64; i++) {
+    w[i] = (rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^
+              (w[i - 2] >> 10)) +
+            w[i - 7] +
+            (rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^
+              (w[i - 15] >> 3)) +
+            w[i - 16];
+  }
+  
+  /* Run the rounds */
+  memcpy(v, ps->h, sizeof(v));
+  for(i = 0; i < 64; i++) {
+    t1 = v[7] + (rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25)) +
+          ((v[4] & v[5]) ^ ((~v[4]) & v[6])) + k_round[i] + w[i];
+    t2 = (rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22)) +
+          ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+    v[7] = v[6];
+    v[6] = v[5];
+    v[5] = v[4];
+    v[4] = v[3] + t1;
+    v[3] = v[2];
+    v[2] = v[1];
+    v[1] = v[0];
+    v[0] = t1 + t2;
+  }
+  
+  /* Add into the hash value */
+  for(i = 0; i < 8; i++) {
+    ps->h[i] += v[i];
+  }
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * sha256_init function.
+ */
+void sha256_init(SHA256 *ps) {
+  /* Check parameter */
+  if (ps == NULL) {
+    abort();
+  }
+  
+  ps->h[0] = 0x6a09e667;
+  ps->h[1] = 0xbb67ae85;
+  ps->h[2] = 0x3c6ef372;
+  ps->h[3] = 0xa54ff53a;
+  ps->h[4] = 0x510e527f;
+  ps->h[5] = 0x9b05688c;
+  ps->h[6] = 0x1f83d9ab;
+  ps->h[7] = 0x5be0cd19;
+  ps->len = 0;
+  ps->fill = 0;
+}
+
+/*
+ * sha256_update function.
+ */
+void sha256_update(SHA256 *ps, const void *pData, size_t len) {
+  const uint8_t *pd = NULL;
+  size_t work = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || ((pData == NULL) && (len > 0))) {
+    abort();
+  }
+  
+  pd = (const uint8_t *) pData;
+  ps->len += (uint64_t) len;
+  
+  /* Complete a partial block first */
+  if (ps->fill > 0) {
+    work = (size_t) (64 - ps->fill);
+    if (len < work) {
+      work = len;
+    }
+    memcpy(ps->buf + ps->fill, pd, work);
+    ps->fill += (int32_t) work;
+    pd += work;
+    len -= work;
+    
+    if (ps->fill < 64) {
+      return;
+    }
+    processBlock(ps, ps->buf);
+    ps->fill = 0;
+  }
+  
+  /* Process whole blocks straight from the message */
+  for( ; len >= 64; len -= 64) {
+    processBlock(ps, pd);
+    pd += 64;
+  }
+  
+  /* Keep the rest for later */
+  memcpy(ps->buf, pd, len);
+  ps->fill = (int32_t) len;
+}
+
+/*
+ * sha256_final function.
+ */
+void sha256_final(SHA256 *ps, uint8_t *pDigest) {
+  uint64_t bits = 0;
+  int i = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pDigest == NULL)) {
+    abort();
+  }
+  
+  /* Pad with a one bit and zeros up to the length field */
+  bits = ps->len * 8;
+  ps->buf[ps->fill] = 0x80;
+  (ps->fill)++;
+  if (ps->fill > 56) {
+    memset(ps->buf + ps->fill, 0, (size_t) (64 - ps->fill));
+    processBlock(ps, ps->buf);
+    ps->fill = 0;
+  }
+  memset(ps->buf + ps->fill, 0, (size_t) (56 - ps->fill));
+  
+  /* Add the message length in bits, most significant byte first */
+  for(i = 0; i < 8; i++) {
+    ps->buf[56 + i] = (uint8_t) ((bits >> (56 - (i * 8))) & 0xff);
+  }
+  processBlock(ps, ps->buf);
+  
+  /* Write out the hash value, most significant byte first */
+  for(i = 0; i < 8; i++) {
+    pDigest[i * 4] = (uint8_t) (ps->h[i] >> 24);
+    pDigest[(i * 4) + 1] = (uint8_t) ((ps->h[i] >> 16) & 0xff);
+    pDigest[(i * 4) + 2] = (uint8_t) ((ps->h[i] >> 8) & 0xff);
+    pDigest[(i * 4) + 3] = (uint8_t) (ps->h[i] & 0xff);
+  }
+}
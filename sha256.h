@@ -0,0 +1,87 @@
+#ifndef SHA256_H_INCLUDED
+#define SHA256_H_INCLUDED
+
+/*
+ * sha256.h
+ * ========
+ * 
+ * SHA-256 message digest, as specified in FIPS 180-4.
+ * 
+ * The digest is computed incrementally.  Initialize a SHA256 structure
+ * with sha256_init(), feed it the message in any number of pieces with
+ * sha256_update(), and then get the digest with sha256_final().
+ * 
+ * Separate structures may be used concurrently from separate threads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The number of bytes in a digest.
+ */
+#define SHA256_DIGEST_SIZE (32)
+
+/*
+ * The state of a digest computation.
+ * 
+ * The fields are only meant to be used by the implementation.
+ */
+typedef struct {
+  
+  /*
+   * The intermediate hash value.
+   */
+  uint32_t h[8];
+  
+  /*
+   * The total number of message bytes so far.
+   */
+  uint64_t len;
+  
+  /*
+   * The message bytes that do not yet fill a whole block, and how many
+   * there are.
+   */
+  uint8_t buf[64];
+  int32_t fill;
+
+} SHA256;
+
+/*
+ * Start a new digest computation.
+ * 
+ * Parameters:
+ * 
+ *   ps - the structure to initialize
+ */
+void sha256_init(SHA256 *ps);
+
+/*
+ * Add message bytes to a digest computation.
+ * 
+ * Parameters:
+ * 
+ *   ps - the digest computation
+ * 
+ *   pData - the message bytes
+ * 
+ *   len - the number of bytes
+ */
+void sha256_update(SHA256 *ps, const void *pData, size_t len);
+
+/*
+ * Finish a digest computation and get the digest.
+ * 
+ * The structure must be initialized again before it is used for
+ * another digest.
+ * 
+ * Parameters:
+ * 
+ *   ps - the digest computation
+ * 
+ *   pDigest - the buffer to receive SHA256_DIGEST_SIZE bytes
+ */
+void sha256_final(SHA256 *ps, uint8_t *pDigest);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * pull_raw.c
+ * ==========
+ * 
+ * Test program that renders an input through the render library in
+ * opl_render.h and writes the samples as headerless 16-bit
+ * little-endian PCM, the same format that "retro_opl -raw" writes by
+ * default.  The regression suite compares the two, so that the library
+ * and retro_opl are proven to give the same samples for the same input.
+ * 
+ * Syntax:
+ * 
+ *   pull_raw [-core name] [-coalesce] [-loop 2] [out] [rate] [input]
+ * 
+ * The frames are pulled in blocks of odd sizes, so that pulls that end
+ * in the middle of the events of the input are covered too.
+ * 
+ * You must compile with opl_render.c and everything it needs, as given
+ * in the README, with the main directory on the include path.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opl_driver.h"
+#include "opl_render.h"
+
+/*
+ * The largest number of frames pulled at a time.
+ */
+#define PULL_MAX (4096)
+
+/*
+ * The number of sample frames in each pull, in turn.
+ */
+static const int32_t pull_sizes[] = {1, 17, 4096, 333, 1024, 2};
+
+/*
+ * The name of the executable module, for error reports.
+ */
+static const char *pModule = NULL;
+
+/*
+ * Program entrypoint.
+ * 
+ * Parameters:
+ * 
+ *   argc - the number of program arguments
+ * 
+ *   argv - the program arguments
+ * 
+ * Return:
+ * 
+ *   zero if successful, one if there was an error
+ */
+int main(int argc, char *argv[]) {
+  
+  OPL_RENDER *pr = NULL;
+  FILE *pOut = NULL;
+  int16_t buf[PULL_MAX * 2];
+  uint8_t bytes[PULL_MAX * 2 * 2];
+  int32_t sample_rate = 0;
+  int32_t got = 0;
+  int32_t want = 0;
+  int32_t count = 0;
+  int32_t i = 0;
+  int rep_count = 1;
+  int flags = 0;
+  int err = 0;
+  int n = 0;
+  int a = 1;
+  
+  pModule = "pull_raw";
+  if ((argc > 0) && (argv != NULL) && (argv[0] != NULL)) {
+    pModule = argv[0];
+  }
+  
+  /* Handle the options */
+  while (a < argc) {
+    if ((strcmp(argv[a], "-core") == 0) && (a + 1 < argc)) {
+      if (!opl_core_select(argv[a + 1])) {
+        fprintf(stderr, "%s: Unknown emulator core!\n", pModule);
+        return 1;
+      }
+      a += 2;
+    } else if (strcmp(argv[a], "-coalesce") == 0) {
+      flags |= OPL_RENDER_COALESCE;
+      a++;
+    } else if ((strcmp(argv[a], "-loop") == 0) && (a + 1 < argc)) {
+      rep_count = atoi(argv[a + 1]);
+      a += 2;
+    } else {
+      break;
+    }
+  }
+  if (argc - a != 3) {
+    fprintf(stderr, "Syntax: %s [-core name] [-coalesce] [-loop 2] "
+            "[out] [rate] [input]\n", pModule);
+    return 1;
+  }
+  sample_rate = (int32_t) atol(argv[a + 1]);
+  
+  /* Open the render and the output */
+  pr = opl_render_open(argv[a + 2], sample_rate, rep_count, flags,
+                        &err);
+  if (pr == NULL) {
+    fprintf(stderr, "%s: %s!\n", pModule, opl_render_errstr(err));
+    return 1;
+  }
+  pOut = fopen(argv[a], "wb");
+  if (pOut == NULL) {
+    fprintf(stderr, "%s: Failed to create file '%s'!\n",
+            pModule, argv[a]);
+    return 1;
+  }
+  
+  /* Pull until the end of the output */
+  do {
+    want = pull_sizes[n];
+    n = (n + 1) % ((int) (sizeof(pull_sizes) / sizeof(int32_t)));
+    
+    got = opl_render_pull(pr, buf, want, &err);
+    count = got * opl_render_channels(pr);
+    for(i = 0; i < count; i++) {
+      bytes[2 * i] = (uint8_t) (((uint16_t) buf[i]) & 0xff);
+      bytes[2 * i + 1] = (uint8_t) (((uint16_t) buf[i]) >> 8);
+    }
+    if (fwrite(bytes, 2, (size_t) count, pOut) != (size_t) count) {
+      fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+      return 1;
+    }
+  } while (got == want);
+  
+  if (err != OPL_RENDER_ERR_NONE) {
+    fprintf(stderr, "%s: %s!\n", pModule, opl_render_errstr(err));
+    if (opl_render_line(pr) > 0) {
+      fprintf(stderr, "%s: Error on line %ld!\n",
+              pModule, (long) opl_render_line(pr));
+    }
+    return 1;
+  }
+  
+  if (fclose(pOut)) {
+    fprintf(stderr, "%s: I/O error writing output!\n", pModule);
+    return 1;
+  }
+  opl_render_close(pr);
+  return 0;
+}
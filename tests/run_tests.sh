@@ -0,0 +1,578 @@
+#!/bin/sh
+#
+# run_tests.sh
+# ============
+#
+# Golden-output regression suite and throughput gates for retro_opl.
+#
+# Syntax:
+#
+#   tests/run_tests.sh [-update] [-bench]
+#
+# The suite has three parts:
+#
+# 1. Golden outputs.  Every line of golden.txt names an emulator core,
+#    a sample rate, a variant, and an input from the corpus, along with
+#    the SHA-256 digest of the raw samples that render must produce.
+#    Each render is repeated with the current build and its digest is
+#    compared with the stored one.  The variants are "plain", which
+#    renders the input as it is, "coalesce", which adds -coalesce,
+#    "loop", which adds -loop 2 for VGM inputs, and "vgm2opl", which
+#    converts a VGM input with vgm2opl and renders the conversion.
+#
+# 2. Determinism.  For every core the build has, each input rendered
+#    with -split 4 must have the same length as a plain render, with
+#    the first segment exactly the same, and must give the same samples
+#    when it is rendered with -split 4 again.  The later segments start
+#    from the registers with a pre-roll, so they are not compared with
+#    the plain render.  Renders are only split into segments of at
+#    least SPLIT_MIN seconds in retro_opl.c, so long.opl2 in the corpus
+#    is long enough for four segments, and the first SPLIT_MIN / 2
+#    seconds of each channel always lie in the first segment.  Each
+#    script must give the same samples when it is compiled to a binary
+#    event stream first.  Each input must also give the same samples
+#    when it is pulled through the render library with the pull_raw
+#    test program, and a range of it must give the same samples when it
+#    is rendered by a batch job.  A batch job that names a core must
+#    render with that core.  The native and native-scalar cores
+#    must also agree with each other on every input.  vgm2opl must
+#    keep the exact time of hours.vgz, whose waits add up to more than
+#    2^31 samples, about 13.6 hours at the VGM rate.  These checks need
+#    no stored digests, so they also cover cores without golden
+#    outputs, such as dosbox, whose output depends on the external
+#    opl.c.  Inputs a core can not render at all, such as dual-chip
+#    inputs on the DOSBox core, are reported and skipped.
+#
+# 3. Throughput.  Every line of baseline.txt names a core, a benchmark
+#    stage, an input, and its throughput per second from -bench mode.
+#    The benchmark is run again for each core, and any stage that falls
+#    more than BENCH_TOLERANCE percent below its baseline fails.  The
+#    baselines are absolute numbers from the machine that measured
+#    them, so this part only runs with the -bench option, on the
+#    machine that wrote the baselines.
+#
+# The script exits with a non-zero status if anything fails, and each
+# failure is printed with what was expected and what was found.
+#
+# The -update option renders the golden outputs again and rewrites
+# golden.txt with the results instead of checking them, and together
+# with -bench it also runs the benchmark and rewrites baseline.txt.
+# Only update the golden outputs after a deliberate change to the
+# output, and the baselines on the machine that runs the throughput
+# gates, since throughput depends on the machine.
+#
+# The following environment variables change the defaults:
+#
+#   RETRO_OPL - path to retro_opl, by default retro_opl in the parent
+#   directory of this script; relative paths start from the current
+#   directory
+#
+#   VGM2OPL - path to vgm2opl, in the same way as RETRO_OPL
+#
+#   PULL_RAW - path to the pull_raw test program built from pull_raw.c,
+#   by default pull_raw in the directory of this script, in the same way
+#   as RETRO_OPL
+#
+#   GOLDEN_CORES - cores that -update writes golden outputs for, by
+#   default "null native native-scalar native-preview"
+#
+#   BENCH_CORES - cores that -update writes baselines for, by default
+#   "null native native-scalar"
+#
+#   BENCH_TOLERANCE - allowed throughput loss in percent, by default 25
+#
+
+# Paths given in the environment are relative to where the script was
+# started
+START_DIR=$(pwd)
+case "${RETRO_OPL:-/}" in
+  /*)
+    ;;
+  *)
+    RETRO_OPL="$START_DIR/$RETRO_OPL"
+    ;;
+esac
+case "${VGM2OPL:-/}" in
+  /*)
+    ;;
+  *)
+    VGM2OPL="$START_DIR/$VGM2OPL"
+    ;;
+esac
+case "${PULL_RAW:-/}" in
+  /*)
+    ;;
+  *)
+    PULL_RAW="$START_DIR/$PULL_RAW"
+    ;;
+esac
+
+# Work from the directory of the script, where the inputs are named
+cd "$(dirname "$0")" || exit 1
+TEST_DIR=$(pwd)
+
+RETRO_OPL=${RETRO_OPL:-../retro_opl}
+VGM2OPL=${VGM2OPL:-../vgm2opl}
+PULL_RAW=${PULL_RAW:-./pull_raw}
+GOLDEN_CORES=${GOLDEN_CORES:-"null native native-scalar native-preview"}
+BENCH_CORES=${BENCH_CORES:-"null native native-scalar"}
+BENCH_TOLERANCE=${BENCH_TOLERANCE:-25}
+
+GOLDEN_RATES="44100 48000 22050"
+SCRIPTS="../first.opl2 corpus/chords.opl2 corpus/drums.opl2
+corpus/dual.opl2 corpus/long.opl2"
+VGMS="corpus/tune.vgm corpus/dual.vgm"
+BENCH_INPUTS="../first.opl2 corpus/chords.opl2 corpus/tune.vgm"
+BENCH_STAGES="parse generate"
+
+# Parse the options
+UPDATE=0
+BENCH=0
+for opt in "$@"; do
+  case "$opt" in
+    -update)
+      UPDATE=1
+      ;;
+    -bench)
+      BENCH=1
+      ;;
+    *)
+      echo "Usage: $0 [-update] [-bench]" >&2
+      exit 1
+      ;;
+  esac
+done
+
+# Find a SHA-256 tool
+if command -v sha256sum > /dev/null 2>&1; then
+  SHA="sha256sum"
+elif command -v shasum > /dev/null 2>&1; then
+  SHA="shasum -a 256"
+else
+  echo "$0: No sha256sum or shasum found!" >&2
+  exit 1
+fi
+
+if [ ! -x "$RETRO_OPL" ]; then
+  echo "$0: retro_opl not found at '$RETRO_OPL'!" >&2
+  exit 1
+fi
+if [ ! -x "$VGM2OPL" ]; then
+  echo "$0: vgm2opl not found at '$VGM2OPL'!" >&2
+  exit 1
+fi
+if [ $UPDATE -eq 0 ] && [ ! -x "$PULL_RAW" ]; then
+  echo "$0: pull_raw not found at '$PULL_RAW'!" >&2
+  exit 1
+fi
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/retro_opl_tests.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+trap 'exit 1' HUP INT TERM
+
+CHECKS=0
+FAILURES=0
+
+# The cores the build has, from the program syntax
+CORES=$("$RETRO_OPL" 2>&1 | sed -n 's/.*emulator core, one of: //p')
+
+#
+# fail [message...]
+# -----------------
+#
+# Report a failed check.
+#
+fail() {
+  echo "FAIL $*"
+  FAILURES=$((FAILURES + 1))
+}
+
+#
+# isVgm [input]
+# -------------
+#
+# Succeed if the input is one of the VGM inputs.
+#
+isVgm() {
+  case "$1" in
+    *.vgm|*.vgz)
+      return 0
+      ;;
+  esac
+  return 1
+}
+
+#
+# render [core] [rate] [variant] [input] [extra options...]
+# ---------------------------------------------------------
+#
+# Render an input and print the digest of its raw samples, or print
+# nothing if the render failed.
+#
+render() {
+  core=$1
+  rate=$2
+  variant=$3
+  input=$4
+  shift 4
+
+  case "$variant" in
+    plain)
+      set -- "$@"
+      ;;
+    coalesce)
+      set -- -coalesce "$@"
+      ;;
+    loop)
+      set -- -loop 2 "$@"
+      ;;
+    vgm2opl)
+      "$VGM2OPL" "$input" 1 > "$WORK/conv.opl2" 2> /dev/null || return
+      input="$WORK/conv.opl2"
+      ;;
+    *)
+      return
+      ;;
+  esac
+
+  "$RETRO_OPL" -core "$core" "$@" -raw "$WORK/out.raw" "$rate" \
+    "$input" > /dev/null 2>&1 || return
+  $SHA < "$WORK/out.raw" | cut -d ' ' -f 1
+}
+
+#
+# pull [core] [rate] [input] [extra options...]
+# ---------------------------------------------
+#
+# Pull an input through the render library and print the digest of its
+# samples, or print nothing if the render failed.
+#
+pull() {
+  core=$1
+  rate=$2
+  input=$3
+  shift 3
+
+  "$PULL_RAW" -core "$core" "$@" "$WORK/pull.raw" "$rate" "$input" \
+    > /dev/null 2>&1 || return
+  $SHA < "$WORK/pull.raw" | cut -d ' ' -f 1
+}
+
+#
+# Golden outputs
+# ==============
+#
+
+if [ $UPDATE -ne 0 ]; then
+  {
+    echo "# Golden outputs: core rate variant input sha256"
+    echo "# Written by run_tests.sh -update"
+    for core in $GOLDEN_CORES; do
+      for rate in $GOLDEN_RATES; do
+        for input in $SCRIPTS $VGMS; do
+          variants="plain coalesce"
+          if isVgm "$input"; then
+            variants="$variants loop vgm2opl"
+          fi
+          for variant in $variants; do
+            digest=$(render "$core" "$rate" "$variant" "$input")
+            if [ -z "$digest" ]; then
+              echo "$0: Failed to render $core $rate $variant" \
+                "$input!" >&2
+              exit 1
+            fi
+            echo "$core $rate $variant $input $digest"
+          done
+        done
+      done
+    done
+  } > "$WORK/golden.txt" || exit 1
+  mv "$WORK/golden.txt" "$TEST_DIR/golden.txt"
+  echo "Wrote golden.txt"
+
+else
+  while read -r core rate variant input digest; do
+    case "$core" in
+      ''|'#'*)
+        continue
+        ;;
+    esac
+    CHECKS=$((CHECKS + 1))
+    found=$(render "$core" "$rate" "$variant" "$input")
+    if [ -z "$found" ]; then
+      fail "golden $core $rate $variant $input: render failed"
+    elif [ "$found" != "$digest" ]; then
+      fail "golden $core $rate $variant $input: expected $digest," \
+        "got $found"
+    fi
+  done < golden.txt
+fi
+
+#
+# Determinism
+# ===========
+#
+
+if [ $UPDATE -eq 0 ]; then
+  for core in $CORES; do
+    : > "$WORK/jobs.txt"
+    for input in $SCRIPTS $VGMS; do
+      plain=$(render "$core" 44100 plain "$input")
+      if [ -z "$plain" ]; then
+        echo "SKIP $core $input: core can not render input"
+        continue
+      fi
+      for rate in 44100 22050; do
+        echo "$rate $input $WORK/batch.$rate.${input##*/}.raw" \
+          >> "$WORK/jobs.txt"
+      done
+
+      # Split renders must keep the length and the first segment, and
+      # must be the same on every run
+      cp "$WORK/out.raw" "$WORK/plain.raw"
+      CHECKS=$((CHECKS + 2))
+      split=$(render "$core" 44100 plain "$input" -split 4)
+      if [ -z "$split" ] ||
+          [ $(wc -c < "$WORK/out.raw") -ne \
+            $(wc -c < "$WORK/plain.raw") ] ||
+          [ "$(head -c 882000 "$WORK/out.raw" | $SHA)" != \
+            "$(head -c 882000 "$WORK/plain.raw" | $SHA)" ]; then
+        fail "split $core $input: differs from plain render"
+      fi
+      found=$(render "$core" 44100 plain "$input" -split 4)
+      if [ "$found" != "$split" ]; then
+        fail "split $core $input: expected $split, got $found"
+      fi
+
+      # Compiled scripts must render the same as the scripts
+      if ! isVgm "$input"; then
+        CHECKS=$((CHECKS + 1))
+        found=""
+        if "$RETRO_OPL" -compile "$WORK/in.oplb" "$input" \
+            > /dev/null 2>&1; then
+          found=$(render "$core" 44100 plain "$WORK/in.oplb")
+        fi
+        if [ "$found" != "$plain" ]; then
+          fail "compile $core $input: expected $plain, got $found"
+        fi
+      fi
+
+      # The render library must pull the same samples, also when it
+      # resamples and coalesces
+      CHECKS=$((CHECKS + 1))
+      found=$(pull "$core" 44100 "$input")
+      if [ "$found" != "$plain" ]; then
+        fail "library $core $input: expected $plain, got $found"
+      fi
+      CHECKS=$((CHECKS + 1))
+      expect=$(render "$core" 48000 coalesce "$input")
+      found=$(pull "$core" 48000 "$input" -coalesce)
+      if [ -z "$expect" ] || [ "$found" != "$expect" ]; then
+        fail "library $core 48000 coalesce $input: expected $expect," \
+          "got $found"
+      fi
+
+      # The SIMD kernels must match the scalar kernel
+      if [ "$core" = "native" ]; then
+        CHECKS=$((CHECKS + 1))
+        found=$(render native-scalar 44100 plain "$input")
+        if [ "$found" != "$plain" ]; then
+          fail "kernels $input: native $plain, native-scalar $found"
+        fi
+      fi
+    done
+
+    # Batch jobs render through render sessions, which must give the
+    # same samples for a range of time, also when a job switches the
+    # session to another rate
+    "$RETRO_OPL" -core "$core" -from 0.25 -to 1.5 -raw \
+      -batch "$WORK/jobs.txt" > /dev/null 2>&1
+    while read -r rate input out; do
+      CHECKS=$((CHECKS + 1))
+      expect=$(render "$core" "$rate" plain "$input" -from 0.25 -to 1.5)
+      found=""
+      if [ -f "$out" ]; then
+        found=$($SHA < "$out" | cut -d ' ' -f 1)
+      fi
+      if [ -z "$expect" ] || [ "$found" != "$expect" ]; then
+        fail "batch $core $rate $input: expected $expect, got $found"
+      fi
+    done < "$WORK/jobs.txt"
+    rm -f "$WORK"/batch.*
+  done
+
+  # A batch job that names a core must render with that core, whatever
+  # core the run selects
+  : > "$WORK/jobs.txt"
+  for core in $CORES; do
+    echo "44100 corpus/drums.opl2 $WORK/batch.$core.raw $core" \
+      >> "$WORK/jobs.txt"
+  done
+  "$RETRO_OPL" -core null -raw -batch "$WORK/jobs.txt" \
+    > /dev/null 2>&1
+  for core in $CORES; do
+    CHECKS=$((CHECKS + 1))
+    expect=$(render "$core" 44100 plain corpus/drums.opl2)
+    found=""
+    if [ -f "$WORK/batch.$core.raw" ]; then
+      found=$($SHA < "$WORK/batch.$core.raw" | cut -d ' ' -f 1)
+    fi
+    if [ -z "$expect" ] || [ "$found" != "$expect" ]; then
+      fail "batch job core $core: expected $expect, got $found"
+    fi
+  done
+  rm -f "$WORK"/batch.*
+
+  # Silence skipping must engage once a released note has died away,
+  # even though an operator at full attenuation still outputs -1 on
+  # half of its waveform: the plain render keeps that tail up to the
+  # end, while the skipped one is exactly zero for the last two seconds
+  # and the same as the plain one up to the key-off
+  for core in native native-scalar; do
+    case " $CORES " in
+      *" $core "*)
+        ;;
+      *)
+        continue
+        ;;
+    esac
+    for k in plain skip; do
+      set --
+      if [ "$k" = "skip" ]; then
+        set -- -skip
+      fi
+      "$RETRO_OPL" -core "$core" "$@" -raw "$WORK/$k.raw" 44100 \
+        corpus/tail.opl2 > /dev/null 2>&1
+    done
+    CHECKS=$((CHECKS + 1))
+    expect=$(head -c 44100 "$WORK/plain.raw" | $SHA | cut -d ' ' -f 1)
+    found=$(head -c 44100 "$WORK/skip.raw" | $SHA | cut -d ' ' -f 1)
+    if [ "$found" != "$expect" ]; then
+      fail "skip $core corpus/tail.opl2: note differs from plain render"
+    fi
+    CHECKS=$((CHECKS + 1))
+    plain=$(tail -c 176400 "$WORK/plain.raw" | od -v -A n -t d2 | \
+      tr -s ' ' '\n' | grep -c '^-')
+    found=$(tail -c 176400 "$WORK/skip.raw" | od -v -A n -t d2 | \
+      tr -s ' ' '\n' | grep -c -v -e '^0$' -e '^$')
+    if [ "$plain" -eq 0 ] || [ "$found" -ne 0 ]; then
+      fail "skip $core corpus/tail.opl2: $found samples of the tail" \
+        "synthesized, $plain negative in the plain render"
+    fi
+  done
+
+  # Sample offsets past 2^31 must not overflow in vgm2opl; at the VGM
+  # rate the waits add up to exactly the samples of the input
+  for rate in 44100 980; do
+    CHECKS=$((CHECKS + 1))
+    expect=$(awk -v r="$rate" \
+      'BEGIN { printf("%.0f\n", int(2162655735 * r / 44100)) }')
+    found=$("$VGM2OPL" -rate "$rate" corpus/hours.vgz 1 2> /dev/null | \
+      awk '$1 == "w" { s += $2 } END { printf("%.0f\n", s) }')
+    if [ "$found" != "$expect" ]; then
+      fail "vgm2opl -rate $rate corpus/hours.vgz: expected $expect" \
+        "cycles, got $found"
+    fi
+  done
+
+  # WAVE headers: 16-bit integers use the plain format chunk, float
+  # samples an 18-byte one and a fact chunk, and wider integers an
+  # extensible one; the sizes are the same whether they are known up
+  # front for a pipe or patched at the end of a file
+  while read -r format input expect; do
+    for out in "$WORK/out.wav" -; do
+      CHECKS=$((CHECKS + 1))
+      found=$("$RETRO_OPL" -core null -format "$format" "$out" 44100 \
+        "$input" 2> /dev/null | od -A n -t x1 | tr -d ' \n')
+      if [ "$out" != "-" ]; then
+        found=$(od -A n -t x1 "$out" | tr -d ' \n')
+      fi
+      found=$(echo "$found" | cut -c "1-${#expect}")
+      if [ "$found" != "$expect" ]; then
+        fail "header $format $input $out: expected $expect, got $found"
+      fi
+    done
+  done << EOF
+s16 ../first.opl2 5249464634b1020057415645666d7420100000000100010044ac000088580100020010006461746110b10200
+f32 ../first.opl2 524946465262050057415645666d7420120000000300010044ac000010b102000400200000006661637404000000885801006461746120620500
+s24 ../first.opl2 52494646d409040057415645666d742028000000feff010044ac0000cc0402000300180016001800040000000100000000001000800000aa00389b716461746198090400
+s24 corpus/dual.opl2 524946467c61130057415645666d742028000000feff020044ac0000980904000600180016001800030000000100000000001000800000aa00389b716461746140611300
+EOF
+fi
+
+#
+# Throughput
+# ==========
+#
+
+#
+# bench [core]
+# ------------
+#
+# Run the benchmark on a core and print "stage input per_second" for
+# each result.
+#
+bench() {
+  # shellcheck disable=SC2086
+  "$RETRO_OPL" -core "$1" -bench 44100 $BENCH_INPUTS 2> /dev/null | \
+    sed -n -e 's/.*"input":"\([^"]*\)".*"stage":"\([^"]*\)"/\2 \1 /' \
+      -e 's/ [^ ]*"per_second":\([0-9.]*\).*/ \1/p'
+}
+
+if [ $BENCH -ne 0 ] && [ $UPDATE -ne 0 ]; then
+  {
+    echo "# Throughput baselines: core stage input per_second"
+    echo "# Written by run_tests.sh -update"
+    for core in $BENCH_CORES; do
+      bench "$core" | while read -r stage input rate; do
+        for s in $BENCH_STAGES; do
+          if [ "$s" = "$stage" ]; then
+            echo "$core $stage $input ${rate%.*}"
+          fi
+        done
+      done
+    done
+  } > "$WORK/baseline.txt" || exit 1
+  mv "$WORK/baseline.txt" "$TEST_DIR/baseline.txt"
+  echo "Wrote baseline.txt"
+
+elif [ $BENCH -ne 0 ]; then
+  # Benchmark each core named in the baselines once
+  for core in $(sed -e '/^#/d' -e 's/ .*//' baseline.txt | sort -u); do
+    bench "$core" > "$WORK/bench.$core"
+  done
+
+  while read -r core stage input base; do
+    case "$core" in
+      ''|'#'*)
+        continue
+        ;;
+    esac
+    CHECKS=$((CHECKS + 1))
+    found=$(awk -v s="$stage" -v i="$input" \
+      '$1 == s && $2 == i { print $3; exit }' "$WORK/bench.$core")
+    if [ -z "$found" ]; then
+      fail "bench $core $stage $input: no result"
+      continue
+    fi
+
+    # Fail below the tolerance, and show the change either way
+    if awk -v f="$found" -v b="$base" -v t="$BENCH_TOLERANCE" \
+        'BEGIN { exit !(f < b * (100 - t) / 100) }'; then
+      fail "bench $core $stage $input: $found per second, baseline" \
+        "$base"
+    else
+      awk -v c="$core" -v s="$stage" -v i="$input" -v f="$found" \
+        -v b="$base" 'BEGIN { printf("ok   bench %s %s %s: %+.1f%%\n",
+        c, s, i, (f - b) * 100 / b) }'
+    fi
+  done < baseline.txt
+fi
+
+if [ $UPDATE -eq 0 ]; then
+  echo "$CHECKS checks, $FAILURES failed"
+fi
+if [ $FAILURES -ne 0 ]; then
+  exit 1
+fi
+exit 0
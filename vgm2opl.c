@@ -5,38 +5,168 @@
  * Convert a VGM file storing OPL2 instructions into an OPL2 hardware
  * script that Retro-OPL can use.
  * 
- * The timing in the conversion is not perfect, but it should be good
- * enough.  VGM uses a control rate of 44,100 Hz.  This utility will use
- * a control rate of 980 Hz, which is exactly 1/45 times the VGM control
- * rate.
+ * VGM uses a control rate of 44,100 Hz.  By default, this utility will
+ * use a control rate of 980 Hz, which is exactly 1/45 times the VGM
+ * control rate, so each wait may be shifted by up to about a
+ * millisecond.  The "-rate" option chooses another control rate, and
+ * with "-rate 44100" the timing of the script is exactly the timing of
+ * the VGM file.
  * 
  * Program takes a two arguments.  First is the path to the VGM file.
  * Second is 1 to perform once, 2 to loop back once.  The OPL2 hardware
  * script is written to standard output.
  * 
- * If you have a compressed VGZ file, use gunzip to unzip it first, and
- * then run it through this program.
+ * Compressed VGZ files are also accepted, and they are decompressed
+ * while they are read.
+ * 
+ * Dual-chip VGM files are converted into scripts that declare two chips
+ * in the header line and select the chip with "c" commands.
+ * 
+ * If "-coalesce" is given before the path, register writes that end up
+ * at the same control cycle are coalesced, so that repeated writes and
+ * writes that change nothing are left out of the script.  See
+ * opl_coalesce.h for the details.
+ * 
+ * If "-binary" is given before the path, the output is a binary event
+ * stream in the format that "retro_opl -compile" writes, instead of a
+ * text script.
+ * 
+ * Alternatively, the program can be invoked with "-batch" and the path
+ * to a batch manifest, or with "-dir", an input directory, an output
+ * directory, and a repeat code.  Each job line in a manifest has a
+ * repeat code, the path to an input VGM or VGZ file, and the path to
+ * the output file, separated by spaces or tabs.  Blank lines and lines
+ * beginning with an apostrophe are ignored.  In directory mode, every
+ * file in the input directory ending in ".vgm" or ".vgz" is converted
+ * into a file with the same name in the output directory, ending in
+ * ".opl2" or, with "-binary", in ".oplb".  The jobs are converted on a
+ * pool of worker threads.  A file that fails to convert does not stop
+ * the others; the failures are reported when all jobs are done.
+ * 
+ * Output is collected in a large buffer and written in big blocks.
+ * 
+ * You must compile with vgm_reader.c, which does the actual decoding of
+ * the VGM file, and with opl_coalesce.c, and link with zlib and the
+ * POSIX threads library.
  */
 
-#include <math.h>
+#include <ctype.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "opl_bin.h"
+#include "opl_coalesce.h"
+#include "vgm_reader.h"
+
 /*
  * Constants
  * =========
  */
 
 /*
- * The maximum size in bytes for the data included in a VGM file.
+ * The default control rate of the converted scripts, and the largest
+ * control rate that retro_opl accepts.
+ */
+#define CTL_RATE (980)
+#define CTL_RATE_MAX (192000)
+
+/*
+ * The size in bytes of the output buffer of each conversion.
+ */
+#define OUT_BUFFER (1048576)
+
+/*
+ * The maximum number of worker threads used in batch mode.
+ */
+#define MAX_WORKERS (64)
+
+/*
+ * The size in bytes of the buffer that each manifest line is read
+ * into, including the line break and the terminating nul.
+ */
+#define LINE_SIZE (4096)
+
+/*
+ * The size in bytes of the buffer for the error message of a job.
+ */
+#define MSG_SIZE (256)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * The state of a conversion.
  * 
- * This is set to 16MB, which should definitely cover any historic VGM
- * file for the OPL2.
+ * Each worker has one of these and reuses it for all its jobs.
+ */
+typedef struct {
+  
+  /*
+   * The output file.
+   */
+  FILE *pOut;
+  
+  /*
+   * The output buffer, and the number of bytes in it.
+   */
+  uint8_t *pBuf;
+  size_t buf_len;
+  
+  /*
+   * Flag set if writing to the output file failed.
+   */
+  int io_err;
+  
+  /*
+   * The register write coalescer of each chip, or NULL if coalescing is
+   * off.
+   */
+  OPL_COALESCE *pcs[2];
+  
+  /*
+   * The VGM reader, which is reopened on each file so that its buffer
+   * is reused, or NULL before the first file.
+   */
+  VGM_READER *pv;
+
+} CONVERT;
+
+/*
+ * A job in batch or directory mode.
  */
-#define MAX_DATA_SECTION UINT32_C(16*1024*1024)
+typedef struct {
+  
+  /*
+   * 1 to convert once through, 2 to loop back once.
+   */
+  int rep_count;
+  
+  /*
+   * The path to the input VGM or VGZ file.
+   */
+  char *pInPath;
+  
+  /*
+   * The path to the output file.
+   */
+  char *pOutPath;
+  
+  /*
+   * Flag set if the job failed, and the error message if it did.
+   */
+  int failed;
+  char msg[MSG_SIZE];
+
+} JOB;
 
 /*
  * Local data
@@ -51,19 +181,27 @@
 static const char *pModule = NULL;
 
 /*
- * The input file handle, or NULL.
+ * Flag set if register writes are coalesced, and flag set if the
+ * output is a binary event stream.
  */
-static FILE *pInput = NULL;
+static int coalesce_writes = 0;
+static int out_binary = 0;
 
 /*
- * The whole VGM data section read into memory, or NULL.
+ * The control rate of the output.
  */
-static uint8_t *pData = NULL;
+static int32_t ctl_rate = CTL_RATE;
 
 /*
- * The full length of the VGM data section.
+ * The job list of batch and directory mode, its allocated capacity,
+ * and the index of the next job that a worker should take, which is
+ * protected by the job lock.
  */
-static uint32_t full_length = 0;
+static JOB *pJobs = NULL;
+static int32_t job_count = 0;
+static int32_t job_cap = 0;
+static int32_t job_next = 0;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * Local functions
@@ -73,9 +211,37 @@ static uint32_t full_length = 0;
 /* Prototypes */
 static void raiseErr(void);
 
-static uint8_t readByte(void);
-static uint32_t readDword(void);
-static uint32_t readHead(int32_t offs);
+static CONVERT *newConvert(void);
+static void freeConvert(CONVERT *pc);
+
+static void outFlush(CONVERT *pc);
+static void outBytes(CONVERT *pc, const uint8_t *pData, size_t len);
+static void outHeader(CONVERT *pc, int chips);
+static void outChip(CONVERT *pc, int chip);
+static void outWait(CONVERT *pc, int32_t cycles);
+static void writeOut(void *pArg, int32_t reg, int32_t val);
+static int convertFile(
+          CONVERT * pc,
+    const char    * pInPath,
+          int       rep_count,
+          char    * pMsg);
+
+static int parseRep(const char *pstr);
+static int32_t parseRate(const char *pstr);
+static char *copyStr(const char *pstr, size_t len);
+static char *joinPath(
+    const char   * pDir,
+    const char   * pName,
+          size_t   name_len,
+    const char   * pExt);
+static JOB *addJob(void);
+static void readManifest(const char *pPath);
+static int hasVGMExt(const char *pName);
+static int compareJobs(const void *pA, const void *pB);
+static void scanDir(const char *pInDir, const char *pOutDir, int rep);
+static JOB *nextJob(void);
+static void *workerMain(void *pArg);
+static int runBatch(void);
 
 /*
  * Function called when the program is stopping on an error.
@@ -97,81 +263,945 @@ static void raiseErr(void) {
 }
 
 /*
- * Read a byte from the input file.
+ * Create a conversion state, with coalescers if coalescing is on.
+ * 
+ * Return:
+ * 
+ *   the new state, or NULL if memory allocation failed
+ */
+static CONVERT *newConvert(void) {
+  CONVERT *pc = NULL;
+  int i = 0;
+  
+  pc = (CONVERT *) calloc(1, sizeof(CONVERT));
+  if (pc == NULL) {
+    return NULL;
+  }
+  
+  pc->pBuf = (uint8_t *) malloc(OUT_BUFFER);
+  if (pc->pBuf == NULL) {
+    freeConvert(pc);
+    return NULL;
+  }
+  
+  if (coalesce_writes) {
+    for(i = 0; i < 2; i++) {
+      pc->pcs[i] = opl_coalesce_new(&writeOut, pc);
+      if (pc->pcs[i] == NULL) {
+        freeConvert(pc);
+        return NULL;
+      }
+    }
+  }
+  
+  return pc;
+}
+
+/*
+ * Free a conversion state.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pc - the state to free, or NULL
+ */
+static void freeConvert(CONVERT *pc) {
+  if (pc != NULL) {
+    opl_coalesce_free(pc->pcs[0]);
+    opl_coalesce_free(pc->pcs[1]);
+    vgm_close(pc->pv);
+    free(pc->pBuf);
+    free(pc);
+  }
+}
+
+/*
+ * Write the output buffer to the output file and empty it.
+ * 
+ * Parameters:
+ * 
+ *   pc - the conversion state
+ */
+static void outFlush(CONVERT *pc) {
+  if (pc->buf_len > 0) {
+    if (fwrite(pc->pBuf, 1, pc->buf_len, pc->pOut) != pc->buf_len) {
+      pc->io_err = 1;
+    }
+    pc->buf_len = 0;
+  }
+}
+
+/*
+ * Append bytes to the output buffer, writing the buffer out first if
+ * they do not fit.
+ * 
+ * Parameters:
+ * 
+ *   pc - the conversion state
+ * 
+ *   pData - the bytes to append
+ * 
+ *   len - the number of bytes, at most 64
+ */
+static void outBytes(CONVERT *pc, const uint8_t *pData, size_t len) {
+  if (pc->buf_len > OUT_BUFFER - len) {
+    outFlush(pc);
+  }
+  memcpy(&((pc->pBuf)[pc->buf_len]), pData, len);
+  pc->buf_len += len;
+}
+
+/*
+ * Write the header of the output, with a chip count if more than one.
+ * 
+ * Parameters:
+ * 
+ *   pc - the conversion state
+ * 
+ *   chips - the number of chips
+ */
+static void outHeader(CONVERT *pc, int chips) {
+  
+  uint8_t b[16];
+  char line[32];
+  uint32_t fields[3];
+  int field_count = 0;
+  int i = 0;
+  int k = 0;
+  
+  if (out_binary) {
+    /* Signature and little-endian fields */
+    memcpy(b, BIN_SIGNATURE, BIN_SIGNATURE_SIZE);
+    fields[0] = (uint32_t) BIN_VERSION;
+    fields[1] = (uint32_t) ctl_rate;
+    fields[2] = (uint32_t) chips;
+    field_count = 2;
+    if (chips > 1) {
+      fields[0] = (uint32_t) BIN_VERSION_CHIPS;
+      field_count = 3;
+    }
+    for(i = 0; i < field_count; i++) {
+      for(k = 0; k < 4; k++) {
+        b[BIN_SIGNATURE_SIZE + (i * 4) + k] =
+          (uint8_t) ((fields[i] >> (k * 8)) & 0xff);
+      }
+    }
+    outBytes(pc, b, (size_t) (BIN_SIGNATURE_SIZE + (field_count * 4)));
+  
+  } else {
+    if (chips > 1) {
+      sprintf(line, "OPL2 %ld %d\n", (long) ctl_rate, chips);
+    } else {
+      sprintf(line, "OPL2 %ld\n", (long) ctl_rate);
+    }
+    outBytes(pc, (const uint8_t *) line, strlen(line));
+  }
+}
+
+/*
+ * Write a chip select.
+ * 
+ * Parameters:
+ * 
+ *   pc - the conversion state
+ * 
+ *   chip - the chip to select
+ */
+static void outChip(CONVERT *pc, int chip) {
+  uint8_t b[4];
+  
+  if (out_binary) {
+    b[0] = BIN_EVENT_CHIP;
+    b[1] = (uint8_t) chip;
+    outBytes(pc, b, 2);
+  } else {
+    b[0] = 'c';
+    b[1] = ' ';
+    b[2] = (uint8_t) ('0' + chip);
+    b[3] = '\n';
+    outBytes(pc, b, 4);
+  }
+}
+
+/*
+ * Write a wait.
+ * 
+ * Parameters:
+ * 
+ *   pc - the conversion state
+ * 
+ *   cycles - the number of control cycles to wait, at least one
+ */
+static void outWait(CONVERT *pc, int32_t cycles) {
+  
+  uint8_t b[16];
+  uint8_t digits[12];
+  uint32_t uv = 0;
+  size_t len = 0;
+  int n = 0;
+  
+  uv = (uint32_t) cycles;
+  if (out_binary) {
+    /* Base-128 count, with the least significant group first and the
+     * high bit set on all groups except the last */
+    b[len++] = BIN_EVENT_WAIT;
+    while (uv >= 0x80) {
+      b[len++] = (uint8_t) ((uv & 0x7f) | 0x80);
+      uv >>= 7;
+    }
+    b[len++] = (uint8_t) uv;
+  
+  } else {
+    /* Decimal count, with the digits produced in reverse */
+    do {
+      digits[n++] = (uint8_t) ('0' + (uv % 10));
+      uv /= 10;
+    } while (uv > 0);
+    
+    b[len++] = 'w';
+    b[len++] = ' ';
+    while (n > 0) {
+      b[len++] = digits[--n];
+    }
+    b[len++] = '\n';
+  }
+  
+  outBytes(pc, b, len);
+}
+
+/*
+ * Write a register write.
+ * 
+ * This is also the callback for register write coalescers.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the conversion state
+ * 
+ *   reg - the OPL2 register
+ * 
+ *   val - the value to write
+ */
+static void writeOut(void *pArg, int32_t reg, int32_t val) {
+  
+  static const char hex[] = "0123456789abcdef";
+  CONVERT *pc = NULL;
+  uint8_t b[8];
+  
+  pc = (CONVERT *) pArg;
+  
+  if (out_binary) {
+    b[0] = BIN_EVENT_WRITE;
+    b[1] = (uint8_t) reg;
+    b[2] = (uint8_t) val;
+    outBytes(pc, b, 3);
+  
+  } else {
+    /* Same as printing "r %02x %02x\n" */
+    b[0] = 'r';
+    b[1] = ' ';
+    b[2] = (uint8_t) hex[(reg >> 4) & 0xf];
+    b[3] = (uint8_t) hex[reg & 0xf];
+    b[4] = ' ';
+    b[5] = (uint8_t) hex[(val >> 4) & 0xf];
+    b[6] = (uint8_t) hex[val & 0xf];
+    b[7] = '\n';
+    outBytes(pc, b, 8);
+  }
+}
+
+/*
+ * Convert a VGM file to the output file of a conversion state.
+ * 
+ * The output file must already be set in the conversion state.  The
+ * output buffer is written out before returning, but the output file
+ * is not closed.
+ * 
+ * Parameters:
+ * 
+ *   pc - the conversion state
+ * 
+ *   pInPath - the path to the VGM or VGZ file
+ * 
+ *   rep_count - 1 for no loop, 2 for loop once
+ * 
+ *   pMsg - buffer of MSG_SIZE bytes to receive an error message,
+ *   without punctuation at the end
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+static int convertFile(
+          CONVERT * pc,
+    const char    * pInPath,
+          int       rep_count,
+          char    * pMsg) {
+  
+  VGM_READER *pv = NULL;
+  VGM_EVENT ev;
+  int err = 0;
+  int ok = 1;
+  int i = 0;
+  
+  int64_t samp_offs = 0;
+  int64_t ctl_offs = 0;
+  int64_t new_ctl = 0;
+  int64_t d = 0;
+  int chip = 0;
+  
+  /* Start with an empty buffer and empty coalescers */
+  pc->buf_len = 0;
+  pc->io_err = 0;
+  for(i = 0; i < 2; i++) {
+    if (pc->pcs[i] != NULL) {
+      opl_coalesce_reset(pc->pcs[i]);
+    }
+  }
+  
+  /* Open the VGM file, reusing the reader of the previous file */
+  if (pc->pv == NULL) {
+    pc->pv = vgm_open(pInPath, rep_count, &err);
+    ok = (pc->pv != NULL);
+  } else {
+    ok = vgm_reopen(pc->pv, pInPath, rep_count, &err);
+  }
+  pv = pc->pv;
+  if (!ok) {
+    if (err == VGM_ERR_OPEN) {
+      snprintf(pMsg, MSG_SIZE, "Failed to open file '%s'", pInPath);
+    } else {
+      snprintf(pMsg, MSG_SIZE, "%s", vgm_errstr(err));
+    }
+    return 0;
+  }
+  
+  /* Write the OPL2 header */
+  outHeader(pc, vgm_chips(pv));
+  
+  /* Convert each event */
+  while (ok) {
+    /* Decode the next event */
+    if (!vgm_next(pv, &ev, &err)) {
+      if (err == VGM_ERR_OPCODE) {
+        snprintf(pMsg, MSG_SIZE, "Unsupported VGM opcode 0x%02x",
+                  (unsigned int) ev.opcode);
+      } else {
+        snprintf(pMsg, MSG_SIZE, "%s", vgm_errstr(err));
+      }
+      ok = 0;
+      break;
+    }
+    
+    /* Handle the different events */
+    if (ev.type == VGM_EVENT_END) {
+      /* End of sound data -- write any pending writes and leave
+       * loop */
+      if (pc->pcs[chip] != NULL) {
+        opl_coalesce_flush(pc->pcs[chip]);
+      }
+      break;
+    
+    } else if (ev.type == VGM_EVENT_WRITE) {
+      /* Produce a c command if the chip changes, after any pending
+       * writes for the chip selected before */
+      if (ev.chip != chip) {
+        if (pc->pcs[chip] != NULL) {
+          opl_coalesce_flush(pc->pcs[chip]);
+        }
+        outChip(pc, ev.chip);
+        chip = ev.chip;
+      }
+      
+      /* Produce the OPL2 hardware r command, or hold it back until the
+       * time moves forward if coalescing */
+      if (pc->pcs[chip] != NULL) {
+        opl_coalesce_write(pc->pcs[chip], ev.reg, ev.val);
+      } else {
+        writeOut(pc, ev.reg, ev.val);
+      }
+    
+    } else if (ev.type == VGM_EVENT_WAIT) {
+      /* Update sample offset, watching for overflow of the control
+       * offset computed from it */
+      if (samp_offs <= (INT64_MAX / CTL_RATE_MAX) - ev.samples) {
+        samp_offs += ev.samples;
+      } else {
+        snprintf(pMsg, MSG_SIZE, "Sample count overflow");
+        ok = 0;
+        break;
+      }
+      
+      /* Compute the position at the control rate relative to the VGM
+       * control rate, rounded down, exactly in integers */
+      new_ctl = (samp_offs * ((int64_t) ctl_rate)) /
+                  ((int64_t) VGM_SAMPLE_RATE);
+      
+      /* If new control offset is ahead of current, insert appropriate
+       * wait commands and update control offset; at control rates above
+       * the VGM rate, a single VGM wait may need more than one */
+      if (new_ctl > ctl_offs) {
+        if (pc->pcs[chip] != NULL) {
+          opl_coalesce_flush(pc->pcs[chip]);
+        }
+        for(d = new_ctl - ctl_offs; d > INT32_MAX; d -= INT32_MAX) {
+          outWait(pc, INT32_MAX);
+        }
+        outWait(pc, (int32_t) d);
+        ctl_offs = new_ctl;
+      }
+    }
+  }
+  
+  /* Write out the rest of the output */
+  outFlush(pc);
+  if (ok && pc->io_err) {
+    snprintf(pMsg, MSG_SIZE, "I/O error writing output");
+    ok = 0;
+  }
+  
+  return ok;
+}
+
+/*
+ * Parse a repeat code.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the repeat code string
+ * 
+ * Return:
+ * 
+ *   1 or 2, or zero if the string is not a repeat code
+ */
+static int parseRep(const char *pstr) {
+  if (strcmp(pstr, "1") == 0) {
+    return 1;
+  } else if (strcmp(pstr, "2") == 0) {
+    return 2;
+  }
+  return 0;
+}
+
+/*
+ * Parse the value of the -rate option.
+ * 
+ * Problems cause an error stop.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the option value
+ * 
+ * Return:
+ * 
+ *   the control rate in Hz, in range [1, CTL_RATE_MAX]
+ */
+static int32_t parseRate(const char *pstr) {
+  int32_t rate = 0;
+  
+  /* Only decimal digits, without leading zeros */
+  if ((*pstr < '1') || (*pstr > '9')) {
+    fprintf(stderr, "%s: Invalid value for -rate!\n", pModule);
+    raiseErr();
+  }
+  for( ; *pstr != '\0'; pstr++) {
+    if ((*pstr < '0') || (*pstr > '9') || (rate > CTL_RATE_MAX)) {
+      fprintf(stderr, "%s: Invalid value for -rate!\n", pModule);
+      raiseErr();
+    }
+    rate = (rate * 10) + (int32_t) (*pstr - '0');
+  }
+  if (rate > CTL_RATE_MAX) {
+    fprintf(stderr, "%s: Invalid value for -rate!\n", pModule);
+    raiseErr();
+  }
+  
+  return rate;
+}
+
+/*
+ * Make a dynamically allocated copy of a string prefix.
+ * 
+ * Problems cause an error stop.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the string
+ * 
+ *   len - the number of bytes to copy
  * 
  * Return:
  * 
- *   the byte value read
+ *   the nul-terminated copy, which the caller must free
  */
-static uint8_t readByte(void) {
-  int c = 0;
+static char *copyStr(const char *pstr, size_t len) {
+  char *pc = NULL;
   
-  /* Check state */
-  if (pInput == NULL) {
+  pc = (char *) malloc(len + 1);
+  if (pc == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
     raiseErr();
   }
+  memcpy(pc, pstr, len);
+  pc[len] = '\0';
+  
+  return pc;
+}
+
+/*
+ * Make a dynamically allocated path from a directory, a file name, and
+ * an optional extension.
+ * 
+ * Problems cause an error stop.
+ * 
+ * Parameters:
+ * 
+ *   pDir - the directory
+ * 
+ *   pName - the file name
+ * 
+ *   name_len - the number of bytes of the file name to use
+ * 
+ *   pExt - the extension to append, or NULL
+ * 
+ * Return:
+ * 
+ *   the nul-terminated path, which the caller must free
+ */
+static char *joinPath(
+    const char   * pDir,
+    const char   * pName,
+          size_t   name_len,
+    const char   * pExt) {
+  
+  char *pPath = NULL;
+  size_t dir_len = 0;
+  size_t ext_len = 0;
+  
+  dir_len = strlen(pDir);
+  if (pExt != NULL) {
+    ext_len = strlen(pExt);
+  }
   
-  /* Read a byte */
-  c = fgetc(pInput);
-  if (c == EOF) {
-    fprintf(stderr, "%s: Failed to read byte!\n", pModule);
+  pPath = (char *) malloc(dir_len + 1 + name_len + ext_len + 1);
+  if (pPath == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
     raiseErr();
   }
   
-  /* Return the byte */
-  return (uint8_t) c;
+  memcpy(pPath, pDir, dir_len);
+  pPath[dir_len] = '/';
+  memcpy(&(pPath[dir_len + 1]), pName, name_len);
+  if (ext_len > 0) {
+    memcpy(&(pPath[dir_len + 1 + name_len]), pExt, ext_len);
+  }
+  pPath[dir_len + 1 + name_len + ext_len] = '\0';
+  
+  return pPath;
 }
 
 /*
- * Read a 32-bit unsigned integer value in little-endian order from the
- * input file.
+ * Add a cleared job to the end of the job list.
+ * 
+ * Problems cause an error stop.
  * 
  * Return:
  * 
- *   the dword that was read
+ *   the new job
  */
-static uint32_t readDword(void) {
-  uint32_t retval = 0;
+static JOB *addJob(void) {
+  JOB *pj = NULL;
+  int32_t new_cap = 0;
   
-  retval = (uint32_t) readByte();
-  retval = retval | (((uint32_t) readByte()) << 8);
-  retval = retval | (((uint32_t) readByte()) << 16);
-  retval = retval | (((uint32_t) readByte()) << 24);
+  /* Expand the job list if necessary */
+  if (job_count >= job_cap) {
+    if (job_cap < 1) {
+      new_cap = 16;
+    } else if (job_cap <= INT32_MAX / 2) {
+      new_cap = job_cap * 2;
+    } else {
+      fprintf(stderr, "%s: Too many jobs!\n", pModule);
+      raiseErr();
+    }
+    
+    pj = (JOB *) realloc(pJobs, ((size_t) new_cap) * sizeof(JOB));
+    if (pj == NULL) {
+      fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+      raiseErr();
+    }
+    pJobs = pj;
+    job_cap = new_cap;
+  }
+  
+  pj = &(pJobs[job_count]);
+  memset(pj, 0, sizeof(JOB));
+  job_count++;
   
-  return retval;
+  return pj;
 }
 
 /*
- * Read a 32-bit unsigned integer value in little-endian order from the
- * given file offset.
+ * Read a batch manifest into the job list.
+ * 
+ * Problems with the manifest itself cause an error stop.
  * 
  * Parameters:
  * 
- *   offs - the byte offset of the dword
+ *   pPath - the path to the manifest
+ */
+static void readManifest(const char *pPath) {
+  
+  FILE *pf = NULL;
+  char line[LINE_SIZE];
+  const char *pTok[4];
+  size_t tok_len[4];
+  const char *p = NULL;
+  char *pRep = NULL;
+  long line_count = 0;
+  int tok_count = 0;
+  size_t len = 0;
+  JOB *pj = NULL;
+  
+  pf = fopen(pPath, "rb");
+  if (pf == NULL) {
+    fprintf(stderr, "%s: Failed to open file '%s'!\n", pModule, pPath);
+    raiseErr();
+  }
+  
+  while (fgets(line, LINE_SIZE, pf) != NULL) {
+    line_count++;
+    
+    /* Make sure the whole line was read */
+    len = strlen(line);
+    if ((len > 0) && (line[len - 1] != '\n') && (!feof(pf))) {
+      fprintf(stderr, "%s: Line %ld of manifest is too long!\n",
+              pModule, line_count);
+      raiseErr();
+    }
+    
+    /* Skip comment lines */
+    if (line[0] == '\'') {
+      continue;
+    }
+    
+    /* Split the line into fields separated by spaces or tabs */
+    tok_count = 0;
+    p = line;
+    while (1) {
+      while ((*p == ' ') || (*p == '\t') ||
+              (*p == '\r') || (*p == '\n')) {
+        p++;
+      }
+      if (*p == '\0') {
+        break;
+      }
+      if (tok_count >= 4) {
+        break;
+      }
+      pTok[tok_count] = p;
+      while ((*p != '\0') && (*p != ' ') && (*p != '\t') &&
+              (*p != '\r') && (*p != '\n')) {
+        p++;
+      }
+      tok_len[tok_count] = (size_t) (p - pTok[tok_count]);
+      tok_count++;
+    }
+    
+    /* Skip blank lines */
+    if (tok_count < 1) {
+      continue;
+    }
+    
+    if (tok_count != 3) {
+      fprintf(stderr, "%s: Invalid job syntax on line %ld!\n",
+              pModule, line_count);
+      raiseErr();
+    }
+    
+    /* Parse the repeat code and the paths */
+    pj = addJob();
+    pRep = copyStr(pTok[0], tok_len[0]);
+    pj->rep_count = parseRep(pRep);
+    free(pRep);
+    if (pj->rep_count < 1) {
+      fprintf(stderr, "%s: Unrecognized repeat code on line %ld!\n",
+              pModule, line_count);
+      raiseErr();
+    }
+    pj->pInPath = copyStr(pTok[1], tok_len[1]);
+    pj->pOutPath = copyStr(pTok[2], tok_len[2]);
+    
+    /* Jobs run in parallel, so they can not share standard output */
+    if (strcmp(pj->pOutPath, "-") == 0) {
+      fprintf(stderr,
+              "%s: Job writes to standard output on line %ld!\n",
+              pModule, line_count);
+      raiseErr();
+    }
+  }
+  
+  if (ferror(pf)) {
+    fprintf(stderr, "%s: I/O error reading manifest!\n", pModule);
+    raiseErr();
+  }
+  fclose(pf);
+}
+
+/*
+ * Check whether a file name ends in ".vgm" or ".vgz", in any case.
+ * 
+ * Parameters:
+ * 
+ *   pName - the file name
  * 
  * Return:
  * 
- *   the dword at that location
+ *   non-zero if the file name has a VGM extension
+ */
+static int hasVGMExt(const char *pName) {
+  size_t len = 0;
+  const char *pExt = NULL;
+  
+  len = strlen(pName);
+  if (len < 5) {
+    return 0;
+  }
+  pExt = &(pName[len - 4]);
+  
+  if ((pExt[0] != '.') || (tolower((unsigned char) pExt[1]) != 'v') ||
+      (tolower((unsigned char) pExt[2]) != 'g')) {
+    return 0;
+  }
+  return ((tolower((unsigned char) pExt[3]) == 'm') ||
+          (tolower((unsigned char) pExt[3]) == 'z'));
+}
+
+/*
+ * Comparison function for sorting jobs by input path.
+ */
+static int compareJobs(const void *pA, const void *pB) {
+  return strcmp(((const JOB *) pA)->pInPath,
+                ((const JOB *) pB)->pInPath);
+}
+
+/*
+ * Add a job for every VGM and VGZ file in a directory to the job list.
+ * 
+ * The jobs are sorted by file name.  Problems reading the directory
+ * cause an error stop.
+ * 
+ * Parameters:
+ * 
+ *   pInDir - the input directory
+ * 
+ *   pOutDir - the output directory
+ * 
+ *   rep - 1 for no loop, 2 for loop once
  */
-static uint32_t readHead(int32_t offs) {
-  /* Check parameters */
-  if (offs < 0) {
+static void scanDir(const char *pInDir, const char *pOutDir, int rep) {
+  
+  DIR *pd = NULL;
+  struct dirent *pe = NULL;
+  const char *pExt = NULL;
+  size_t name_len = 0;
+  JOB *pj = NULL;
+  
+  pExt = out_binary ? ".oplb" : ".opl2";
+  
+  pd = opendir(pInDir);
+  if (pd == NULL) {
+    fprintf(stderr, "%s: Failed to open directory '%s'!\n",
+            pModule, pInDir);
     raiseErr();
   }
   
-  /* Check state */
-  if (pInput == NULL) {
+  for(pe = readdir(pd); pe != NULL; pe = readdir(pd)) {
+    if ((pe->d_name[0] == '.') || (!hasVGMExt(pe->d_name))) {
+      continue;
+    }
+    name_len = strlen(pe->d_name);
+    
+    /* The output has the same name with the extension replaced */
+    pj = addJob();
+    pj->rep_count = rep;
+    pj->pInPath = joinPath(pInDir, pe->d_name, name_len, NULL);
+    pj->pOutPath = joinPath(pOutDir, pe->d_name, name_len - 4, pExt);
+  }
+  closedir(pd);
+  
+  if (job_count > 1) {
+    qsort(pJobs, (size_t) job_count, sizeof(JOB), &compareJobs);
+  }
+}
+
+/*
+ * Take the next job from the job list.
+ * 
+ * This function is safe to call from multiple worker threads.
+ * 
+ * Return:
+ * 
+ *   the next job, or NULL if there are no more jobs
+ */
+static JOB *nextJob(void) {
+  JOB *pj = NULL;
+  
+  if (pthread_mutex_lock(&job_lock)) {
+    fprintf(stderr, "%s: Failed to lock job list!\n", pModule);
     raiseErr();
   }
   
-  /* Seek to the requested dword */
-  if (fseek(pInput, (long) offs, SEEK_SET)) {
-    fprintf(stderr, "%s: Input seek failed!\n", pModule);
+  if (job_next < job_count) {
+    pj = &(pJobs[job_next]);
+    job_next++;
+  }
+  
+  if (pthread_mutex_unlock(&job_lock)) {
+    fprintf(stderr, "%s: Failed to unlock job list!\n", pModule);
     raiseErr();
   }
   
-  /* Read the dword */
-  return readDword();
+  return pj;
+}
+
+/*
+ * Worker procedure for batch and directory mode.
+ * 
+ * The worker keeps taking jobs from the job list until there are no
+ * jobs left, reusing its conversion state for each job.  Failures are
+ * recorded in the job, and the output file of a failed job is removed.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the CONVERT state owned by this worker
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *workerMain(void *pArg) {
+  CONVERT *pc = NULL;
+  JOB *pj = NULL;
+  
+  pc = (CONVERT *) pArg;
+  
+  for(pj = nextJob(); pj != NULL; pj = nextJob()) {
+    
+    pc->pOut = fopen(pj->pOutPath, "wb");
+    if (pc->pOut == NULL) {
+      snprintf(pj->msg, MSG_SIZE, "Failed to create file '%s'",
+                pj->pOutPath);
+      pj->failed = 1;
+      continue;
+    }
+    
+    if (!convertFile(pc, pj->pInPath, pj->rep_count, pj->msg)) {
+      pj->failed = 1;
+    }
+    if (fclose(pc->pOut) && (!(pj->failed))) {
+      snprintf(pj->msg, MSG_SIZE, "I/O error writing output");
+      pj->failed = 1;
+    }
+    pc->pOut = NULL;
+    
+    if (pj->failed) {
+      remove(pj->pOutPath);
+    }
+  }
+  
+  return NULL;
+}
+
+/*
+ * Convert all the jobs in the job list and report the failures.
+ * 
+ * The number of worker threads is the number of processors, limited by
+ * the number of jobs.
+ * 
+ * Return:
+ * 
+ *   the number of jobs that failed
+ */
+static int runBatch(void) {
+  
+  CONVERT *pWork[MAX_WORKERS];
+  pthread_t tid[MAX_WORKERS];
+  long cpu_count = 0;
+  int32_t worker_count = 0;
+  int32_t failures = 0;
+  int32_t i = 0;
+  
+  memset(pWork, 0, sizeof(CONVERT *) * MAX_WORKERS);
+  
+  /* Determine the number of workers */
+  cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpu_count < 1) {
+    cpu_count = 1;
+  } else if (cpu_count > MAX_WORKERS) {
+    cpu_count = MAX_WORKERS;
+  }
+  
+  worker_count = (int32_t) cpu_count;
+  if (worker_count > job_count) {
+    worker_count = job_count;
+  }
+  if (worker_count < 1) {
+    worker_count = 1;
+  }
+  
+  for(i = 0; i < worker_count; i++) {
+    pWork[i] = newConvert();
+    if (pWork[i] == NULL) {
+      fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
+      raiseErr();
+    }
+  }
+  
+  /* Run the first worker on this thread and the others on their own
+   * threads */
+  for(i = 1; i < worker_count; i++) {
+    if (pthread_create(&(tid[i]), NULL, &workerMain, pWork[i])) {
+      fprintf(stderr, "%s: Failed to start worker thread!\n",
+              pModule);
+      raiseErr();
+    }
+  }
+  workerMain(pWork[0]);
+  for(i = 1; i < worker_count; i++) {
+    if (pthread_join(tid[i], NULL)) {
+      fprintf(stderr, "%s: Failed to join worker thread!\n",
+              pModule);
+      raiseErr();
+    }
+  }
+  
+  /* Report each failure in job order, and then the totals */
+  for(i = 0; i < job_count; i++) {
+    if (pJobs[i].failed) {
+      fprintf(stderr, "%s: %s: %s!\n",
+              pModule, pJobs[i].pInPath, pJobs[i].msg);
+      failures++;
+    }
+  }
+  fprintf(stderr, "%s: Converted %ld of %ld files\n", pModule,
+          (long) (job_count - failures), (long) job_count);
+  
+  /* Release the conversion states and the job list */
+  for(i = 0; i < worker_count; i++) {
+    freeConvert(pWork[i]);
+    pWork[i] = NULL;
+  }
+  for(i = 0; i < job_count; i++) {
+    free(pJobs[i].pInPath);
+    free(pJobs[i].pOutPath);
+  }
+  free(pJobs);
+  pJobs = NULL;
+  job_count = 0;
+  job_cap = 0;
+  
+  return (int) failures;
 }
 
 /*
@@ -182,21 +1212,10 @@ static uint32_t readHead(int32_t offs) {
 int main(int argc, char *argv[]) {
   int i = 0;
   int rep_count = 0;
-  const char *pPath = NULL;
-  
-  uint32_t file_ver = 0;
-  uint32_t file_len = 0;
-  uint32_t data_offs = 0;
-  uint32_t data_len = 0;
-  uint32_t loop_offs = 0;
-  
-  const uint8_t *pd = NULL;
-  int wait_cmd = 0;
-  int32_t wait_req = 0;
-  int32_t samp_offs = 0;
-  int32_t ctl_offs = 0;
-  int32_t new_ctl = 0;
-  double f = 0.0;
+  int opt_count = 0;
+  
+  CONVERT *pc = NULL;
+  char msg[MSG_SIZE];
   
   /* Get the module name */
   pModule = NULL;
@@ -221,274 +1240,119 @@ int main(int argc, char *argv[]) {
     }
   }
   
+  /* Handle any options before the other arguments, and then shift the
+   * argument array so the first argument after the options is at index
+   * one */
+  opt_count = 0;
+  while (opt_count + 1 < argc) {
+    if (strcmp(argv[opt_count + 1], "-coalesce") == 0) {
+      coalesce_writes = 1;
+      opt_count++;
+    
+    } else if (strcmp(argv[opt_count + 1], "-binary") == 0) {
+      out_binary = 1;
+      opt_count++;
+      
+    } else if (strcmp(argv[opt_count + 1], "-rate") == 0) {
+      if (opt_count + 2 >= argc) {
+        fprintf(stderr, "%s: Missing value for -rate!\n", pModule);
+        raiseErr();
+      }
+      ctl_rate = parseRate(argv[opt_count + 2]);
+      opt_count += 2;
+    
+    } else {
+      break;
+    }
+  }
+  argc -= opt_count;
+  argv += opt_count;
+  
   /* If no arguments, print syntax and return error status */
   if (argc < 2) {
     fprintf(stderr, "Syntax:\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "  vgm2opl [input.vgm] [r] > [output.opl2]\n");
+    fprintf(stderr,
+      "  vgm2opl [options] [input.vgm] [r] > [output.opl2]\n");
+    fprintf(stderr, "  vgm2opl [options] -batch [manifest]\n");
+    fprintf(stderr, "  vgm2opl [options] -dir [in] [out] [r]\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "[input.vgm] is path to VGM file to read\n");
+    fprintf(stderr, "[input.vgm] is path to VGM or VGZ file to read\n");
     fprintf(stderr, "[r] is 1 for no loop, 2 for loop once\n");
     fprintf(stderr, "OPL2 script written to standard output\n");
+    fprintf(stderr, "-dir converts all VGM and VGZ files in [in]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[options]:\n");
+    fprintf(stderr, "  -coalesce - merge writes at the same time\n");
+    fprintf(stderr, "  -binary - write a binary event stream\n");
+    fprintf(stderr, "  -rate [hz] - control rate, 1 to 192000\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[manifest] lists jobs, one per line, as:\n");
+    fprintf(stderr, "  [r] [input] [output]\n");
     fprintf(stderr, "\n");
     exit(1);
   }
   
-  /* Check that two arguments beyond module name */
+  /* Handle batch and directory mode */
+  if (strcmp(argv[1], "-batch") == 0) {
+    if (argc != 3) {
+      fprintf(stderr, "%s: Wrong number of program arguments!\n",
+        pModule);
+      raiseErr();
+    }
+    readManifest(argv[2]);
+    return (runBatch() > 0) ? 1 : 0;
+  }
+  if (strcmp(argv[1], "-dir") == 0) {
+    if (argc != 5) {
+      fprintf(stderr, "%s: Wrong number of program arguments!\n",
+        pModule);
+      raiseErr();
+    }
+    rep_count = parseRep(argv[4]);
+    if (rep_count < 1) {
+      fprintf(stderr, "%s: Unrecognized repeat code '%s'!\n",
+        pModule, argv[4]);
+      raiseErr();
+    }
+    scanDir(argv[2], argv[3], rep_count);
+    return (runBatch() > 0) ? 1 : 0;
+  }
+  
+  /* Check that two arguments beyond module name and options */
   if (argc != 3) {
     fprintf(stderr, "%s: Wrong number of program arguments!\n",
       pModule);
     raiseErr();
   }
   
-  /* Get path and rep count */
-  pPath = argv[1];
-  
-  if (strcmp(argv[2], "1") == 0) {
-    rep_count = 1;
-  } else if (strcmp(argv[2], "2") == 0) {
-    rep_count = 2;
-  } else {
+  /* Get rep count */
+  rep_count = parseRep(argv[2]);
+  if (rep_count < 1) {
     fprintf(stderr, "%s: Unrecognized repeat code '%s'!\n",
       pModule, argv[2]);
     raiseErr();
   }
   
-  /* Open file */
-  pInput = fopen(pPath, "rb");
-  if (pInput == NULL) {
-    fprintf(stderr, "%s: Failed to open file '%s'!\n",
-            pModule, pPath);
-    raiseErr();
-  }
-  
-  /* Check file type */
-  if (readHead(0) != 0x206d6756) {
-    fprintf(stderr, "%s: Input file not a VGM file!\n",
-            pModule);
-    fprintf(stderr, "%s: (If you have a VGZ, decompress it!)\n",
-            pModule);
-    raiseErr();
-  }
-  
-  /* Read the version number */
-  file_ver = readHead(0x08);
-  
-  /* Read the file length from the header, adding four to adjust for
-   * relative addressing */
-  file_len = readHead(0x04) + 4;
-  
-  /* Get loop offset, or zero if no specific loop offset */
-  loop_offs = readHead(0x1c) + 0x1c;
-  if (loop_offs <= 0x1c) {
-    loop_offs = 0;
-  }
-  
-  /* Data offset is 0x40 unless version is at least 1.50, in which case
-   * if header value 0x34 is non-zero, it stores 52 less than the data
-   * offset */
-  data_offs = 0x40;
-  if (file_ver >= 0x150) {
-    data_offs = readHead(0x34) + 0x34;
-    if (data_offs <= 52) {
-      data_offs = 0x40;
-    }
-  }
-  
-  /* If loop offset is zero, set it to data_offs */
-  if (loop_offs <= 0) {
-    loop_offs = data_offs;
-  }
-  
-  /* Loop offset must be at least data_offs and less than file length */
-  if ((loop_offs < data_offs) || (loop_offs >= file_len)) {
-    fprintf(stderr, "%s: Invalid looping offset!\n", pModule);
-    raiseErr();
-  }
-  
-  /* Convert loop offset to be relative to data offset */
-  loop_offs = loop_offs - data_offs;
-  
-  /* File length must be greater than data offset */
-  if (file_len <= data_offs) {
-    fprintf(stderr, "%s: Improper data offset and file length!\n",
-            pModule);
+  /* Convert the file to standard output */
+  pc = newConvert();
+  if (pc == NULL) {
+    fprintf(stderr, "%s: Memory allocation failed!\n", pModule);
     raiseErr();
   }
+  pc->pOut = stdout;
   
-  /* Compute the data length and make sure it is within the limit */
-  data_len = file_len - data_offs;
-  if (data_len > MAX_DATA_SECTION) {
-    fprintf(stderr, "%s: VGM file is too large!\n",
-            pModule);
+  if (!convertFile(pc, argv[1], rep_count, msg)) {
+    fprintf(stderr, "%s: %s!\n", pModule, msg);
     raiseErr();
   }
-  
-  /* Store full length */
-  full_length = data_len;
-  
-  /* Allocate the memory for the data section */
-  pData = malloc((size_t) data_len);
-  if (pData == NULL) {
-    fprintf(stderr, "%s: Memory allocation failed!\n",
-            pModule);
+  if (fflush(stdout)) {
+    fprintf(stderr, "%s: I/O error writing output!\n", pModule);
     raiseErr();
   }
   
-  /* Seek to the data section */
-  if (fseek(pInput, (long) data_offs, SEEK_SET)) {
-    fprintf(stderr, "%s: Seek failed!\n",
-            pModule);
-    raiseErr();
-  }
-  
-  /* Read data section into memory */
-  if (fread(pData, 1, (size_t) data_len, pInput) != data_len) {
-    fprintf(stderr, "%s: Read failed!\n",
-            pModule);
-    raiseErr();
-  }
-  
-  /* Close file if open */
-  if (pInput != NULL) {
-    fclose(pInput);
-    pInput = NULL;
-  }
-  
-  /* Write the OPL2 header */
-  printf("OPL2 980\n");
-  
-  /* Perform the loops */
-  for(i = 0; i < rep_count; i++) {
-  
-    /* Start at beginning of data and reset data length */
-    pd = pData;
-    data_len = full_length;
-    
-    /* If this is a loop, advance the loop offset */
-    if (i > 0) {
-      pd += loop_offs;
-      data_len -= loop_offs;
-    }
-    
-    /* Keep processing while data remains in data section */
-    while (data_len > 0) {
-      /* Handle the different commands */
-      if (*pd == 0x66) {
-        /* End of sound data -- leave loop */
-        break;
-        
-      } else if ((*pd >= 0x70) && (*pd <= 0x7f)) {
-        /* Shorthand wait command */
-        wait_cmd = 1;
-        wait_req = (*pd - 0x70) + 1;
-        
-      } else if (*pd == 0x63) {
-        /* Wait 882 samples */
-        wait_cmd = 1;
-        wait_req = 882;
-        
-      } else if (*pd == 0x62) {
-        /* Wait 735 samples */
-        wait_cmd = 1;
-        wait_req = 735;
-        
-      } else if (*pd == 0x61) {
-        /* General wait command -- must be at least three bytes in data
-         * section still */
-        if (data_len < 3) {
-          fprintf(stderr, "%s: VGM opcode missing parameters!\n",
-                  pModule);
-          raiseErr();
-        }
-        
-        /* Get the wait request */
-        wait_cmd = 1;
-        wait_req = ((int32_t) pd[1]) | (((int32_t) pd[2]) << 8);
-        
-        /* Advance two bytes to account for the parameters */
-        pd += 2;
-        data_len -= 2;
-        
-      } else if (*pd == 0x5a) {
-        /* OPL2 register write -- start by clearing wait request flag */
-        wait_cmd = 0;
-        
-        /* Must be at least three bytes in data section still */
-        if (data_len < 3) {
-          fprintf(stderr, "%s: VGM opcode missing parameters!\n",
-                  pModule);
-          raiseErr();
-        }
-        
-        /* Produce the OPL2 hardware r command */
-        printf("r %02x %02x\n",
-          (unsigned int) pd[1],
-          (unsigned int) pd[2]);
-        
-        /* Advance two bytes to account for the parameters */
-        pd += 2;
-        data_len -= 2;
-        
-      } else {
-        /* Unsupported opcode */
-        fprintf(stderr, "%s: Unsupported VGM opcode 0x%02x!\n",
-                pModule, (unsigned int) *pd);
-        raiseErr();
-      }
-      
-      /* If we have a wait command, but request is zero, then turn off
-       * the request */
-      if (wait_cmd) {
-        if (wait_req < 1) {
-          wait_cmd = 0;
-        }
-      }
-      
-      /* If we have a wait command, handle it */
-      if (wait_cmd) {
-        /* Update sample offset, watching for overflow */
-        if (samp_offs <= INT32_MAX - wait_req) {
-          samp_offs += wait_req;
-        } else {
-          fprintf(stderr, "%s: Sample count overflow!\n", pModule);
-          raiseErr();
-        }
-        
-        /* Compute the position at control rate of 980 relative to VGM
-         * control rate of 44100 */
-        f = (((double) samp_offs) * 980.0) / 44100.0;
-        
-        /* Floor and make sure within integer range */
-        f = floor(f);
-        if (!((f >= 0) && (f <= (double) INT32_MAX))) {
-          fprintf(stderr, "%s: Numeric problem!\n", pModule);
-          raiseErr();
-        }
-        
-        /* Get new control offset */
-        new_ctl = (int32_t) f;
-        
-        /* If new control offset is ahead of current, insert appropriate
-         * wait command and update control offset */
-        if (new_ctl > ctl_offs) {
-          printf("w %ld\n", (long) (new_ctl - ctl_offs));
-          ctl_offs = new_ctl;
-        }
-      }
-      
-      /* Advance in the data section */
-      pd++;
-      data_len--;
-    }
-  }
-  
-  /* Free data section if allocated */
-  pd = NULL;
-  if (pData != NULL) {
-    free(pData);
-    pData = NULL;
-  }
+  freeConvert(pc);
+  pc = NULL;
   
   /* Return successfully if we got here */
   return 0;
@@ -0,0 +1,770 @@
+/*
+ * vgm_reader.c
+ * ============
+ * 
+ * Implementation of vgm_reader.h
+ * 
+ * See the header for further information.
+ * 
+ * Input files are read through zlib, which transparently inflates
+ * gzip-compressed (VGZ) files and passes uncompressed files through.
+ * You must link with zlib.
+ * 
+ * The header is parsed from a single read of its first HEAD_SIZE bytes,
+ * and if the data section starts within those bytes, they also become
+ * the first bytes in the buffer, so opening a file does not seek.
+ * 
+ * The data section is never loaded into memory as a whole.  Instead,
+ * it is streamed through a fixed-size buffer, so the memory used by a
+ * reader does not depend on the size of the VGM file.  When the reader
+ * loops back, it seeks back to the loop point in the input file.  For
+ * compressed files, zlib implements that seek by inflating the file
+ * again from the start up to the loop point.
+ */
+
+#include "vgm_reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The size in bytes of the buffer that the data section is streamed
+ * through.
+ */
+#define CHUNK_SIZE (65536)
+
+/*
+ * The number of bytes at the start of the file that are read to parse
+ * the header.  This covers every header field that the reader uses.
+ */
+#define HEAD_SIZE (256)
+
+/*
+ * The maximum number of bytes in a single VGM command that the reader
+ * supports.
+ */
+#define MAX_COMMAND (3)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * VGM_READER structure.
+ * 
+ * Prototype given in header.
+ */
+struct VGM_READER_TAG {
+  
+  /*
+   * The input file, which may be compressed.
+   */
+  gzFile pInput;
+  
+  /*
+   * The file offset of the VGM data section.
+   */
+  uint32_t data_offs;
+  
+  /*
+   * The full length of the VGM data section.
+   */
+  uint32_t full_length;
+  
+  /*
+   * The offset of the loop point within the data section.
+   */
+  uint32_t loop_offs;
+  
+  /*
+   * The total number of passes through the data, and the number of the
+   * current pass, starting at zero.
+   */
+  int rep_count;
+  int rep_index;
+  
+  /*
+   * The number of bytes remaining in the data section of the current
+   * pass, including the unread bytes in the buffer.
+   */
+  uint32_t data_len;
+  
+  /*
+   * The read position within the buffer, and the number of valid bytes
+   * in the buffer.
+   */
+  int32_t buf_pos;
+  int32_t buf_len;
+  
+  /*
+   * The buffer that the data section is streamed through.
+   */
+  uint8_t buf[CHUNK_SIZE];
+  
+  /*
+   * The number of YM3812 chips, either one or two.
+   */
+  int chips;
+  
+  /*
+   * Flag set once the end of the data has been reached.
+   */
+  int done;
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int readHead(
+    const uint8_t  * pHead,
+          int32_t    head_len,
+          int32_t    offs,
+          uint32_t * pv);
+static int startPass(VGM_READER *pv, uint32_t offs);
+static int fillBuffer(VGM_READER *pv, int32_t need);
+static int loadFile(VGM_READER *pv, const char *pPath, int rep_count);
+
+/*
+ * Get a 32-bit unsigned integer value in little-endian order from the
+ * given offset within the header bytes.
+ * 
+ * For compressed files, the header bytes are the start of the
+ * decompressed data.
+ * 
+ * Parameters:
+ * 
+ *   pHead - the header bytes that were read from the start of the file
+ * 
+ *   head_len - the number of header bytes that were read
+ * 
+ *   offs - the byte offset of the dword
+ * 
+ *   pv - variable to receive the dword at that location
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file is too short to have the
+ *   dword
+ */
+static int readHead(
+    const uint8_t  * pHead,
+          int32_t    head_len,
+          int32_t    offs,
+          uint32_t * pv) {
+  
+  /* Check parameters */
+  if ((pHead == NULL) || (offs < 0) || (pv == NULL)) {
+    abort();
+  }
+  
+  /* Check that the dword was read */
+  if ((head_len < 4) || (offs > head_len - 4)) {
+    return 0;
+  }
+  
+  /* Get the dword */
+  *pv = ((uint32_t) pHead[offs]) |
+        (((uint32_t) pHead[offs + 1]) << 8) |
+        (((uint32_t) pHead[offs + 2]) << 16) |
+        (((uint32_t) pHead[offs + 3]) << 24);
+  return 1;
+}
+
+/*
+ * Start a pass through the data section at the given offset.
+ * 
+ * The buffer is emptied and the input file is positioned at the given
+ * offset within the data section.  For compressed files, seeking
+ * backwards requires zlib to inflate the file again from the start.
+ * 
+ * Parameters:
+ * 
+ *   pv - the reader
+ * 
+ *   offs - the offset within the data section to start the pass at
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the seek failed
+ */
+static int startPass(VGM_READER *pv, uint32_t offs) {
+  z_off_t fpos = 0;
+  
+  /* Check parameters */
+  if ((pv == NULL) || (offs > pv->full_length)) {
+    abort();
+  }
+  
+  /* Empty the buffer and set the length of this pass */
+  pv->buf_pos = 0;
+  pv->buf_len = 0;
+  pv->data_len = pv->full_length - offs;
+  
+  /* Seek to the start of the pass */
+  fpos = (z_off_t) (pv->data_offs + offs);
+  if (gzseek(pv->pInput, fpos, SEEK_SET) != fpos) {
+    return 0;
+  }
+  
+  return 1;
+}
+
+/*
+ * Make sure that at least a given number of unread bytes are in the
+ * buffer.
+ * 
+ * If there are not enough unread bytes, the unread bytes are moved to
+ * the start of the buffer and the rest of the buffer is filled from the
+ * input file, without reading past the end of the data section.  The
+ * need parameter must not exceed the data_len field of the reader.
+ * 
+ * Parameters:
+ * 
+ *   pv - the reader
+ * 
+ *   need - the number of unread bytes required, at most MAX_COMMAND
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an I/O error
+ */
+static int fillBuffer(VGM_READER *pv, int32_t need) {
+  
+  int32_t avail = 0;
+  uint32_t want = 0;
+  int rc = 0;
+  
+  /* Check parameters */
+  if ((pv == NULL) || (need < 0) || (need > MAX_COMMAND) ||
+      ((uint32_t) need > pv->data_len)) {
+    abort();
+  }
+  
+  /* Nothing to do if enough bytes are already buffered */
+  avail = pv->buf_len - pv->buf_pos;
+  if (avail >= need) {
+    return 1;
+  }
+  
+  /* Move the unread bytes to the start of the buffer */
+  if (avail > 0) {
+    memmove(pv->buf, &((pv->buf)[pv->buf_pos]), (size_t) avail);
+  }
+  pv->buf_pos = 0;
+  pv->buf_len = avail;
+  
+  /* Fill the rest of the buffer, but do not read past the end of the
+   * data section */
+  want = (uint32_t) (CHUNK_SIZE - avail);
+  if (want > pv->data_len - (uint32_t) avail) {
+    want = pv->data_len - (uint32_t) avail;
+  }
+  
+  rc = gzread(pv->pInput, &((pv->buf)[avail]), (unsigned int) want);
+  if (rc != (int) want) {
+    return 0;
+  }
+  pv->buf_len += rc;
+  
+  return 1;
+}
+
+/*
+ * Open a VGM or VGZ file in a reader.
+ * 
+ * Any file the reader had open before is closed first.  If there is an
+ * error, the reader is left at the end of its data, so that it may
+ * only be loaded again or closed.
+ * 
+ * Parameters:
+ * 
+ *   pv - the reader
+ * 
+ *   pPath - path to the VGM or VGZ file
+ * 
+ *   rep_count - 1 for no loop, 2 for loop once
+ * 
+ * Return:
+ * 
+ *   VGM_ERR_NONE if successful, or else an error code
+ */
+static int loadFile(VGM_READER *pv, const char *pPath, int rep_count) {
+  
+  gzFile pInput = NULL;
+  int err = VGM_ERR_NONE;
+  
+  uint8_t head[HEAD_SIZE];
+  int32_t head_len = 0;
+  int32_t pre = 0;
+  
+  uint32_t sig = 0;
+  uint32_t file_ver = 0;
+  uint32_t file_len = 0;
+  uint32_t data_offs = 0;
+  uint32_t data_len = 0;
+  uint32_t loop_offs = 0;
+  uint32_t clock = 0;
+  int chips = 1;
+  
+  /* Close any file from before, and stay at the end of the data until
+   * the new file is ready */
+  if (pv->pInput != NULL) {
+    gzclose(pv->pInput);
+    pv->pInput = NULL;
+  }
+  pv->done = 1;
+  
+  /* Open file, which may be compressed */
+  pInput = gzopen(pPath, "rb");
+  if (pInput == NULL) {
+    err = VGM_ERR_OPEN;
+  }
+  
+  /* Read the header with a single read, using a buffer as large as the
+   * one the data section is streamed through */
+  if (!err) {
+    if (gzbuffer(pInput, CHUNK_SIZE)) {
+      err = VGM_ERR_IO;
+    }
+  }
+  if (!err) {
+    head_len = (int32_t) gzread(pInput, head, HEAD_SIZE);
+    if (head_len < 0) {
+      err = VGM_ERR_IO;
+    }
+  }
+  
+  /* Check file type */
+  if (!err) {
+    if (!readHead(head, head_len, 0, &sig)) {
+      err = VGM_ERR_SIG;
+    } else if (sig != 0x206d6756) {
+      err = VGM_ERR_SIG;
+    }
+  }
+  
+  /* Read the version number */
+  if (!err) {
+    if (!readHead(head, head_len, 0x08, &file_ver)) {
+      err = VGM_ERR_IO;
+    }
+  }
+  
+  /* Read the file length from the header, adding four to adjust for
+   * relative addressing */
+  if (!err) {
+    if (readHead(head, head_len, 0x04, &file_len)) {
+      file_len += 4;
+    } else {
+      err = VGM_ERR_IO;
+    }
+  }
+  
+  /* Get loop offset, or zero if no specific loop offset */
+  if (!err) {
+    if (readHead(head, head_len, 0x1c, &loop_offs)) {
+      loop_offs += 0x1c;
+      if (loop_offs <= 0x1c) {
+        loop_offs = 0;
+      }
+    } else {
+      err = VGM_ERR_IO;
+    }
+  }
+  
+  /* Data offset is 0x40 unless version is at least 1.50, in which case
+   * if header value 0x34 is non-zero, it stores 52 less than the data
+   * offset */
+  if (!err) {
+    data_offs = 0x40;
+    if (file_ver >= 0x150) {
+      if (readHead(head, head_len, 0x34, &data_offs)) {
+        data_offs += 0x34;
+        if (data_offs <= 52) {
+          data_offs = 0x40;
+        }
+      } else {
+        err = VGM_ERR_IO;
+      }
+    }
+  }
+  
+  /* Starting with version 1.51, the header has the YM3812 clock at
+   * 0x50, where bit 30 indicates a dual-chip setup, as long as the data
+   * does not start before that field */
+  if (!err) {
+    if ((file_ver >= 0x151) && (data_offs >= 0x54)) {
+      if (readHead(head, head_len, 0x50, &clock)) {
+        if (clock & UINT32_C(0x40000000)) {
+          chips = 2;
+        }
+      } else {
+        err = VGM_ERR_IO;
+      }
+    }
+  }
+  
+  /* If loop offset is zero, set it to data_offs */
+  if (!err) {
+    if (loop_offs <= 0) {
+      loop_offs = data_offs;
+    }
+  }
+  
+  /* Loop offset must be at least data_offs and less than file length */
+  if (!err) {
+    if ((loop_offs < data_offs) || (loop_offs >= file_len)) {
+      err = VGM_ERR_LOOP;
+    }
+  }
+  
+  /* Convert loop offset to be relative to data offset */
+  if (!err) {
+    loop_offs = loop_offs - data_offs;
+  }
+  
+  /* File length must be greater than data offset */
+  if (!err) {
+    if (file_len <= data_offs) {
+      err = VGM_ERR_OFFSET;
+    }
+  }
+  
+  /* Compute the data length */
+  if (!err) {
+    data_len = file_len - data_offs;
+  }
+  
+  /* The reader takes over the input file */
+  if (!err) {
+    pv->pInput = pInput;
+    pInput = NULL;
+  }
+  
+  /* Initialize decoding state */
+  if (!err) {
+    pv->data_offs = data_offs;
+    pv->full_length = data_len;
+    pv->loop_offs = loop_offs;
+    pv->rep_count = rep_count;
+    pv->rep_index = 0;
+    pv->chips = chips;
+    pv->done = 0;
+  }
+  
+  /* Start the first pass; if the data section starts within the header
+   * bytes, they go into the buffer and the file is already positioned
+   * right after them, otherwise seek forward to the data section */
+  if (!err) {
+    if (data_offs < (uint32_t) head_len) {
+      pre = head_len - (int32_t) data_offs;
+      if ((uint32_t) pre > data_len) {
+        pre = (int32_t) data_len;
+      }
+      memcpy(pv->buf, &(head[data_offs]), (size_t) pre);
+      pv->buf_pos = 0;
+      pv->buf_len = pre;
+      pv->data_len = data_len;
+    } else if (!startPass(pv, 0)) {
+      err = VGM_ERR_IO;
+    }
+  }
+  
+  /* Close file if it was not taken over by the reader */
+  if (pInput != NULL) {
+    gzclose(pInput);
+    pInput = NULL;
+  }
+  
+  /* Leave the reader at the end of its data if error */
+  if (err) {
+    pv->done = 1;
+  }
+  
+  return err;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See header for specifications.
+ */
+
+/*
+ * vgm_open function.
+ */
+VGM_READER *vgm_open(const char *pPath, int rep_count, int *perr) {
+  
+  VGM_READER *pv = NULL;
+  int err = VGM_ERR_NONE;
+  
+  /* Check parameters */
+  if ((pPath == NULL) || (perr == NULL) ||
+      ((rep_count != 1) && (rep_count != 2))) {
+    abort();
+  }
+  
+  /* Allocate the reader and open the file in it */
+  pv = (VGM_READER *) calloc(1, sizeof(VGM_READER));
+  if (pv == NULL) {
+    *perr = VGM_ERR_MEM;
+    return NULL;
+  }
+  err = loadFile(pv, pPath, rep_count);
+  if (err) {
+    vgm_close(pv);
+    *perr = err;
+    return NULL;
+  }
+  
+  return pv;
+}
+
+/*
+ * vgm_reopen function.
+ */
+int vgm_reopen(
+          VGM_READER * pv,
+    const char       * pPath,
+          int          rep_count,
+          int        * perr) {
+  
+  int err = VGM_ERR_NONE;
+  
+  /* Check parameters */
+  if ((pv == NULL) || (pPath == NULL) || (perr == NULL) ||
+      ((rep_count != 1) && (rep_count != 2))) {
+    abort();
+  }
+  
+  err = loadFile(pv, pPath, rep_count);
+  if (err) {
+    *perr = err;
+    return 0;
+  }
+  return 1;
+}
+
+
+/*
+ * vgm_close function.
+ */
+void vgm_close(VGM_READER *pv) {
+  if (pv != NULL) {
+    if (pv->pInput != NULL) {
+      gzclose(pv->pInput);
+      pv->pInput = NULL;
+    }
+    free(pv);
+  }
+}
+
+/*
+ * vgm_chips function.
+ */
+int vgm_chips(const VGM_READER *pv) {
+  if (pv == NULL) {
+    abort();
+  }
+  return pv->chips;
+}
+
+/*
+ * vgm_next function.
+ */
+int vgm_next(VGM_READER *pv, VGM_EVENT *pe, int *perr) {
+  
+  const uint8_t *pd = NULL;
+  int32_t need = 0;
+  
+  /* Check parameters */
+  if ((pv == NULL) || (pe == NULL) || (perr == NULL)) {
+    abort();
+  }
+  
+  /* Clear the event */
+  memset(pe, 0, sizeof(VGM_EVENT));
+  pe->type = VGM_EVENT_END;
+  
+  /* Keep decoding until we have an event or the data is done */
+  while (!(pv->done)) {
+    
+    /* If the current pass is out of data, start the next pass, or stop
+     * if all passes are done */
+    if (pv->data_len < 1) {
+      pv->rep_index++;
+      if (pv->rep_index >= pv->rep_count) {
+        pv->done = 1;
+        break;
+      }
+      
+      /* Loop passes start at the loop offset */
+      if (!startPass(pv, pv->loop_offs)) {
+        *perr = VGM_ERR_IO;
+        return 0;
+      }
+      continue;
+    }
+    
+    /* Make sure the whole command is buffered, if the data section is
+     * long enough to hold it */
+    if (pv->data_len < MAX_COMMAND) {
+      need = (int32_t) pv->data_len;
+    } else {
+      need = MAX_COMMAND;
+    }
+    if (!fillBuffer(pv, need)) {
+      *perr = VGM_ERR_IO;
+      return 0;
+    }
+    
+    /* Handle the different commands */
+    pd = &((pv->buf)[pv->buf_pos]);
+    pe->opcode = *pd;
+    if (*pd == 0x66) {
+      /* End of sound data -- leave this pass */
+      pv->data_len = 0;
+      continue;
+    
+    } else if ((*pd >= 0x70) && (*pd <= 0x7f)) {
+      /* Shorthand wait command */
+      pe->type = VGM_EVENT_WAIT;
+      pe->samples = (*pd - 0x70) + 1;
+    
+    } else if (*pd == 0x63) {
+      /* Wait 882 samples */
+      pe->type = VGM_EVENT_WAIT;
+      pe->samples = 882;
+    
+    } else if (*pd == 0x62) {
+      /* Wait 735 samples */
+      pe->type = VGM_EVENT_WAIT;
+      pe->samples = 735;
+    
+    } else if (*pd == 0x61) {
+      /* General wait command -- must be at least three bytes in data
+       * section still */
+      if (pv->data_len < 3) {
+        *perr = VGM_ERR_PARAM;
+        return 0;
+      }
+      
+      /* Get the wait request */
+      pe->type = VGM_EVENT_WAIT;
+      pe->samples = ((int32_t) pd[1]) | (((int32_t) pd[2]) << 8);
+      
+      /* Advance two bytes to account for the parameters */
+      pv->buf_pos += 2;
+      pv->data_len -= 2;
+    
+    } else if ((*pd == 0x5a) ||
+                ((*pd == 0xaa) && (pv->chips > 1))) {
+      /* OPL2 register write, to the second chip for 0xaa -- must be at
+       * least three bytes in data section still */
+      if (pv->data_len < 3) {
+        *perr = VGM_ERR_PARAM;
+        return 0;
+      }
+      
+      /* Get the register write */
+      pe->type = VGM_EVENT_WRITE;
+      pe->reg = pd[1];
+      pe->val = pd[2];
+      pe->chip = (*pd == 0xaa) ? 1 : 0;
+      
+      /* Advance two bytes to account for the parameters */
+      pv->buf_pos += 2;
+      pv->data_len -= 2;
+    
+    } else {
+      /* Unsupported opcode */
+      *perr = VGM_ERR_OPCODE;
+      return 0;
+    }
+    
+    /* Advance in the data section */
+    (pv->buf_pos)++;
+    pv->data_len--;
+    
+    /* If we have a wait command, but request is zero, then ignore it
+     * and keep decoding */
+    if (pe->type == VGM_EVENT_WAIT) {
+      if (pe->samples < 1) {
+        pe->type = VGM_EVENT_END;
+        pe->samples = 0;
+        continue;
+      }
+    }
+    
+    /* We have an event */
+    return 1;
+  }
+  
+  /* If we got here, all data is done */
+  memset(pe, 0, sizeof(VGM_EVENT));
+  pe->type = VGM_EVENT_END;
+  return 1;
+}
+
+/*
+ * vgm_errstr function.
+ */
+const char *vgm_errstr(int code) {
+  const char *pResult = NULL;
+  
+  switch (code) {
+    case VGM_ERR_NONE:
+      pResult = "No error";
+      break;
+    
+    case VGM_ERR_OPEN:
+      pResult = "Failed to open file";
+      break;
+    
+    case VGM_ERR_IO:
+      pResult = "I/O error reading file";
+      break;
+    
+    case VGM_ERR_SIG:
+      pResult = "Input file not a VGM file";
+      break;
+    
+    case VGM_ERR_LOOP:
+      pResult = "Invalid looping offset";
+      break;
+    
+    case VGM_ERR_OFFSET:
+      pResult = "Improper data offset and file length";
+      break;
+    
+case VGM_ERR_MEM:
+      pResult = "Memory allocation failed";
+      break;
+    
+    case VGM_ERR_PARAM:
+      pResult = "VGM opcode missing parameters";
+      break;
+    
+    case VGM_ERR_OPCODE:
+      pResult = "Unsupported VGM opcode";
+      break;
+    
+    default:
+      pResult = "Unknown error";
+  }
+  
+  return pResult;
+}
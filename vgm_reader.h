@@ -0,0 +1,228 @@
+#ifndef VGM_READER_H_INCLUDED
+#define VGM_READER_H_INCLUDED
+
+/*
+ * vgm_reader.h
+ * ============
+ * 
+ * Decoder for VGM files storing OPL2 instructions.
+ * 
+ * The reader parses the VGM header and then decodes the data section
+ * into a sequence of register write and wait events.  The data section
+ * is streamed from the file while it is decoded, so VGM files of any
+ * size can be read with a small, constant amount of memory.
+ * 
+ * Both uncompressed VGM files and gzip-compressed VGZ files are
+ * supported.  Only the YM3812 (OPL2) opcodes are supported.  An error
+ * occurs if the VGM has any opcodes relating to other chipsets.
+ * 
+ * The reader can optionally loop back once, using any looping
+ * information present in the VGM file.
+ * 
+ * Dual-chip VGM files with two YM3812 chips are supported.  Register
+ * writes to the second chip have their chip field set to one.
+ * 
+ * Separate readers may be used concurrently from separate threads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Error codes.
+ * 
+ * Use vgm_errstr() to get an error message for a code.
+ */
+#define VGM_ERR_NONE    (0)   /* No error */
+#define VGM_ERR_OPEN    (1)   /* Failed to open file */
+#define VGM_ERR_IO      (2)   /* I/O error reading file */
+#define VGM_ERR_SIG     (3)   /* Input file not a VGM file */
+#define VGM_ERR_LOOP    (4)   /* Invalid looping offset */
+#define VGM_ERR_OFFSET  (5)   /* Improper data offset and file length */
+#define VGM_ERR_MEM     (6)   /* Memory allocation failed */
+#define VGM_ERR_PARAM   (7)   /* VGM opcode missing parameters */
+#define VGM_ERR_OPCODE  (8)   /* Unsupported VGM opcode */
+
+/*
+ * Event types.
+ */
+#define VGM_EVENT_END   (0)   /* End of the decoded data */
+#define VGM_EVENT_WRITE (1)   /* OPL2 register write */
+#define VGM_EVENT_WAIT  (2)   /* Wait a number of samples */
+
+/*
+ * The sample rate that VGM wait counts are measured in.
+ */
+#define VGM_SAMPLE_RATE (44100)
+
+/*
+ * Structure prototype for a VGM reader.
+ * 
+ * The actual structure is defined in the implementation.
+ */
+struct VGM_READER_TAG;
+typedef struct VGM_READER_TAG VGM_READER;
+
+/*
+ * Structure holding a decoded event.
+ */
+typedef struct {
+  
+  /*
+   * The event type, one of the VGM_EVENT constants.
+   */
+  int type;
+  
+  /*
+   * The VGM opcode that produced this event.
+   * 
+   * If vgm_next() fails with VGM_ERR_OPCODE, this is the unsupported
+   * opcode.
+   */
+  int opcode;
+  
+  /*
+   * For register writes, the OPL2 register and the value to write.
+   */
+  uint8_t reg;
+  uint8_t val;
+  
+  /*
+   * For register writes, the chip to write to.  This is zero for the
+   * first chip, and one for the second chip of a dual-chip VGM file.
+   */
+  int chip;
+  
+  /*
+   * For waits, the number of samples to wait at VGM_SAMPLE_RATE.  This
+   * is always at least one.
+   */
+  int32_t samples;
+
+} VGM_EVENT;
+
+/*
+ * Open a VGM or VGZ file for reading.
+ * 
+ * Compressed VGZ files are detected automatically.
+ * 
+ * rep_count is 1 to decode the data once through, or 2 to loop back
+ * once using any looping information present in the VGM file.
+ * 
+ * If the file can not be opened, NULL is returned and an error code is
+ * written to *perr.
+ * 
+ * Parameters:
+ * 
+ *   pPath - path to the VGM or VGZ file
+ * 
+ *   rep_count - 1 for no loop, 2 for loop once
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   the new reader, or NULL if there was an error
+ */
+VGM_READER *vgm_open(const char *pPath, int rep_count, int *perr);
+
+/*
+ * Open another VGM or VGZ file in an existing reader.
+ * 
+ * This closes the file the reader had open and opens the new file just
+ * like vgm_open() does, but the reader and its buffer are reused, so
+ * the only memory allocated is what zlib needs for the file.  This
+ * makes it cheap to decode many files one after another.
+ * 
+ * If the file can not be opened, zero is returned and an error code is
+ * written to *perr.  The reader then behaves as if its data were done,
+ * and it may be reopened again or closed.
+ * 
+ * Parameters:
+ * 
+ *   pv - the reader
+ * 
+ *   pPath - path to the VGM or VGZ file
+ * 
+ *   rep_count - 1 for no loop, 2 for loop once
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an error
+ */
+int vgm_reopen(
+          VGM_READER * pv,
+    const char       * pPath,
+          int          rep_count,
+          int        * perr);
+
+/*
+ * Close a VGM reader.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pv - the reader to close, or NULL
+ */
+void vgm_close(VGM_READER *pv);
+
+/*
+ * Return the number of YM3812 chips that a VGM file uses.
+ * 
+ * This is two if the header declares a dual-chip YM3812 setup, or one
+ * otherwise.
+ * 
+ * Parameters:
+ * 
+ *   pv - the reader
+ * 
+ * Return:
+ * 
+ *   the number of chips, either one or two
+ */
+int vgm_chips(const VGM_READER *pv);
+
+/*
+ * Decode the next event.
+ * 
+ * Wait opcodes that wait for zero samples do not produce any event.
+ * Once VGM_EVENT_END has been returned, all further calls will also
+ * return VGM_EVENT_END.
+ * 
+ * If there is an error, zero is returned and an error code is written
+ * to *perr.
+ * 
+ * Parameters:
+ * 
+ *   pv - the reader
+ * 
+ *   pe - the structure to receive the event
+ * 
+ *   perr - variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+int vgm_next(VGM_READER *pv, VGM_EVENT *pe, int *perr);
+
+/*
+ * Get an error message for an error code.
+ * 
+ * The message does not have any punctuation at the end.  An unknown
+ * error code returns a generic message.
+ * 
+ * Parameters:
+ * 
+ *   code - the error code
+ * 
+ * Return:
+ * 
+ *   the error message
+ */
+const char *vgm_errstr(int code);
+
+#endif